@@ -548,6 +548,41 @@ static GtkWidget * ui_context_init_listview(db_viewer_ui_context_t * ui, int num
 	return listview;
 }
 
+#define LISTVIEW_MAX_ROWS (10000)
+static int ui_context_init_listview_from_result(db_viewer_ui_context_t * ui, const psql_result_t res)
+{
+	const char ** fields = NULL;
+	int num_fields = psql_result_get_fields(res, &fields);
+	printf("num_fields: %d\n", num_fields);
+	if(num_fields <= 0) return -1;
+	
+	GtkWidget * listview = ui_context_init_listview(ui, num_fields, fields);
+	free(fields);
+	ui->listview = listview;
+	gtk_container_add(GTK_CONTAINER(ui->main_panel), listview);
+	return 0;
+}
+
+static int on_load_table_rows(psql_context_t * psql, const psql_result_t res, int num_rows, void * user_data)
+{
+	db_viewer_ui_context_t * ui = user_data;
+	
+	if(NULL == ui->listview) {	// first chunk: create columns
+		if(ui_context_init_listview_from_result(ui, res)) return -1;
+	}
+	
+	GtkListStore * store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(ui->listview)));
+	int num_fields = psql_result_get_fields(res, NULL);
+	for(int row = 0; row < num_rows; ++row) {
+		GtkTreeIter iter;
+		gtk_list_store_append(store, &iter);
+		for(int col = 0; col < num_fields; ++col) {
+			gtk_list_store_set(store, &iter, col, psql_result_get_value(res, row, col), -1);
+		}
+	}
+	return 0;
+}
+
 static int ui_context_load_table_or_view(db_viewer_ui_context_t * ui, const char * schema, const char * table_name)
 {
 	assert(ui && ui->psql);
@@ -555,30 +590,25 @@ static int ui_context_load_table_or_view(db_viewer_ui_context_t * ui, const char
 	
 	char load_table_command[PATH_MAX] = "";
 	
-	snprintf(load_table_command, sizeof(load_table_command), "select * from %s.%s ;", schema, table_name);
+	// the list store keeps every row it is given: only show the first LISTVIEW_MAX_ROWS rows
+	snprintf(load_table_command, sizeof(load_table_command), "select * from %s.%s limit %d;", schema, table_name, LISTVIEW_MAX_ROWS);
 	
-	psql_result_t res = NULL;
-	int rc = psql_execute(psql, load_table_command, &res);
-	if(rc || !res) {
-		psql_result_clear(&res);
-		return -1;
+	if(ui->listview) {
+		gtk_widget_destroy(ui->listview);
+		ui->listview = NULL;
 	}
 	
-	const char ** fields = NULL;
-	int num_fields = psql_result_get_fields(res, &fields);
-	printf("num_fields: %d\n", num_fields);
-	if(num_fields > 0) {
-		GtkWidget * listview = ui_context_init_listview(ui, num_fields, fields);
-		if(ui->listview) {
-			gtk_widget_destroy(ui->listview);
-		}
-		ui->listview = listview;
-		gtk_container_add(GTK_CONTAINER(ui->main_panel), listview);
-		gtk_widget_show_all(listview);
+	// stream the rows in chunks, so that a large table never has to fit in a single PGresult
+	int rc = psql_query_stream(psql, load_table_command, NULL, 1000, on_load_table_rows, ui, NULL);
+	if(0 == rc && NULL == ui->listview) {
+		// empty table: no chunk has been delivered, get the columns from the result metadata
+		snprintf(load_table_command, sizeof(load_table_command), "select * from %s.%s limit 0;", schema, table_name);
+		psql_result_t res = NULL;
+		rc = psql_execute(psql, load_table_command, &res);
+		if(0 == rc && res) ui_context_init_listview_from_result(ui, res);
+		psql_result_clear(&res);
 	}
-	
-	free(fields);
-	psql_result_clear(&res);
-	return 0;
+	if(ui->listview) gtk_widget_show_all(ui->listview);
+	return rc;
 	
 }
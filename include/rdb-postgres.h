@@ -6,7 +6,10 @@ extern "C" {
 #endif
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include "avl_tree.h"
+#include "auto_buffer.h"
 
 typedef struct psql_prepare_params
 {
@@ -31,6 +34,46 @@ int psql_params_setv(psql_params_t * params,
 	unsigned int type, const char * value, const int cb_value, const int value_format,
 	...);
 
+/**
+ * psql_params_builder: 
+ * 	builds a psql_params_t in one reusable arena (parameter arrays + value bytes).
+ * 	call psql_params_builder_reset() between executions to reuse the memory.
+ * 
+ * 	add_xxx() functions return the parameter index, or -1 on failure.
+ * 	psql_params_builder_add() copies the value (cb_value = -1: strlen), 
+ * 	psql_params_builder_add_ref() only keeps the pointer, which must stay valid until the statement is executed.
+ * 	typed helpers (int32/int64/double/bool/bytes/uuid/timestamp) use the binary format.
+ * 
+ * 	builder->params can be passed to psql_exec_params() / psql_exec_prepared() etc.
+ * 	and stays valid until the next add / reset / cleanup.
+*/
+typedef struct psql_params_builder
+{
+	psql_params_t params[1];
+	int max_params;
+	int * value_offsets;	// offsets of the copied values in data, -1: referenced or NULL
+	size_t data_size;
+	size_t data_length;
+	unsigned char * data;
+	void * arena;
+}psql_params_builder_t;
+psql_params_builder_t * psql_params_builder_init(psql_params_builder_t * builder, int max_params, size_t data_size, int result_format);
+void psql_params_builder_cleanup(psql_params_builder_t * builder);
+void psql_params_builder_reset(psql_params_builder_t * builder);
+
+int psql_params_builder_add(psql_params_builder_t * builder, unsigned int type, const void * value, int cb_value, int value_format);
+int psql_params_builder_add_ref(psql_params_builder_t * builder, unsigned int type, const void * value, int cb_value, int value_format);
+int psql_params_builder_add_null(psql_params_builder_t * builder, unsigned int type);
+int psql_params_builder_add_text(psql_params_builder_t * builder, const char * text, int cb_text);
+int psql_params_builder_add_printf(psql_params_builder_t * builder, unsigned int type, const char * fmt, ...) __attribute__((format(printf, 3, 4)));
+int psql_params_builder_add_int32(psql_params_builder_t * builder, int32_t value);
+int psql_params_builder_add_int64(psql_params_builder_t * builder, int64_t value);
+int psql_params_builder_add_double(psql_params_builder_t * builder, double value);
+int psql_params_builder_add_bool(psql_params_builder_t * builder, int value);
+int psql_params_builder_add_bytes(psql_params_builder_t * builder, const void * value, int cb_value);
+int psql_params_builder_add_uuid(psql_params_builder_t * builder, const unsigned char uuid[16]);
+int psql_params_builder_add_timestamp(psql_params_builder_t * builder, int64_t unix_usec);
+
 
 typedef void * psql_result_t;
 void psql_result_clear(psql_result_t * p_result);
@@ -39,13 +82,33 @@ int psql_result_get_count(const psql_result_t res);
 int psql_result_get_fields(const psql_result_t res, const char *** p_fields);
 const char * psql_result_strerror(const psql_result_t res);
 
+/**
+ * typed accessors
+ * 	binary-format values (result_format = 1) are decoded directly, 
+ * 	the column OID must match the requested type.
+ * 	@return 0: ok; 1: NULL; -1: type mismatch or invalid value.
+ * 
+ * 	psql_result_get_int64(): int2 / int4 / int8
+ * 	psql_result_get_double(): float4 / float8 / numeric / int2 / int4 / int8
+ * 	psql_result_get_timestamp(): timestamp / timestamptz (binary only), in microseconds since the unix epoch
+*/
+int psql_result_is_null(const psql_result_t res, int row, int col);
+int psql_result_get_int64(const psql_result_t res, int row, int col, int64_t * p_value);
+int psql_result_get_double(const psql_result_t res, int row, int col, double * p_value);
+int psql_result_get_bool(const psql_result_t res, int row, int col, int * p_value);
+int psql_result_get_uuid(const psql_result_t res, int row, int col, unsigned char uuid[16]);
+int psql_result_get_timestamp(const psql_result_t res, int row, int col, int64_t * p_unix_usec);
+int psql_result_get_bytes(const psql_result_t res, int row, int col, const void ** p_data, int * p_length);
+
 typedef struct psql_context psql_context_t;
 psql_context_t * psql_context_init(psql_context_t * psql, void * user_data);
 void psql_context_cleanup(psql_context_t * psql);
 
 int psql_connect_db(psql_context_t * psql, const char * sz_conn, int async_mode);
 int psql_connect_async_wait(psql_context_t * psql, int64_t timeout_ms);
+int psql_connect_db_parallel(psql_context_t ** contexts, int count, const char * sz_conn, int64_t timeout_ms); // returns the number of connected contexts
 int psql_disconnect(psql_context_t * psql);
+int psql_in_transaction(psql_context_t * psql);	// 1: inside a transaction block (also a failed one), 0: idle, -1: busy or not connected
 
 int psql_execute(psql_context_t * psql, const char * command, void ** p_result);
 int psql_exec_params(psql_context_t * psql, const char * command, const psql_params_t * params, psql_result_t * p_result);
@@ -62,6 +125,781 @@ int psql_exec_prepared(psql_context_t * psql, const char * stmt_name, const psql
 */
 int psql_get_result(psql_context_t * psql, psql_result_t * p_result);
 
+/* asynchronous command processing */
+int psql_send_query(psql_context_t * psql, const char * command);
+int psql_send_query_params(psql_context_t * psql, const char * command, const psql_params_t * params);
+int psql_send_prepare(psql_context_t * psql, const char * query, const char * stmt_name, int num_params, const unsigned int * param_types);
+int psql_send_query_prepared(psql_context_t * psql, const char * stmt_name, const psql_params_t * params);
+
+/**
+ * psql_async_engine: epoll event loop for many non-blocking connections
+ * 	psql_async_engine_add(engine, psql);	// switches the connection to non-blocking mode
+ * 	psql_send_query(psql, ...);
+ * 	psql_async_engine_submit(engine, psql, on_result, on_complete, user_data);
+ * 	psql_async_engine_run(engine, -1);		// dispatches callbacks until all queries complete
+ * 
+ * on_result: (nullable) called for every result, the result is cleared after the callback returns.
+ * on_complete: (nullable) called once all results of the query have been read, status: 0 or -1.
+ * a connection's socket is only watched while a query is in progress. 
+ * psql_async_engine_cleanup() detaches the connections still added, without closing them.
+*/
+typedef void (* psql_async_on_result_fn)(psql_context_t * psql, const psql_result_t res, void * user_data);
+typedef void (* psql_async_on_complete_fn)(psql_context_t * psql, int status, void * user_data);
+typedef struct psql_async_engine psql_async_engine_t;
+psql_async_engine_t * psql_async_engine_init(psql_async_engine_t * engine, int max_events);
+void psql_async_engine_cleanup(psql_async_engine_t * engine);
+int psql_async_engine_add(psql_async_engine_t * engine, psql_context_t * psql);
+int psql_async_engine_remove(psql_async_engine_t * engine, psql_context_t * psql);
+int psql_async_engine_submit(psql_async_engine_t * engine, psql_context_t * psql, 
+	psql_async_on_result_fn on_result, psql_async_on_complete_fn on_complete, void * user_data);
+int psql_async_engine_run(psql_async_engine_t * engine, int timeout_ms);
+
+
+/**
+ * psql_query_stream(): execute a query and deliver its rows in bounded memory.
+ * 	@params: nullable
+ * 	@chunk_size: rows per callback; <= 1 for single-row mode. 
+ * 		chunked-rows mode requires libpq >= 17, otherwise rows are delivered one at a time.
+ * 	@on_rows: called with a result holding num_rows rows (cleared after the callback returns), 
+ * 		return non-zero to cancel the query. the cancellation is complete when this returns: 
+ * 		outside of a transaction block, a cancel which arrives after the query has finished 
+ * 		is absorbed by an extra "SELECT 1". inside one, no statement is added: 
+ * 		a late cancel may then fail the caller's next statement with SQLSTATE 57014.
+ * 	@stats: nullable
+*/
+typedef int (* psql_on_rows_fn)(psql_context_t * psql, const psql_result_t res, int num_rows, void * user_data);
+typedef struct psql_stream_stats
+{
+	int64_t num_rows;
+	int64_t num_chunks;
+	double time_to_first_row;	// seconds
+	double total_time;			// seconds
+	int cancelled;
+}psql_stream_stats_t;
+int psql_query_stream(psql_context_t * psql, const char * command, const psql_params_t * params, 
+	int chunk_size, psql_on_rows_fn on_rows, void * user_data, psql_stream_stats_t * stats);
+
+/**
+ * psql_cursor: server-side cursor iterator
+ * 	psql_cursor_open(cursor, "select ...", params, fetch_size, prefetch);
+ * 	while((res = psql_cursor_next_batch(cursor, &num_rows))) { ... }
+ * 	psql_cursor_close(cursor);
+ * 
+ * A transaction is started (and committed on close) if the connection is idle.
+ * With prefetch enabled, a background thread fetches the next batch while the caller 
+ * processes the current one; the connection must not be used by the caller until 
+ * the cursor is closed. The fetch size adapts between min_fetch_size and max_fetch_size: 
+ * it grows when the caller waits for the network and shrinks when batches are ready 
+ * long before they are needed. Without prefetch nothing overlaps with the FETCH, 
+ * so the fetch size only grows while the round trip dominates and never shrinks.
+*/
+typedef struct psql_cursor_stats
+{
+	int64_t num_rows;
+	int64_t num_batches;
+	double total_wait_time;		// seconds the caller spent waiting for batches
+	double total_fetch_time;	// seconds spent in FETCH
+	int fetch_size;				// current fetch size
+	int failed;
+}psql_cursor_stats_t;
+
+typedef struct psql_cursor psql_cursor_t;
+psql_cursor_t * psql_cursor_init(psql_cursor_t * cursor, psql_context_t * psql, int min_fetch_size, int max_fetch_size);
+void psql_cursor_cleanup(psql_cursor_t * cursor);
+int psql_cursor_open(psql_cursor_t * cursor, const char * query, const psql_params_t * params, int fetch_size, int prefetch);
+psql_result_t psql_cursor_next_batch(psql_cursor_t * cursor, int * p_num_rows);
+int psql_cursor_close(psql_cursor_t * cursor);
+int psql_cursor_get_stats(psql_cursor_t * cursor, psql_cursor_stats_t * stats);
+
+/**
+ * auto-prepared statements cache
+ * 	psql_exec_cached() behaves like psql_exec_params(), but once a SQL text (with the same 
+ * 	param types) has been executed auto_prepare_threshold times on this connection, it is 
+ * 	prepared and subsequently run with PQexecPrepared(). At most @capacity statements stay prepared 
+ * 	(LRU, evicted with DEALLOCATE), and all of them are re-prepared after a reconnect.
+ * 	DEALLOCATE is deferred while a transaction block is open (it would fail in an aborted one),
+ * 	and the pending ones are sent in one round trip by the next psql_exec_cached() outside 
+ * 	of a transaction. When too many are pending, nothing more is evicted until the transaction ends.
+ * 
+ * 	auto_prepare_threshold: 0 disables the cache (default).
+ * 	capacity: <= 0 to use the default (256).
+*/
+typedef struct psql_stmt_cache_stats
+{
+	int64_t num_hits;
+	int64_t num_misses;
+	int64_t num_prepares;
+	int64_t num_evictions;
+	int num_entries;
+	int num_prepared;
+	int num_pending_deallocs;	// evicted, waiting for the transaction to end
+}psql_stmt_cache_stats_t;
+int psql_stmt_cache_configure(psql_context_t * psql, int auto_prepare_threshold, int capacity);
+void psql_stmt_cache_clear(psql_context_t * psql);
+int psql_stmt_cache_get_stats(psql_context_t * psql, psql_stmt_cache_stats_t * stats);
+int psql_exec_cached(psql_context_t * psql, const char * command, const psql_params_t * params, psql_result_t * p_result);
+
+/**
+ * statement metrics: per-statement latency histograms, row and byte counters
+ * 	recorded by psql_execute(), psql_exec_params(), psql_exec_prepared() and the COPY writer / reader 
+ * 	(and everything built on them) once enabled, a single branch per call otherwise.
+ * 	statements are grouped by fingerprint: the SQL text with literals replaced by '?', 
+ * 	or "EXECUTE <stmt_name>" for prepared statements.
+ * 	latencies are bucketed log-linearly in microseconds (8 buckets per power of two, <= 12.5% error), 
+ * 	see psql_metrics_bucket_bound().
+*/
+#define PSQL_METRICS_NUM_BUCKETS (312)	// up to 2^41 us
+#define PSQL_METRICS_LABEL_SIZE (256)
+typedef struct psql_stmt_metrics
+{
+	uint64_t fingerprint;
+	char label[PSQL_METRICS_LABEL_SIZE];	// normalized SQL (truncated)
+	
+	int64_t num_calls;
+	int64_t num_errors;
+	int64_t num_rows;			// returned, affected or copied
+	int64_t bytes_sent;			// SQL text + parameters, COPY data
+	int64_t bytes_received;		// result values (see psql_metrics_measure_bytes()), COPY data
+	double total_time;			// seconds
+	double min_time;
+	double max_time;
+	uint32_t buckets[PSQL_METRICS_NUM_BUCKETS];
+}psql_stmt_metrics_t;
+int psql_metrics_enable(psql_context_t * psql, int enabled);	// disabling discards the metrics
+void psql_metrics_reset(psql_context_t * psql);
+int psql_metrics_snapshot(psql_context_t * psql, psql_stmt_metrics_t ** p_metrics, int reset);	// free(*p_metrics)
+double psql_stmt_metrics_percentile(const psql_stmt_metrics_t * metrics, double q);	// q: 0.0 ~ 1.0, returns seconds
+int64_t psql_metrics_bucket_bound(int index);	// the upper bound of a bucket, in microseconds
+int psql_metrics_measure_bytes(psql_context_t * psql, int enabled);	// sum the result value lengths into bytes_received (metrics and hook events), off by default
+
+/**
+ * execution hooks: before / after callbacks around every exec, prepare, send and get-result call
+ * 	(psql_execute(), psql_exec_params(), psql_exec_prepared(), psql_prepare(), psql_send_*(), psql_get_result()),
+ * 	including the ones made internally by the statement cache, pipeline, insert batcher, streaming query, 
+ * 	cursor, upsert, loader and async engine. COPY is measured by the metrics only.
+ * 	before hooks see op, command, stmt_name and params; after hooks also get the outcome.
+ * 	*p_span is a per-hook, per-call slot: whatever the before hook stores there is passed to the after hook.
+ * 	at most PSQL_MAX_HOOKS per context, no cost when none is registered.
+*/
+#define PSQL_MAX_HOOKS (8)
+enum psql_hook_op
+{
+	psql_hook_op_exec = 0,
+	psql_hook_op_prepare,
+	psql_hook_op_send,
+	psql_hook_op_get_result,
+};
+typedef struct psql_hook_event
+{
+	enum psql_hook_op op;
+	const char * command;		// SQL text, NULL when executing a prepared statement
+	const char * stmt_name;		// nullable
+	const psql_params_t * params;	// nullable
+	
+	// set for the after hooks
+	double begin_time;
+	double duration;			// seconds, excluding the before hooks
+	int rc;						// 0: ok, -1: failed
+	int exec_status;			// ExecStatusType of the result, -1: no result (send calls, no more results)
+	const void * result;		// PGresult *, nullable
+	int64_t num_rows;
+	int num_fields;				// columns of a row-returning result
+	int64_t bytes_sent;
+	int64_t bytes_received;		// 0 unless psql_metrics_measure_bytes() is enabled
+}psql_hook_event_t;
+typedef void (* psql_hook_fn)(psql_context_t * psql, const psql_hook_event_t * event, void ** p_span, void * user_data);
+int psql_add_hook(psql_context_t * psql, psql_hook_fn before, psql_hook_fn after, void * user_data);	// returns the hook id, or -1
+int psql_remove_hook(psql_context_t * psql, int hook_id);
+
+/**
+ * psql_result_cache: opt-in client-side cache of query results
+ * 	psql_result_cache_exec() behaves like psql_exec_params(), row-returning results are cached 
+ * 	by (SQL, params) for ttl_ms, the total size is bounded by max_bytes (LRU).
+ * 
+ * 	invalidation: each result is tagged with the tables it depends on.
+ * 	psql_result_cache_listen(cache, listener, "users") runs LISTEN "users" on a dedicated connection,
+ * 	a NOTIFY on that channel (or a NOTIFY whose payload is "users") invalidates the tag.
+ * 	pending notifications are drained at most every poll_interval_ms by lookups, or by psql_result_cache_poll().
+ * 	if the listener connection fails, the cache is dropped and bypassed (nothing is stored) 
+ * 	until psql_result_cache_listen() succeeds again on a reconnected or new listener.
+ * 	e.g. server-side: 
+ * 	  CREATE FUNCTION notify_users() RETURNS trigger AS $$ BEGIN PERFORM pg_notify('users', ''); RETURN NULL; END $$ LANGUAGE plpgsql;
+ * 	  CREATE TRIGGER users_changed AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON users 
+ * 	    FOR EACH STATEMENT EXECUTE FUNCTION notify_users();
+*/
+typedef struct psql_result_cache psql_result_cache_t;
+typedef struct psql_result_cache_params
+{
+	int64_t ttl_ms;				// 0: default (60s)
+	size_t max_bytes;			// 0: default (64 MiB)
+	int64_t poll_interval_ms;	// 0: default (100ms)
+}psql_result_cache_params_t;
+typedef struct psql_result_cache_stats
+{
+	int64_t num_hits;
+	int64_t num_misses;
+	int64_t num_stale;			// expired or invalidated entries found by lookups
+	int64_t num_evictions;		// removed to stay within max_bytes
+	int64_t num_invalidations;
+	int64_t num_entries;
+	size_t num_bytes;
+}psql_result_cache_stats_t;
+psql_result_cache_t * psql_result_cache_init(psql_result_cache_t * cache, const psql_result_cache_params_t * params);
+void psql_result_cache_cleanup(psql_result_cache_t * cache);
+int psql_result_cache_listen(psql_result_cache_t * cache, psql_context_t * listener, const char * tag);
+int psql_result_cache_poll(psql_result_cache_t * cache);
+void psql_result_cache_invalidate(psql_result_cache_t * cache, const char * tag);	// tag == NULL: drop all
+int psql_result_cache_exec(psql_result_cache_t * cache, psql_context_t * psql, 
+	const char * command, const psql_params_t * params, 
+	const char ** tags, int num_tags, 
+	psql_result_t * p_result);
+int psql_result_cache_get_stats(psql_result_cache_t * cache, psql_result_cache_stats_t * stats);
+
+/**
+ * psql_notify_dispatcher: LISTEN/NOTIFY without polling the tables
+ * 	a background thread holds a dedicated connection, waits on its socket and drains 
+ * 	the notifications in batches (max_batch), then fans them out:
+ * 	  - subscribers with a callback are called on the dispatcher thread (keep them short);
+ * 	  - subscribers without a callback get them through psql_notify_dispatcher_pop().
+ * 	the connection is re-established (and the channels re-LISTENed) when it breaks, 
+ * 	notifications sent meanwhile are lost: on_reconnect() is the place to resynchronize 
+ * 	(e.g. psql_result_cache_invalidate(cache, NULL)).
+*/
+typedef struct psql_notify_dispatcher psql_notify_dispatcher_t;
+typedef struct psql_notification
+{
+	const char * channel;
+	const char * payload;
+	int be_pid;				// the notifying backend
+	double recv_time;
+}psql_notification_t;
+typedef void (* psql_notify_callback_fn)(psql_notify_dispatcher_t * dispatcher, const psql_notification_t * notification, void * user_data);
+typedef struct psql_notify_dispatcher_params
+{
+	int max_batch;					// 0: default (256)
+	int queue_size;					// 0: default (4096), the oldest notifications are dropped when full
+	int64_t reconnect_interval_ms;	// 0: default (1000ms)
+	void (* on_reconnect)(psql_notify_dispatcher_t * dispatcher, void * user_data);
+	void * user_data;
+}psql_notify_dispatcher_params_t;
+typedef struct psql_notify_dispatcher_stats
+{
+	int64_t num_received;
+	int64_t num_batches;
+	int64_t num_callbacks;
+	int64_t num_queued;
+	int64_t num_dropped;	// queue overflows
+	int64_t num_unhandled;	// no subscriber (unsubscribed meanwhile)
+	int64_t num_reconnects;
+	int64_t num_channels;
+	int64_t queue_length;
+}psql_notify_dispatcher_stats_t;
+psql_notify_dispatcher_t * psql_notify_dispatcher_init(psql_notify_dispatcher_t * dispatcher, const char * sz_conn, const psql_notify_dispatcher_params_t * params);
+void psql_notify_dispatcher_cleanup(psql_notify_dispatcher_t * dispatcher);
+int psql_notify_dispatcher_start(psql_notify_dispatcher_t * dispatcher);
+void psql_notify_dispatcher_stop(psql_notify_dispatcher_t * dispatcher);
+int psql_notify_dispatcher_listen(psql_notify_dispatcher_t * dispatcher, const char * channel, psql_notify_callback_fn callback, void * user_data);
+int psql_notify_dispatcher_unlisten(psql_notify_dispatcher_t * dispatcher, const char * channel, psql_notify_callback_fn callback, void * user_data);
+int psql_notify_dispatcher_pop(psql_notify_dispatcher_t * dispatcher, psql_notification_t ** p_notification, int64_t timeout_ms);
+int psql_notify_dispatcher_get_stats(psql_notify_dispatcher_t * dispatcher, psql_notify_dispatcher_stats_t * stats);
+
+/**
+ * pipeline mode:
+ * 	psql_pipeline_enter();
+ * 	psql_pipeline_send_prepared() x N;
+ * 	psql_pipeline_sync();
+ * 	psql_pipeline_get_results();	// drain all statements up to the last sync point
+ * 	psql_pipeline_exit();
+ * 
+ * After a statement fails, the following statements are skipped (aborted) 
+ * until the next sync point.
+ * 
+ * psql_pipeline_get_results()
+ * 	@statuses: (nullable) per-statement status, enum psql_pipeline_status
+ * 	@on_result: (nullable) called for every result, the result is cleared after the callback returns.
+ * 	@return number of statements drained, or -1 if the connection was lost 
+ * 		or the server sent fewer results than statements were synced.
+*/
+enum psql_pipeline_status
+{
+	psql_pipeline_status_failed = -1,
+	psql_pipeline_status_ok = 0,
+	psql_pipeline_status_aborted = 1,
+};
+typedef void (* psql_pipeline_on_result_fn)(psql_context_t * psql, int index, int status, const psql_result_t res, void * user_data);
+
+int psql_pipeline_enter(psql_context_t * psql);
+int psql_pipeline_exit(psql_context_t * psql);
+int psql_pipeline_send_params(psql_context_t * psql, const char * command, const psql_params_t * params);
+int psql_pipeline_send_prepared(psql_context_t * psql, const char * stmt_name, const psql_params_t * params);
+int psql_pipeline_sync(psql_context_t * psql);
+ssize_t psql_pipeline_get_results(psql_context_t * psql, int * statuses, size_t max_statuses, 
+	psql_pipeline_on_result_fn on_result, void * user_data);
+
+/**
+ * Insert batcher: coalesces row-at-a-time INSERTs into multi-row statements
+ * 	psql_insert_batcher_init(batcher, psql, "schema.table", "col1, col2", 2, &params);
+ * 	psql_insert_batcher_add(batcher, row_params) x N;	// instead of psql_exec_prepared() per row
+ * 	psql_insert_batcher_flush(batcher);	// returns number of rows inserted, or -1
+ * 	psql_insert_batcher_cleanup(batcher);	// queued rows which have not been flushed are discarded
+ * 
+ * 	values mode: INSERT ... VALUES ($1,$2),($3,$4),...  (limited to 65535 parameters per statement)
+ * 	unnest mode: INSERT ... SELECT * FROM unnest($1::type[], $2::type[]), text-format values only
+ * 	rows are flushed when max_rows or max_bytes is reached, 
+ * 	or when the oldest queued row is older than flush_interval_ms (checked by add() and poll()).
+*/
+enum psql_insert_batch_mode
+{
+	psql_insert_batch_mode_values = 0,
+	psql_insert_batch_mode_unnest = 1,
+};
+typedef struct psql_insert_batcher_params
+{
+	int mode;				// enum psql_insert_batch_mode
+	int max_rows;			// 0: default (1000)
+	size_t max_bytes;		// 0: default (1 MiB)
+	int64_t flush_interval_ms;	// 0: disabled
+	const char ** column_types;	// unnest mode: element type of each column, e.g. "int8" (NULL: "text")
+	const char * on_conflict;	// nullable, e.g. "ON CONFLICT DO NOTHING"
+}psql_insert_batcher_params_t;
+
+typedef struct psql_insert_batcher
+{
+	psql_context_t * psql;
+	psql_insert_batcher_params_t params;
+	int num_columns;
+	
+	char * sql;			// statement of a full batch
+	size_t cb_prefix;	// values mode: length of "INSERT ... VALUES "
+	char * on_conflict;
+	char stmt_name[64];
+	uint64_t prepared_generation;
+	unsigned int * prepared_types;	// values mode: param types the full-batch statement was prepared with
+	
+	psql_params_builder_t builder[1];	// values mode: queued parameters
+	auto_buffer_t * arrays;				// unnest mode: one array literal per column
+	int num_queued;
+	size_t num_bytes;
+	double first_row_time;
+	
+	int64_t num_rows;		// rows added
+	int64_t num_inserted;	// rows reported by the server
+	int64_t num_failed;
+	int64_t num_batches;
+}psql_insert_batcher_t;
+psql_insert_batcher_t * psql_insert_batcher_init(psql_insert_batcher_t * batcher, psql_context_t * psql, 
+	const char * table_name, const char * columns, int num_columns, 
+	const psql_insert_batcher_params_t * params);
+void psql_insert_batcher_cleanup(psql_insert_batcher_t * batcher);
+int psql_insert_batcher_add(psql_insert_batcher_t * batcher, const psql_params_t * row);
+int psql_insert_batcher_add_values(psql_insert_batcher_t * batcher, const char ** values);	// text values
+int psql_insert_batcher_poll(psql_insert_batcher_t * batcher);
+int64_t psql_insert_batcher_flush(psql_insert_batcher_t * batcher);
+
+/**
+ * COPY ... FROM STDIN writer
+ * 	psql_copy_writer_begin(writer, "schema.table", "col1, col2");	// columns is nullable
+ * 	psql_copy_writer_append_row() x N;	// data is sent whenever more than flush_threshold bytes are buffered
+ * 	psql_copy_writer_end(writer, NULL);	// returns number of rows copied, or -1
+ * 
+ * flush_threshold: 0 to use the default size (256 KiB)
+*/
+enum psql_copy_format
+{
+	psql_copy_format_text = 0,
+	psql_copy_format_binary = 1,
+};
+typedef struct psql_copy_writer
+{
+	psql_context_t * psql;
+	int format;
+	int in_progress;
+	size_t flush_threshold;
+	auto_buffer_t buf[1];
+	
+	int64_t num_rows;	// rows appended
+	int64_t num_bytes;	// bytes sent
+	
+	// statement metrics (psql_metrics_enable())
+	uint64_t metrics_fingerprint;
+	double begin_time;
+}psql_copy_writer_t;
+psql_copy_writer_t * psql_copy_writer_init(psql_copy_writer_t * writer, psql_context_t * psql, int format, size_t flush_threshold);
+void psql_copy_writer_cleanup(psql_copy_writer_t * writer);
+int psql_copy_writer_begin(psql_copy_writer_t * writer, const char * table_name, const char * columns);
+int psql_copy_writer_append_row(psql_copy_writer_t * writer, int num_fields, const char ** values, const int * cb_values);
+int psql_copy_writer_append_raw(psql_copy_writer_t * writer, const void * data, size_t length, int num_rows);	// pre-encoded rows
+int psql_copy_writer_end_row(psql_copy_writer_t * writer);	// a row has been encoded into writer->buf
+int psql_copy_writer_flush(psql_copy_writer_t * writer);
+int64_t psql_copy_writer_end(psql_copy_writer_t * writer, const char * err_msg);
+
+// encodes one row (text or binary format) into any buffer, e.g. a chunk of psql_copy_pipeline_run()
+int psql_copy_buffer_append_row(auto_buffer_t * buf, int format, int num_fields, const char ** values, const int * cb_values);
+
+/**
+ * Bulk upsert: COPY into a staging table + one merge statement
+ * 	psql_upsert_init(upsert, psql, "schema.table", &params);
+ * 	psql_upsert_begin(upsert);
+ * 	psql_upsert_append_row() x N;	// or encode rows into upsert->writer directly
+ * 	psql_upsert_end(upsert, &num_inserted, &num_updated);
+ * 
+ * 	the merge runs as INSERT ... SELECT ... ON CONFLICT (key_columns) DO UPDATE, 
+ * 	or as MERGE (PostgreSQL 15+) when use_merge is set.
+ * 	key_columns must be unique within one batch.
+*/
+typedef struct psql_upsert_params
+{
+	const char * columns;			// required, e.g. "id, name, value"
+	const char * key_columns;		// required, the conflict target, e.g. "id"
+	const char * update_columns;	// nullable: all non-key columns; "": insert only (DO NOTHING)
+	const char * staging_table;		// nullable: a session TEMP table; otherwise an UNLOGGED table with this name
+	int format;						// enum psql_copy_format
+	int use_merge;
+}psql_upsert_params_t;
+
+typedef struct psql_upsert
+{
+	psql_context_t * psql;
+	char * table_name;
+	char * staging_table;
+	char * columns;
+	int use_merge;
+	int server_version;
+	
+	char * create_sql;
+	char * merge_sql;
+	char * count_sql;	// MERGE before PostgreSQL 17: matched rows are counted beforehand
+	uint64_t staging_generation;
+	
+	psql_copy_writer_t writer[1];
+	int64_t num_inserted;
+	int64_t num_updated;
+}psql_upsert_t;
+psql_upsert_t * psql_upsert_init(psql_upsert_t * upsert, psql_context_t * psql, const char * table_name, const psql_upsert_params_t * params);
+void psql_upsert_cleanup(psql_upsert_t * upsert);
+int psql_upsert_begin(psql_upsert_t * upsert);
+int psql_upsert_append_row(psql_upsert_t * upsert, int num_fields, const char ** values, const int * cb_values);
+int psql_upsert_end(psql_upsert_t * upsert, int64_t * p_num_inserted, int64_t * p_num_updated);
+
+/**
+ * Parallel COPY loader
+ * 	opens num_workers connections, each worker thread runs BEGIN + COPY for one partition: 
+ * 	  fill(partition) appends the rows of the partition to partition->writer, returns -1 to abort.
+ * 	the transactions are committed if every partition succeeded, otherwise all are rolled back.
+ * 	the commit phase itself is NOT atomic across connections: if some COMMITs fail, 
+ * 	the other partitions stay committed. summary->committed is only set when all of them are, 
+ * 	summary->num_committed and params->partition_committed[] tell which ones are.
+ * 
+ * 	when total_rows > 0, [first_row, first_row + num_rows) is the range assigned to the partition.
+*/
+typedef struct psql_loader_partition
+{
+	int index;
+	int num_partitions;
+	int64_t first_row;
+	int64_t num_rows;
+	psql_context_t * psql;
+	psql_copy_writer_t * writer;
+	void * user_data;
+}psql_loader_partition_t;
+typedef int (* psql_loader_fill_fn)(psql_loader_partition_t * partition);
+
+typedef struct psql_loader_params
+{
+	int num_workers;		// 0: number of online CPUs (up to 8)
+	int format;				// enum psql_copy_format
+	size_t flush_threshold;	// 0: default
+	const char * columns;	// nullable
+	int64_t total_rows;		// optional, used to compute the partition ranges
+	int * partition_committed;	// nullable, num_workers (> 0) entries: set to 1 if the partition has been committed
+}psql_loader_params_t;
+
+typedef struct psql_loader_summary
+{
+	int num_workers;
+	int num_succeeded;
+	int num_failed;
+	int committed;			// every partition has been committed
+	int num_committed;		// partitions committed (< num_workers: partial commit)
+	int64_t num_rows;
+	int64_t num_bytes;
+	double time_elapsed;	// seconds, including connect and commit
+	double max_worker_time;	// the slowest partition
+}psql_loader_summary_t;
+int psql_loader_run(const char * sz_conn, const char * table_name, const psql_loader_params_t * params, 
+	psql_loader_fill_fn fill, void * user_data, psql_loader_summary_t * summary);
+
+/**
+ * COPY pipeline: overlaps row encoding with sending
+ * 	num_encoders threads call encode(encoder_index, chunk, chunk_size, user_data), 
+ * 	which appends whole rows to 'chunk' until chunk->length >= chunk_size or the input of this encoder is exhausted, 
+ * 	and returns the number of rows appended (0: no more rows, -1: abort).
+ * 	the calling thread sends the chunks, which are recycled (num_chunks buffers in total).
+ * 	rows from different encoders are interleaved chunk by chunk.
+*/
+typedef int64_t (* psql_copy_encode_fn)(int encoder_index, auto_buffer_t * chunk, size_t chunk_size, void * user_data);
+typedef struct psql_copy_pipeline_params
+{
+	int num_encoders;		// 0: default (2)
+	int num_chunks;			// 0: num_encoders * 2 + 2
+	size_t chunk_size;		// 0: default (256 KiB)
+	int format;				// enum psql_copy_format
+	const char * columns;	// nullable
+}psql_copy_pipeline_params_t;
+
+typedef struct psql_copy_pipeline_stats
+{
+	int64_t num_rows;
+	int64_t num_bytes;
+	int64_t num_chunks;
+	double encode_wait_time;	// total time encoders waited for a free chunk (sender-bound)
+	double send_wait_time;		// time the sender waited for an encoded chunk (encoder-bound)
+	double time_elapsed;
+}psql_copy_pipeline_stats_t;
+int64_t psql_copy_pipeline_run(psql_context_t * psql, const char * table_name, const psql_copy_pipeline_params_t * params, 
+	psql_copy_encode_fn encode, void * user_data, psql_copy_pipeline_stats_t * stats);
+
+/**
+ * CSV / TSV importer: mmap + SIMD scanning + parallel parsing, streamed with psql_copy_pipeline_run()
+ * 	csv: RFC 4180 quoting, an unquoted empty field is NULL, "" is an empty string.
+ * 	tsv: no quoting.
+ * 	returns the number of rows copied, or -1 on error (malformed rows abort the whole COPY).
+*/
+enum psql_csv_format
+{
+	psql_csv_format_csv = 0,
+	psql_csv_format_tsv = 1,
+};
+typedef struct psql_csv_import_params
+{
+	int format;				// enum psql_csv_format
+	char delimiter;			// 0: ',' for csv, '\t' for tsv
+	int has_header;			// skip the first line
+	int num_columns;		// 0: the header's field count (if any), otherwise not checked
+	int num_workers;		// parser threads, 0: number of CPUs - 1 (up to 8)
+	size_t chunk_size;		// 0: default
+	const char * columns;	// nullable
+}psql_csv_import_params_t;
+
+typedef struct psql_csv_import_stats
+{
+	int num_workers;
+	int64_t num_rows;
+	int64_t input_bytes;
+	int64_t output_bytes;
+	double time_elapsed;
+}psql_csv_import_stats_t;
+int64_t psql_import_csv(psql_context_t * psql, const char * table_name, const char * path, 
+	const psql_csv_import_params_t * params, psql_csv_import_stats_t * stats);
+
+/**
+ * Typed binary COPY encoder
+ * 	compiled once from a column list, then each row is written in PostgreSQL binary wire format:
+ * 
+ * 	psql_copy_encoder_init(encoder, num_columns, columns);
+ * 	psql_copy_writer_begin(writer, "schema.table", encoder->column_names);
+ * 	psql_copy_encoder_begin_row(encoder, writer->buf);
+ * 	psql_copy_encoder_add_int64(encoder, ...);  ...  // one call per column, in order
+ * 	psql_copy_encoder_end_row(encoder);
+ * 	psql_copy_writer_end_row(writer);
+ * 
+ * timestamps are microseconds since the unix epoch (UTC).
+*/
+enum psql_data_type
+{
+	psql_data_type_text,
+	psql_data_type_varchar,
+	psql_data_type_bytea,
+	psql_data_type_bool,
+	psql_data_type_int2,
+	psql_data_type_int4,
+	psql_data_type_int8,
+	psql_data_type_float4,
+	psql_data_type_float8,
+	psql_data_type_uuid,
+	psql_data_type_timestamp,
+	psql_data_type_timestamptz,
+	psql_data_type_numeric,
+	psql_data_types_count
+};
+unsigned int psql_data_type_to_oid(int type, int is_array);
+int psql_oid_to_data_type(unsigned int oid, int * p_is_array);	// -1 if unknown
+
+typedef struct psql_column_desc
+{
+	const char * name;	// nullable
+	int type;			// enum psql_data_type
+	int is_array;		// one-dimensional array of type
+}psql_column_desc_t;
+
+typedef struct psql_copy_encoder
+{
+	int num_columns;
+	psql_column_desc_t * columns;
+	char * column_names;	// "col1, col2, ...", NULL if any column has no name
+	
+	auto_buffer_t * buf;	// output of the current row
+	size_t row_start;
+	int column_index;		// -1: not in a row
+	int64_t num_rows;
+}psql_copy_encoder_t;
+psql_copy_encoder_t * psql_copy_encoder_init(psql_copy_encoder_t * encoder, int num_columns, const psql_column_desc_t * columns);
+void psql_copy_encoder_cleanup(psql_copy_encoder_t * encoder);
+
+int psql_copy_encoder_begin_row(psql_copy_encoder_t * encoder, auto_buffer_t * buf);
+int psql_copy_encoder_end_row(psql_copy_encoder_t * encoder);
+int psql_copy_encoder_add_null(psql_copy_encoder_t * encoder);
+int psql_copy_encoder_add_int64(psql_copy_encoder_t * encoder, int64_t value);	// int2 / int4 / int8
+int psql_copy_encoder_add_double(psql_copy_encoder_t * encoder, double value);	// float4 / float8
+int psql_copy_encoder_add_bool(psql_copy_encoder_t * encoder, int value);
+int psql_copy_encoder_add_uuid(psql_copy_encoder_t * encoder, const unsigned char uuid[16]);
+int psql_copy_encoder_add_timestamp(psql_copy_encoder_t * encoder, int64_t unix_usec);
+int psql_copy_encoder_add_numeric(psql_copy_encoder_t * encoder, const char * sz_value);	// decimal string, eg. "-123.4500"
+int psql_copy_encoder_add_bytes(psql_copy_encoder_t * encoder, const void * data, size_t length);	// text / varchar / bytea
+int psql_copy_encoder_add_text(psql_copy_encoder_t * encoder, const char * text);
+int psql_copy_encoder_add_array(psql_copy_encoder_t * encoder, int num_elements, const void * values, const int * lengths, const unsigned char * is_null);
+
+/**
+ * psql_columns: columnar (struct-of-arrays) copy of a result
+ * 	each column is converted once into a contiguous array of its C type, 
+ * 	unknown types, arrays and text-format timestamps are kept as strings (offsets + data).
+ * 	numeric is converted to double, timestamps to microseconds since the unix epoch.
+ * 	null_bitmap: bit (row % 8) of byte (row / 8) is set if the value is NULL.
+*/
+enum psql_column_storage
+{
+	psql_column_storage_string,	// offsets[row] .. offsets[row + 1] in str_data
+	psql_column_storage_bool,
+	psql_column_storage_int16,
+	psql_column_storage_int32,
+	psql_column_storage_int64,
+	psql_column_storage_float32,
+	psql_column_storage_float64,
+	psql_column_storage_uuid,
+	psql_column_storage_timestamp,	// int64
+	psql_column_storage_types_count
+};
+
+typedef struct psql_column
+{
+	char * name;
+	int type;		// enum psql_data_type, -1 if unknown
+	int is_array;
+	int storage;	// enum psql_column_storage
+	
+	uint8_t * null_bitmap;
+	int64_t num_nulls;
+	union {
+		void * data;
+		uint8_t * b;
+		int16_t * i16;
+		int32_t * i32;
+		int64_t * i64;
+		float * f32;
+		double * f64;
+		unsigned char (* uuid)[16];
+	}values;
+	
+	int64_t * offsets;	// [num_rows + 1]
+	char * str_data;
+}psql_column_t;
+#define psql_column_is_null(column, row) (((column)->null_bitmap[(row) >> 3] >> ((row) & 7)) & 1)
+const char * psql_column_get_string(const psql_column_t * column, int row, int * p_length);
+
+typedef struct psql_columns
+{
+	int num_rows;
+	int num_columns;
+	psql_column_t * columns;
+}psql_columns_t;
+psql_columns_t * psql_columns_init(psql_columns_t * columns, const psql_result_t res);
+void psql_columns_cleanup(psql_columns_t * columns);
+
+/**
+ * COPY ... TO STDOUT reader
+ * 	psql_copy_reader_begin(reader, "schema.table", NULL);	// or psql_copy_reader_begin_query(reader, "select ...")
+ * 	while((num_fields = psql_copy_reader_next_row(reader, &fields)) > 0) { ... }
+ * 	psql_copy_reader_end(reader);
+ * 
+ * fields point into the row buffer (no per-field allocation) and are only valid until the next call.
+ * text-format fields are unescaped and NUL-terminated; binary-format fields are raw network-order values.
+*/
+typedef struct psql_copy_field
+{
+	const char * data;	// NULL if SQL NULL
+	int length;			// -1 if SQL NULL
+}psql_copy_field_t;
+
+typedef struct psql_copy_reader
+{
+	psql_context_t * psql;
+	int format;
+	int in_progress;
+	int header_parsed;
+	
+	char * row_data;	// buffer of the current row
+	int num_fields;
+	int max_fields;
+	psql_copy_field_t * fields;
+	
+	int64_t num_rows;
+	int64_t num_bytes;
+	
+	// statement metrics (psql_metrics_enable())
+	uint64_t metrics_fingerprint;
+	double begin_time;
+}psql_copy_reader_t;
+psql_copy_reader_t * psql_copy_reader_init(psql_copy_reader_t * reader, psql_context_t * psql, int format);
+void psql_copy_reader_cleanup(psql_copy_reader_t * reader);
+int psql_copy_reader_begin(psql_copy_reader_t * reader, const char * table_name, const char * columns);
+int psql_copy_reader_begin_query(psql_copy_reader_t * reader, const char * query);
+int psql_copy_reader_next_row(psql_copy_reader_t * reader, const psql_copy_field_t ** p_fields);
+int64_t psql_copy_reader_end(psql_copy_reader_t * reader);
+
+/**
+ * psql_pool: thread-safe connection pool
+ * 	psql_pool_acquire()
+ * 		@timeout_ms: <0: wait forever; 0: non-blocking; >0: max wait time
+ * 		@return NULL if timed out or failed to connect.
+ * 	psql_pool_release() rolls back any open transaction before
+ * 	returning the connection to the idle list.
+ * 	psql_pool_cleanup() waits up to cleanup_timeout_ms for checked-out connections,
+ * 		the ones still not released are logged and leaked: 
+ * 		a later psql_pool_release() closes them without touching the (destroyed) pool;
+ * 		releases already in progress when the timeout expires are waited for.
+*/
+typedef struct psql_pool_params
+{
+	int min_idle;	// connections opened by psql_pool_init()
+	int max_idle;	// extra idle connections are closed on release
+	int max_conns;	// upper bound of (idle + busy) connections
+	int64_t health_check_interval_ms;	// ping idle connections older than this before reuse
+	int64_t cleanup_timeout_ms;	// 0: default (30s); <0: wait forever
+}psql_pool_params_t;
+
+typedef struct psql_pool_stats
+{
+	int64_t num_acquired;
+	int64_t num_waits;		// acquires that had to block
+	int64_t num_timeouts;
+	int64_t num_created;
+	int64_t num_connect_failures;
+	int64_t num_health_check_failures;
+	double total_wait_time;	// seconds
+	double max_wait_time;	// seconds
+	int num_idle;
+	int num_busy;
+	int num_connecting;		// slots reserved while a new connection is being established
+}psql_pool_stats_t;
+
+typedef struct psql_pool psql_pool_t;
+psql_pool_t * psql_pool_init(psql_pool_t * pool, const char * sz_conn, const psql_pool_params_t * params);
+void psql_pool_cleanup(psql_pool_t * pool);
+psql_context_t * psql_pool_acquire(psql_pool_t * pool, int64_t timeout_ms);
+void psql_pool_release(psql_pool_t * pool, psql_context_t * psql);
+int psql_pool_get_stats(psql_pool_t * pool, psql_pool_stats_t * stats);
+void psql_pool_reset_stats(psql_pool_t * pool);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,100 @@
+#ifndef RDB_UTILS_H_
+#define RDB_UTILS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+enum rdb_type
+{
+	rdb_type_postgres,
+	rdb_type_mariadb,
+	rdb_type_sqllite,
+	rdb_type_oracle,
+	rdb_type_sqlserver,
+};
+
+typedef struct rdb_transaction
+{
+	void * priv;	// rdb_context_t *
+	int (* begin)(struct rdb_transaction * trans);
+	int (* save_point)(struct rdb_transaction * trans, const char * saved_name);
+	int (* commit)(struct rdb_transaction * trans);
+	int (* rollback)(struct rdb_transaction * trans, const char * saved_name);	// saved_name: NULL to rollback the whole transaction
+}rdb_transaction_t;
+
+/**
+ * rdb_on_row_fn: called for every row of rdb->query()
+ * 	@values: text values, NULL: SQL NULL. only valid during the callback.
+ * 	@return non-zero to stop the query.
+*/
+struct rdb_context;
+typedef int (* rdb_on_row_fn)(struct rdb_context * rdb, int num_fields, const char ** field_names, const char ** values, void * user_data);
+
+/**
+ * rdb_context: one connection, the same interface for all backends
+ * 	rdb_type_postgres: priv is a psql_context_t *, conn_string is a libpq conninfo string.
+ * 	rdb_type_sqllite: priv is a sqlite3 *, conn_string is a file name, a "file:" uri or ":memory:" (default).
+ * 		meant as a local read-cache tier (e.g. hot reference data loaded by rdb_load_table()),
+ * 		so it is opened with synchronous=OFF and an in-memory journal: the data is rebuildable, not durable.
+ *
+ * 	statements of execute_batch() and query() use $1, $2, ... placeholders with both backends.
+ * 	results are text only: get_value() returns NULL for SQL NULL.
+ * 	like psql_context_t, an rdb_context_t must not be used by more than one thread at a time.
+*/
+typedef struct rdb_context
+{
+	void * user_data;
+	void * priv;
+	enum rdb_type type;
+
+	int (* connect)(struct rdb_context * rdb, const char * conn_string, int async_mmode);
+	int (* execute)(struct rdb_context * rdb, const char * sql_statements, void ** p_result);
+	void (* clear_result)(void * result);
+	int (* disconnect)(struct rdb_context * rdb);
+
+	/*
+	 * execute_batch(): runs one statement for every row of parameters, all-or-nothing.
+	 * 	postgres: pipelined with a single sync (one round trip), inside BEGIN / COMMIT 
+	 * 		(a savepoint within the caller's transaction); a failed send is rolled back
+	 * 	sqlite: prepared once, inside a savepoint
+	 * 	@values: values[row * num_params + col], NULL: SQL NULL
+	 * 	@return number of affected rows, or -1 (nothing has been applied)
+	 */
+	int64_t (* execute_batch)(struct rdb_context * rdb, const char * command, int num_params, int num_rows, const char ** values);
+
+	/*
+	 * query(): streams the rows of a single statement to on_row(), in bounded memory
+	 * 	@params: nullable, num_params text values
+	 * 	@return number of rows delivered, or -1
+	 */
+	int64_t (* query)(struct rdb_context * rdb, const char * sql, int num_params, const char ** params,
+		rdb_on_row_fn on_row, void * user_data);
+
+	// result accessors (result of execute())
+	int (* get_num_rows)(const void * result);
+	int (* get_num_fields)(const void * result);
+	const char * (* get_field_name)(const void * result, int col);
+	const char * (* get_value)(const void * result, int row, int col);
+}rdb_context_t;
+
+rdb_context_t * rdb_context_init(rdb_context_t * rdb, enum rdb_type type, void * user_data);	// NULL: backend not supported
+void rdb_context_cleanup(rdb_context_t * rdb);
+
+rdb_transaction_t * rdb_transaction_init(rdb_transaction_t * trans, rdb_context_t * rdb);
+
+/**
+ * rdb_load_table(): (re)builds table_name in the cache from the rows of select_sql on source,
+ * 	e.g. rdb_load_table(sqlite_cache, "currencies", postgres, "SELECT code, name, rate FROM ref.currencies");
+ * 	the rows are streamed and inserted in batches, all columns are TEXT.
+ * 	the table is replaced within one transaction, so readers of the cache see the old or the new rows.
+ * 	@return number of rows loaded, or -1 (the cache is unchanged)
+*/
+int64_t rdb_load_table(rdb_context_t * cache, const char * table_name, rdb_context_t * source, const char * select_sql);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -35,16 +35,36 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 #include <limits.h>
 
 #include <stdarg.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 
+#include <endian.h>
 #include <libpq-fe.h>
 #include "avl_tree.h"
+#include "auto_buffer.h"
+#include "csv_scanner.h"
 
 #include "rdb-postgres.h"
 
 #define CHLIB_PSQL_VERBOSE (1)
+#define PSQL_EPOCH_OFFSET_USEC (INT64_C(946684800) * 1000000)	// unix time of the PostgreSQL epoch (2000-01-01 00:00:00 UTC)
+
+static inline double psql_get_time(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
 int psql_prepare_params_compare(const void * a, const void * b)
 {
 	return strcmp((const char *)a, (const char *)b);
@@ -127,6 +147,14 @@ void psql_params_cleanup(psql_params_t * params)
 	return;
 }
 
+typedef struct psql_hook
+{
+	int id;
+	psql_hook_fn before;
+	psql_hook_fn after;
+	void * user_data;
+}psql_hook_t;
+
 /*********************************************
  * 
 *********************************************/
@@ -140,8 +168,52 @@ typedef struct psql_context
 	
 	ExecStatusType exec_status;
 	char err_msg[PATH_MAX];
+	
+	// pooled connection info
+	struct psql_pool * pool;
+	double last_active_time;
+	
+	// pipeline mode
+	int pipeline_mode;
+	int pipeline_num_queued;	// statements sent since the last drain
+	int pipeline_num_synced;	// statements covered by a sync point
+	int pipeline_num_syncs;
+	
+	// emulated pipeline (libpq < 14): statements run on send, results are kept until drained
+	int pipeline_aborted;
+	int pipeline_max_pending;
+	int * pipeline_statuses;
+	PGresult ** pipeline_results;
+	
+	// auto-prepared statements cache (named_params_tree + LRU list)
+	int auto_prepare_threshold;	// 0: disabled
+	int stmt_cache_capacity;	// max prepared statements
+	int num_prepared;
+	unsigned int stmt_serial;
+	uint64_t conn_generation;	// bumped on every (re)connect, invalidates prepared statements
+	struct psql_stmt_cache_entry * lru_head;	// most recently used
+	struct psql_stmt_cache_entry * lru_tail;
+	psql_stmt_cache_stats_t stmt_cache_stats;
+	int num_pending_deallocs;	// evicted, but DEALLOCATE has to wait until the transaction ends
+	int max_pending_deallocs;
+	char (* pending_deallocs)[32];
+	
+	// async engine
+	struct psql_async_task * async_task;
+	
+	// statement metrics, NULL: disabled
+	struct psql_metrics * metrics;
+	
+	// execution hooks
+	int num_hooks;
+	int hook_serial;
+	int measure_bytes;	// sum the result value lengths into bytes_received
+	struct psql_hook hooks[PSQL_MAX_HOOKS];
 }psql_context_t;
 
+static void psql_stmt_cache_entry_free(void * entry);
+static void psql_async_task_free(psql_context_t * psql);
+static void psql_metrics_free(struct psql_metrics * metrics);
 psql_context_t * psql_context_init(psql_context_t * psql, void * user_data)
 {
 	if(NULL == psql) psql = calloc(1, sizeof(*psql));
@@ -149,13 +221,14 @@ psql_context_t * psql_context_init(psql_context_t * psql, void * user_data)
 	
 	avl_tree_t * tree = avl_tree_init(psql->named_params_tree, psql);
 	assert(tree && tree == psql->named_params_tree);
-	tree->on_free_data = free;
+	tree->on_free_data = psql_stmt_cache_entry_free;
 	
 	return psql;
 }
 void psql_context_cleanup(psql_context_t * psql) 
 {
 	if(NULL == psql) return;
+	psql_async_task_free(psql);
 	
 	PGconn * conn = psql->conn;
 	if(conn) {
@@ -163,6 +236,24 @@ void psql_context_cleanup(psql_context_t * psql)
 		PQfinish(conn);
 	}
 	avl_tree_cleanup(psql->named_params_tree);
+	psql->lru_head = psql->lru_tail = NULL;
+	psql->num_prepared = 0;
+	free(psql->pending_deallocs);
+	psql->pending_deallocs = NULL;
+	psql->num_pending_deallocs = psql->max_pending_deallocs = 0;
+	
+	if(psql->pipeline_results) {
+		for(int i = 0; i < psql->pipeline_num_queued; ++i) PQclear(psql->pipeline_results[i]);
+		free(psql->pipeline_results);
+		psql->pipeline_results = NULL;
+	}
+	free(psql->pipeline_statuses);
+	psql->pipeline_statuses = NULL;
+	psql->pipeline_max_pending = 0;
+	psql->pipeline_num_queued = 0;
+	
+	psql_metrics_free(psql->metrics);
+	psql->metrics = NULL;
 	return;
 }
 
@@ -175,6 +266,32 @@ int psql_disconnect(psql_context_t * psql)
 	return 0;
 }
 
+int psql_in_transaction(psql_context_t * psql)
+{
+	if(NULL == psql || NULL == psql->conn) return -1;
+	switch(PQtransactionStatus(psql->conn)) {
+	case PQTRANS_IDLE: return 0;
+	case PQTRANS_INTRANS: 
+	case PQTRANS_INERROR: return 1;
+	default: 
+		break;
+	}
+	return -1;
+}
+
+static const char * s_secure_search_path_sql = 
+	//~ "SELECT pg_catalog.set_config('search_path', '', false)";
+	"SELECT pg_catalog.set_config('search_path', '\"$user\", public', false)";
+
+static void psql_attach_conn(psql_context_t * psql, PGconn * conn)
+{
+	psql->conn = conn;
+	psql->conn_status = PQstatus(conn);
+	++psql->conn_generation;
+	psql->num_prepared = 0;
+	psql->num_pending_deallocs = 0;	// a new session has no prepared statements
+}
+
 int psql_connect_db(psql_context_t * psql, const char * sz_conn, int async_mode)
 {
 	PGconn * conn = NULL;
@@ -213,10 +330,7 @@ int psql_connect_db(psql_context_t * psql, const char * sz_conn, int async_mode)
 		}
 		
 		/* Set always-secure search path, so malicious users can't take control. */
-		psql_result_t res = PQexec(conn, 
-			//~ "SELECT pg_catalog.set_config('search_path', '', false)");
-			"SELECT pg_catalog.set_config('search_path', '\"$user\", public', false)");
-			
+		psql_result_t res = PQexec(conn, s_secure_search_path_sql);
 		if(PQresultStatus(res) != PGRES_TUPLES_OK) {
 			fprintf(stderr, "[ERROR]: set_config(search_path) failed: \n"
 				"  - err_msg: %s\n",
@@ -229,294 +343,6815 @@ int psql_connect_db(psql_context_t * psql, const char * sz_conn, int async_mode)
 		psql_result_clear(&res); 
 	}
 	if(NULL == conn) return -1;
-	psql->conn = conn;
+	
+	psql_attach_conn(psql, conn);
 	return 0;
 }
 
+/*
+ * returns the remaining milliseconds before 'deadline' (-1: wait forever),
+ * or 0 if the deadline has already been passed.
+ */
+static inline int connect_poll_timeout(double deadline)
+{
+	if(deadline <= 0) return -1;
+	double remain = deadline - psql_get_time();
+	if(remain <= 0) return 0;
+	return (int)ceil(remain * 1000.0);
+}
+
 int psql_connect_async_wait(psql_context_t * psql, int64_t timeout_ms)
 {
 	assert(psql && psql->conn);
-	assert(timeout_ms > 0);
 	
-	ConnStatusType conn_status = CONNECTION_AWAITING_RESPONSE;
 	PGconn * conn = psql->conn;
-	struct timespec timer, remain;
-	memset(&timer, 0, sizeof(timer));
+	double deadline = (timeout_ms > 0)?(psql_get_time() + (double)timeout_ms / 1000.0):0;
 	
-//	timer->tv_sec = timeout_ms / 1000;
-	timer.tv_sec = 0;
-	timer.tv_nsec = 100 * 1000000; // check_intervals: 100 ms
-	int rc = -1;
-	while(timeout_ms > 0) {
-		memset(&remain, 0, sizeof(remain));
-		rc = nanosleep(&timer, &remain);
-		if(rc < 0) {
-			if(errno == EINTR) { // The pause has been interrupted by a signal that was delivered to the thread
-				timer = remain;
-				continue;
-			}
-			perror("psql_connect_async_wait()::nanosleep");
+	// After PQconnectStart(), libpq expects the caller to behave as if 
+	// PQconnectPoll() had last returned PGRES_POLLING_WRITING.
+	PostgresPollingStatusType polling_status = PGRES_POLLING_WRITING;
+	if(PQstatus(conn) == CONNECTION_BAD) polling_status = PGRES_POLLING_FAILED;
+	
+	while(polling_status != PGRES_POLLING_OK && polling_status != PGRES_POLLING_FAILED) {
+		// the socket may change between calls (e.g. when trying multiple hosts)
+		struct pollfd pfd = {
+			.fd = PQsocket(conn),
+			.events = (polling_status == PGRES_POLLING_READING)?POLLIN:POLLOUT,
+		};
+		if(pfd.fd < 0) {
+			polling_status = PGRES_POLLING_FAILED;
 			break;
 		}
 		
-		// reset timer
-		timer.tv_sec = 0;
-		timer.tv_nsec = 100 * 1000000; // check_intervals: 100 ms
-		PostgresPollingStatusType polling_status = PQconnectPoll(conn);
-		if(PGRES_POLLING_FAILED == polling_status) {
-			rc = -1;
-			conn_status = CONNECTION_BAD;
+		int timeout = connect_poll_timeout(deadline);
+		if(0 == timeout) break;
+		
+		int n = poll(&pfd, 1, timeout);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("psql_connect_async_wait()::poll");
+			polling_status = PGRES_POLLING_FAILED;
 			break;
 		}
-		if(polling_status == PGRES_POLLING_OK) {
-			conn_status = CONNECTION_OK;
-			break;
+		if(0 == n) continue; // timeout, re-checked at the top of the loop
+		
+		polling_status = PQconnectPoll(conn);
+	}
+	
+	psql->conn_status = PQstatus(conn);
+	if(polling_status != PGRES_POLLING_OK) {
+		if(polling_status == PGRES_POLLING_FAILED) {
+			fprintf(stderr, "[ERROR]: %s() failed: %s\n", __FUNCTION__, PQerrorMessage(conn));
+		}else {
+			fprintf(stderr, "[ERROR]: %s() timeout.\n", __FUNCTION__);
 		}
+		return -1;
 	}
-	psql->conn_status = conn_status;
-	if(rc < 0 || conn_status != CONNECTION_MADE) return -1;
 	return 0;
 }
 
-
-	
-static inline int psql_check_result(psql_context_t * psql, const psql_result_t res)
+/*
+ * psql_connect_db_parallel(): 
+ *   opens 'count' connections concurrently, all of them share the same deadline.
+ *   A single poll() set drives every pending PQconnectPoll() state machine,
+ *   so the total latency is bounded by the slowest handshake instead of the sum of all.
+ * 
+ * On return, contexts[i]->conn is NULL if the i-th connection could not be established.
+ * returns the number of connected contexts, or -1 on invalid arguments.
+ */
+int psql_connect_db_parallel(psql_context_t ** contexts, int count, const char * sz_conn, int64_t timeout_ms)
 {
-	ExecStatusType status = PQresultStatus(res);
-	psql->exec_status = status;
+	if(NULL == contexts || count <= 0) return -1;
+	if(NULL == sz_conn) sz_conn = "dbname=postgres";
 	
-	snprintf(psql->err_msg, sizeof(psql->err_msg), "STATUS: %d(%s): %s", 
-		status, PQresStatus(status), 
-		PQresultErrorMessage(res));
-	//fprintf(stderr, "%s\n", psql->err_msg);
-
-	switch(status) {
-	case PGRES_COMMAND_OK:
-	case PGRES_TUPLES_OK:
-	case PGRES_SINGLE_TUPLE:
-		return 0;	// ok
+	double deadline = (timeout_ms > 0)?(psql_get_time() + (double)timeout_ms / 1000.0):0;
 	
-	case PGRES_EMPTY_QUERY:
-	case PGRES_COPY_OUT:
-	case PGRES_COPY_IN:
-	case PGRES_COPY_BOTH:
-	case PGRES_NONFATAL_ERROR:
-		return 1;	// ok with informations
+	PostgresPollingStatusType * states = calloc(count, sizeof(*states));
+	struct pollfd * pfds = calloc(count, sizeof(*pfds));
+	int * indices = calloc(count, sizeof(*indices));
+	assert(states && pfds && indices);
+	
+	int num_pending = 0;
+	for(int i = 0; i < count; ++i) {
+		psql_context_t * psql = contexts[i];
+		assert(psql && NULL == psql->conn);
+		
+		PGconn * conn = PQconnectStart(sz_conn);
+		if(NULL == conn || PQstatus(conn) == CONNECTION_BAD) {
+			if(conn) {
+				fprintf(stderr, "[ERROR]: %s(): PQconnectStart() failed: %s\n", __FUNCTION__, PQerrorMessage(conn));
+				PQfinish(conn);
+			}
+			states[i] = PGRES_POLLING_FAILED;
+			continue;
+		}
+		psql->conn = conn;
+		states[i] = PGRES_POLLING_WRITING;
+		++num_pending;
+	}
+	
+	// stage 1: drive all handshakes with one poll() set
+	while(num_pending > 0) {
+		int timeout = connect_poll_timeout(deadline);
+		if(0 == timeout) break;
+		
+		int nfds = 0;
+		for(int i = 0; i < count; ++i) {
+			if(states[i] != PGRES_POLLING_READING && states[i] != PGRES_POLLING_WRITING) continue;
+			pfds[nfds].fd = PQsocket(contexts[i]->conn);
+			pfds[nfds].events = (states[i] == PGRES_POLLING_READING)?POLLIN:POLLOUT;
+			pfds[nfds].revents = 0;
+			indices[nfds] = i;
+			++nfds;
+		}
+		assert(nfds == num_pending);
+		
+		int n = poll(pfds, nfds, timeout);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("psql_connect_db_parallel()::poll");
+			break;
+		}
+		
+		for(int k = 0; k < nfds && n > 0; ++k) {
+			if(0 == pfds[k].revents) continue;
+			--n;
+			
+			int i = indices[k];
+			states[i] = PQconnectPoll(contexts[i]->conn);
+			if(states[i] == PGRES_POLLING_OK || states[i] == PGRES_POLLING_FAILED) --num_pending;
+		}
+	}
+	
+	// stage 2: set the secure search path on all new connections, 
+	// the statements are sent first so that they are processed concurrently, 
+	// and their results are read with the same poll() loop and deadline.
+	// states[i] stays PGRES_POLLING_READING until the result has arrived.
+	num_pending = 0;
+	for(int i = 0; i < count; ++i) {
+		if(states[i] != PGRES_POLLING_OK) continue;
+		if(!PQsendQuery(contexts[i]->conn, s_secure_search_path_sql)) {
+			states[i] = PGRES_POLLING_FAILED;
+			continue;
+		}
+		states[i] = PGRES_POLLING_READING;
+		++num_pending;
+	}
+	
+	while(num_pending > 0) {
+		int nfds = 0;
+		for(int i = 0; i < count; ++i) {
+			if(states[i] != PGRES_POLLING_READING || NULL == contexts[i]->conn) continue;
+			PGconn * conn = contexts[i]->conn;
+			int done = 0;
+			int ok = 1;
+			while(!done && ok && !PQisBusy(conn)) {
+				PGresult * res = PQgetResult(conn);
+				if(NULL == res) done = 1;	// all results have been read
+				else if(PQresultStatus(res) != PGRES_TUPLES_OK) ok = 0;
+				PQclear(res);
+			}
+			if(done || !ok) {
+				states[i] = ok?PGRES_POLLING_OK:PGRES_POLLING_FAILED;
+				--num_pending;
+				continue;
+			}
+			pfds[nfds].fd = PQsocket(conn);
+			pfds[nfds].events = POLLIN;
+			pfds[nfds].revents = 0;
+			indices[nfds] = i;
+			++nfds;
+		}
+		if(0 == nfds) break;
+		
+		int timeout = connect_poll_timeout(deadline);
+		if(0 == timeout) break;
+		
+		int n = poll(pfds, nfds, timeout);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("psql_connect_db_parallel()::poll");
+			break;
+		}
+		
+		for(int k = 0; k < nfds && n > 0; ++k) {
+			if(0 == pfds[k].revents) continue;
+			--n;
+			
+			int i = indices[k];
+			if(!PQconsumeInput(contexts[i]->conn)) {
+				states[i] = PGRES_POLLING_FAILED;
+				--num_pending;
+			}
+		}
+	}
+	
+	int num_connected = 0;
+	for(int i = 0; i < count; ++i) {
+		psql_context_t * psql = contexts[i];
+		PGconn * conn = psql->conn;
+		if(NULL == conn) continue;
+		
+		psql->conn = NULL;
+		if(states[i] != PGRES_POLLING_OK) {
+			fprintf(stderr, "[ERROR]: %s(): connection[%d] failed: %s\n", __FUNCTION__, i, 
+				(states[i] == PGRES_POLLING_FAILED)?PQerrorMessage(conn):"timeout\n");
+			PQfinish(conn);
+			psql->conn_status = CONNECTION_BAD;
+			continue;
+		}
+		psql_attach_conn(psql, conn);
+		++num_connected;
+	}
+	
+	free(states);
+	free(pfds);
+	free(indices);
+	return num_connected;
+}
 
-	case PGRES_BAD_RESPONSE:
-	case PGRES_FATAL_ERROR:
-	default:
-		break;
+
+
+/* *********************************** **
+ * Statement Metrics
+ * 	per-statement latency histograms, row and byte counters.
+ * 	statements are keyed by their fingerprint: the SQL text with literals replaced by '?' 
+ * 	and whitespace collapsed, or the statement name for prepared statements.
+ * 	disabled (psql->metrics == NULL) it costs a single branch per call.
+** *********************************** */
+#define PSQL_METRICS_SUB_BITS (3)		// 8 sub-buckets per power of two: <= 12.5% relative error
+#define PSQL_METRICS_MAX_ENTRIES (1024)	// distinct statements, the others are aggregated into "<other>"
+
+struct psql_metrics
+{
+	pthread_mutex_t mutex;	// snapshots may be taken by another thread
+	avl_tree_t entries[1];	// psql_stmt_metrics_t
+};
+
+static inline uint64_t hash_fnv1a_bytes(const void * data, size_t length)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	const unsigned char * p = data;
+	for(size_t i = 0; i < length; ++i) {
+		hash ^= p[i];
+		hash *= UINT64_C(0x100000001b3);
 	}
-	return -1;	// failed
+	return hash;
 }
 
-#define psql_check_result_on_error_return(conn, res) do { 	\
-		if(psql_check_result(psql, res) < 0) {						\
-			fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);		\
-			return -1;												\
-		}															\
-	}while(0)
-int psql_execute(psql_context_t * psql, const char * command, void ** p_result)
+static int psql_metrics_compare(const void * _a, const void * _b)
 {
-	assert(psql && psql->conn);
-	PGconn * conn = psql->conn;
-	PGresult * result = PQexec(conn, command);
+	const psql_stmt_metrics_t * a = _a;
+	const psql_stmt_metrics_t * b = _b;
+	if(a->fingerprint == b->fingerprint) return 0;
+	return (a->fingerprint < b->fingerprint)?-1:1;
+}
+
+static inline int psql_metrics_bucket_index(int64_t usec)
+{
+	if(usec < (1 << PSQL_METRICS_SUB_BITS)) return (usec < 0)?0:(int)usec;
+	int exponent = 63 - __builtin_clzll((uint64_t)usec);
+	int index = (exponent - PSQL_METRICS_SUB_BITS + 1) * (1 << PSQL_METRICS_SUB_BITS) 
+		+ (int)((usec >> (exponent - PSQL_METRICS_SUB_BITS)) & ((1 << PSQL_METRICS_SUB_BITS) - 1));
+	return (index < PSQL_METRICS_NUM_BUCKETS)?index:(PSQL_METRICS_NUM_BUCKETS - 1);
+}
+
+/* the largest value (in microseconds) which falls into the bucket */
+int64_t psql_metrics_bucket_bound(int index)
+{
+	assert(index >= 0 && index < PSQL_METRICS_NUM_BUCKETS);
+	int sub_count = 1 << PSQL_METRICS_SUB_BITS;
+	if(index < sub_count) return index;
+	int shift = index / sub_count - 1;
+	int64_t lower = (int64_t)(sub_count + index % sub_count) << shift;
+	return lower + ((int64_t)1 << shift) - 1;
+}
+
+/*
+ * fingerprint the SQL text: literals are replaced by '?', whitespace is collapsed, 
+ * $n placeholders and identifiers are kept. 
+ * a dollar-quoted body ($$...$$, $tag$...$tag$) is one literal, "quoted identifiers" are copied verbatim.
+ * the (truncated) normalized text is written to label.
+ */
+static uint64_t psql_metrics_fingerprint(const char * sql, char * label, size_t size)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	size_t length = 0;
+	int last_space = 1;
 	
-	psql_check_result_on_error_return(conn, result);
+#define emit(c) do { 											\
+		unsigned char ch = (unsigned char)(c);					\
+		hash = (hash ^ ch) * UINT64_C(0x100000001b3);			\
+		if(length + 1 < size) label[length++] = ch;				\
+	}while(0)
 	
-	if(p_result) {
-		*p_result = result;
-	}else {
-		PQclear(result);
+	const char * p = sql;
+	while(*p) {
+		unsigned char c = *p;
+		if(isspace(c)) {
+			if(!last_space) emit(' ');
+			last_space = 1;
+			++p;
+			continue;
+		}
+		last_space = 0;
+		
+		if(c == '\'') {	// string literal, '' is an escaped quote
+			++p;
+			while(*p) {
+				if(*p == '\'' && p[1] == '\'') p += 2;
+				else if(*p == '\'') { ++p; break; }
+				else ++p;
+			}
+			emit('?');
+			continue;
+		}
+		if(c == '"') {	// quoted identifier, "" is an escaped quote
+			emit(*p++);
+			while(*p) {
+				if(*p == '"' && p[1] == '"') { emit(*p++); emit(*p++); continue; }
+				if(*p == '"') { emit(*p++); break; }
+				emit(*p++);
+			}
+			continue;
+		}
+		if(c == '$' && (p == sql || !(isalnum((unsigned char)p[-1]) || p[-1] == '_' || p[-1] == '$'))) {
+			// dollar quote: $$ or $tag$, where the tag does not start with a digit ($n is a placeholder)
+			const char * tag_end = p + 1;
+			if(isalpha((unsigned char)*tag_end) || *tag_end == '_') {
+				while(isalnum((unsigned char)*tag_end) || *tag_end == '_') ++tag_end;
+			}
+			if(*tag_end == '$') {
+				size_t cb_tag = tag_end - p + 1;
+				const char * body = tag_end + 1;
+				const char * end = body;
+				while((end = strchr(end, '$')) && strncmp(end, p, cb_tag) != 0) ++end;
+				p = end?(end + cb_tag):(body + strlen(body));	// unterminated: the rest is the literal
+				emit('?');
+				continue;
+			}
+		}
+		if(isdigit(c) && (p == sql || !(isalnum((unsigned char)p[-1]) || p[-1] == '_' || p[-1] == '$'))) {
+			while(isalnum((unsigned char)*p) || *p == '.') ++p;	// number (incl. 1.5e3, 0x..)
+			emit('?');
+			continue;
+		}
+		emit(c);
+		++p;
 	}
-	return 0;
+#undef emit
+	while(length > 0 && (label[length - 1] == ' ' || label[length - 1] == ';')) --length;
+	if(size > 0) label[length] = '\0';
+	return hash;
 }
 
-int psql_exec_params(psql_context_t * psql, const char * command, const psql_params_t * params, void ** p_result)
+static psql_stmt_metrics_t * psql_metrics_get_entry(struct psql_metrics * metrics, uint64_t fingerprint, const char * label)
 {
-	assert(psql && psql->conn);
-	PGconn * conn = psql->conn;
-	PGresult * result = PQexecParams(conn, command, params->num_params, 
-		params->types, 
-		params->values,
-		params->cb_values,
-		params->value_formats,
-		params->result_format
-	);
+	psql_stmt_metrics_t key = { .fingerprint = fingerprint };
+	struct avl_node * node = avl_tree_find(metrics->entries, &key, psql_metrics_compare);
+	if(node) return avl_node_get_data(node);
+	if(NULL == label) return NULL;
 	
-	psql_check_result_on_error_return(conn, result);
+	if(fingerprint != 0 && metrics->entries->count >= PSQL_METRICS_MAX_ENTRIES) {
+		return psql_metrics_get_entry(metrics, 0, "<other>");
+	}
 	
-	if(p_result) {
-		*p_result = result;
+	psql_stmt_metrics_t * entry = calloc(1, sizeof(*entry));
+	assert(entry);
+	entry->fingerprint = fingerprint;
+	strncpy(entry->label, label, sizeof(entry->label) - 1);
+	node = avl_tree_add(metrics->entries, entry, psql_metrics_compare);
+	assert(node);
+	return entry;
+}
+
+/* the fingerprint of a SQL text, or of a prepared statement (command == NULL) */
+static uint64_t psql_metrics_make_key(const char * command, const char * stmt_name, char * label)
+{
+	uint64_t fingerprint = 0;
+	if(NULL == command) {
+		snprintf(label, PSQL_METRICS_LABEL_SIZE, "EXECUTE %s", stmt_name);
+		fingerprint = hash_fnv1a_bytes(label, strlen(label));
 	}else {
-		PQclear(result);
+		fingerprint = psql_metrics_fingerprint(command, label, PSQL_METRICS_LABEL_SIZE);
 	}
-	return 0;
+	return fingerprint?fingerprint:1;	// 0 is reserved for "<other>"
 }
 
-int psql_prepare(psql_context_t * psql, const char * query, const psql_prepare_params_t * prepare_params)
+/* for long running statements (COPY): the entry is created when they start */
+static uint64_t psql_metrics_register(psql_context_t * psql, const char * command)
 {
-	assert(psql && psql->conn);
-	PGconn * conn = psql->conn;
-	PGresult * result = PQprepare(conn, prepare_params->stmt_name, query, prepare_params->num_params, prepare_params->types);
+	struct psql_metrics * metrics = psql->metrics;
+	char label[PSQL_METRICS_LABEL_SIZE] = "";
+	uint64_t fingerprint = psql_metrics_make_key(command, NULL, label);
 	
-	if(NULL == result) return -1;
-	PQclear(result);
-	return 0;
+	pthread_mutex_lock(&metrics->mutex);
+	psql_stmt_metrics_t * entry = psql_metrics_get_entry(metrics, fingerprint, label);
+	if(entry) fingerprint = entry->fingerprint;	// may be "<other>"
+	pthread_mutex_unlock(&metrics->mutex);
+	return fingerprint;
 }
 
-int psql_exec_prepared(psql_context_t * psql, const char * stmt_name, const psql_params_t * params, void ** p_result)
+/*
+ * @label: (nullable) creates the entry if it does not exist, 
+ * 	otherwise the sample is dropped when the entry has been reset meanwhile.
+ */
+static void psql_metrics_record(psql_context_t * psql, uint64_t fingerprint, const char * label, 
+	double duration, int failed, int64_t num_rows, int64_t bytes_sent, int64_t bytes_received)
 {
-	assert(psql && psql->conn);
-	PGconn * conn = psql->conn;
-	assert(params);
-	
-	PGresult * result = PQexecPrepared(conn, stmt_name, params->num_params, 
-		params->values,
-		params->cb_values,
-		params->value_formats,
-		params->result_format
-	);
+	struct psql_metrics * metrics = psql->metrics;
+	if(NULL == metrics) return;
 	
-	psql_check_result_on_error_return(conn, result);
-	if(p_result) {
-		*p_result = result;
-	}else {
-		PQclear(result);
+	pthread_mutex_lock(&metrics->mutex);
+	psql_stmt_metrics_t * entry = psql_metrics_get_entry(metrics, fingerprint, label);
+	if(entry) {
+		if(entry->num_calls == 0 || duration < entry->min_time) entry->min_time = duration;
+		if(duration > entry->max_time) entry->max_time = duration;
+		++entry->num_calls;
+		entry->total_time += duration;
+		if(failed) ++entry->num_errors;
+		if(num_rows > 0) entry->num_rows += num_rows;
+		entry->bytes_sent += bytes_sent;
+		entry->bytes_received += bytes_received;
+		++entry->buckets[psql_metrics_bucket_index((int64_t)(duration * 1000000.0))];
 	}
-	return 0;
+	pthread_mutex_unlock(&metrics->mutex);
 }
 
-void psql_result_clear(psql_result_t * p_result)
+static void psql_metrics_free(struct psql_metrics * metrics)
 {
-	if(NULL == p_result || NULL == *p_result) return;
-	PQclear(*p_result);
-	*p_result = NULL;
-	return;
+	if(NULL == metrics) return;
+	avl_tree_cleanup(metrics->entries);
+	pthread_mutex_destroy(&metrics->mutex);
+	free(metrics);
 }
-const char * psql_result_get_value(const psql_result_t res, int row, int col)
+
+/*
+ * psql_metrics_enable(): 
+ *   start (enabled != 0) or stop recording, stopping discards the collected metrics.
+ *   not thread-safe with respect to the statements running on the context.
+ */
+int psql_metrics_enable(psql_context_t * psql, int enabled)
 {
-	return PQgetvalue(res, row, col);
+	assert(psql);
+	if(!enabled) {
+		psql_metrics_free(psql->metrics);
+		psql->metrics = NULL;
+		return 0;
+	}
+	if(psql->metrics) return 0;
+	
+	struct psql_metrics * metrics = calloc(1, sizeof(*metrics));
+	assert(metrics);
+	pthread_mutex_init(&metrics->mutex, NULL);
+	avl_tree_init(metrics->entries, metrics);
+	metrics->entries->on_free_data = free;
+	psql->metrics = metrics;
+	return 0;
 }
-int psql_result_get_count(const psql_result_t res)
+
+void psql_metrics_reset(psql_context_t * psql)
 {
-	return PQntuples(res);
+	assert(psql);
+	struct psql_metrics * metrics = psql->metrics;
+	if(NULL == metrics) return;
+	pthread_mutex_lock(&metrics->mutex);
+	avl_tree_cleanup(metrics->entries);
+	pthread_mutex_unlock(&metrics->mutex);
 }
-int psql_result_get_fields(const psql_result_t res, const char *** p_fields)
+
+/*
+ * psql_metrics_snapshot(): 
+ *   copies the metrics of all statements into *p_metrics (free() it), 
+ *   @reset: start over atomically with the snapshot.
+ *   @return the number of statements.
+ */
+int psql_metrics_snapshot(psql_context_t * psql, psql_stmt_metrics_t ** p_metrics, int reset)
 {
-	int num_fields = PQnfields(res);
-	if(num_fields <= 0) return num_fields;
-	if(NULL == p_fields) return num_fields;	// return num fields only
-	
-	const char ** fields = calloc(num_fields, sizeof(*fields));
-	assert(fields);
+	assert(psql && p_metrics);
+	*p_metrics = NULL;
+	struct psql_metrics * metrics = psql->metrics;
+	if(NULL == metrics) return 0;
 	
-	for(int i = 0; i < num_fields; ++i)
-	{
-		fields[i] = PQfname(res, i);
+	pthread_mutex_lock(&metrics->mutex);
+	int count = (int)metrics->entries->count;
+	psql_stmt_metrics_t * snapshot = NULL;
+	if(count > 0) {
+		snapshot = calloc(count, sizeof(*snapshot));
+		assert(snapshot);
+		int index = 0;
+		for(struct avl_node * node = avl_tree_iter_begin(metrics->entries); node; node = avl_tree_iter_next(metrics->entries)) {
+			snapshot[index++] = *(psql_stmt_metrics_t *)avl_node_get_data(node);
+		}
+		assert(index == count);
 	}
-	*p_fields = fields;
-	return num_fields;
+	if(reset) avl_tree_cleanup(metrics->entries);
+	pthread_mutex_unlock(&metrics->mutex);
+	
+	*p_metrics = snapshot;
+	return count;
 }
 
-
-/* *********************************** **
- * Asynchronous Command Processing
-** *********************************** */
-int psql_send_query(psql_context_t * psql, const char * command)
+/* @q: 0.0 ~ 1.0, returns seconds */
+double psql_stmt_metrics_percentile(const psql_stmt_metrics_t * metrics, double q)
 {
-	assert(psql && psql->conn);
-	PGconn * conn = psql->conn;
-	psql->err_msg[0] = '\0';
+	assert(metrics);
+	if(metrics->num_calls <= 0) return 0.0;
+	int64_t rank = (int64_t)ceil(q * (double)metrics->num_calls);
+	if(rank < 1) rank = 1;
 	
-	int ok = PQsendQuery(conn, command);
-	if(!ok) {
-		const char * err_msg = PQerrorMessage(conn);
-		if(err_msg) {
-			strncpy(psql->err_msg, err_msg, sizeof(psql->err_msg));
+	int64_t total = 0;
+	for(int i = 0; i < PSQL_METRICS_NUM_BUCKETS; ++i) {
+		total += metrics->buckets[i];
+		if(total >= rank) {
+			double value = (double)psql_metrics_bucket_bound(i) / 1000000.0;
+			if(value > metrics->max_time) value = metrics->max_time;
+			if(value < metrics->min_time) value = metrics->min_time;
+			return value;
 		}
-		return -1;
 	}
-	return 0;
+	return metrics->max_time;
 }
+#undef PSQL_METRICS_SUB_BITS
+#undef PSQL_METRICS_MAX_ENTRIES
 
-int psql_send_query_params(psql_context_t * psql, const char * command, const psql_params_t * params)
+/* *********************************** **
+ * Execution Hooks
+ * 	before / after callbacks around exec, prepare, send and get-result calls, 
+ * 	for tracing, slow query logs, sampling ...
+ * 	like the metrics, nothing is measured unless a hook is registered.
+** *********************************** */
+/* the state of one instrumented call, on the caller's stack */
+typedef struct psql_hook_call
 {
-	assert(psql && psql->conn);
-	PGconn * conn = psql->conn;
-	psql->err_msg[0] = '\0';
-	
-	int ok = PQsendQueryParams(conn, command, params->num_params, 
-		params->types, params->values, params->cb_values, params->value_formats, 
+	psql_hook_event_t event;
+	void * spans[PSQL_MAX_HOOKS];
+}psql_hook_call_t;
+
+#define psql_is_instrumented(psql) ((psql)->metrics || (psql)->num_hooks)
+
+/*
+ * psql_add_hook(): 
+ *   @before, @after: (nullable) called on the thread which uses the context.
+ *   hooks must not be added or removed from within a hook.
+ *   @return the hook id (> 0), or -1 if PSQL_MAX_HOOKS are already registered.
+ */
+int psql_add_hook(psql_context_t * psql, psql_hook_fn before, psql_hook_fn after, void * user_data)
+{
+	assert(psql);
+	if(psql->num_hooks >= PSQL_MAX_HOOKS) return -1;
+	psql_hook_t * hook = &psql->hooks[psql->num_hooks++];
+	hook->id = ++psql->hook_serial;
+	hook->before = before;
+	hook->after = after;
+	hook->user_data = user_data;
+	return hook->id;
+}
+
+int psql_remove_hook(psql_context_t * psql, int hook_id)
+{
+	assert(psql);
+	for(int i = 0; i < psql->num_hooks; ++i) {
+		if(psql->hooks[i].id != hook_id) continue;
+		memmove(&psql->hooks[i], &psql->hooks[i + 1], (psql->num_hooks - i - 1) * sizeof(psql->hooks[0]));
+		--psql->num_hooks;
+		return 0;
+	}
+	return -1;
+}
+
+int psql_metrics_measure_bytes(psql_context_t * psql, int enabled)
+{
+	assert(psql);
+	psql->measure_bytes = enabled;
+	return 0;
+}
+
+static void psql_instrument_begin(psql_context_t * psql, psql_hook_call_t * call, 
+	enum psql_hook_op op, const char * command, const char * stmt_name, const psql_params_t * params)
+{
+	memset(call, 0, sizeof(*call));
+	psql_hook_event_t * event = &call->event;
+	event->op = op;
+	event->command = command;
+	event->stmt_name = stmt_name;
+	event->params = params;
+	event->exec_status = -1;
+	
+	for(int i = 0; i < psql->num_hooks; ++i) {
+		if(psql->hooks[i].before) psql->hooks[i].before(psql, event, &call->spans[i], psql->hooks[i].user_data);
+	}
+	event->begin_time = psql_get_time();	// excludes the before hooks
+}
+
+static void psql_measure_result(psql_hook_event_t * event, const PGresult * res, int measure_bytes)
+{
+	const psql_params_t * params = event->params;
+	
+	int64_t bytes_sent = 0;
+	if(event->op != psql_hook_op_get_result) {
+		bytes_sent = event->command?strlen(event->command):strlen(event->stmt_name);
+		for(int i = 0; params && i < params->num_params; ++i) {
+			if(NULL == params->values[i]) continue;
+			bytes_sent += (params->value_formats && params->value_formats[i])?params->cb_values[i]:strlen(params->values[i]);
+		}
+	}
+	event->bytes_sent = bytes_sent;
+	if(NULL == res) return;
+	
+	ExecStatusType status = PQresultStatus(res);
+	event->exec_status = status;
+	if(status == PGRES_TUPLES_OK || status == PGRES_SINGLE_TUPLE) {
+		int num_fields = PQnfields(res);
+		int num_rows = PQntuples(res);
+		event->num_rows = num_rows;
+		event->num_fields = num_fields;
+		if(!measure_bytes) return;	// O(rows x columns), opt-in
+		
+		int64_t bytes_received = 0;
+		for(int row = 0; row < num_rows; ++row) {
+			for(int col = 0; col < num_fields; ++col) bytes_received += PQgetlength(res, row, col);
+		}
+		event->bytes_received = bytes_received;
+	}else if(status == PGRES_COMMAND_OK) {
+		const char * sz_tuples = PQcmdTuples((PGresult *)res);
+		if(sz_tuples && sz_tuples[0]) event->num_rows = strtoll(sz_tuples, NULL, 10);
+	}
+}
+
+/*
+ * @rc: 0 or -1 as returned to the caller
+ * @res: (nullable) the result of an exec / prepare / get_result call
+ */
+static void psql_instrument_end(psql_context_t * psql, psql_hook_call_t * call, int rc, const PGresult * res)
+{
+	psql_hook_event_t * event = &call->event;
+	event->duration = psql_get_time() - event->begin_time;
+	event->rc = rc;
+	event->result = res;
+	psql_measure_result(event, res, psql->measure_bytes);
+	
+	if(psql->metrics && event->op == psql_hook_op_exec) {
+		char label[PSQL_METRICS_LABEL_SIZE] = "";
+		uint64_t fingerprint = psql_metrics_make_key(event->command, event->stmt_name, label);
+		psql_metrics_record(psql, fingerprint, label, event->duration, rc < 0, 
+			event->num_rows, event->bytes_sent, event->bytes_received);
+	}
+	for(int i = 0; i < psql->num_hooks; ++i) {
+		if(psql->hooks[i].after) psql->hooks[i].after(psql, event, &call->spans[i], psql->hooks[i].user_data);
+	}
+}
+
+static inline int psql_check_result(psql_context_t * psql, const psql_result_t res)
+{
+	ExecStatusType status = PQresultStatus(res);
+	psql->exec_status = status;
+	
+	snprintf(psql->err_msg, sizeof(psql->err_msg), "STATUS: %d(%s): %s", 
+		status, PQresStatus(status), 
+		PQresultErrorMessage(res));
+	//fprintf(stderr, "%s\n", psql->err_msg);
+
+	switch(status) {
+	case PGRES_COMMAND_OK:
+	case PGRES_TUPLES_OK:
+	case PGRES_SINGLE_TUPLE:
+#if defined(LIBPQ_HAS_CHUNK_MODE)
+	case PGRES_TUPLES_CHUNK:
+#endif
+		return 0;	// ok
+	
+	case PGRES_EMPTY_QUERY:
+	case PGRES_COPY_OUT:
+	case PGRES_COPY_IN:
+	case PGRES_COPY_BOTH:
+	case PGRES_NONFATAL_ERROR:
+		return 1;	// ok with informations
+
+	case PGRES_BAD_RESPONSE:
+	case PGRES_FATAL_ERROR:
+	default:
+		break;
+	}
+	return -1;	// failed
+}
+
+/* the same ok / failed classification as psql_check_result(), without touching the context */
+static inline int psql_result_rc(const PGresult * res)
+{
+	switch(PQresultStatus(res)) {
+	case PGRES_BAD_RESPONSE:
+	case PGRES_FATAL_ERROR:
+		return -1;
+	default:
+		break;
+	}
+	return (NULL == res)?-1:0;
+}
+
+/*
+ * the libpq calls behind every statement issued on a context, the public API and the internal paths 
+ * (statement cache, pipeline, insert batcher, stream, cursor, upsert, loader, async engine) alike, 
+ * so that hooks and metrics see all of them.
+ */
+static PGresult * psql_do_exec(psql_context_t * psql, const char * command)
+{
+	if(!psql_is_instrumented(psql)) return PQexec(psql->conn, command);
+	
+	psql_hook_call_t call[1];
+	psql_instrument_begin(psql, call, psql_hook_op_exec, command, NULL, NULL);
+	PGresult * res = PQexec(psql->conn, command);
+	psql_instrument_end(psql, call, psql_result_rc(res), res);
+	return res;
+}
+
+static PGresult * psql_do_exec_params(psql_context_t * psql, const char * command, const psql_params_t * params)
+{
+	PGresult * res = NULL;
+	psql_hook_call_t call[1];
+	int instrumented = psql_is_instrumented(psql);
+	if(instrumented) psql_instrument_begin(psql, call, psql_hook_op_exec, command, NULL, params);
+	
+	res = PQexecParams(psql->conn, command, params->num_params, 
+		params->types, 
+		params->values,
+		params->cb_values,
+		params->value_formats,
+		params->result_format
+	);
+	if(instrumented) psql_instrument_end(psql, call, psql_result_rc(res), res);
+	return res;
+}
+
+static PGresult * psql_do_prepare(psql_context_t * psql, const char * stmt_name, const char * query, int num_params, const unsigned int * types)
+{
+	if(0 == psql->num_hooks) return PQprepare(psql->conn, stmt_name, query, num_params, types);
+	
+	psql_hook_call_t call[1];
+	psql_instrument_begin(psql, call, psql_hook_op_prepare, query, stmt_name, NULL);
+	PGresult * res = PQprepare(psql->conn, stmt_name, query, num_params, types);
+	psql_instrument_end(psql, call, psql_result_rc(res), res);
+	return res;
+}
+
+static PGresult * psql_do_exec_prepared(psql_context_t * psql, const char * stmt_name, const psql_params_t * params)
+{
+	PGresult * res = NULL;
+	psql_hook_call_t call[1];
+	int instrumented = psql_is_instrumented(psql);
+	if(instrumented) psql_instrument_begin(psql, call, psql_hook_op_exec, NULL, stmt_name, params);
+	
+	res = PQexecPrepared(psql->conn, stmt_name, params->num_params, 
+		params->values,
+		params->cb_values,
+		params->value_formats,
+		params->result_format
+	);
+	if(instrumented) psql_instrument_end(psql, call, psql_result_rc(res), res);
+	return res;
+}
+
+/* send calls: 1 on success, 0 on failure, as libpq */
+static int psql_do_send_query(psql_context_t * psql, const char * command)
+{
+	if(0 == psql->num_hooks) return PQsendQuery(psql->conn, command);
+	
+	psql_hook_call_t call[1];
+	psql_instrument_begin(psql, call, psql_hook_op_send, command, NULL, NULL);
+	int ok = PQsendQuery(psql->conn, command);
+	psql_instrument_end(psql, call, ok?0:-1, NULL);
+	return ok;
+}
+
+static int psql_do_send_query_params(psql_context_t * psql, const char * command, const psql_params_t * params)
+{
+	int ok = 0;
+	psql_hook_call_t call[1];
+	int instrumented = psql->num_hooks;
+	if(instrumented) psql_instrument_begin(psql, call, psql_hook_op_send, command, NULL, params);
+	
+	ok = PQsendQueryParams(psql->conn, command, params->num_params, 
+		params->types, params->values, params->cb_values, params->value_formats, 
+		params->result_format);
+	if(instrumented) psql_instrument_end(psql, call, ok?0:-1, NULL);
+	return ok;
+}
+
+static int psql_do_send_prepare(psql_context_t * psql, const char * stmt_name, const char * query, int num_params, const unsigned int * types)
+{
+	if(0 == psql->num_hooks) return PQsendPrepare(psql->conn, stmt_name, query, num_params, types);
+	
+	psql_hook_call_t call[1];
+	psql_instrument_begin(psql, call, psql_hook_op_prepare, query, stmt_name, NULL);
+	int ok = PQsendPrepare(psql->conn, stmt_name, query, num_params, types);
+	psql_instrument_end(psql, call, ok?0:-1, NULL);
+	return ok;
+}
+
+static int psql_do_send_query_prepared(psql_context_t * psql, const char * stmt_name, const psql_params_t * params)
+{
+	int ok = 0;
+	psql_hook_call_t call[1];
+	int instrumented = psql->num_hooks;
+	if(instrumented) psql_instrument_begin(psql, call, psql_hook_op_send, NULL, stmt_name, params);
+	
+	ok = PQsendQueryPrepared(psql->conn, stmt_name, 
+		params->num_params, 
+		params->values, params->cb_values, params->value_formats,
 		params->result_format);
+	if(instrumented) psql_instrument_end(psql, call, ok?0:-1, NULL);
+	return ok;
+}
+
+static PGresult * psql_do_get_result(psql_context_t * psql)
+{
+	if(0 == psql->num_hooks) return PQgetResult(psql->conn);
+	
+	psql_hook_call_t call[1];
+	psql_instrument_begin(psql, call, psql_hook_op_get_result, NULL, NULL, NULL);
+	PGresult * res = PQgetResult(psql->conn);
+	psql_instrument_end(psql, call, res?psql_result_rc(res):0, res);
+	return res;
+}
+
+#define psql_check_result_on_error_return(conn, res) do { 	\
+		if(psql_check_result(psql, res) < 0) {						\
+			fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);		\
+			return -1;												\
+		}															\
+	}while(0)
+int psql_execute(psql_context_t * psql, const char * command, void ** p_result)
+{
+	assert(psql && psql->conn);
+	PGresult * result = psql_do_exec(psql, command);
+	psql_check_result_on_error_return(psql->conn, result);
+	
+	if(p_result) {
+		*p_result = result;
+	}else {
+		PQclear(result);
+	}
+	return 0;
+}
+
+int psql_exec_params(psql_context_t * psql, const char * command, const psql_params_t * params, void ** p_result)
+{
+	assert(psql && psql->conn);
+	PGresult * result = psql_do_exec_params(psql, command, params);
+	psql_check_result_on_error_return(psql->conn, result);
+	
+	if(p_result) {
+		*p_result = result;
+	}else {
+		PQclear(result);
+	}
+	return 0;
+}
+
+int psql_prepare(psql_context_t * psql, const char * query, const psql_prepare_params_t * prepare_params)
+{
+	assert(psql && psql->conn);
+	PGresult * result = psql_do_prepare(psql, prepare_params->stmt_name, query, prepare_params->num_params, prepare_params->types);
+	int rc = psql_check_result(psql, result);
+	PQclear(result);
+	if(rc < 0) {
+		fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+		return -1;
+	}
+	return 0;
+}
+
+int psql_exec_prepared(psql_context_t * psql, const char * stmt_name, const psql_params_t * params, void ** p_result)
+{
+	assert(psql && psql->conn);
+	assert(params);
+	
+	PGresult * result = psql_do_exec_prepared(psql, stmt_name, params);
+	psql_check_result_on_error_return(psql->conn, result);
+	if(p_result) {
+		*p_result = result;
+	}else {
+		PQclear(result);
+	}
+	return 0;
+}
+
+void psql_result_clear(psql_result_t * p_result)
+{
+	if(NULL == p_result || NULL == *p_result) return;
+	PQclear(*p_result);
+	*p_result = NULL;
+	return;
+}
+const char * psql_result_get_value(const psql_result_t res, int row, int col)
+{
+	return PQgetvalue(res, row, col);
+}
+int psql_result_get_count(const psql_result_t res)
+{
+	return PQntuples(res);
+}
+int psql_result_get_fields(const psql_result_t res, const char *** p_fields)
+{
+	int num_fields = PQnfields(res);
+	if(num_fields <= 0) return num_fields;
+	if(NULL == p_fields) return num_fields;	// return num fields only
+	
+	const char ** fields = calloc(num_fields, sizeof(*fields));
+	assert(fields);
+	
+	for(int i = 0; i < num_fields; ++i)
+	{
+		fields[i] = PQfname(res, i);
+	}
+	*p_fields = fields;
+	return num_fields;
+}
+
+
+/* *********************************** **
+ * Asynchronous Command Processing
+** *********************************** */
+static void psql_set_conn_error(psql_context_t * psql)
+{
+	const char * err_msg = PQerrorMessage(psql->conn);
+	if(err_msg) {
+		strncpy(psql->err_msg, err_msg, sizeof(psql->err_msg) - 1);
+		psql->err_msg[sizeof(psql->err_msg) - 1] = '\0';
+	}
+	return;
+}
+
+int psql_send_query(psql_context_t * psql, const char * command)
+{
+	assert(psql && psql->conn);
+	psql->err_msg[0] = '\0';
+	if(!psql_do_send_query(psql, command)) {
+		psql_set_conn_error(psql);
+		return -1;
+	}
+	return 0;
+}
+
+int psql_send_query_params(psql_context_t * psql, const char * command, const psql_params_t * params)
+{
+	assert(psql && psql->conn);
+	psql->err_msg[0] = '\0';
+	if(!psql_do_send_query_params(psql, command, params)) {
+		psql_set_conn_error(psql);
+		return -1;
+	}
+	return 0;
+}
+
+int psql_send_prepare(psql_context_t * psql, const char * query, const char * stmt_name, int num_params, const unsigned int * param_types)
+{
+	assert(psql && psql->conn);
+	psql->err_msg[0] = '\0';
+	if(!psql_do_send_prepare(psql, stmt_name, query, num_params, param_types)) {
+		psql_set_conn_error(psql);
+		return -1;
+	}
+	return 0;
+}
+
+int psql_send_query_prepared(psql_context_t * psql, const char * stmt_name, const psql_params_t * params)
+{
+	assert(psql && psql->conn);
+	psql->err_msg[0] = '\0';
+	if(!psql_do_send_query_prepared(psql, stmt_name, params)) {
+		psql_set_conn_error(psql);
+		return -1;
+	}
+	return 0;
+}
+
+enum {
+	FAILED = -1,
+	NO_MORE_RESULTS = 0,
+	MORE_RESULTS = 1
+};
+int psql_get_result(psql_context_t * psql, psql_result_t * p_result)
+{
+	assert(psql && psql->conn);
+	psql->err_msg[0] = '\0';
+	PGresult * res = psql_do_get_result(psql);
+	if(NULL == res) return NO_MORE_RESULTS;	// ok and and there will be no more results.
+	
+	if(NULL == p_result) {
+		PQclear(res);
+		return MORE_RESULTS;
+	}
+	*p_result = res;
+	return MORE_RESULTS; // ok and maybe more results available.
+}
+
+/* *********************************** **
+ * Pipeline Mode
+ * 	queue many statements and wait for all of them in a single round trip.
+ * 	with libpq < 14 the pipeline is emulated: each statement is executed
+ * 	on send and only its status is deferred, keeping the abort-until-sync semantics.
+** *********************************** */
+#if !defined(LIBPQ_HAS_PIPELINING)
+static int psql_pipeline_emulated_push(psql_context_t * psql, PGresult * res)
+{
+	if(psql->pipeline_num_queued >= psql->pipeline_max_pending) {
+		int new_size = psql->pipeline_max_pending * 2;
+		if(new_size <= 0) new_size = 1024;
+		psql->pipeline_statuses = realloc(psql->pipeline_statuses, sizeof(*psql->pipeline_statuses) * new_size);
+		psql->pipeline_results = realloc(psql->pipeline_results, sizeof(*psql->pipeline_results) * new_size);
+		assert(psql->pipeline_statuses && psql->pipeline_results);
+		psql->pipeline_max_pending = new_size;
+	}
+	
+	int status = psql_pipeline_status_aborted;
+	if(res) {
+		status = (psql_check_result(psql, res) < 0)?psql_pipeline_status_failed:psql_pipeline_status_ok;
+		if(status == psql_pipeline_status_failed) psql->pipeline_aborted = 1;
+	}
+	psql->pipeline_statuses[psql->pipeline_num_queued] = status;
+	psql->pipeline_results[psql->pipeline_num_queued] = res;
+	++psql->pipeline_num_queued;
+	return 0;
+}
+#endif
+
+int psql_pipeline_enter(psql_context_t * psql)
+{
+	assert(psql && psql->conn);
+	if(psql->pipeline_mode) return 0;
+	
+#if defined(LIBPQ_HAS_PIPELINING)
+	if(!PQenterPipelineMode(psql->conn)) {
+		psql_set_conn_error(psql);
+		return -1;
+	}
+#endif
+	psql->pipeline_mode = 1;
+	psql->pipeline_aborted = 0;
+	psql->pipeline_num_queued = 0;
+	psql->pipeline_num_synced = 0;
+	psql->pipeline_num_syncs = 0;
+	return 0;
+}
+
+int psql_pipeline_exit(psql_context_t * psql)
+{
+	assert(psql && psql->conn);
+	if(!psql->pipeline_mode) return 0;
+	if(psql->pipeline_num_queued > 0 || psql->pipeline_num_syncs > 0) {
+		snprintf(psql->err_msg, sizeof(psql->err_msg), "pipeline has %d pending statements", psql->pipeline_num_queued);
+		return -1;
+	}
+	
+#if defined(LIBPQ_HAS_PIPELINING)
+	if(!PQexitPipelineMode(psql->conn)) {
+		psql_set_conn_error(psql);
+		return -1;
+	}
+#endif
+	psql->pipeline_mode = 0;
+	return 0;
+}
+
+int psql_pipeline_send_params(psql_context_t * psql, const char * command, const psql_params_t * params)
+{
+	assert(psql && psql->conn && params);
+	assert(psql->pipeline_mode);
+	psql->err_msg[0] = '\0';
+	
+#if defined(LIBPQ_HAS_PIPELINING)
+	if(!psql_do_send_query_params(psql, command, params)) {
+		psql_set_conn_error(psql);
+		return -1;
+	}
+	++psql->pipeline_num_queued;
+	return 0;
+#else
+	PGresult * res = NULL;
+	if(!psql->pipeline_aborted) {
+		res = psql_do_exec_params(psql, command, params);
+	}
+	return psql_pipeline_emulated_push(psql, res);
+#endif
+}
+
+int psql_pipeline_send_prepared(psql_context_t * psql, const char * stmt_name, const psql_params_t * params)
+{
+	assert(psql && psql->conn && params);
+	assert(psql->pipeline_mode);
+	psql->err_msg[0] = '\0';
+	
+#if defined(LIBPQ_HAS_PIPELINING)
+	if(!psql_do_send_query_prepared(psql, stmt_name, params)) {
+		psql_set_conn_error(psql);
+		return -1;
+	}
+	++psql->pipeline_num_queued;
+	return 0;
+#else
+	PGresult * res = NULL;
+	if(!psql->pipeline_aborted) {
+		res = psql_do_exec_prepared(psql, stmt_name, params);
+	}
+	return psql_pipeline_emulated_push(psql, res);
+#endif
+}
+
+int psql_pipeline_sync(psql_context_t * psql)
+{
+	assert(psql && psql->conn);
+	assert(psql->pipeline_mode);
+	
+#if defined(LIBPQ_HAS_PIPELINING)
+	if(!PQpipelineSync(psql->conn)) {
+		psql_set_conn_error(psql);
+		return -1;
+	}
+#else
+	psql->pipeline_aborted = 0;
+#endif
+	psql->pipeline_num_synced = psql->pipeline_num_queued;
+	++psql->pipeline_num_syncs;
+	return 0;
+}
+
+ssize_t psql_pipeline_get_results(psql_context_t * psql, int * statuses, size_t max_statuses, 
+	psql_pipeline_on_result_fn on_result, void * user_data)
+{
+	assert(psql && psql->conn);
+	assert(psql->pipeline_mode);
+	
+	int num_synced = psql->pipeline_num_synced;
+	int index = 0;
+	int failed = 0;
+	
+#if defined(LIBPQ_HAS_PIPELINING)
+	PGconn * conn = psql->conn;
+	int num_syncs = psql->pipeline_num_syncs;
+	int status = psql_pipeline_status_ok;
+	int has_result = 0;
+	
+	while(index < num_synced || num_syncs > 0) {
+		PGresult * res = psql_do_get_result(psql);
+		if(NULL == res) {
+			// a NULL which does not end a statement: libpq has nothing queued,
+			// the counters do not match what was actually sent. Don't spin on it.
+			if(!has_result) break;
+			// end of current statement
+			if(statuses && index < max_statuses) statuses[index] = status;
+			if(status == psql_pipeline_status_failed) ++failed;
+			++index;
+			status = psql_pipeline_status_ok;
+			has_result = 0;
+			continue;
+		}
+		
+		ExecStatusType exec_status = PQresultStatus(res);
+		if(exec_status == PGRES_PIPELINE_SYNC) {
+			--num_syncs;
+			PQclear(res);
+			continue;
+		}
+		
+		has_result = 1;
+		if(exec_status == PGRES_PIPELINE_ABORTED) {
+			status = psql_pipeline_status_aborted;
+		}else if(psql_check_result(psql, res) < 0) {
+			if(status == psql_pipeline_status_ok) fprintf(stderr, "[ERROR]: pipeline[%d]: %s\n", index, psql->err_msg);
+			status = psql_pipeline_status_failed;
+		}
+		if(on_result) on_result(psql, index, status, res, user_data);
+		PQclear(res);
+	}
+	if(index < num_synced || num_syncs > 0) {
+		if(PQstatus(conn) == CONNECTION_BAD) {
+			psql_set_conn_error(psql);
+		}else {
+			snprintf(psql->err_msg, sizeof(psql->err_msg), 
+				"pipeline out of sync: %d statement(s) and %d sync(s) expected but no more results", 
+				num_synced - index, num_syncs);
+			num_syncs = 0;	// nothing left to drain
+			psql->pipeline_num_queued -= num_synced - index;
+		}
+		fprintf(stderr, "[ERROR]: %s(): %s\n", __FUNCTION__, psql->err_msg);
+		failed = -1;
+	}
+	psql->pipeline_num_syncs = num_syncs;
+#else
+	for(; index < num_synced; ++index) {
+		int status = psql->pipeline_statuses[index];
+		PGresult * res = psql->pipeline_results[index];
+		if(statuses && index < max_statuses) statuses[index] = status;
+		if(status == psql_pipeline_status_failed) ++failed;
+		if(on_result && res) on_result(psql, index, status, res, user_data);
+		if(res) PQclear(res);
+	}
+	
+	// keep un-synced statements
+	int num_left = psql->pipeline_num_queued - num_synced;
+	if(num_left > 0) {
+		memmove(psql->pipeline_statuses, psql->pipeline_statuses + num_synced, sizeof(*psql->pipeline_statuses) * num_left);
+		memmove(psql->pipeline_results, psql->pipeline_results + num_synced, sizeof(*psql->pipeline_results) * num_left);
+	}
+	psql->pipeline_num_syncs = 0;
+#endif
+	
+	psql->pipeline_num_queued -= index;
+	psql->pipeline_num_synced = 0;
+	if(failed < 0) return -1;
+	return index;
+}
+
+
+/* *********************************** **
+ * Connection Pool
+** *********************************** */
+#define PSQL_POOL_DEFAULT_MAX_CONNS (16)
+#define PSQL_POOL_DEFAULT_HEALTH_CHECK_INTERVAL_MS (30 * 1000)
+#define PSQL_POOL_PREFILL_TIMEOUT_MS (10 * 1000)
+#define PSQL_POOL_DEFAULT_CLEANUP_TIMEOUT_MS (30 * 1000)
+
+struct psql_pool
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	
+	char * sz_conn;
+	psql_pool_params_t params;
+	
+	int num_conns;		// idle + busy + connecting
+	int num_idle;
+	psql_context_t ** idle_conns; // LIFO, keeps the most recently used connections warm
+	int num_busy;
+	psql_context_t ** busy_conns; // checked out, orphaned by cleanup() if never released
+	
+	int quit;
+	psql_pool_stats_t stats;
+};
+
+/*
+ * serializes psql_pool_release() against the detach step of psql_pool_cleanup(): 
+ * a releaser either sees psql->pool == NULL, or takes the connection off busy_conns 
+ * before cleanup can detach it, and cleanup then waits for it through num_conns.
+ * lock order: g_pool_detach_mutex -> pool->mutex
+ */
+static pthread_mutex_t g_pool_detach_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static psql_context_t * psql_pool_new_connection(psql_pool_t * pool)
+{
+	psql_context_t * psql = psql_context_init(NULL, pool);
+	assert(psql);
+	
+	int rc = psql_connect_db(psql, pool->sz_conn, 0);
+	if(rc) {
+		psql_context_cleanup(psql);
+		free(psql);
+		return NULL;
+	}
+	psql->pool = pool;
+	psql->last_active_time = psql_get_time();
+	return psql;
+}
+
+static void psql_pool_free_connection(psql_context_t * psql)
+{
+	if(NULL == psql) return;
+	psql_context_cleanup(psql);
+	free(psql);
+}
+
+/*
+ * The connection is only verified when it has been idle for longer than
+ * health_check_interval_ms, so busy pools never pay an extra round trip.
+ */
+static int psql_pool_check_health(psql_pool_t * pool, psql_context_t * psql)
+{
+	PGconn * conn = psql->conn;
+	if(NULL == conn || PQstatus(conn) != CONNECTION_OK) return -1;
+	
+	double idle_time = psql_get_time() - psql->last_active_time;
+	if(idle_time * 1000.0 < (double)pool->params.health_check_interval_ms) return 0;
+	
+	PGresult * res = PQexec(conn, "");	// empty query: cheapest possible ping
+	ExecStatusType status = PQresultStatus(res);
+	PQclear(res);
+	if(status != PGRES_EMPTY_QUERY) return -1;
+	return 0;
+}
+
+psql_pool_t * psql_pool_init(psql_pool_t * pool, const char * sz_conn, const psql_pool_params_t * params)
+{
+	if(NULL == pool) pool = calloc(1, sizeof(*pool));
+	else memset(pool, 0, sizeof(*pool));
+	assert(pool);
+	
+	if(NULL == sz_conn) sz_conn = "dbname=postgres";
+	pool->sz_conn = strdup(sz_conn);
+	assert(pool->sz_conn);
+	
+	if(params) pool->params = *params;
+	if(pool->params.max_conns <= 0) pool->params.max_conns = PSQL_POOL_DEFAULT_MAX_CONNS;
+	if(pool->params.max_idle <= 0 || pool->params.max_idle > pool->params.max_conns) pool->params.max_idle = pool->params.max_conns;
+	if(pool->params.min_idle < 0) pool->params.min_idle = 0;
+	if(pool->params.min_idle > pool->params.max_idle) pool->params.min_idle = pool->params.max_idle;
+	if(pool->params.health_check_interval_ms <= 0) pool->params.health_check_interval_ms = PSQL_POOL_DEFAULT_HEALTH_CHECK_INTERVAL_MS;
+	if(pool->params.cleanup_timeout_ms == 0) pool->params.cleanup_timeout_ms = PSQL_POOL_DEFAULT_CLEANUP_TIMEOUT_MS;
+	
+	pool->idle_conns = calloc(pool->params.max_conns, sizeof(*pool->idle_conns));
+	pool->busy_conns = calloc(pool->params.max_conns, sizeof(*pool->busy_conns));
+	assert(pool->idle_conns && pool->busy_conns);
+	
+	pthread_mutex_init(&pool->mutex, NULL);
+	
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&pool->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	
+	// pre-open min_idle connections concurrently
+	int num_prefill = pool->params.min_idle;
+	if(num_prefill > 0) {
+		psql_context_t ** contexts = calloc(num_prefill, sizeof(*contexts));
+		assert(contexts);
+		for(int i = 0; i < num_prefill; ++i) {
+			contexts[i] = psql_context_init(NULL, pool);
+			assert(contexts[i]);
+		}
+		
+		psql_connect_db_parallel(contexts, num_prefill, pool->sz_conn, PSQL_POOL_PREFILL_TIMEOUT_MS);
+		
+		double now = psql_get_time();
+		for(int i = 0; i < num_prefill; ++i) {
+			psql_context_t * psql = contexts[i];
+			if(NULL == psql->conn) {
+				psql_pool_free_connection(psql);
+				continue;
+			}
+			psql->pool = pool;
+			psql->last_active_time = now;
+			pool->idle_conns[pool->num_idle++] = psql;
+			++pool->num_conns;
+			++pool->stats.num_created;
+		}
+		free(contexts);
+	}
+	return pool;
+}
+
+void psql_pool_cleanup(psql_pool_t * pool)
+{
+	if(NULL == pool) return;
+	
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	
+	// busy connections will be closed on release
+	while(pool->num_idle > 0) {
+		psql_context_t * psql = pool->idle_conns[--pool->num_idle];
+		pool->idle_conns[pool->num_idle] = NULL;
+		--pool->num_conns;
+		psql_pool_free_connection(psql);
+	}
+	pthread_cond_broadcast(&pool->cond);
+	
+	int64_t timeout_ms = pool->params.cleanup_timeout_ms;
+	struct timespec deadline = { 0 };
+	if(timeout_ms > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000) {
+			++deadline.tv_sec;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+	while(pool->num_conns > 0) {
+		if(timeout_ms < 0) {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}else if(pthread_cond_timedwait(&pool->cond, &pool->mutex, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	
+	if(pool->num_busy > 0) {
+		// re-take the locks in order; releases that started meanwhile are no longer in busy_conns
+		pthread_mutex_unlock(&pool->mutex);
+		pthread_mutex_lock(&g_pool_detach_mutex);
+		pthread_mutex_lock(&pool->mutex);
+	}
+	if(pool->num_busy > 0) {
+		// never released: detach them, psql_pool_release() will close them without touching the pool
+		fprintf(stderr, "[WARNING]: %s(): %d connection(s) still checked out after %ld ms, leaked.\n", 
+			__FUNCTION__, pool->num_busy, (long)timeout_ms);
+		for(int i = 0; i < pool->num_busy; ++i) {
+			pool->busy_conns[i]->pool = NULL;
+			pool->busy_conns[i] = NULL;
+		}
+		pool->num_conns -= pool->num_busy;
+		pool->num_busy = 0;
+		pthread_mutex_unlock(&pool->mutex);
+		pthread_mutex_unlock(&g_pool_detach_mutex);
+		pthread_mutex_lock(&pool->mutex);
+	}
+	
+	// connections being opened by acquire() are closed as soon as the connect returns, 
+	// and in-flight releases still hold their slot in num_conns until they are done.
+	while(pool->num_conns > 0) pthread_cond_wait(&pool->cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+	
+	free(pool->idle_conns);
+	pool->idle_conns = NULL;
+	free(pool->busy_conns);
+	pool->busy_conns = NULL;
+	free(pool->sz_conn);
+	pool->sz_conn = NULL;
+	
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	return;
+}
+
+psql_context_t * psql_pool_acquire(psql_pool_t * pool, int64_t timeout_ms)
+{
+	assert(pool);
+	double begin_time = psql_get_time();
+	struct timespec deadline = { 0 };
+	if(timeout_ms > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000) {
+			++deadline.tv_sec;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+	
+	psql_context_t * psql = NULL;
+	int waited = 0;
+	int rc = 0;
+	
+	pthread_mutex_lock(&pool->mutex);
+	while(NULL == psql && !pool->quit) {
+		if(pool->num_idle > 0) {
+			psql = pool->idle_conns[--pool->num_idle];
+			pool->idle_conns[pool->num_idle] = NULL;
+			
+			// check health without holding the lock
+			pthread_mutex_unlock(&pool->mutex);
+			rc = psql_pool_check_health(pool, psql);
+			if(rc) {
+				psql_pool_free_connection(psql);
+				psql = NULL;
+			}
+			pthread_mutex_lock(&pool->mutex);
+			
+			if(NULL == psql) {
+				--pool->num_conns;
+				++pool->stats.num_health_check_failures;
+			}
+			continue;
+		}
+		
+		if(pool->num_conns < pool->params.max_conns) {
+			++pool->num_conns;	// reserve a slot, then connect without holding the lock
+			pthread_mutex_unlock(&pool->mutex);
+			psql = psql_pool_new_connection(pool);
+			pthread_mutex_lock(&pool->mutex);
+			
+			if(NULL == psql) {
+				--pool->num_conns;
+				++pool->stats.num_connect_failures;
+				pthread_cond_signal(&pool->cond);
+				break;
+			}
+			++pool->stats.num_created;
+			continue;
+		}
+		
+		if(timeout_ms == 0) break;	// non-blocking
+		
+		waited = 1;
+		if(timeout_ms < 0) {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}else {
+			rc = pthread_cond_timedwait(&pool->cond, &pool->mutex, &deadline);
+			if(rc == ETIMEDOUT) {
+				++pool->stats.num_timeouts;
+				break;
+			}
+		}
+	}
+	
+	if(psql && pool->quit) {
+		pthread_mutex_unlock(&pool->mutex);
+		psql_pool_free_connection(psql);
+		pthread_mutex_lock(&pool->mutex);
+		--pool->num_conns;
+		pthread_cond_broadcast(&pool->cond);
+		psql = NULL;
+	}
+	
+	double wait_time = psql_get_time() - begin_time;
+	if(psql) {
+		++pool->stats.num_acquired;
+		pool->busy_conns[pool->num_busy++] = psql;
+	}
+	if(waited) ++pool->stats.num_waits;
+	pool->stats.total_wait_time += wait_time;
+	if(wait_time > pool->stats.max_wait_time) pool->stats.max_wait_time = wait_time;
+	pthread_mutex_unlock(&pool->mutex);
+	return psql;
+}
+
+void psql_pool_release(psql_pool_t * pool, psql_context_t * psql)
+{
+	assert(pool);
+	if(NULL == psql) return;
+	
+	// take the connection off busy_conns first: from then on, cleanup() waits for this release
+	pthread_mutex_lock(&g_pool_detach_mutex);
+	if(NULL == psql->pool) {
+		// orphaned by psql_pool_cleanup(), the pool may be gone
+		pthread_mutex_unlock(&g_pool_detach_mutex);
+		psql_pool_free_connection(psql);
+		return;
+	}
+	assert(psql->pool == pool);
+	pthread_mutex_lock(&pool->mutex);
+	for(int i = 0; i < pool->num_busy; ++i) {
+		if(pool->busy_conns[i] != psql) continue;
+		pool->busy_conns[i] = pool->busy_conns[--pool->num_busy];
+		pool->busy_conns[pool->num_busy] = NULL;
+		break;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	pthread_mutex_unlock(&g_pool_detach_mutex);
+	
+	// never hand out a connection with a dangling transaction
+	PGconn * conn = psql->conn;
+	int reusable = (conn && PQstatus(conn) == CONNECTION_OK);
+	if(reusable) {
+		PGTransactionStatusType trans_status = PQtransactionStatus(conn);
+		if(trans_status == PQTRANS_INTRANS || trans_status == PQTRANS_INERROR) {
+			PGresult * res = PQexec(conn, "ROLLBACK;");
+			if(PQresultStatus(res) != PGRES_COMMAND_OK) reusable = 0;
+			PQclear(res);
+		}else if(trans_status != PQTRANS_IDLE) {
+			reusable = 0;	// PQTRANS_ACTIVE or PQTRANS_UNKNOWN
+		}
+	}
+	psql->last_active_time = psql_get_time();
+	
+	pthread_mutex_lock(&pool->mutex);
+	if(reusable && !pool->quit && pool->num_idle < pool->params.max_idle) {
+		pool->idle_conns[pool->num_idle++] = psql;
+		psql = NULL;
+	}else {
+		--pool->num_conns;
+	}
+	pthread_cond_signal(&pool->cond);
+	if(pool->quit) pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+	
+	if(psql) psql_pool_free_connection(psql);
+	return;
+}
+
+int psql_pool_get_stats(psql_pool_t * pool, psql_pool_stats_t * stats)
+{
+	assert(pool && stats);
+	pthread_mutex_lock(&pool->mutex);
+	*stats = pool->stats;
+	stats->num_idle = pool->num_idle;
+	stats->num_busy = pool->num_busy;
+	stats->num_connecting = pool->num_conns - pool->num_idle - pool->num_busy;	// slots reserved by connects in flight
+	pthread_mutex_unlock(&pool->mutex);
+	return 0;
+}
+
+void psql_pool_reset_stats(psql_pool_t * pool)
+{
+	assert(pool);
+	pthread_mutex_lock(&pool->mutex);
+	memset(&pool->stats, 0, sizeof(pool->stats));
+	pthread_mutex_unlock(&pool->mutex);
+	return;
+}
+#undef PSQL_POOL_DEFAULT_MAX_CONNS
+#undef PSQL_POOL_DEFAULT_HEALTH_CHECK_INTERVAL_MS
+#undef PSQL_POOL_PREFILL_TIMEOUT_MS
+#undef PSQL_POOL_DEFAULT_CLEANUP_TIMEOUT_MS
+
+/* *********************************** **
+ * COPY FROM STDIN
+** *********************************** */
+#define PSQL_COPY_DEFAULT_FLUSH_THRESHOLD (256 * 1024)
+
+static const unsigned char s_copy_binary_header[19] = "PGCOPY\n\377\r\n\0" "\0\0\0\0" "\0\0\0\0";
+
+psql_copy_writer_t * psql_copy_writer_init(psql_copy_writer_t * writer, psql_context_t * psql, int format, size_t flush_threshold)
+{
+	assert(psql);
+	if(NULL == writer) writer = calloc(1, sizeof(*writer));
+	else memset(writer, 0, sizeof(*writer));
+	assert(writer);
+	
+	if(flush_threshold == 0) flush_threshold = PSQL_COPY_DEFAULT_FLUSH_THRESHOLD;
+	writer->psql = psql;
+	writer->format = format;
+	writer->flush_threshold = flush_threshold;
+	
+	// leave some headroom so that a typical row never triggers a realloc before the flush
+	auto_buffer_init(writer->buf, flush_threshold + flush_threshold / 4);
+	return writer;
+}
+
+void psql_copy_writer_cleanup(psql_copy_writer_t * writer)
+{
+	if(NULL == writer) return;
+	if(writer->in_progress) psql_copy_writer_end(writer, "copy writer cleanup");
+	auto_buffer_cleanup(writer->buf);
+	return;
+}
+
+int psql_copy_writer_begin(psql_copy_writer_t * writer, const char * table_name, const char * columns)
+{
+	assert(writer && writer->psql && writer->psql->conn);
+	assert(table_name && table_name[0]);
+	psql_context_t * psql = writer->psql;
+	if(writer->in_progress) return -1;
+	
+	char command[PATH_MAX] = "";
+	int cb = snprintf(command, sizeof(command), "COPY %s%s%s%s FROM STDIN%s;",
+		table_name, 
+		columns?"(":"", columns?columns:"", columns?")":"",
+		(writer->format == psql_copy_format_binary)?" BINARY":"");
+	if(cb <= 0 || cb >= sizeof(command)) return -1;
+	
+	if(psql->metrics) {
+		writer->metrics_fingerprint = psql_metrics_register(psql, command);
+		writer->begin_time = psql_get_time();
+	}
+	
+	PGresult * res = PQexec(psql->conn, command);
+	int rc = psql_check_result(psql, res);
+	PQclear(res);
+	if(rc < 0 || psql->exec_status != PGRES_COPY_IN) {
+		fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+		return -1;
+	}
+	
+	writer->in_progress = 1;
+	writer->num_rows = 0;
+	writer->num_bytes = 0;
+	writer->buf->length = 0;
+	writer->buf->start_pos = 0;
+	
+	if(writer->format == psql_copy_format_binary) {
+		auto_buffer_push(writer->buf, s_copy_binary_header, sizeof(s_copy_binary_header));
+	}
+	return 0;
+}
+
+int psql_copy_writer_flush(psql_copy_writer_t * writer)
+{
+	assert(writer && writer->psql);
+	auto_buffer_t * buf = writer->buf;
+	if(buf->length == 0) return 0;
+	
+	psql_context_t * psql = writer->psql;
+	int ok = PQputCopyData(psql->conn, (const char *)buf->data + buf->start_pos, buf->length);
+	if(ok != 1) {
+		psql_set_conn_error(psql);
+		fprintf(stderr, "[ERROR]: PQputCopyData() failed: %s\n", psql->err_msg);
+		return -1;
+	}
+	writer->num_bytes += buf->length;
+	buf->length = 0;
+	buf->start_pos = 0;
+	return 0;
+}
+
+#define psql_copy_writer_check_flush(writer) \
+	(((writer)->buf->length >= (writer)->flush_threshold)?psql_copy_writer_flush(writer):0)
+
+int psql_copy_writer_append_raw(psql_copy_writer_t * writer, const void * data, size_t length, int num_rows)
+{
+	assert(writer && writer->in_progress);
+	int rc = auto_buffer_push(writer->buf, data, length);
+	if(rc) return -1;
+	writer->num_rows += num_rows;
+	return psql_copy_writer_check_flush(writer);
+}
+
+static int copy_text_push_escaped(auto_buffer_t * buf, const char * value, size_t length)
+{
+	const char * p = value;
+	const char * p_end = value + length;
+	const char * p_start = p;
+	
+	for(; p < p_end; ++p) {
+		char c = *p;
+		char escaped = 0;
+		switch(c) {
+		case '\\': escaped = '\\'; break;
+		case '\t': escaped = 't'; break;
+		case '\n': escaped = 'n'; break;
+		case '\r': escaped = 'r'; break;
+		default: continue;
+		}
+		if(p > p_start) auto_buffer_push(buf, p_start, p - p_start);
+		char seq[2] = { '\\', escaped };
+		auto_buffer_push(buf, seq, 2);
+		p_start = p + 1;
+	}
+	if(p > p_start) auto_buffer_push(buf, p_start, p - p_start);
+	return 0;
+}
+
+/*
+ * for rows encoded directly into writer->buf (e.g. by psql_copy_encoder_t)
+ */
+int psql_copy_writer_end_row(psql_copy_writer_t * writer)
+{
+	assert(writer && writer->in_progress);
+	++writer->num_rows;
+	return psql_copy_writer_check_flush(writer);
+}
+
+/*
+ * values[i] == NULL means SQL NULL. 
+ * cb_values is nullable for text format, in which case strlen() is used.
+ */
+int psql_copy_buffer_append_row(auto_buffer_t * buf, int format, int num_fields, const char ** values, const int * cb_values)
+{
+	assert(buf);
+	assert(num_fields > 0 && num_fields <= INT16_MAX);
+	
+	if(format == psql_copy_format_binary) {
+		assert(cb_values);
+		uint16_t be_num_fields = htobe16((uint16_t)num_fields);
+		auto_buffer_push(buf, &be_num_fields, sizeof(be_num_fields));
+		for(int i = 0; i < num_fields; ++i) {
+			int32_t length = values[i]?cb_values[i]:-1;
+			uint32_t be_length = htobe32((uint32_t)length);
+			auto_buffer_push(buf, &be_length, sizeof(be_length));
+			if(length > 0) auto_buffer_push(buf, values[i], length);
+		}
+	}else {
+		for(int i = 0; i < num_fields; ++i) {
+			if(i > 0) auto_buffer_push(buf, "\t", 1);
+			if(NULL == values[i]) {
+				auto_buffer_push(buf, "\\N", 2);
+				continue;
+			}
+			size_t length = cb_values?cb_values[i]:strlen(values[i]);
+			copy_text_push_escaped(buf, values[i], length);
+		}
+		auto_buffer_push(buf, "\n", 1);
+	}
+	return 0;
+}
+
+int psql_copy_writer_append_row(psql_copy_writer_t * writer, int num_fields, const char ** values, const int * cb_values)
+{
+	assert(writer && writer->in_progress);
+	psql_copy_buffer_append_row(writer->buf, writer->format, num_fields, values, cb_values);
+	++writer->num_rows;
+	return psql_copy_writer_check_flush(writer);
+}
+#undef psql_copy_writer_check_flush
+
+/*
+ * psql_copy_writer_end()
+ * 	@err_msg: (nullable) if not NULL, abort the COPY with this message
+ * 	@return number of rows copied (reported by the server), or -1 on error.
+ */
+int64_t psql_copy_writer_end(psql_copy_writer_t * writer, const char * err_msg)
+{
+	assert(writer && writer->psql);
+	psql_context_t * psql = writer->psql;
+	PGconn * conn = psql->conn;
+	if(!writer->in_progress) return -1;
+	writer->in_progress = 0;
+	
+	int rc = 0;
+	if(NULL == err_msg) {
+		if(writer->format == psql_copy_format_binary) {
+			static const int16_t file_trailer = -1;
+			auto_buffer_push(writer->buf, &file_trailer, sizeof(file_trailer));
+		}
+		rc = psql_copy_writer_flush(writer);
+		if(rc) err_msg = "failed to send copy data";
+	}
+	writer->buf->length = 0;
+	writer->buf->start_pos = 0;
+	
+	int ok = PQputCopyEnd(conn, err_msg);
+	if(ok != 1) {
+		psql_set_conn_error(psql);
+		fprintf(stderr, "[ERROR]: PQputCopyEnd() failed: %s\n", psql->err_msg);
+		return -1;
+	}
+	
+	// check the final status of the COPY command
+	int64_t num_rows = -1;
+	PGresult * res = NULL;
+	while((res = PQgetResult(conn))) {
+		rc = psql_check_result(psql, res);
+		if(psql->exec_status == PGRES_COMMAND_OK) {
+			const char * sz_tuples = PQcmdTuples(res);
+			num_rows = (sz_tuples && sz_tuples[0])?strtoll(sz_tuples, NULL, 10):writer->num_rows;
+		}else if(rc < 0) {
+			if(NULL == err_msg) fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+			num_rows = -1;
+		}
+		PQclear(res);
+	}
+	if(psql->metrics) {
+		psql_metrics_record(psql, writer->metrics_fingerprint, NULL, psql_get_time() - writer->begin_time, 
+			(err_msg || num_rows < 0), writer->num_rows, writer->num_bytes, 0);
+	}
+	if(err_msg) return -1;
+	return num_rows;
+}
+#undef PSQL_COPY_DEFAULT_FLUSH_THRESHOLD
+
+/* *********************************** **
+ * Bulk Upsert
+ * 	rows are copied into a staging table, then merged into the target table 
+ * 	with a single INSERT ... ON CONFLICT DO UPDATE (or MERGE) statement.
+** *********************************** */
+static void append_string(auto_buffer_t * buf, const char * str)
+{
+	auto_buffer_push(buf, str, strlen(str));
+}
+
+/* splits "a, b ,c" into trimmed names, returns the number of names */
+static int split_column_list(const char * list, char *** p_names)
+{
+	int count = 0;
+	char ** names = NULL;
+	const char * p = list;
+	while(p && *p) {
+		const char * end = strchr(p, ',');
+		if(NULL == end) end = p + strlen(p);
+		
+		const char * q = end;
+		while(p < q && isspace((unsigned char)*p)) ++p;
+		while(q > p && isspace((unsigned char)q[-1])) --q;
+		if(q > p) {
+			names = realloc(names, sizeof(*names) * (count + 1));
+			assert(names);
+			names[count] = strndup(p, q - p);
+			assert(names[count]);
+			++count;
+		}
+		p = (*end)?(end + 1):end;
+	}
+	*p_names = names;
+	return count;
+}
+
+static void free_column_list(char ** names, int count)
+{
+	if(NULL == names) return;
+	for(int i = 0; i < count; ++i) free(names[i]);
+	free(names);
+}
+
+static int column_list_contains(char ** names, int count, const char * name)
+{
+	for(int i = 0; i < count; ++i) if(0 == strcmp(names[i], name)) return 1;
+	return 0;
+}
+
+static void append_column_list(auto_buffer_t * sql, char ** names, int count, const char * prefix)
+{
+	for(int i = 0; i < count; ++i) {
+		if(i > 0) append_string(sql, ", ");
+		if(prefix) append_string(sql, prefix);
+		append_string(sql, names[i]);
+	}
+}
+
+/*
+ * builds the statement(s) which merge the staging table into the target table, 
+ * the merge statement returns one row: (num_inserted, num_updated).
+ */
+static int upsert_build_sql(psql_upsert_t * upsert, const psql_upsert_params_t * params)
+{
+	char ** columns = NULL, ** keys = NULL, ** updates = NULL;
+	int num_columns = split_column_list(params->columns, &columns);
+	int num_keys = split_column_list(params->key_columns, &keys);
+	int num_updates = 0;
+	
+	if(num_columns <= 0 || num_keys <= 0) {
+		fprintf(stderr, "[ERROR]: %s(): columns and key_columns are required.\n", __FUNCTION__);
+		free_column_list(columns, num_columns);
+		free_column_list(keys, num_keys);
+		return -1;
+	}
+	
+	if(params->update_columns) num_updates = split_column_list(params->update_columns, &updates);
+	else {
+		// update all non-key columns
+		updates = calloc(num_columns, sizeof(*updates));
+		assert(updates);
+		for(int i = 0; i < num_columns; ++i) {
+			if(column_list_contains(keys, num_keys, columns[i])) continue;
+			updates[num_updates++] = strdup(columns[i]);
+		}
+	}
+	
+	auto_buffer_t sql[1];
+	auto_buffer_init(sql, 4096);
+	
+	if(!upsert->use_merge) {
+		append_string(sql, "WITH _r AS (INSERT INTO ");
+		append_string(sql, upsert->table_name);
+		append_string(sql, " (");
+		append_column_list(sql, columns, num_columns, NULL);
+		append_string(sql, ") SELECT ");
+		append_column_list(sql, columns, num_columns, NULL);
+		append_string(sql, " FROM ");
+		append_string(sql, upsert->staging_table);
+		append_string(sql, " ON CONFLICT (");
+		append_column_list(sql, keys, num_keys, NULL);
+		if(num_updates > 0) {
+			append_string(sql, ") DO UPDATE SET ");
+			for(int i = 0; i < num_updates; ++i) {
+				if(i > 0) append_string(sql, ", ");
+				append_string(sql, updates[i]);
+				append_string(sql, " = EXCLUDED.");
+				append_string(sql, updates[i]);
+			}
+		}else {
+			append_string(sql, ") DO NOTHING");
+		}
+		// xmax is 0 only for newly inserted tuples
+		append_string(sql, " RETURNING (xmax = 0) AS inserted) "
+			"SELECT count(*) FILTER (WHERE inserted), count(*) FILTER (WHERE NOT inserted) FROM _r");
+	}else {
+		auto_buffer_t on_keys[1];
+		auto_buffer_init(on_keys, 1024);
+		for(int i = 0; i < num_keys; ++i) {
+			if(i > 0) append_string(on_keys, " AND ");
+			append_string(on_keys, "_t.");
+			append_string(on_keys, keys[i]);
+			append_string(on_keys, " = _s.");
+			append_string(on_keys, keys[i]);
+		}
+		auto_buffer_push(on_keys, "", 1);
+		
+		int has_returning = (upsert->server_version >= 170000);
+		if(has_returning) append_string(sql, "WITH _r AS (");
+		append_string(sql, "MERGE INTO ");
+		append_string(sql, upsert->table_name);
+		append_string(sql, " AS _t USING ");
+		append_string(sql, upsert->staging_table);
+		append_string(sql, " AS _s ON ");
+		append_string(sql, (char *)on_keys->data);
+		if(num_updates > 0) {
+			append_string(sql, " WHEN MATCHED THEN UPDATE SET ");
+			for(int i = 0; i < num_updates; ++i) {
+				if(i > 0) append_string(sql, ", ");
+				append_string(sql, updates[i]);
+				append_string(sql, " = _s.");
+				append_string(sql, updates[i]);
+			}
+		}
+		append_string(sql, " WHEN NOT MATCHED THEN INSERT (");
+		append_column_list(sql, columns, num_columns, NULL);
+		append_string(sql, ") VALUES (");
+		append_column_list(sql, columns, num_columns, "_s.");
+		append_string(sql, ")");
+		if(has_returning) {
+			append_string(sql, " RETURNING merge_action() AS action) "
+				"SELECT count(*) FILTER (WHERE action = 'INSERT'), count(*) FILTER (WHERE action = 'UPDATE') FROM _r");
+		}else if(num_updates > 0) {
+			// MERGE has no RETURNING before PostgreSQL 17, count the matched rows beforehand
+			auto_buffer_t count_sql[1];
+			auto_buffer_init(count_sql, 1024);
+			append_string(count_sql, "SELECT count(*) FROM ");
+			append_string(count_sql, upsert->staging_table);
+			append_string(count_sql, " AS _s JOIN ");
+			append_string(count_sql, upsert->table_name);
+			append_string(count_sql, " AS _t ON ");
+			append_string(count_sql, (char *)on_keys->data);
+			auto_buffer_push(count_sql, "", 1);
+			upsert->count_sql = strdup((char *)count_sql->data);
+			auto_buffer_cleanup(count_sql);
+		}
+		auto_buffer_cleanup(on_keys);
+	}
+	auto_buffer_push(sql, "", 1);
+	upsert->merge_sql = strdup((char *)sql->data);
+	assert(upsert->merge_sql);
+	auto_buffer_cleanup(sql);
+	
+	// staging table: same column types as the target, no constraints or defaults
+	auto_buffer_init(sql, 1024);
+	append_string(sql, params->staging_table?"CREATE UNLOGGED TABLE IF NOT EXISTS ":"CREATE TEMP TABLE IF NOT EXISTS ");
+	append_string(sql, upsert->staging_table);
+	append_string(sql, " AS SELECT ");
+	append_column_list(sql, columns, num_columns, NULL);
+	append_string(sql, " FROM ");
+	append_string(sql, upsert->table_name);
+	append_string(sql, " WITH NO DATA");
+	auto_buffer_push(sql, "", 1);
+	upsert->create_sql = strdup((char *)sql->data);
+	assert(upsert->create_sql);
+	auto_buffer_cleanup(sql);
+	
+	free_column_list(columns, num_columns);
+	free_column_list(keys, num_keys);
+	free_column_list(updates, num_updates);
+	return 0;
+}
+
+psql_upsert_t * psql_upsert_init(psql_upsert_t * upsert, psql_context_t * psql, const char * table_name, const psql_upsert_params_t * params)
+{
+	assert(psql && psql->conn && table_name && params);
+	int is_allocated = (NULL == upsert);
+	if(NULL == upsert) upsert = calloc(1, sizeof(*upsert));
+	else memset(upsert, 0, sizeof(*upsert));
+	assert(upsert);
+	
+	upsert->psql = psql;
+	upsert->table_name = strdup(table_name);
+	upsert->use_merge = params->use_merge;
+	upsert->server_version = PQserverVersion(psql->conn);
+	if(upsert->use_merge && upsert->server_version < 150000) {
+		fprintf(stderr, "[ERROR]: %s(): MERGE requires PostgreSQL 15+ (server version: %d).\n", 
+			__FUNCTION__, upsert->server_version);
+		goto label_err;
+	}
+	
+	if(params->staging_table) upsert->staging_table = strdup(params->staging_table);
+	else {
+		char name[100] = "";
+		snprintf(name, sizeof(name), "_psql_upsert_%u", ++psql->stmt_serial);
+		upsert->staging_table = strdup(name);
+	}
+	assert(upsert->table_name && upsert->staging_table);
+	
+	upsert->columns = strdup(params->columns);
+	assert(upsert->columns);
+	if(upsert_build_sql(upsert, params)) goto label_err;
+	
+	psql_copy_writer_init(upsert->writer, psql, params->format, 0);
+	return upsert;
+	
+label_err:
+	psql_upsert_cleanup(upsert);
+	if(is_allocated) free(upsert);
+	return NULL;
+}
+
+void psql_upsert_cleanup(psql_upsert_t * upsert)
+{
+	if(NULL == upsert) return;
+	psql_context_t * psql = upsert->psql;
+	
+	if(upsert->writer->psql) psql_copy_writer_cleanup(upsert->writer);
+	
+	// temp tables are dropped with the session, only drop the ones created by this connection
+	if(psql && psql->conn && upsert->staging_generation && upsert->staging_generation == psql->conn_generation) {
+		char command[PATH_MAX] = "";
+		snprintf(command, sizeof(command), "DROP TABLE IF EXISTS %s", upsert->staging_table);
+		PGresult * res = psql_do_exec(psql, command);
+		PQclear(res);
+	}
+	
+	free(upsert->table_name);
+	free(upsert->staging_table);
+	free(upsert->columns);
+	free(upsert->create_sql);
+	free(upsert->merge_sql);
+	free(upsert->count_sql);
+	memset(upsert, 0, sizeof(*upsert));
+	return;
+}
+
+static int upsert_exec_command(psql_context_t * psql, const char * command, PGresult ** p_res)
+{
+	PGresult * res = psql_do_exec(psql, command);
+	int rc = psql_check_result(psql, res);
+	if(rc < 0) {
+		fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+		PQclear(res);
+		return -1;
+	}
+	if(p_res) *p_res = res;
+	else PQclear(res);
+	return 0;
+}
+
+int psql_upsert_begin(psql_upsert_t * upsert)
+{
+	assert(upsert && upsert->psql && upsert->psql->conn);
+	psql_context_t * psql = upsert->psql;
+	
+	// (re)create the staging table once per connection
+	if(upsert->staging_generation != psql->conn_generation) {
+		if(upsert_exec_command(psql, upsert->create_sql, NULL)) return -1;
+		upsert->staging_generation = psql->conn_generation;
+	}
+	
+	char command[PATH_MAX] = "";
+	snprintf(command, sizeof(command), "TRUNCATE %s", upsert->staging_table);
+	if(upsert_exec_command(psql, command, NULL)) return -1;
+	
+	return psql_copy_writer_begin(upsert->writer, upsert->staging_table, upsert->columns);
+}
+
+int psql_upsert_append_row(psql_upsert_t * upsert, int num_fields, const char ** values, const int * cb_values)
+{
+	assert(upsert);
+	return psql_copy_writer_append_row(upsert->writer, num_fields, values, cb_values);
+}
+
+/*
+ * psql_upsert_end(): 
+ *   finishes the COPY and merges the staging table into the target table.
+ *   keys must be unique within one batch.
+ */
+int psql_upsert_end(psql_upsert_t * upsert, int64_t * p_num_inserted, int64_t * p_num_updated)
+{
+	assert(upsert && upsert->psql);
+	psql_context_t * psql = upsert->psql;
+	
+	int64_t num_copied = psql_copy_writer_end(upsert->writer, NULL);
+	if(num_copied < 0) return -1;
+	
+	int64_t num_inserted = 0, num_updated = 0;
+	PGresult * res = NULL;
+	
+	if(upsert->count_sql) {
+		if(upsert_exec_command(psql, upsert->count_sql, &res)) return -1;
+		num_updated = strtoll(PQgetvalue(res, 0, 0), NULL, 10);
+		PQclear(res);
+		res = NULL;
+	}
+	
+	if(upsert_exec_command(psql, upsert->merge_sql, &res)) return -1;
+	if(PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1) {
+		num_inserted = strtoll(PQgetvalue(res, 0, 0), NULL, 10);
+		num_updated = strtoll(PQgetvalue(res, 0, 1), NULL, 10);
+	}else {
+		// MERGE without RETURNING: only the total number of affected rows is reported
+		const char * sz_tuples = PQcmdTuples(res);
+		int64_t num_affected = (sz_tuples && sz_tuples[0])?strtoll(sz_tuples, NULL, 10):0;
+		num_inserted = num_affected - num_updated;
+	}
+	PQclear(res);
+	
+	upsert->num_inserted += num_inserted;
+	upsert->num_updated += num_updated;
+	if(p_num_inserted) *p_num_inserted = num_inserted;
+	if(p_num_updated) *p_num_updated = num_updated;
+	return 0;
+}
+
+/* *********************************** **
+ * Parallel COPY Loader
+ * 	the input is split into num_workers partitions, each worker thread owns 
+ * 	a connection, a transaction and a COPY stream. 
+ * 	the transactions are committed only if every partition has been copied, 
+ * 	but the COMMITs are independent: a failed one leaves the others committed.
+** *********************************** */
+#define PSQL_LOADER_DEFAULT_MAX_WORKERS (8)
+#define PSQL_LOADER_CONNECT_TIMEOUT_MS (10 * 1000)
+
+typedef struct psql_loader_worker
+{
+	pthread_t th;
+	psql_loader_partition_t partition[1];
+	psql_copy_writer_t writer[1];
+	const char * table_name;
+	const char * columns;
+	psql_loader_fill_fn fill;
+	
+	int rc;
+	int64_t num_rows;
+	double time_elapsed;
+}psql_loader_worker_t;
+
+static void * psql_loader_worker_thread(void * user_data)
+{
+	psql_loader_worker_t * worker = user_data;
+	psql_loader_partition_t * partition = worker->partition;
+	psql_context_t * psql = partition->psql;
+	double time_start = psql_get_time();
+	
+	worker->rc = -1;
+	PGresult * res = psql_do_exec(psql, "BEGIN");
+	int rc = psql_check_result(psql, res);
+	PQclear(res);
+	if(rc < 0) {
+		fprintf(stderr, "[ERROR]: loader worker %d: BEGIN failed: %s\n", partition->index, psql->err_msg);
+		goto label_final;
+	}
+	
+	rc = psql_copy_writer_begin(worker->writer, worker->table_name, worker->columns);
+	if(rc) goto label_final;
+	
+	rc = worker->fill(partition);
+	worker->num_rows = psql_copy_writer_end(worker->writer, (rc < 0)?"loader: partition aborted":NULL);
+	if(rc >= 0 && worker->num_rows >= 0) worker->rc = 0;
+	
+label_final:
+	worker->time_elapsed = psql_get_time() - time_start;
+	return (void *)(intptr_t)worker->rc;
+}
+
+/*
+ * sends the same command to all connections first, then collects the results, 
+ * so that the commit phase costs one round trip instead of N.
+ */
+static int psql_loader_broadcast(psql_loader_worker_t * workers, int num_workers, const char * command)
+{
+	int num_failed = 0;
+	for(int i = 0; i < num_workers; ++i) {
+		psql_context_t * psql = workers[i].partition->psql;
+		if(!psql_do_send_query(psql, command)) {
+			psql_set_conn_error(psql);
+			workers[i].rc = -1;
+		}
+	}
+	for(int i = 0; i < num_workers; ++i) {
+		psql_context_t * psql = workers[i].partition->psql;
+		PGresult * res = NULL;
+		while((res = psql_do_get_result(psql))) {
+			if(psql_check_result(psql, res) < 0) workers[i].rc = -1;
+			PQclear(res);
+		}
+		if(workers[i].rc < 0) {
+			fprintf(stderr, "[ERROR]: loader worker %d: %s failed: %s\n", i, command, psql->err_msg);
+			++num_failed;
+		}
+	}
+	return num_failed?-1:0;
+}
+
+int psql_loader_run(const char * sz_conn, const char * table_name, const psql_loader_params_t * params, 
+	psql_loader_fill_fn fill, void * user_data, psql_loader_summary_t * summary)
+{
+	assert(table_name && fill);
+	static const psql_loader_params_t default_params[1];
+	if(NULL == params) params = default_params;
+	
+	int num_workers = params->num_workers;
+	if(num_workers <= 0) {
+		long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_workers = (num_cpus > 0)?(int)num_cpus:1;
+		if(num_workers > PSQL_LOADER_DEFAULT_MAX_WORKERS) num_workers = PSQL_LOADER_DEFAULT_MAX_WORKERS;
+	}
+	int * partition_committed = (params->num_workers > 0)?params->partition_committed:NULL;	// sized by the caller
+	if(partition_committed) memset(partition_committed, 0, sizeof(*partition_committed) * num_workers);
+	
+	psql_loader_summary_t result[1];
+	memset(result, 0, sizeof(result));
+	result->num_workers = num_workers;
+	double time_start = psql_get_time();
+	
+	psql_loader_worker_t * workers = calloc(num_workers, sizeof(*workers));
+	psql_context_t ** contexts = calloc(num_workers, sizeof(*contexts));
+	assert(workers && contexts);
+	
+	for(int i = 0; i < num_workers; ++i) {
+		contexts[i] = psql_context_init(NULL, NULL);
+		assert(contexts[i]);
+	}
+	
+	int rc = -1;
+	int num_connected = psql_connect_db_parallel(contexts, num_workers, sz_conn, PSQL_LOADER_CONNECT_TIMEOUT_MS);
+	if(num_connected != num_workers) {
+		fprintf(stderr, "[ERROR]: %s(): only %d of %d connections established.\n", __FUNCTION__, num_connected, num_workers);
+		goto label_final;
+	}
+	
+	int64_t total_rows = params->total_rows;
+	int num_started = 0;
+	for(int i = 0; i < num_workers; ++i) {
+		psql_loader_worker_t * worker = &workers[i];
+		psql_loader_partition_t * partition = worker->partition;
+		
+		partition->index = i;
+		partition->num_partitions = num_workers;
+		if(total_rows > 0) {
+			partition->first_row = total_rows * i / num_workers;
+			partition->num_rows = total_rows * (i + 1) / num_workers - partition->first_row;
+		}
+		partition->psql = contexts[i];
+		partition->writer = worker->writer;
+		partition->user_data = user_data;
+		
+		worker->table_name = table_name;
+		worker->columns = params->columns;
+		worker->fill = fill;
+		worker->rc = -1;
+		psql_copy_writer_init(worker->writer, contexts[i], params->format, params->flush_threshold);
+		
+		int err = pthread_create(&worker->th, NULL, psql_loader_worker_thread, worker);
+		if(err) {
+			fprintf(stderr, "[ERROR]: %s()::pthread_create(): %s\n", __FUNCTION__, strerror(err));
+			break;
+		}
+		++num_started;
+	}
+	
+	for(int i = 0; i < num_started; ++i) pthread_join(workers[i].th, NULL);
+	
+	for(int i = 0; i < num_workers; ++i) {
+		psql_loader_worker_t * worker = &workers[i];
+		if(worker->rc == 0) {
+			++result->num_succeeded;
+			result->num_rows += worker->num_rows;
+		}
+		result->num_bytes += worker->writer->num_bytes;
+		if(worker->time_elapsed > result->max_worker_time) result->max_worker_time = worker->time_elapsed;
+	}
+	
+	// commit all partitions, or none of them if any failed to copy.
+	// a COMMIT can still fail on some connections after others have succeeded.
+	if(result->num_succeeded == num_workers) {
+		rc = psql_loader_broadcast(workers, num_workers, "COMMIT");
+		for(int i = 0; i < num_workers; ++i) {
+			if(workers[i].rc < 0) continue;
+			++result->num_committed;
+			if(partition_committed) partition_committed[i] = 1;
+		}
+		result->committed = (0 == rc);
+		if(rc) {
+			fprintf(stderr, "[ERROR]: %s(): partial commit: %d of %d partitions committed.\n", 
+				__FUNCTION__, result->num_committed, num_workers);
+		}
+	}else {
+		for(int i = 0; i < num_started; ++i) workers[i].rc = 0;	// reset, only the ROLLBACK status matters now
+		psql_loader_broadcast(workers, num_started, "ROLLBACK");
+		rc = -1;
+	}
+	
+label_final:
+	for(int i = 0; i < num_workers; ++i) {
+		if(workers[i].writer->psql) psql_copy_writer_cleanup(workers[i].writer);
+		psql_context_cleanup(contexts[i]);
+		free(contexts[i]);
+	}
+	free(contexts);
+	free(workers);
+	
+	result->num_failed = num_workers - result->num_succeeded;
+	result->time_elapsed = psql_get_time() - time_start;
+	if(summary) *summary = *result;
+	return rc;
+}
+
+#undef PSQL_LOADER_DEFAULT_MAX_WORKERS
+#undef PSQL_LOADER_CONNECT_TIMEOUT_MS
+
+/* *********************************** **
+ * COPY Pipeline
+ * 	encoder threads fill chunks, the calling thread streams them with PQputCopyData().
+ * 	chunks travel through two bounded lock-free rings (free -> encoders -> full -> sender -> free), 
+ * 	semaphores are only used to sleep while a ring is empty.
+** *********************************** */
+#define PSQL_COPY_PIPELINE_DEFAULT_NUM_ENCODERS (2)
+#define PSQL_COPY_PIPELINE_DEFAULT_CHUNK_SIZE (256 * 1024)
+#define PSQL_COPY_PIPELINE_WRITER_BUFFER_SIZE (64)	// the writer only holds the binary header and trailer
+
+/* bounded MPMC queue (D. Vyukov), capacity must be a power of 2 */
+typedef struct psql_ring_cell
+{
+	size_t seq;
+	void * data;
+}psql_ring_cell_t;
+
+typedef struct psql_ring
+{
+	size_t mask;
+	psql_ring_cell_t * cells;
+	size_t enqueue_pos __attribute__((aligned(64)));
+	size_t dequeue_pos __attribute__((aligned(64)));
+}psql_ring_t;
+
+static int psql_ring_init(psql_ring_t * ring, size_t min_capacity)
+{
+	size_t capacity = 2;
+	while(capacity < min_capacity) capacity <<= 1;
+	
+	memset(ring, 0, sizeof(*ring));
+	ring->cells = calloc(capacity, sizeof(*ring->cells));
+	if(NULL == ring->cells) return -1;
+	ring->mask = capacity - 1;
+	for(size_t i = 0; i < capacity; ++i) ring->cells[i].seq = i;
+	return 0;
+}
+
+static void psql_ring_cleanup(psql_ring_t * ring)
+{
+	free(ring->cells);
+	ring->cells = NULL;
+}
+
+static int psql_ring_push(psql_ring_t * ring, void * data)
+{
+	psql_ring_cell_t * cell = NULL;
+	size_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+	while(1) {
+		cell = &ring->cells[pos & ring->mask];
+		size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if(diff == 0) {
+			if(__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}else if(diff < 0) {
+			return -1;	// full
+		}else {
+			pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	cell->data = data;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void * psql_ring_pop(psql_ring_t * ring)
+{
+	psql_ring_cell_t * cell = NULL;
+	size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+	while(1) {
+		cell = &ring->cells[pos & ring->mask];
+		size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+		if(diff == 0) {
+			if(__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		}else if(diff < 0) {
+			return NULL;	// empty
+		}else {
+			pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	void * data = cell->data;
+	__atomic_store_n(&cell->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+	return data;
+}
+
+typedef struct psql_copy_chunk
+{
+	auto_buffer_t buf[1];
+	int64_t num_rows;
+}psql_copy_chunk_t;
+
+typedef struct psql_copy_pipeline
+{
+	psql_ring_t free_ring[1];
+	psql_ring_t full_ring[1];
+	sem_t num_free;
+	sem_t num_full;
+	
+	size_t chunk_size;
+	psql_copy_encode_fn encode;
+	void * user_data;
+	
+	int num_active;		// encoders still running
+	int failed;
+	psql_copy_chunk_t end_marker[1];	// queued by the last encoder
+	int64_t encode_wait_usec;	// time the encoders spent waiting for a free chunk
+}psql_copy_pipeline_t;
+
+typedef struct psql_copy_encoder_thread
+{
+	pthread_t th;
+	int index;
+	psql_copy_pipeline_t * pipeline;
+}psql_copy_encoder_thread_t;
+
+/* waits for a semaphore, then pops (a pushed item may still be in the middle of being published) */
+static void * psql_copy_pipeline_take(psql_ring_t * ring, sem_t * sem)
+{
+	while(sem_wait(sem) != 0) {
+		if(errno != EINTR) return NULL;
+	}
+	void * data = NULL;
+	while(NULL == (data = psql_ring_pop(ring))) sched_yield();
+	return data;
+}
+
+static void psql_copy_pipeline_give(psql_ring_t * ring, sem_t * sem, void * data)
+{
+	// never fails: the capacity of each ring is greater than the number of chunks
+	int rc = psql_ring_push(ring, data);
+	assert(0 == rc);
+	(void)rc;
+	sem_post(sem);
+}
+
+static void * psql_copy_encoder_thread(void * user_data)
+{
+	psql_copy_encoder_thread_t * encoder = user_data;
+	psql_copy_pipeline_t * pipeline = encoder->pipeline;
+	
+	while(!__atomic_load_n(&pipeline->failed, __ATOMIC_ACQUIRE)) {
+		double time_start = psql_get_time();
+		psql_copy_chunk_t * chunk = psql_copy_pipeline_take(pipeline->free_ring, &pipeline->num_free);
+		int64_t wait_usec = (int64_t)((psql_get_time() - time_start) * 1000000.0);
+		__atomic_add_fetch(&pipeline->encode_wait_usec, wait_usec, __ATOMIC_RELAXED);
+		if(NULL == chunk) {
+			__atomic_store_n(&pipeline->failed, 1, __ATOMIC_RELEASE);
+			break;
+		}
+		
+		chunk->buf->length = 0;
+		chunk->buf->start_pos = 0;
+		int64_t num_rows = pipeline->encode(encoder->index, chunk->buf, pipeline->chunk_size, pipeline->user_data);
+		if(num_rows < 0) __atomic_store_n(&pipeline->failed, 1, __ATOMIC_RELEASE);
+		if(num_rows <= 0 && chunk->buf->length == 0) {
+			psql_copy_pipeline_give(pipeline->free_ring, &pipeline->num_free, chunk);
+			break;
+		}
+		
+		chunk->num_rows = (num_rows > 0)?num_rows:0;
+		psql_copy_pipeline_give(pipeline->full_ring, &pipeline->num_full, chunk);
+		if(num_rows <= 0) break;
+	}
+	
+	// the last encoder marks the end of the stream
+	if(0 == __atomic_sub_fetch(&pipeline->num_active, 1, __ATOMIC_ACQ_REL)) {
+		psql_copy_pipeline_give(pipeline->full_ring, &pipeline->num_full, pipeline->end_marker);
+	}
+	return NULL;
+}
+
+/*
+ * psql_copy_pipeline_run(): 
+ *   runs 'COPY table_name (columns) FROM STDIN' with num_encoders threads calling encode(), 
+ *   the calling thread sends the encoded chunks.
+ *   returns the number of rows copied, or -1 on error.
+ */
+int64_t psql_copy_pipeline_run(psql_context_t * psql, const char * table_name, const psql_copy_pipeline_params_t * params, 
+	psql_copy_encode_fn encode, void * user_data, psql_copy_pipeline_stats_t * stats)
+{
+	assert(psql && psql->conn && table_name && encode);
+	static const psql_copy_pipeline_params_t default_params[1];
+	if(NULL == params) params = default_params;
+	
+	int num_encoders = params->num_encoders;
+	if(num_encoders <= 0) num_encoders = PSQL_COPY_PIPELINE_DEFAULT_NUM_ENCODERS;
+	int num_chunks = params->num_chunks;
+	if(num_chunks < num_encoders) num_chunks = num_encoders * 2 + 2;	// every encoder can run ahead of the sender
+	size_t chunk_size = params->chunk_size?params->chunk_size:PSQL_COPY_PIPELINE_DEFAULT_CHUNK_SIZE;
+	
+	double time_start = psql_get_time();
+	psql_copy_writer_t writer[1];
+	psql_copy_writer_init(writer, psql, params->format, PSQL_COPY_PIPELINE_WRITER_BUFFER_SIZE);	// rows are encoded into the chunks
+	if(psql_copy_writer_begin(writer, table_name, params->columns)) {
+		psql_copy_writer_cleanup(writer);
+		return -1;
+	}
+	
+	psql_copy_pipeline_t pipeline[1];
+	memset(pipeline, 0, sizeof(pipeline));
+	pipeline->chunk_size = chunk_size;
+	pipeline->encode = encode;
+	pipeline->user_data = user_data;
+	pipeline->num_active = num_encoders;
+	
+	int rc = psql_ring_init(pipeline->free_ring, num_chunks + 1);
+	assert(0 == rc);
+	rc = psql_ring_init(pipeline->full_ring, num_chunks + 1);	// + the end marker
+	assert(0 == rc);
+	sem_init(&pipeline->num_free, 0, 0);
+	sem_init(&pipeline->num_full, 0, 0);
+	
+	// chunks are allocated once and recycled through the free ring
+	psql_copy_chunk_t * chunks = calloc(num_chunks, sizeof(*chunks));
+	assert(chunks);
+	for(int i = 0; i < num_chunks; ++i) {
+		// leave headroom for the row which crosses chunk_size
+		auto_buffer_init(chunks[i].buf, chunk_size + chunk_size / 4);
+		psql_copy_pipeline_give(pipeline->free_ring, &pipeline->num_free, &chunks[i]);
+	}
+	
+	psql_copy_encoder_thread_t * encoders = calloc(num_encoders, sizeof(*encoders));
+	assert(encoders);
+	int num_started = 0;
+	for(int i = 0; i < num_encoders; ++i) {
+		encoders[i].index = i;
+		encoders[i].pipeline = pipeline;
+		int err = pthread_create(&encoders[i].th, NULL, psql_copy_encoder_thread, &encoders[i]);
+		if(err) {
+			fprintf(stderr, "[ERROR]: %s()::pthread_create(): %s\n", __FUNCTION__, strerror(err));
+			__atomic_store_n(&pipeline->failed, 1, __ATOMIC_RELEASE);
+			// account for the threads which will never run
+			if(0 == __atomic_sub_fetch(&pipeline->num_active, num_encoders - i, __ATOMIC_ACQ_REL)) {
+				psql_copy_pipeline_give(pipeline->full_ring, &pipeline->num_full, pipeline->end_marker);
+			}
+			break;
+		}
+		++num_started;
+	}
+	
+	// sender: keeps draining until the end marker, even after a failure, so that no encoder blocks forever
+	int64_t num_chunks_sent = 0;
+	double send_wait_time = 0;
+	int send_failed = (psql_copy_writer_flush(writer) != 0);	// binary header
+	while(1) {
+		double wait_start = psql_get_time();
+		psql_copy_chunk_t * chunk = psql_copy_pipeline_take(pipeline->full_ring, &pipeline->num_full);
+		send_wait_time += psql_get_time() - wait_start;
+		if(NULL == chunk || chunk == pipeline->end_marker) break;
+		
+		if(!send_failed && !__atomic_load_n(&pipeline->failed, __ATOMIC_ACQUIRE)) {
+			int ok = PQputCopyData(psql->conn, (const char *)chunk->buf->data + chunk->buf->start_pos, chunk->buf->length);
+			if(ok != 1) {
+				psql_set_conn_error(psql);
+				fprintf(stderr, "[ERROR]: PQputCopyData() failed: %s\n", psql->err_msg);
+				send_failed = 1;
+				__atomic_store_n(&pipeline->failed, 1, __ATOMIC_RELEASE);
+			}else {
+				writer->num_bytes += chunk->buf->length;
+				writer->num_rows += chunk->num_rows;
+				++num_chunks_sent;
+			}
+		}
+		psql_copy_pipeline_give(pipeline->free_ring, &pipeline->num_free, chunk);
+	}
+	
+	for(int i = 0; i < num_started; ++i) pthread_join(encoders[i].th, NULL);
+	
+	int failed = send_failed || pipeline->failed;
+	int64_t num_rows = psql_copy_writer_end(writer, failed?"copy pipeline aborted":NULL);
+	if(failed) num_rows = -1;
+	
+	if(stats) {
+		stats->num_rows = writer->num_rows;
+		stats->num_bytes = writer->num_bytes;
+		stats->num_chunks = num_chunks_sent;
+		stats->encode_wait_time = (double)pipeline->encode_wait_usec / 1000000.0;
+		stats->send_wait_time = send_wait_time;
+		stats->time_elapsed = psql_get_time() - time_start;
+	}
+	
+	free(encoders);
+	for(int i = 0; i < num_chunks; ++i) auto_buffer_cleanup(chunks[i].buf);
+	free(chunks);
+	sem_destroy(&pipeline->num_free);
+	sem_destroy(&pipeline->num_full);
+	psql_ring_cleanup(pipeline->free_ring);
+	psql_ring_cleanup(pipeline->full_ring);
+	psql_copy_writer_cleanup(writer);
+	return num_rows;
+}
+
+#undef PSQL_COPY_PIPELINE_DEFAULT_NUM_ENCODERS
+#undef PSQL_COPY_PIPELINE_DEFAULT_CHUNK_SIZE
+#undef PSQL_COPY_PIPELINE_WRITER_BUFFER_SIZE
+
+/* *********************************** **
+ * CSV / TSV Importer
+ * 	the file is mmap'ed and split into line-aligned ranges, one per parser thread.
+ * 	the parsers convert rows to COPY text format (unquote + escape) with the SIMD scanner, 
+ * 	and the chunks are streamed by psql_copy_pipeline_run().
+** *********************************** */
+#define PSQL_CSV_IMPORT_DEFAULT_MAX_WORKERS (8)
+
+typedef struct psql_csv_importer
+{
+	const char * data;
+	size_t size;
+	char delimiter;
+	char quote;		// 0: no quoting (tsv)
+	int num_columns;	// 0: not checked
+	
+	csv_charset_t unquoted_set[1];	// delimiter, quote, '\n', '\r', and the chars escaped by COPY
+	csv_charset_t quoted_set[1];
+	
+	size_t * offsets;	// [num_parts + 1]
+	size_t * cursors;	// current position of each part
+}psql_csv_importer_t;
+
+static inline void push_copy_escaped_char(auto_buffer_t * buf, char c)
+{
+	char seq[2] = { '\\', c };
+	switch(c) {
+	case '\t': seq[1] = 't'; break;
+	case '\n': seq[1] = 'n'; break;
+	case '\r': seq[1] = 'r'; break;
+	default: break;
+	}
+	auto_buffer_push(buf, seq, 2);
+}
+
+/*
+ * converts one CSV row at *p_cursor into a COPY text row.
+ * returns the number of fields, 0 for an empty line, or -1 on malformed input.
+ */
+static int csv_row_to_copy_text(const psql_csv_importer_t * importer, const char ** p_cursor, const char * end, auto_buffer_t * buf)
+{
+	const char * p = *p_cursor;
+	const char delimiter = importer->delimiter;
+	const char quote = importer->quote;
+	
+	// skip empty lines
+	if(p < end && (*p == '\n' || *p == '\r')) {
+		if(*p == '\r') ++p;
+		if(p < end && *p == '\n') ++p;
+		*p_cursor = p;
+		return 0;
+	}
+	
+	int num_fields = 0;
+	while(1) {
+		if(num_fields++ > 0) auto_buffer_push(buf, "\t", 1);
+		
+		if(quote && p < end && *p == quote) {
+			++p;
+			while(1) {
+				size_t n = csv_scan_any(p, end - p, importer->quoted_set);
+				auto_buffer_push(buf, p, n);
+				p += n;
+				if(p >= end) return -1;	// unterminated quoted field
+				
+				if(*p == quote) {
+					if((p + 1) < end && p[1] == quote) {	// "" -> "
+						auto_buffer_push(buf, p, 1);
+						p += 2;
+						continue;
+					}
+					++p;
+					break;
+				}
+				push_copy_escaped_char(buf, *p++);
+			}
+		}else {
+			const char * field_start = p;
+			while(p < end) {
+				size_t n = csv_scan_any(p, end - p, importer->unquoted_set);
+				auto_buffer_push(buf, p, n);
+				p += n;
+				if(p >= end) break;
+				
+				char c = *p;
+				if(c == delimiter || c == '\n' || c == '\r') break;
+				if(c == quote) auto_buffer_push(buf, p, 1);	// stray quote, kept as is
+				else push_copy_escaped_char(buf, c);
+				++p;
+			}
+			if(p == field_start) auto_buffer_push(buf, "\\N", 2);	// unquoted empty field is NULL
+		}
+		
+		if(p >= end) break;	// last row without a newline
+		char c = *p++;
+		if(c == delimiter) continue;
+		if(c == '\r') {
+			if(p < end && *p == '\n') ++p;
+			break;
+		}
+		if(c == '\n') break;
+		return -1;	// garbage after a closing quote
+	}
+	auto_buffer_push(buf, "\n", 1);
+	*p_cursor = p;
+	
+	if(importer->num_columns > 0 && num_fields != importer->num_columns) return -1;
+	return num_fields;
+}
+
+static int64_t csv_import_encode(int encoder_index, auto_buffer_t * chunk, size_t chunk_size, void * user_data)
+{
+	psql_csv_importer_t * importer = user_data;
+	const char * p = importer->data + importer->cursors[encoder_index];
+	const char * end = importer->data + importer->offsets[encoder_index + 1];
+	
+	int64_t num_rows = 0;
+	while(p < end && chunk->length < chunk_size) {
+		size_t row_start = chunk->length;
+		const char * line = p;
+		int num_fields = csv_row_to_copy_text(importer, &p, end, chunk);
+		if(num_fields < 0) {
+			const char * line_end = memchr(line, '\n', end - line);
+			int cb_line = line_end?(int)(line_end - line):(int)(end - line);
+			if(cb_line > 100) cb_line = 100;
+			fprintf(stderr, "[ERROR]: malformed csv row at offset %ld: '%.*s'\n", 
+				(long)(line - importer->data), cb_line, line);
+			return -1;
+		}
+		if(num_fields == 0) {
+			chunk->length = row_start;
+			continue;
+		}
+		++num_rows;
+	}
+	importer->cursors[encoder_index] = p - importer->data;
+	return num_rows;
+}
+
+int64_t psql_import_csv(psql_context_t * psql, const char * table_name, const char * path, 
+	const psql_csv_import_params_t * params, psql_csv_import_stats_t * stats)
+{
+	assert(psql && table_name && path);
+	static const psql_csv_import_params_t default_params[1];
+	if(NULL == params) params = default_params;
+	
+	double time_start = psql_get_time();
+	csv_file_t file[1];
+	if(NULL == csv_file_open(file, path)) return -1;
+	
+	psql_csv_importer_t importer[1];
+	memset(importer, 0, sizeof(importer));
+	importer->data = file->data;
+	importer->size = file->size;
+	importer->delimiter = (params->format == psql_csv_format_tsv)?'\t':',';
+	importer->quote = (params->format == psql_csv_format_tsv)?0:'"';
+	if(params->delimiter) importer->delimiter = params->delimiter;
+	importer->num_columns = params->num_columns;
+	
+	char chars[6] = { importer->delimiter, '\n', '\r', '\\', '\t', importer->quote?importer->quote:'\n' };
+	csv_charset_init(importer->unquoted_set, chars, 6);
+	char quoted_chars[5] = { importer->quote?importer->quote:'\n', '\n', '\r', '\\', '\t' };
+	csv_charset_init(importer->quoted_set, quoted_chars, 5);
+	
+	// skip the header line, its field count is used for validation if num_columns is not set
+	size_t data_start = 0;
+	if(params->has_header && file->size > 0) {
+		auto_buffer_t header[1];
+		auto_buffer_init(header, 0);
+		const char * p = file->data;
+		int num_fields = csv_row_to_copy_text(importer, &p, file->data + file->size, header);
+		auto_buffer_cleanup(header);
+		if(num_fields < 0) {
+			fprintf(stderr, "[ERROR]: %s(): invalid header in '%s'\n", __FUNCTION__, path);
+			csv_file_close(file);
+			return -1;
+		}
+		if(importer->num_columns <= 0) importer->num_columns = num_fields;
+		data_start = p - file->data;
+	}
+	
+	int num_workers = params->num_workers;
+	if(num_workers <= 0) {
+		long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_workers = (num_cpus > 1)?(int)(num_cpus - 1):1;	// one core is left for the sender
+		if(num_workers > PSQL_CSV_IMPORT_DEFAULT_MAX_WORKERS) num_workers = PSQL_CSV_IMPORT_DEFAULT_MAX_WORKERS;
+	}
+	
+	importer->offsets = calloc(num_workers + 1, sizeof(*importer->offsets));
+	importer->cursors = calloc(num_workers, sizeof(*importer->cursors));
+	assert(importer->offsets && importer->cursors);
+	csv_split_lines(file->data + data_start, file->size - data_start, importer->quote, num_workers, importer->offsets);
+	for(int i = 0; i <= num_workers; ++i) importer->offsets[i] += data_start;
+	for(int i = 0; i < num_workers; ++i) importer->cursors[i] = importer->offsets[i];
+	
+	psql_copy_pipeline_params_t pipeline_params = {
+		.num_encoders = num_workers,
+		.chunk_size = params->chunk_size,
+		.format = psql_copy_format_text,
+		.columns = params->columns,
+	};
+	psql_copy_pipeline_stats_t pipeline_stats[1];
+	memset(pipeline_stats, 0, sizeof(pipeline_stats));
+	int64_t num_rows = psql_copy_pipeline_run(psql, table_name, &pipeline_params, csv_import_encode, importer, pipeline_stats);
+	
+	if(stats) {
+		stats->num_rows = pipeline_stats->num_rows;
+		stats->input_bytes = file->size;
+		stats->output_bytes = pipeline_stats->num_bytes;
+		stats->num_workers = num_workers;
+		stats->time_elapsed = psql_get_time() - time_start;
+	}
+	
+	free(importer->offsets);
+	free(importer->cursors);
+	csv_file_close(file);
+	return num_rows;
+}
+#undef PSQL_CSV_IMPORT_DEFAULT_MAX_WORKERS
+
+/* *********************************** **
+ * COPY TO STDOUT
+ * 	rows are parsed in place inside the buffer returned by PQgetCopyData(),
+ * 	which is released when the next row is read.
+** *********************************** */
+psql_copy_reader_t * psql_copy_reader_init(psql_copy_reader_t * reader, psql_context_t * psql, int format)
+{
+	assert(psql);
+	if(NULL == reader) reader = calloc(1, sizeof(*reader));
+	else memset(reader, 0, sizeof(*reader));
+	assert(reader);
+	
+	reader->psql = psql;
+	reader->format = format;
+	return reader;
+}
+
+static void psql_copy_reader_release_row(psql_copy_reader_t * reader)
+{
+	if(reader->row_data) {
+		PQfreemem(reader->row_data);
+		reader->row_data = NULL;
+	}
+	reader->num_fields = 0;
+	return;
+}
+
+void psql_copy_reader_cleanup(psql_copy_reader_t * reader)
+{
+	if(NULL == reader) return;
+	if(reader->in_progress) psql_copy_reader_end(reader);
+	psql_copy_reader_release_row(reader);
+	free(reader->fields);
+	reader->fields = NULL;
+	reader->max_fields = 0;
+	return;
+}
+
+static int psql_copy_reader_start(psql_copy_reader_t * reader, const char * command)
+{
+	psql_context_t * psql = reader->psql;
+	if(reader->in_progress) return -1;
+	
+	if(psql->metrics) {
+		reader->metrics_fingerprint = psql_metrics_register(psql, command);
+		reader->begin_time = psql_get_time();
+	}
+	
+	PGresult * res = PQexec(psql->conn, command);
+	int rc = psql_check_result(psql, res);
+	PQclear(res);
+	if(rc < 0 || psql->exec_status != PGRES_COPY_OUT) {
+		fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+		return -1;
+	}
+	reader->in_progress = 1;
+	reader->header_parsed = 0;
+	reader->num_rows = 0;
+	reader->num_bytes = 0;
+	return 0;
+}
+
+int psql_copy_reader_begin(psql_copy_reader_t * reader, const char * table_name, const char * columns)
+{
+	assert(reader && reader->psql && reader->psql->conn);
+	assert(table_name && table_name[0]);
+	
+	char command[PATH_MAX] = "";
+	int cb = snprintf(command, sizeof(command), "COPY %s%s%s%s TO STDOUT%s;",
+		table_name, 
+		columns?"(":"", columns?columns:"", columns?")":"",
+		(reader->format == psql_copy_format_binary)?" BINARY":"");
+	if(cb <= 0 || cb >= sizeof(command)) return -1;
+	return psql_copy_reader_start(reader, command);
+}
+
+int psql_copy_reader_begin_query(psql_copy_reader_t * reader, const char * query)
+{
+	assert(reader && reader->psql && reader->psql->conn);
+	assert(query && query[0]);
+	
+	size_t cb_query = strlen(query);
+	while(cb_query > 0 && (query[cb_query - 1] == ';' || isspace((unsigned char)query[cb_query - 1]))) --cb_query;
+	
+	auto_buffer_t command[1];
+	auto_buffer_init(command, cb_query + 64);
+	auto_buffer_push(command, "COPY (", 6);
+	auto_buffer_push(command, query, cb_query);
+	if(reader->format == psql_copy_format_binary) auto_buffer_push(command, ") TO STDOUT BINARY;", sizeof(") TO STDOUT BINARY;"));
+	else auto_buffer_push(command, ") TO STDOUT;", sizeof(") TO STDOUT;"));
+	
+	int rc = psql_copy_reader_start(reader, (const char *)command->data);
+	auto_buffer_cleanup(command);
+	return rc;
+}
+
+static inline psql_copy_field_t * psql_copy_reader_add_field(psql_copy_reader_t * reader)
+{
+	if(reader->num_fields >= reader->max_fields) {
+		int new_size = reader->max_fields * 2;
+		if(new_size < 16) new_size = 16;
+		reader->fields = realloc(reader->fields, sizeof(*reader->fields) * new_size);
+		assert(reader->fields);
+		reader->max_fields = new_size;
+	}
+	return &reader->fields[reader->num_fields++];
+}
+
+static inline int hex_value(char c)
+{
+	if(c >= '0' && c <= '9') return c - '0';
+	if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+/*
+ * text format: fields are separated by '\t' and the row ends with '\n'.
+ * each field is unescaped and NUL-terminated in place, "\N" means NULL.
+ */
+static int copy_text_parse_row(psql_copy_reader_t * reader, char * data, int length)
+{
+	char * p = data;
+	char * p_end = data + length;
+	if(p_end > p && p_end[-1] == '\n') --p_end;
+	
+	while(1) {
+		psql_copy_field_t * field = psql_copy_reader_add_field(reader);
+		char * dst = p;
+		char * field_start = p;
+		
+		if(p + 2 <= p_end && p[0] == '\\' && p[1] == 'N' && (p + 2 == p_end || p[2] == '\t')) {
+			field->data = NULL;
+			field->length = -1;
+			p += 2;
+		}else {
+			while(p < p_end && *p != '\t') {
+				char c = *p++;
+				if(c != '\\' || p >= p_end) {
+					*dst++ = c;
+					continue;
+				}
+				c = *p++;
+				switch(c) {
+				case 'b': *dst++ = '\b'; break;
+				case 'f': *dst++ = '\f'; break;
+				case 'n': *dst++ = '\n'; break;
+				case 'r': *dst++ = '\r'; break;
+				case 't': *dst++ = '\t'; break;
+				case 'v': *dst++ = '\v'; break;
+				case 'x': 
+					if(p < p_end && hex_value(*p) >= 0) {
+						int value = hex_value(*p++);
+						if(p < p_end && hex_value(*p) >= 0) value = (value << 4) | hex_value(*p++);
+						*dst++ = (char)value;
+					}else *dst++ = 'x';
+					break;
+				default:
+					if(c >= '0' && c <= '7') {
+						int value = c - '0';
+						for(int i = 0; i < 2 && p < p_end && *p >= '0' && *p <= '7'; ++i) value = (value << 3) | (*p++ - '0');
+						*dst++ = (char)value;
+					}else *dst++ = c;
+					break;
+				}
+			}
+			field->data = field_start;
+			field->length = dst - field_start;
+		}
+		
+		if(p >= p_end) {
+			if(field->data) *dst = '\0';
+			break;
+		}
+		// *p == '\t'
+		if(field->data) *dst = '\0';
+		++p;
+	}
+	return reader->num_fields;
+}
+
+/*
+ * binary format: int16 num_fields, then (int32 length, bytes) for each field, length == -1 means NULL.
+ * the first row is prefixed with the file header, and the last message is the int16 -1 trailer.
+ */
+static int copy_binary_parse_row(psql_copy_reader_t * reader, char * data, int length)
+{
+	const unsigned char * p = (const unsigned char *)data;
+	const unsigned char * p_end = p + length;
+	
+	if(!reader->header_parsed) {
+		if(length < 19 || memcmp(p, "PGCOPY\n\377\r\n\0", 11) != 0) return -1;
+		uint32_t cb_ext = 0;
+		memcpy(&cb_ext, p + 15, 4);
+		cb_ext = be32toh(cb_ext);
+		p += 19;
+		if(cb_ext > p_end - p) return -1;
+		p += cb_ext;
+		reader->header_parsed = 1;
+	}
+	if(p + 2 > p_end) return -1;
+	
+	uint16_t be_num_fields = 0;
+	memcpy(&be_num_fields, p, 2);
+	int16_t num_fields = (int16_t)be16toh(be_num_fields);
+	p += 2;
+	if(num_fields == -1) return 0;	// file trailer
+	
+	for(int i = 0; i < num_fields; ++i) {
+		if(p + 4 > p_end) return -1;
+		uint32_t be_cb_field = 0;
+		memcpy(&be_cb_field, p, 4);
+		int32_t cb_field = (int32_t)be32toh(be_cb_field);
+		p += 4;
+		
+		psql_copy_field_t * field = psql_copy_reader_add_field(reader);
+		if(cb_field < 0) {
+			field->data = NULL;
+			field->length = -1;
+			continue;
+		}
+		if(cb_field > p_end - p) return -1;
+		field->data = (const char *)p;
+		field->length = cb_field;
+		p += cb_field;
+	}
+	return num_fields;
+}
+
+/*
+ * psql_copy_reader_next_row()
+ * 	@return number of fields of the current row, 0 if no more rows, -1 on error.
+ * 	the fields are valid until the next call.
+ */
+int psql_copy_reader_next_row(psql_copy_reader_t * reader, const psql_copy_field_t ** p_fields)
+{
+	assert(reader && reader->psql);
+	psql_context_t * psql = reader->psql;
+	psql_copy_reader_release_row(reader);
+	if(!reader->in_progress) return 0;
+	
+	while(1) {
+		char * data = NULL;
+		int cb = PQgetCopyData(psql->conn, &data, 0);
+		if(cb == -1) {	// COPY finished
+			int rc = psql_copy_reader_end(reader);
+			return (rc < 0)?-1:0;
+		}
+		if(cb < 0) {
+			psql_set_conn_error(psql);
+			fprintf(stderr, "[ERROR]: PQgetCopyData() failed: %s\n", psql->err_msg);
+			psql_copy_reader_end(reader);
+			return -1;
+		}
+		
+		reader->row_data = data;
+		reader->num_bytes += cb;
+		
+		int num_fields = 0;
+		if(reader->format == psql_copy_format_binary) num_fields = copy_binary_parse_row(reader, data, cb);
+		else num_fields = copy_text_parse_row(reader, data, cb);
+		
+		if(num_fields < 0) {
+			snprintf(psql->err_msg, sizeof(psql->err_msg), "invalid copy data (row %ld)", (long)reader->num_rows);
+			fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+			return -1;
+		}
+		if(num_fields == 0) {	// binary trailer, wait for the end of COPY
+			psql_copy_reader_release_row(reader);
+			continue;
+		}
+		
+		++reader->num_rows;
+		if(p_fields) *p_fields = reader->fields;
+		return num_fields;
+	}
+	return -1;
+}
+
+/*
+ * psql_copy_reader_end()
+ * 	can be called before all rows are read, the remaining data will be discarded.
+ * 	@return number of rows read, or -1 if the COPY failed.
+ */
+int64_t psql_copy_reader_end(psql_copy_reader_t * reader)
+{
+	assert(reader && reader->psql);
+	psql_context_t * psql = reader->psql;
+	PGconn * conn = psql->conn;
+	psql_copy_reader_release_row(reader);
+	if(!reader->in_progress) return reader->num_rows;
+	reader->in_progress = 0;
+	
+	// drain unread rows
+	char * data = NULL;
+	int cb = 0;
+	while((cb = PQgetCopyData(conn, &data, 0)) >= 0) {
+		if(data) PQfreemem(data);
+		data = NULL;
+	}
+	
+	int64_t num_rows = reader->num_rows;
+	PGresult * res = NULL;
+	while((res = PQgetResult(conn))) {
+		int rc = psql_check_result(psql, res);
+		if(rc < 0) {
+			fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+			num_rows = -1;
+		}
+		PQclear(res);
+	}
+	if(psql->metrics) {
+		psql_metrics_record(psql, reader->metrics_fingerprint, NULL, psql_get_time() - reader->begin_time, 
+			(num_rows < 0), reader->num_rows, 0, reader->num_bytes);
+	}
+	return num_rows;
+}
+
+/* *********************************** **
+ * Typed Binary COPY Encoder
+ * 	values are written directly in PostgreSQL binary wire format, 
+ * 	so the server skips the text input functions.
+** *********************************** */
+
+static const struct
+{
+	unsigned int oid;
+	unsigned int array_oid;
+	int width;	// fixed binary size, -1: variable length
+}s_psql_data_types[psql_data_types_count] = {
+	[psql_data_type_text]        = {   25, 1009, -1 },
+	[psql_data_type_varchar]     = { 1043, 1015, -1 },
+	[psql_data_type_bytea]       = {   17, 1001, -1 },
+	[psql_data_type_bool]        = {   16, 1000,  1 },
+	[psql_data_type_int2]        = {   21, 1005,  2 },
+	[psql_data_type_int4]        = {   23, 1007,  4 },
+	[psql_data_type_int8]        = {   20, 1016,  8 },
+	[psql_data_type_float4]      = {  700, 1021,  4 },
+	[psql_data_type_float8]      = {  701, 1022,  8 },
+	[psql_data_type_uuid]        = { 2950, 2951, 16 },
+	[psql_data_type_timestamp]   = { 1114, 1115,  8 },
+	[psql_data_type_timestamptz] = { 1184, 1185,  8 },
+	[psql_data_type_numeric]     = { 1700, 1231, -1 },
+};
+
+unsigned int psql_data_type_to_oid(int type, int is_array)
+{
+	if(type < 0 || type >= psql_data_types_count) return 0;
+	return is_array?s_psql_data_types[type].array_oid:s_psql_data_types[type].oid;
+}
+
+psql_copy_encoder_t * psql_copy_encoder_init(psql_copy_encoder_t * encoder, int num_columns, const psql_column_desc_t * columns)
+{
+	assert(num_columns > 0 && num_columns <= INT16_MAX && columns);
+	if(NULL == encoder) encoder = calloc(1, sizeof(*encoder));
+	else memset(encoder, 0, sizeof(*encoder));
+	assert(encoder);
+	
+	encoder->num_columns = num_columns;
+	encoder->columns = calloc(num_columns, sizeof(*encoder->columns));
+	assert(encoder->columns);
+	memcpy(encoder->columns, columns, sizeof(*columns) * num_columns);
+	
+	// build the column list for "COPY table(...) FROM STDIN BINARY"
+	size_t cb_names = 0;
+	for(int i = 0; i < num_columns; ++i) {
+		assert(columns[i].type >= 0 && columns[i].type < psql_data_types_count);
+		if(columns[i].name) cb_names += strlen(columns[i].name) + 2;
+		else cb_names = -1;
+	}
+	if(cb_names != (size_t)-1 && cb_names > 0) {
+		char * column_names = calloc(cb_names + 1, 1);
+		assert(column_names);
+		char * p = column_names;
+		for(int i = 0; i < num_columns; ++i) {
+			p += sprintf(p, "%s%s", (i > 0)?", ":"", columns[i].name);
+		}
+		encoder->column_names = column_names;
+	}
+	encoder->column_index = -1;
+	return encoder;
+}
+
+void psql_copy_encoder_cleanup(psql_copy_encoder_t * encoder)
+{
+	if(NULL == encoder) return;
+	free(encoder->columns);
+	encoder->columns = NULL;
+	free(encoder->column_names);
+	encoder->column_names = NULL;
+	encoder->num_columns = 0;
+	encoder->buf = NULL;
+	return;
+}
+
+static inline void push_be16(auto_buffer_t * buf, uint16_t value)
+{
+	value = htobe16(value);
+	auto_buffer_push(buf, &value, sizeof(value));
+}
+static inline void push_be32(auto_buffer_t * buf, uint32_t value)
+{
+	value = htobe32(value);
+	auto_buffer_push(buf, &value, sizeof(value));
+}
+static inline void push_be64(auto_buffer_t * buf, uint64_t value)
+{
+	value = htobe64(value);
+	auto_buffer_push(buf, &value, sizeof(value));
+}
+
+int psql_copy_encoder_begin_row(psql_copy_encoder_t * encoder, auto_buffer_t * buf)
+{
+	assert(encoder && buf);
+	if(encoder->column_index >= 0) return -1;	// previous row not finished
+	
+	encoder->buf = buf;
+	encoder->row_start = buf->length;
+	encoder->column_index = 0;
+	push_be16(buf, (uint16_t)encoder->num_columns);
+	return 0;
+}
+
+int psql_copy_encoder_end_row(psql_copy_encoder_t * encoder)
+{
+	assert(encoder && encoder->buf);
+	if(encoder->column_index != encoder->num_columns) {
+		fprintf(stderr, "[ERROR]: %s(): %d of %d columns encoded\n", __FUNCTION__, encoder->column_index, encoder->num_columns);
+		encoder->buf->length = encoder->row_start;	// discard the partial row
+		encoder->column_index = -1;
+		return -1;
+	}
+	encoder->column_index = -1;
+	++encoder->num_rows;
+	return 0;
+}
+
+static inline const psql_column_desc_t * psql_copy_encoder_next_column(psql_copy_encoder_t * encoder)
+{
+	if(encoder->column_index < 0 || encoder->column_index >= encoder->num_columns) return NULL;
+	return &encoder->columns[encoder->column_index];
+}
+#define encoder_column_check(encoder, column, cond) do {	\
+		if(NULL == column || !(cond)) {						\
+			fprintf(stderr, "[ERROR]: %s(): type mismatch at column %d\n", __FUNCTION__, encoder->column_index);	\
+			return -1;										\
+		}													\
+	} while(0)
+
+int psql_copy_encoder_add_null(psql_copy_encoder_t * encoder)
+{
+	const psql_column_desc_t * column = psql_copy_encoder_next_column(encoder);
+	encoder_column_check(encoder, column, 1);
+	push_be32(encoder->buf, (uint32_t)-1);
+	++encoder->column_index;
+	return 0;
+}
+
+static inline void encode_int(auto_buffer_t * buf, int type, int64_t value)
+{
+	switch(type) {
+	case psql_data_type_int2: push_be16(buf, (uint16_t)(int16_t)value); break;
+	case psql_data_type_int4: push_be32(buf, (uint32_t)(int32_t)value); break;
+	default: push_be64(buf, (uint64_t)value); break;
+	}
+}
+
+int psql_copy_encoder_add_int64(psql_copy_encoder_t * encoder, int64_t value)
+{
+	const psql_column_desc_t * column = psql_copy_encoder_next_column(encoder);
+	encoder_column_check(encoder, column, !column->is_array 
+		&& (column->type == psql_data_type_int2 || column->type == psql_data_type_int4 || column->type == psql_data_type_int8));
+	
+	int width = s_psql_data_types[column->type].width;
+	if((width == 2 && (value < INT16_MIN || value > INT16_MAX))
+		|| (width == 4 && (value < INT32_MIN || value > INT32_MAX))) {
+		fprintf(stderr, "[ERROR]: %s(): value %ld out of range at column %d\n", __FUNCTION__, (long)value, encoder->column_index);
+		return -1;
+	}
+	push_be32(encoder->buf, width);
+	encode_int(encoder->buf, column->type, value);
+	++encoder->column_index;
+	return 0;
+}
+
+static inline void encode_double(auto_buffer_t * buf, int type, double value)
+{
+	if(type == psql_data_type_float4) {
+		float f_value = (float)value;
+		uint32_t bits = 0;
+		memcpy(&bits, &f_value, sizeof(bits));
+		push_be32(buf, bits);
+	}else {
+		uint64_t bits = 0;
+		memcpy(&bits, &value, sizeof(bits));
+		push_be64(buf, bits);
+	}
+}
+
+int psql_copy_encoder_add_double(psql_copy_encoder_t * encoder, double value)
+{
+	const psql_column_desc_t * column = psql_copy_encoder_next_column(encoder);
+	encoder_column_check(encoder, column, !column->is_array 
+		&& (column->type == psql_data_type_float4 || column->type == psql_data_type_float8));
+	
+	push_be32(encoder->buf, s_psql_data_types[column->type].width);
+	encode_double(encoder->buf, column->type, value);
+	++encoder->column_index;
+	return 0;
+}
+
+int psql_copy_encoder_add_bool(psql_copy_encoder_t * encoder, int value)
+{
+	const psql_column_desc_t * column = psql_copy_encoder_next_column(encoder);
+	encoder_column_check(encoder, column, !column->is_array && column->type == psql_data_type_bool);
+	
+	unsigned char c = value?1:0;
+	push_be32(encoder->buf, 1);
+	auto_buffer_push(encoder->buf, &c, 1);
+	++encoder->column_index;
+	return 0;
+}
+
+int psql_copy_encoder_add_uuid(psql_copy_encoder_t * encoder, const unsigned char uuid[16])
+{
+	const psql_column_desc_t * column = psql_copy_encoder_next_column(encoder);
+	encoder_column_check(encoder, column, !column->is_array && column->type == psql_data_type_uuid);
+	
+	push_be32(encoder->buf, 16);
+	auto_buffer_push(encoder->buf, uuid, 16);
+	++encoder->column_index;
+	return 0;
+}
+
+int psql_copy_encoder_add_timestamp(psql_copy_encoder_t * encoder, int64_t unix_usec)
+{
+	const psql_column_desc_t * column = psql_copy_encoder_next_column(encoder);
+	encoder_column_check(encoder, column, !column->is_array 
+		&& (column->type == psql_data_type_timestamp || column->type == psql_data_type_timestamptz));
+	
+	push_be32(encoder->buf, 8);
+	push_be64(encoder->buf, (uint64_t)(unix_usec - PSQL_EPOCH_OFFSET_USEC));
+	++encoder->column_index;
+	return 0;
+}
+
+/*
+ * numeric binary format:
+ * 	int16 ndigits, int16 weight, int16 sign, int16 dscale, int16 digits[ndigits] (base 10000)
+ * 	value = sum(digits[i] * 10000^(weight - i))
+ */
+#define NUMERIC_POS  (0x0000)
+#define NUMERIC_NEG  (0x4000)
+#define NUMERIC_NAN  (0xC000)
+static int encode_numeric(auto_buffer_t * buf, const char * sz_value, size_t length)
+{
+	const char * p = sz_value;
+	const char * p_end = sz_value + length;
+	while(p < p_end && isspace((unsigned char)*p)) ++p;
+	while(p_end > p && isspace((unsigned char)p_end[-1])) --p_end;
+	
+	if((p_end - p) == 3 && strncasecmp(p, "NaN", 3) == 0) {
+		push_be32(buf, 8);
+		push_be16(buf, 0);
+		push_be16(buf, 0);
+		push_be16(buf, NUMERIC_NAN);
+		push_be16(buf, 0);
+		return 0;
+	}
+	
+	uint16_t sign = NUMERIC_POS;
+	if(p < p_end && (*p == '-' || *p == '+')) {
+		if(*p == '-') sign = NUMERIC_NEG;
+		++p;
+	}
+	
+	const char * int_begin = p;
+	while(p < p_end && isdigit((unsigned char)*p)) ++p;
+	const char * int_end = p;
+	const char * frac_begin = p;
+	const char * frac_end = p;
+	if(p < p_end && *p == '.') {
+		frac_begin = ++p;
+		while(p < p_end && isdigit((unsigned char)*p)) ++p;
+		frac_end = p;
+	}
+	if(p != p_end || (int_begin == int_end && frac_begin == frac_end)) return -1;	// exponents are not supported
+	
+	while(int_begin < int_end && *int_begin == '0') ++int_begin;	// strip leading zeros
+	
+	int num_int_digits = int_end - int_begin;
+	int dscale = frac_end - frac_begin;
+	if(dscale > 0x3FFF) return -1;
+	
+	int num_int_groups = (num_int_digits + 3) / 4;
+	int num_frac_groups = (dscale + 3) / 4;
+	int ndigits = num_int_groups + num_frac_groups;
+	
+	int16_t digits_buf[64];
+	int16_t * digits = digits_buf;
+	if(ndigits > 64) {
+		digits = calloc(ndigits, sizeof(*digits));
+		assert(digits);
+	}
+	
+	// integer part: groups of 4 digits aligned to the decimal point
+	const char * q = int_begin;
+	for(int i = 0; i < num_int_groups; ++i) {
+		int group_len = (i == 0)?(num_int_digits - (num_int_groups - 1) * 4):4;
+		int value = 0;
+		for(int k = 0; k < group_len; ++k) value = value * 10 + (*q++ - '0');
+		digits[i] = value;
+	}
+	// fraction part: pad the last group with zeros
+	q = frac_begin;
+	for(int i = 0; i < num_frac_groups; ++i) {
+		int value = 0;
+		for(int k = 0; k < 4; ++k) value = value * 10 + ((q < frac_end)?(*q++ - '0'):0);
+		digits[num_int_groups + i] = value;
+	}
+	
+	int weight = num_int_groups - 1;
+	int first = 0;
+	while(first < ndigits && digits[first] == 0) { ++first; --weight; }
+	int last = ndigits;
+	while(last > first && digits[last - 1] == 0) --last;
+	
+	int count = last - first;
+	if(count == 0) {	// zero
+		weight = 0;
+		sign = NUMERIC_POS;
+	}
+	
+	push_be32(buf, 8 + count * 2);
+	push_be16(buf, (uint16_t)count);
+	push_be16(buf, (uint16_t)(int16_t)weight);
+	push_be16(buf, sign);
+	push_be16(buf, (uint16_t)dscale);
+	for(int i = first; i < last; ++i) push_be16(buf, (uint16_t)digits[i]);
+	
+	if(digits != digits_buf) free(digits);
+	return 0;
+}
+#undef NUMERIC_POS
+#undef NUMERIC_NEG
+#undef NUMERIC_NAN
+
+int psql_copy_encoder_add_numeric(psql_copy_encoder_t * encoder, const char * sz_value)
+{
+	const psql_column_desc_t * column = psql_copy_encoder_next_column(encoder);
+	encoder_column_check(encoder, column, !column->is_array && column->type == psql_data_type_numeric);
+	if(NULL == sz_value) return psql_copy_encoder_add_null(encoder);
+	
+	int rc = encode_numeric(encoder->buf, sz_value, strlen(sz_value));
+	if(rc) {
+		fprintf(stderr, "[ERROR]: %s(): invalid numeric '%s' at column %d\n", __FUNCTION__, sz_value, encoder->column_index);
+		return -1;
+	}
+	++encoder->column_index;
+	return 0;
+}
+
+/*
+ * text / varchar / bytea: the raw bytes are the binary representation
+ */
+int psql_copy_encoder_add_bytes(psql_copy_encoder_t * encoder, const void * data, size_t length)
+{
+	const psql_column_desc_t * column = psql_copy_encoder_next_column(encoder);
+	encoder_column_check(encoder, column, !column->is_array 
+		&& (column->type == psql_data_type_text || column->type == psql_data_type_varchar || column->type == psql_data_type_bytea));
+	if(NULL == data) return psql_copy_encoder_add_null(encoder);
+	if(length > INT32_MAX) return -1;
+	
+	push_be32(encoder->buf, (uint32_t)length);
+	auto_buffer_push(encoder->buf, data, length);
+	++encoder->column_index;
+	return 0;
+}
+
+int psql_copy_encoder_add_text(psql_copy_encoder_t * encoder, const char * text)
+{
+	return psql_copy_encoder_add_bytes(encoder, text, text?strlen(text):0);
+}
+
+/*
+ * one-dimensional array of the column's element type.
+ * 	@values: C array of the element type:
+ * 		bool: uint8_t, int2: int16_t, int4: int32_t, int8 / timestamp(tz): int64_t (unix usec), 
+ * 		float4: float, float8: double, uuid: unsigned char[16], 
+ * 		text / varchar / bytea / numeric: const char * (with @lengths, nullable for NUL-terminated strings)
+ * 	@is_null: (nullable) per-element NULL flags
+ */
+int psql_copy_encoder_add_array(psql_copy_encoder_t * encoder, int num_elements, const void * values, const int * lengths, const unsigned char * is_null)
+{
+	const psql_column_desc_t * column = psql_copy_encoder_next_column(encoder);
+	encoder_column_check(encoder, column, column->is_array);
+	assert(num_elements >= 0 && (values || num_elements == 0));
+	
+	auto_buffer_t * buf = encoder->buf;
+	int type = column->type;
+	int has_null = 0;
+	if(is_null) {
+		for(int i = 0; i < num_elements; ++i) if(is_null[i]) { has_null = 1; break; }
+	}
+	
+	// reserve the length prefix, patched once the array is encoded
+	size_t length_pos = buf->start_pos + buf->length;
+	push_be32(buf, 0);
+	size_t data_start = buf->length;
+	
+	if(num_elements == 0) {
+		push_be32(buf, 0);	// ndim
+		push_be32(buf, 0);	// has_null
+		push_be32(buf, s_psql_data_types[type].oid);
+	}else {
+		push_be32(buf, 1);	// ndim
+		push_be32(buf, has_null);
+		push_be32(buf, s_psql_data_types[type].oid);
+		push_be32(buf, num_elements);	// dim size
+		push_be32(buf, 1);				// lower bound
+	}
+	
+	for(int i = 0; i < num_elements; ++i) {
+		if(is_null && is_null[i]) {
+			push_be32(buf, (uint32_t)-1);
+			continue;
+		}
+		switch(type) {
+		case psql_data_type_bool: 
+			push_be32(buf, 1);
+			auto_buffer_push(buf, (((const uint8_t *)values)[i])?"\1":"\0", 1);
+			break;
+		case psql_data_type_int2: 
+			push_be32(buf, 2);
+			push_be16(buf, (uint16_t)((const int16_t *)values)[i]);
+			break;
+		case psql_data_type_int4: 
+			push_be32(buf, 4);
+			push_be32(buf, (uint32_t)((const int32_t *)values)[i]);
+			break;
+		case psql_data_type_int8:
+			push_be32(buf, 8);
+			push_be64(buf, (uint64_t)((const int64_t *)values)[i]);
+			break;
+		case psql_data_type_timestamp:
+		case psql_data_type_timestamptz:
+			push_be32(buf, 8);
+			push_be64(buf, (uint64_t)(((const int64_t *)values)[i] - PSQL_EPOCH_OFFSET_USEC));
+			break;
+		case psql_data_type_float4: 
+			push_be32(buf, 4);
+			encode_double(buf, type, ((const float *)values)[i]);
+			break;
+		case psql_data_type_float8:
+			push_be32(buf, 8);
+			encode_double(buf, type, ((const double *)values)[i]);
+			break;
+		case psql_data_type_uuid:
+			push_be32(buf, 16);
+			auto_buffer_push(buf, (const unsigned char *)values + i * 16, 16);
+			break;
+		case psql_data_type_numeric: 
+			{
+				const char * value = ((const char **)values)[i];
+				size_t cb = lengths?lengths[i]:strlen(value);
+				if(encode_numeric(buf, value, cb)) {
+					buf->length = data_start - 4;
+					fprintf(stderr, "[ERROR]: %s(): invalid numeric at column %d[%d]\n", __FUNCTION__, encoder->column_index, i);
+					return -1;
+				}
+			}
+			break;
+		default:	// text, varchar, bytea
+			{
+				const char * value = ((const char **)values)[i];
+				size_t cb = lengths?lengths[i]:strlen(value);
+				push_be32(buf, (uint32_t)cb);
+				auto_buffer_push(buf, value, cb);
+			}
+			break;
+		}
+	}
+	
+	// patch the length prefix
+	uint32_t cb_array = htobe32((uint32_t)(buf->length - data_start));
+	memcpy(buf->data + length_pos, &cb_array, sizeof(cb_array));
+	
+	++encoder->column_index;
+	return 0;
+}
+#undef encoder_column_check
+
+/* *********************************** **
+ * Parameters Builder
+ * 	the parameter arrays and the value bytes share one bump arena:
+ * 	[ values | types | cb_values | value_formats | value_offsets | data ... ]
+ * 	psql_params_builder_reset() only rewinds the arena, 
+ * 	so the steady state (same statement, similar values) never calls malloc().
+** *********************************** */
+#define PSQL_PARAMS_BUILDER_DEFAULT_MAX_PARAMS (16)
+#define PSQL_PARAMS_BUILDER_DEFAULT_DATA_SIZE (4096)
+
+static int params_builder_reserve(psql_params_builder_t * builder, int max_params, size_t data_size)
+{
+	if(max_params <= builder->max_params && data_size <= builder->data_size) return 0;
+	
+	if(max_params < builder->max_params) max_params = builder->max_params;
+	if(data_size < builder->data_size) data_size = builder->data_size;
+	
+	size_t cb_arrays = (size_t)max_params * (sizeof(const char *) + sizeof(unsigned int) + sizeof(int) * 3);
+	unsigned char * arena = malloc(cb_arrays + data_size);
+	if(NULL == arena) {
+		perror("psql_params_builder::malloc()");
+		return -1;
+	}
+	
+	psql_params_t * params = builder->params;
+	const char ** values = (const char **)arena;
+	unsigned int * types = (unsigned int *)(values + max_params);
+	int * cb_values = (int *)(types + max_params);
+	int * value_formats = cb_values + max_params;
+	int * value_offsets = value_formats + max_params;
+	unsigned char * data = (unsigned char *)(value_offsets + max_params);
+	
+	int num_params = params->num_params;
+	if(num_params > 0) {
+		memcpy(types, params->types, sizeof(*types) * num_params);
+		memcpy(cb_values, params->cb_values, sizeof(*cb_values) * num_params);
+		memcpy(value_formats, params->value_formats, sizeof(*value_formats) * num_params);
+		memcpy(value_offsets, builder->value_offsets, sizeof(*value_offsets) * num_params);
+	}
+	if(builder->data_length > 0) memcpy(data, builder->data, builder->data_length);
+	
+	// rebase the values which were copied into the arena
+	for(int i = 0; i < num_params; ++i) {
+		values[i] = (value_offsets[i] < 0)?params->values[i]:(const char *)data + value_offsets[i];
+	}
+	
+	free(builder->arena);
+	builder->arena = arena;
+	builder->max_params = max_params;
+	builder->data_size = data_size;
+	builder->data = data;
+	builder->value_offsets = value_offsets;
+	
+	params->values = values;
+	params->types = types;
+	params->cb_values = cb_values;
+	params->value_formats = value_formats;
+	return 0;
+}
+
+psql_params_builder_t * psql_params_builder_init(psql_params_builder_t * builder, int max_params, size_t data_size, int result_format)
+{
+	if(NULL == builder) builder = calloc(1, sizeof(*builder));
+	else memset(builder, 0, sizeof(*builder));
+	assert(builder);
+	
+	if(max_params <= 0) max_params = PSQL_PARAMS_BUILDER_DEFAULT_MAX_PARAMS;
+	if(data_size == 0) data_size = PSQL_PARAMS_BUILDER_DEFAULT_DATA_SIZE;
+	
+	builder->params->result_format = result_format;
+	int rc = params_builder_reserve(builder, max_params, data_size);
+	assert(0 == rc);
+	return builder;
+}
+
+void psql_params_builder_cleanup(psql_params_builder_t * builder)
+{
+	if(NULL == builder) return;
+	free(builder->arena);
+	memset(builder, 0, sizeof(*builder));
+}
+
+void psql_params_builder_reset(psql_params_builder_t * builder)
+{
+	assert(builder);
+	builder->params->num_params = 0;
+	builder->data_length = 0;
+}
+
+/*
+ * reserves one parameter slot and (optionally) 'size' bytes of the arena.
+ * returns the parameter index, or -1 on failure.
+ */
+static int params_builder_push(psql_params_builder_t * builder, unsigned int type, int value_format, size_t size, unsigned char ** p_data)
+{
+	psql_params_t * params = builder->params;
+	int max_params = builder->max_params;
+	size_t data_size = builder->data_size;
+	
+	if(params->num_params >= max_params) max_params *= 2;
+	while(size > 0 && (builder->data_length + size) > data_size) data_size *= 2;
+	if(params_builder_reserve(builder, max_params, data_size)) return -1;
+	
+	int index = params->num_params++;
+	params->types[index] = type;
+	params->values[index] = NULL;
+	params->cb_values[index] = 0;
+	params->value_formats[index] = value_format;
+	builder->value_offsets[index] = -1;
+	
+	if(p_data) {
+		assert(builder->data_length <= INT_MAX);
+		builder->value_offsets[index] = (int)builder->data_length;
+		*p_data = builder->data + builder->data_length;
+		params->values[index] = (const char *)*p_data;
+		params->cb_values[index] = (int)size;
+		builder->data_length += size;
+	}
+	return index;
+}
+
+int psql_params_builder_add(psql_params_builder_t * builder, unsigned int type, const void * value, int cb_value, int value_format)
+{
+	if(NULL == value) return psql_params_builder_add_null(builder, type);
+	if(cb_value < 0) cb_value = strlen(value);
+	
+	unsigned char * data = NULL;
+	// text values are NUL-terminated, libpq ignores cb_value for text-format parameters
+	size_t size = cb_value + (value_format?0:1);
+	int index = params_builder_push(builder, type, value_format, size, &data);
+	if(index < 0) return -1;
+	
+	memcpy(data, value, cb_value);
+	if(0 == value_format) data[cb_value] = '\0';
+	builder->params->cb_values[index] = cb_value;
+	return index;
+}
+
+int psql_params_builder_add_ref(psql_params_builder_t * builder, unsigned int type, const void * value, int cb_value, int value_format)
+{
+	int index = params_builder_push(builder, type, value_format, 0, NULL);
+	if(index < 0) return -1;
+	builder->params->values[index] = value;
+	builder->params->cb_values[index] = (value && cb_value < 0)?(int)strlen(value):cb_value;
+	return index;
+}
+
+int psql_params_builder_add_null(psql_params_builder_t * builder, unsigned int type)
+{
+	return params_builder_push(builder, type, 0, 0, NULL);
+}
+
+int psql_params_builder_add_text(psql_params_builder_t * builder, const char * text, int cb_text)
+{
+	// oid 0: let the server infer the type from the context
+	return psql_params_builder_add(builder, 0, text, cb_text, 0);
+}
+
+int psql_params_builder_add_printf(psql_params_builder_t * builder, unsigned int type, const char * fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int cb = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if(cb < 0) return -1;
+	
+	unsigned char * data = NULL;
+	int index = params_builder_push(builder, type, 0, cb + 1, &data);
+	if(index < 0) return -1;
+	
+	va_start(ap, fmt);
+	vsnprintf((char *)data, cb + 1, fmt, ap);
+	va_end(ap);
+	builder->params->cb_values[index] = cb;
+	return index;
+}
+
+int psql_params_builder_add_int32(psql_params_builder_t * builder, int32_t value)
+{
+	unsigned char * data = NULL;
+	int index = params_builder_push(builder, s_psql_data_types[psql_data_type_int4].oid, 1, sizeof(value), &data);
+	if(index < 0) return -1;
+	
+	uint32_t be = htobe32((uint32_t)value);
+	memcpy(data, &be, sizeof(be));
+	return index;
+}
+
+int psql_params_builder_add_int64(psql_params_builder_t * builder, int64_t value)
+{
+	unsigned char * data = NULL;
+	int index = params_builder_push(builder, s_psql_data_types[psql_data_type_int8].oid, 1, sizeof(value), &data);
+	if(index < 0) return -1;
+	
+	uint64_t be = htobe64((uint64_t)value);
+	memcpy(data, &be, sizeof(be));
+	return index;
+}
+
+int psql_params_builder_add_double(psql_params_builder_t * builder, double value)
+{
+	unsigned char * data = NULL;
+	int index = params_builder_push(builder, s_psql_data_types[psql_data_type_float8].oid, 1, sizeof(value), &data);
+	if(index < 0) return -1;
+	
+	uint64_t bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	bits = htobe64(bits);
+	memcpy(data, &bits, sizeof(bits));
+	return index;
+}
+
+int psql_params_builder_add_bool(psql_params_builder_t * builder, int value)
+{
+	unsigned char * data = NULL;
+	int index = params_builder_push(builder, s_psql_data_types[psql_data_type_bool].oid, 1, 1, &data);
+	if(index < 0) return -1;
+	data[0] = value?1:0;
+	return index;
+}
+
+int psql_params_builder_add_bytes(psql_params_builder_t * builder, const void * value, int cb_value)
+{
+	assert(cb_value >= 0);
+	return psql_params_builder_add(builder, s_psql_data_types[psql_data_type_bytea].oid, value, cb_value, 1);
+}
+
+int psql_params_builder_add_uuid(psql_params_builder_t * builder, const unsigned char uuid[16])
+{
+	return psql_params_builder_add(builder, s_psql_data_types[psql_data_type_uuid].oid, uuid, 16, 1);
+}
+
+int psql_params_builder_add_timestamp(psql_params_builder_t * builder, int64_t unix_usec)
+{
+	unsigned char * data = NULL;
+	int index = params_builder_push(builder, s_psql_data_types[psql_data_type_timestamptz].oid, 1, sizeof(int64_t), &data);
+	if(index < 0) return -1;
+	
+	uint64_t be = htobe64((uint64_t)(unix_usec - PSQL_EPOCH_OFFSET_USEC));
+	memcpy(data, &be, sizeof(be));
+	return index;
+}
+
+#undef PSQL_PARAMS_BUILDER_DEFAULT_MAX_PARAMS
+#undef PSQL_PARAMS_BUILDER_DEFAULT_DATA_SIZE
+
+/* *********************************** **
+ * Insert Batcher
+ * 	coalesces row-at-a-time inserts into one statement per batch:
+ * 	  values mode: INSERT INTO t(cols) VALUES ($1,$2),($3,$4),...
+ * 	  unnest mode: INSERT INTO t(cols) SELECT * FROM unnest($1::type[], $2::type[])
+ * 	a full batch always produces the same SQL text, so it is prepared once per connection.
+** *********************************** */
+#define PSQL_INSERT_BATCHER_DEFAULT_MAX_ROWS (1000)
+#define PSQL_INSERT_BATCHER_DEFAULT_MAX_BYTES (1 << 20)
+#define PSQL_MAX_BIND_PARAMS (65535)	// protocol limit: int16 parameter count
+
+static void append_values_list(auto_buffer_t * buf, int num_rows, int num_columns)
+{
+	char param[32] = "";
+	int index = 0;
+	for(int row = 0; row < num_rows; ++row) {
+		append_string(buf, (row == 0)?"(":",(");
+		for(int col = 0; col < num_columns; ++col) {
+			int cb = snprintf(param, sizeof(param), (col == 0)?"$%d":",$%d", ++index);
+			auto_buffer_push(buf, param, cb);
+		}
+		append_string(buf, ")");
+	}
+}
+
+/* appends one element to a text-format array literal: {"a","b\"c",NULL} */
+static void append_array_element(auto_buffer_t * buf, const char * value, int cb_value)
+{
+	if(buf->length > 1) auto_buffer_push(buf, ",", 1);	// buf starts with '{'
+	if(NULL == value) {
+		append_string(buf, "NULL");
+		return;
+	}
+	if(cb_value < 0) cb_value = strlen(value);
+	
+	// worst case: every char escaped, plus the quotes
+	size_t size = buf->length + cb_value * 2 + 2;
+	if(size > buf->size) auto_buffer_resize(buf, (size > buf->size * 2)?size:(buf->size * 2));
+	char * p = (char *)buf->data + buf->length;
+	*p++ = '"';
+	for(int i = 0; i < cb_value; ++i) {
+		if(value[i] == '"' || value[i] == '\\') *p++ = '\\';
+		*p++ = value[i];
+	}
+	*p++ = '"';
+	buf->length = p - (char *)buf->data;
+}
+
+static void insert_batcher_reset_queue(psql_insert_batcher_t * batcher)
+{
+	batcher->num_queued = 0;
+	batcher->num_bytes = 0;
+	batcher->first_row_time = 0;
+	psql_params_builder_reset(batcher->builder);
+	if(batcher->arrays) {
+		for(int i = 0; i < batcher->num_columns; ++i) {
+			batcher->arrays[i].length = 0;
+			auto_buffer_push(&batcher->arrays[i], "{", 1);
+		}
+	}
+}
+
+psql_insert_batcher_t * psql_insert_batcher_init(psql_insert_batcher_t * batcher, psql_context_t * psql, 
+	const char * table_name, const char * columns, int num_columns, 
+	const psql_insert_batcher_params_t * params)
+{
+	assert(psql && table_name && table_name[0]);
+	assert(num_columns > 0 && num_columns <= PSQL_MAX_BIND_PARAMS);
+	
+	if(NULL == batcher) batcher = calloc(1, sizeof(*batcher));
+	else memset(batcher, 0, sizeof(*batcher));
+	assert(batcher);
+	
+	batcher->psql = psql;
+	batcher->num_columns = num_columns;
+	if(params) batcher->params = *params;
+	
+	psql_insert_batcher_params_t * config = &batcher->params;
+	if(config->max_rows <= 0) config->max_rows = PSQL_INSERT_BATCHER_DEFAULT_MAX_ROWS;
+	if(config->max_bytes == 0) config->max_bytes = PSQL_INSERT_BATCHER_DEFAULT_MAX_BYTES;
+	if(config->mode == psql_insert_batch_mode_values && config->max_rows > (PSQL_MAX_BIND_PARAMS / num_columns)) {
+		config->max_rows = PSQL_MAX_BIND_PARAMS / num_columns;
+	}
+	config->column_types = NULL;	// only used while building the statement
+	
+	// build the statement for a full batch
+	auto_buffer_t sql[1];
+	auto_buffer_init(sql, 4096);
+	append_string(sql, "INSERT INTO ");
+	append_string(sql, table_name);
+	if(columns) {
+		append_string(sql, "(");
+		append_string(sql, columns);
+		append_string(sql, ")");
+	}
+	
+	if(config->mode == psql_insert_batch_mode_unnest) {
+		append_string(sql, " SELECT * FROM unnest(");
+		for(int i = 0; i < num_columns; ++i) {
+			const char * type_name = (params && params->column_types && params->column_types[i])?params->column_types[i]:"text";
+			char param[32] = "";
+			snprintf(param, sizeof(param), (i == 0)?"$%d::":", $%d::", i + 1);
+			append_string(sql, param);
+			append_string(sql, type_name);
+			append_string(sql, "[]");
+		}
+		append_string(sql, ")");
+		
+		batcher->arrays = calloc(num_columns, sizeof(*batcher->arrays));
+		assert(batcher->arrays);
+		for(int i = 0; i < num_columns; ++i) auto_buffer_init(&batcher->arrays[i], 4096);
+	}else {
+		append_string(sql, " VALUES ");
+		batcher->cb_prefix = sql->length;
+		append_values_list(sql, config->max_rows, num_columns);
+	}
+	if(config->on_conflict) {
+		append_string(sql, " ");
+		append_string(sql, config->on_conflict);
+	}
+	auto_buffer_push(sql, "", 1);
+	
+	batcher->sql = strndup((char *)sql->data, sql->length);
+	batcher->on_conflict = config->on_conflict?strdup(config->on_conflict):NULL;
+	config->on_conflict = batcher->on_conflict;
+	assert(batcher->sql);
+	auto_buffer_cleanup(sql);
+	
+	snprintf(batcher->stmt_name, sizeof(batcher->stmt_name), "_psql_batch_%u", ++psql->stmt_serial);
+	
+	int num_params = (config->mode == psql_insert_batch_mode_unnest)?num_columns:(num_columns * config->max_rows);
+	psql_params_builder_init(batcher->builder, num_params, 0, 0);
+	if(NULL == batcher->arrays) {
+		batcher->prepared_types = calloc(num_params, sizeof(*batcher->prepared_types));
+		assert(batcher->prepared_types);
+	}
+	insert_batcher_reset_queue(batcher);
+	return batcher;
+}
+
+void psql_insert_batcher_cleanup(psql_insert_batcher_t * batcher)
+{
+	if(NULL == batcher) return;
+	psql_context_t * psql = batcher->psql;
+	
+	if(batcher->num_queued > 0) {
+		fprintf(stderr, "[WARNING]: %s(): %d queued rows discarded, call psql_insert_batcher_flush() first.\n", 
+			__FUNCTION__, batcher->num_queued);
+	}
+	if(psql && psql->conn && batcher->prepared_generation == psql->conn_generation && batcher->prepared_generation) {
+		char command[200] = "";
+		snprintf(command, sizeof(command), "DEALLOCATE %s", batcher->stmt_name);
+		PGresult * res = psql_do_exec(psql, command);
+		PQclear(res);
+	}
+	
+	psql_params_builder_cleanup(batcher->builder);
+	if(batcher->arrays) {
+		for(int i = 0; i < batcher->num_columns; ++i) auto_buffer_cleanup(&batcher->arrays[i]);
+		free(batcher->arrays);
+		batcher->arrays = NULL;
+	}
+	free(batcher->prepared_types);
+	batcher->prepared_types = NULL;
+	free(batcher->sql);
+	batcher->sql = NULL;
+	free(batcher->on_conflict);
+	batcher->on_conflict = NULL;
+	return;
+}
+
+static int64_t insert_batcher_execute(psql_insert_batcher_t * batcher, const char * command, int use_prepared, int num_rows)
+{
+	psql_context_t * psql = batcher->psql;
+	const psql_params_t * params = batcher->builder->params;
+	PGresult * res = NULL;
+	size_t cb_types = sizeof(*params->types) * params->num_params;
+	
+	if(use_prepared && batcher->prepared_generation == psql->conn_generation 
+		&& batcher->prepared_types && memcmp(batcher->prepared_types, params->types, cb_types) != 0) 
+	{
+		use_prepared = 0;	// prepared with other param types: run this batch unnamed
+	}
+	
+	if(use_prepared) {
+		if(batcher->prepared_generation != psql->conn_generation) {
+			res = psql_do_prepare(psql, batcher->stmt_name, command, params->num_params, params->types);
+			int rc = psql_check_result(psql, res);
+			PQclear(res);
+			if(rc < 0) {
+				fprintf(stderr, "[ERROR]: %s(): prepare failed: %s\n", __FUNCTION__, psql->err_msg);
+				return -1;
+			}
+			batcher->prepared_generation = psql->conn_generation;
+			if(batcher->prepared_types) memcpy(batcher->prepared_types, params->types, cb_types);
+		}
+		res = psql_do_exec_prepared(psql, batcher->stmt_name, params);
+	}else {
+		res = psql_do_exec_params(psql, command, params);
+	}
+	
+	int rc = psql_check_result(psql, res);
+	if(rc < 0) {
+		PQclear(res);
+		fprintf(stderr, "[ERROR]: %s(): insert %d rows failed: %s\n", __FUNCTION__, num_rows, psql->err_msg);
+		return -1;
+	}
+	
+	const char * sz_affected = PQcmdTuples(res);
+	int64_t num_inserted = (sz_affected && sz_affected[0])?atoll(sz_affected):num_rows;
+	PQclear(res);
+	return num_inserted;
+}
+
+int64_t psql_insert_batcher_flush(psql_insert_batcher_t * batcher)
+{
+	assert(batcher && batcher->psql && batcher->psql->conn);
+	int num_rows = batcher->num_queued;
+	if(num_rows == 0) return 0;
+	
+	int64_t num_inserted = -1;
+	if(batcher->arrays) {
+		// unnest mode: one array literal per column, the SQL text does not depend on the number of rows
+		psql_params_builder_t * builder = batcher->builder;
+		psql_params_builder_reset(builder);
+		for(int i = 0; i < batcher->num_columns; ++i) {
+			auto_buffer_push(&batcher->arrays[i], "}", 2);	// with the terminating NUL
+			psql_params_builder_add_ref(builder, 0, batcher->arrays[i].data, -1, 0);
+		}
+		num_inserted = insert_batcher_execute(batcher, batcher->sql, 1, num_rows);
+	}else if(num_rows == batcher->params.max_rows) {
+		num_inserted = insert_batcher_execute(batcher, batcher->sql, 1, num_rows);
+	}else {
+		// partial batch: build the SQL text for num_rows, executed unnamed
+		auto_buffer_t sql[1];
+		auto_buffer_init(sql, batcher->cb_prefix + num_rows * batcher->num_columns * 8 + 256);
+		auto_buffer_push(sql, batcher->sql, batcher->cb_prefix);
+		append_values_list(sql, num_rows, batcher->num_columns);
+		if(batcher->on_conflict) {
+			append_string(sql, " ");
+			append_string(sql, batcher->on_conflict);
+		}
+		auto_buffer_push(sql, "", 1);
+		num_inserted = insert_batcher_execute(batcher, (char *)sql->data, 0, num_rows);
+		auto_buffer_cleanup(sql);
+	}
+	
+	++batcher->num_batches;
+	if(num_inserted < 0) batcher->num_failed += num_rows;
+	else batcher->num_inserted += num_inserted;
+	
+	insert_batcher_reset_queue(batcher);
+	return num_inserted;
+}
+
+/*
+ * psql_insert_batcher_add(): 
+ *   queues one row, 'row' is what would have been passed to psql_exec_prepared().
+ *   values are copied, so the caller can reuse its buffers immediately.
+ * returns 0 if the row was queued (and any triggered flush succeeded), -1 on error.
+ */
+int psql_insert_batcher_add(psql_insert_batcher_t * batcher, const psql_params_t * row)
+{
+	assert(batcher && row);
+	if(row->num_params != batcher->num_columns) {
+		fprintf(stderr, "[ERROR]: %s(): num_params mismatch: %d (expected %d)\n", 
+			__FUNCTION__, row->num_params, batcher->num_columns);
+		return -1;
+	}
+	
+	// a row is queued entirely or not at all, a partial row would misalign all the following ones
+	if(batcher->arrays && row->value_formats) {
+		for(int i = 0; i < row->num_params; ++i) {
+			if(row->value_formats[i] == 0) continue;
+			fprintf(stderr, "[ERROR]: %s(): binary values are not supported in unnest mode.\n", __FUNCTION__);
+			return -1;
+		}
+	}
+	psql_params_builder_t * builder = batcher->builder;
+	int row_start = builder->params->num_params;
+	size_t data_start = builder->data_length;
+	
+	size_t num_bytes = 0;
+	for(int i = 0; i < row->num_params; ++i) {
+		const char * value = row->values[i];
+		int value_format = row->value_formats?row->value_formats[i]:0;
+		int cb_value = (row->cb_values && value_format)?row->cb_values[i]:-1;
+		if(value && cb_value < 0) cb_value = strlen(value);
+		
+		if(batcher->arrays) {
+			size_t length = batcher->arrays[i].length;
+			append_array_element(&batcher->arrays[i], value, cb_value);
+			num_bytes += batcher->arrays[i].length - length;
+		}else {
+			unsigned int type = row->types?row->types[i]:0;
+			int rc = psql_params_builder_add(builder, type, value, cb_value, value_format);
+			if(rc < 0) {
+				builder->params->num_params = row_start;
+				builder->data_length = data_start;
+				return -1;
+			}
+			num_bytes += value?cb_value:0;
+		}
+	}
+	if(batcher->num_queued == 0) batcher->first_row_time = psql_get_time();
+	++batcher->num_queued;
+	++batcher->num_rows;
+	batcher->num_bytes += num_bytes;
+	
+	if(batcher->num_queued >= batcher->params.max_rows 
+		|| batcher->num_bytes >= batcher->params.max_bytes) 
+	{
+		if(psql_insert_batcher_flush(batcher) < 0) return -1;
+		return 0;
+	}
+	return psql_insert_batcher_poll(batcher);
+}
+
+int psql_insert_batcher_add_values(psql_insert_batcher_t * batcher, const char ** values)
+{
+	psql_params_t row[1] = {{
+		.num_params = batcher->num_columns,
+		.values = values,
+	}};
+	return psql_insert_batcher_add(batcher, row);
+}
+
+/*
+ * psql_insert_batcher_poll(): 
+ *   flushes the queued rows if the oldest one has been waiting for flush_interval_ms.
+ *   can be called from the caller's idle loop.
+ */
+int psql_insert_batcher_poll(psql_insert_batcher_t * batcher)
+{
+	assert(batcher);
+	if(batcher->num_queued == 0 || batcher->params.flush_interval_ms <= 0) return 0;
+	
+	double elapsed = psql_get_time() - batcher->first_row_time;
+	if(elapsed * 1000.0 < (double)batcher->params.flush_interval_ms) return 0;
+	if(psql_insert_batcher_flush(batcher) < 0) return -1;
+	return 0;
+}
+
+#undef PSQL_INSERT_BATCHER_DEFAULT_MAX_ROWS
+#undef PSQL_INSERT_BATCHER_DEFAULT_MAX_BYTES
+#undef PSQL_MAX_BIND_PARAMS
+
+/* *********************************** **
+ * Auto-prepared Statements Cache
+ * 	statements executed by psql_exec_cached() are tracked by their SQL text.
+ * 	once a statement has been executed auto_prepare_threshold times, 
+ * 	it is prepared on the server and executed with PQexecPrepared().
+** *********************************** */
+#define PSQL_STMT_CACHE_DEFAULT_CAPACITY (256)
+#define PSQL_STMT_CACHE_MAX_ENTRIES(psql) ((psql)->stmt_cache_capacity * 4)
+#define PSQL_STMT_CACHE_MAX_PENDING_DEALLOCS (256)
+
+typedef struct psql_stmt_cache_entry
+{
+	uint64_t hash;
+	char * sql;
+	int num_types;	// param types the statement was prepared with, trailing 0s (unspecified) trimmed
+	unsigned int * types;
+	char stmt_name[32];
+	
+	int64_t exec_count;
+	uint64_t prepared_generation;	// 0: not prepared
+	
+	struct psql_stmt_cache_entry * prev;
+	struct psql_stmt_cache_entry * next;
+}psql_stmt_cache_entry_t;
+
+static void psql_stmt_cache_entry_free(void * _entry)
+{
+	psql_stmt_cache_entry_t * entry = _entry;
+	if(NULL == entry) return;
+	free(entry->sql);
+	free(entry->types);
+	free(entry);
+}
+
+static int psql_stmt_cache_entry_compare(const void * _a, const void * _b)
+{
+	const psql_stmt_cache_entry_t * a = _a;
+	const psql_stmt_cache_entry_t * b = _b;
+	if(a->hash != b->hash) return (a->hash < b->hash)?-1:1;
+	int rc = strcmp(a->sql, b->sql);
+	if(rc) return rc;
+	if(a->num_types != b->num_types) return (a->num_types < b->num_types)?-1:1;
+	if(a->num_types == 0) return 0;
+	return memcmp(a->types, b->types, sizeof(*a->types) * a->num_types);
+}
+
+static inline uint64_t hash_fnv1a(const char * text)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+	for(const unsigned char * p = (const unsigned char *)text; *p; ++p) {
+		hash ^= *p;
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+// the same SQL text prepared with different param types is a different statement
+static uint64_t stmt_cache_key_hash(const char * sql, const unsigned int * types, int num_types)
+{
+	uint64_t hash = hash_fnv1a(sql);
+	const unsigned char * p = (const unsigned char *)types;
+	for(size_t i = 0; i < sizeof(*types) * num_types; ++i) {
+		hash ^= p[i];
+		hash *= UINT64_C(0x100000001b3);
+	}
+	return hash;
+}
+
+static int stmt_cache_key_num_types(const psql_params_t * params)
+{
+	if(NULL == params->types) return 0;
+	int num_types = params->num_params;
+	while(num_types > 0 && 0 == params->types[num_types - 1]) --num_types;
+	return num_types;
+}
+
+static void stmt_cache_lru_unlink(psql_context_t * psql, psql_stmt_cache_entry_t * entry)
+{
+	if(entry->prev) entry->prev->next = entry->next;
+	else psql->lru_head = entry->next;
+	if(entry->next) entry->next->prev = entry->prev;
+	else psql->lru_tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static void stmt_cache_lru_push_front(psql_context_t * psql, psql_stmt_cache_entry_t * entry)
+{
+	entry->prev = NULL;
+	entry->next = psql->lru_head;
+	if(psql->lru_head) psql->lru_head->prev = entry;
+	psql->lru_head = entry;
+	if(NULL == psql->lru_tail) psql->lru_tail = entry;
+}
+
+static inline int stmt_cache_entry_is_prepared(const psql_context_t * psql, const psql_stmt_cache_entry_t * entry)
+{
+	return entry->prepared_generation != 0 && entry->prepared_generation == psql->conn_generation;
+}
+
+/*
+ * DEALLOCATE only runs outside of a transaction block: 
+ * it fails in an aborted transaction, and its failure would abort a healthy one.
+ * the names are kept until the statements are really gone from the server.
+ * all pending names go in one round trip; if any of them fails, 
+ * the remaining ones are retried one by one.
+ */
+static void stmt_cache_flush_deallocs(psql_context_t * psql)
+{
+	PGconn * conn = psql->conn;
+	if(0 == psql->num_pending_deallocs || NULL == conn || psql->pipeline_mode) return;
+	if(PQtransactionStatus(conn) != PQTRANS_IDLE) return;
+	
+	char * command = malloc((sizeof(psql->pending_deallocs[0]) + 16) * psql->num_pending_deallocs + 1);
+	assert(command);
+	char * p = command;
+	for(int i = 0; i < psql->num_pending_deallocs; ++i) {
+		p += sprintf(p, "DEALLOCATE \"%s\";", psql->pending_deallocs[i]);
+	}
+	PGresult * res = psql_do_exec(psql, command);
+	int done = (PQresultStatus(res) == PGRES_COMMAND_OK);
+	PQclear(res);
+	free(command);
+	if(done) {
+		psql->num_pending_deallocs = 0;
+		return;
+	}
+	
+	int num_left = 0;
+	for(int i = 0; i < psql->num_pending_deallocs; ++i) {
+		char command[64] = "";
+		snprintf(command, sizeof(command), "DEALLOCATE \"%s\";", psql->pending_deallocs[i]);
+		PGresult * res = psql_do_exec(psql, command);
+		const char * sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+		int done = (PQresultStatus(res) == PGRES_COMMAND_OK) 
+			|| (sqlstate && 0 == strcmp(sqlstate, "26000"));	// already gone (e.g. DISCARD ALL)
+		PQclear(res);
+		if(!done) {
+			if(i != num_left) memcpy(psql->pending_deallocs[num_left], psql->pending_deallocs[i], sizeof(psql->pending_deallocs[0]));
+			++num_left;
+		}
+	}
+	psql->num_pending_deallocs = num_left;
+}
+
+/*
+ * evicting a prepared statement needs room in the pending DEALLOCATE list: 
+ * once it is full (a long transaction), statements stay prepared until it ends.
+ * only the automatic evictions are bounded, an explicit removal (psql_stmt_cache_clear()) 
+ * always goes through and may grow the list past the cap, by at most the cache capacity.
+ */
+static inline int stmt_cache_can_evict(const psql_context_t * psql)
+{
+	return psql->num_pending_deallocs < PSQL_STMT_CACHE_MAX_PENDING_DEALLOCS;
+}
+
+static void stmt_cache_deallocate(psql_context_t * psql, psql_stmt_cache_entry_t * entry)
+{
+	if(!stmt_cache_entry_is_prepared(psql, entry)) {
+		entry->prepared_generation = 0;
+		return;
+	}
+	
+	if(psql->conn) {
+		if(psql->num_pending_deallocs == psql->max_pending_deallocs) {
+			psql->max_pending_deallocs = psql->max_pending_deallocs?(psql->max_pending_deallocs * 2):16;
+			psql->pending_deallocs = realloc(psql->pending_deallocs, sizeof(*psql->pending_deallocs) * psql->max_pending_deallocs);
+			assert(psql->pending_deallocs);
+		}
+		memcpy(psql->pending_deallocs[psql->num_pending_deallocs++], entry->stmt_name, sizeof(psql->pending_deallocs[0]));
+		stmt_cache_flush_deallocs(psql);
+	}
+	
+	entry->prepared_generation = 0;
+	--psql->num_prepared;
+	++psql->stmt_cache_stats.num_evictions;
+}
+
+static void stmt_cache_remove(psql_context_t * psql, psql_stmt_cache_entry_t * entry)
+{
+	stmt_cache_deallocate(psql, entry);
+	stmt_cache_lru_unlink(psql, entry);
+	avl_tree_del(psql->named_params_tree, entry, psql_stmt_cache_entry_compare);
+	psql_stmt_cache_entry_free(entry);
+}
+
+// least recently used entry that can be dropped: prepared ones only while they can be evicted
+static psql_stmt_cache_entry_t * stmt_cache_find_victim(psql_context_t * psql, const psql_stmt_cache_entry_t * keep)
+{
+	int can_evict = stmt_cache_can_evict(psql);
+	for(psql_stmt_cache_entry_t * victim = psql->lru_tail; victim; victim = victim->prev) {
+		if(victim == keep) continue;
+		if(can_evict || !stmt_cache_entry_is_prepared(psql, victim)) return victim;
+	}
+	return NULL;
+}
+
+int psql_stmt_cache_configure(psql_context_t * psql, int auto_prepare_threshold, int capacity)
+{
+	assert(psql);
+	if(auto_prepare_threshold < 0) auto_prepare_threshold = 0;
+	if(capacity <= 0) capacity = PSQL_STMT_CACHE_DEFAULT_CAPACITY;
+	
+	psql->auto_prepare_threshold = auto_prepare_threshold;
+	psql->stmt_cache_capacity = capacity;
+	
+	// shrink
+	while(psql->lru_tail && psql->named_params_tree->count > PSQL_STMT_CACHE_MAX_ENTRIES(psql)) {
+		psql_stmt_cache_entry_t * victim = stmt_cache_find_victim(psql, NULL);
+		if(NULL == victim) break;
+		stmt_cache_remove(psql, victim);
+	}
+	for(psql_stmt_cache_entry_t * entry = psql->lru_tail; entry && psql->num_prepared > capacity; entry = entry->prev) {
+		if(!stmt_cache_can_evict(psql)) break;	// the rest are evicted by later psql_exec_cached() calls
+		stmt_cache_deallocate(psql, entry);
+	}
+	return 0;
+}
+
+void psql_stmt_cache_clear(psql_context_t * psql)
+{
+	assert(psql);
+	while(psql->lru_tail) stmt_cache_remove(psql, psql->lru_tail);
+	psql->num_prepared = 0;
+}
+
+int psql_stmt_cache_get_stats(psql_context_t * psql, psql_stmt_cache_stats_t * stats)
+{
+	assert(psql && stats);
+	*stats = psql->stmt_cache_stats;
+	stats->num_entries = psql->named_params_tree->count;
+	stats->num_prepared = psql->num_prepared;
+	stats->num_pending_deallocs = psql->num_pending_deallocs;
+	return 0;
+}
+
+static psql_stmt_cache_entry_t * stmt_cache_lookup(psql_context_t * psql, const char * command, const psql_params_t * params)
+{
+	psql_stmt_cache_entry_t key = { .sql = (char *)command, .num_types = stmt_cache_key_num_types(params), .types = params->types };
+	key.hash = stmt_cache_key_hash(command, key.types, key.num_types);
+	struct avl_node * node = avl_tree_find(psql->named_params_tree, &key, psql_stmt_cache_entry_compare);
+	if(node) {
+		psql_stmt_cache_entry_t * entry = avl_node_get_data(node);
+		if(entry != psql->lru_head) {
+			stmt_cache_lru_unlink(psql, entry);
+			stmt_cache_lru_push_front(psql, entry);
+		}
+		return entry;
+	}
+	
+	// keep the number of tracked statements bounded
+	while(psql->lru_tail && psql->named_params_tree->count >= PSQL_STMT_CACHE_MAX_ENTRIES(psql)) {
+		psql_stmt_cache_entry_t * victim = stmt_cache_find_victim(psql, NULL);
+		if(NULL == victim) break;
+		stmt_cache_remove(psql, victim);
+	}
+	
+	psql_stmt_cache_entry_t * entry = calloc(1, sizeof(*entry));
+	assert(entry);
+	entry->hash = key.hash;
+	entry->sql = strdup(command);
+	assert(entry->sql);
+	if(key.num_types > 0) {
+		entry->num_types = key.num_types;
+		entry->types = malloc(sizeof(*entry->types) * key.num_types);
+		assert(entry->types);
+		memcpy(entry->types, key.types, sizeof(*entry->types) * key.num_types);
+	}
+	snprintf(entry->stmt_name, sizeof(entry->stmt_name), "_psql_auto_%u", ++psql->stmt_serial);
+	
+	node = avl_tree_add(psql->named_params_tree, entry, psql_stmt_cache_entry_compare);
+	assert(node);
+	stmt_cache_lru_push_front(psql, entry);
+	return entry;
+}
+
+static int stmt_cache_prepare(psql_context_t * psql, psql_stmt_cache_entry_t * entry, const psql_params_t * params)
+{
+	// evict the least recently used prepared statement
+	if(psql->num_prepared >= psql->stmt_cache_capacity) {
+		if(!stmt_cache_can_evict(psql)) return -1;	// run unprepared until the transaction ends
+		for(psql_stmt_cache_entry_t * victim = psql->lru_tail; victim; victim = victim->prev) {
+			if(victim != entry && stmt_cache_entry_is_prepared(psql, victim)) {
+				stmt_cache_deallocate(psql, victim);
+				break;
+			}
+		}
+	}
+	
+	PGresult * res = psql_do_prepare(psql, entry->stmt_name, entry->sql, 
+		entry->num_types, entry->types);
+	int rc = psql_check_result(psql, res);
+	PQclear(res);
+	if(rc < 0) return -1;
+	
+	entry->prepared_generation = psql->conn_generation;
+	++psql->num_prepared;
+	++psql->stmt_cache_stats.num_prepares;
+	return 0;
+}
+
+/*
+ * psql_exec_cached(): same as psql_exec_params(), 
+ *   but frequently executed statements are transparently prepared.
+ */
+int psql_exec_cached(psql_context_t * psql, const char * command, const psql_params_t * params, psql_result_t * p_result)
+{
+	assert(psql && psql->conn && command);
+	static const psql_params_t empty_params[1];
+	if(NULL == params) params = empty_params;
+	
+	if(psql->auto_prepare_threshold <= 0 || psql->pipeline_mode) {
+		return psql_exec_params(psql, command, params, p_result);
+	}
+	if(psql->stmt_cache_capacity <= 0) psql->stmt_cache_capacity = PSQL_STMT_CACHE_DEFAULT_CAPACITY;
+	if(psql->num_pending_deallocs > 0) stmt_cache_flush_deallocs(psql);
+	
+	psql_stmt_cache_entry_t * entry = stmt_cache_lookup(psql, command, params);
+	++entry->exec_count;
+	
+	if(!stmt_cache_entry_is_prepared(psql, entry)) {
+		if(entry->prepared_generation) {	// the connection has been reset
+			entry->prepared_generation = 0;
+		}
+		if(entry->exec_count < psql->auto_prepare_threshold || stmt_cache_prepare(psql, entry, params) != 0) {
+			++psql->stmt_cache_stats.num_misses;
+			return psql_exec_params(psql, command, params, p_result);
+		}
+	}else {
+		++psql->stmt_cache_stats.num_hits;
+	}
+	
+	PGresult * res = psql_do_exec_prepared(psql, entry->stmt_name, params);
+	if(psql_check_result(psql, res) < 0) {
+		const char * sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+		if(sqlstate && strcmp(sqlstate, "26000") == 0) {
+			// invalid_sql_statement_name: deallocated by someone else (eg. DISCARD ALL), re-prepare next time
+			entry->prepared_generation = 0;
+			--psql->num_prepared;
+			
+			// inside a transaction block the failed EXECUTE has aborted it, a retry cannot succeed
+			if(PQtransactionStatus(psql->conn) == PQTRANS_IDLE) {
+				PQclear(res);
+				return psql_exec_params(psql, command, params, p_result);
+			}
+		}
+		fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+		PQclear(res);
+		return -1;
+	}
+	
+	if(p_result) *p_result = res;
+	else PQclear(res);
+	return 0;
+}
+#undef PSQL_STMT_CACHE_MAX_PENDING_DEALLOCS
+#undef PSQL_STMT_CACHE_MAX_ENTRIES
+#undef PSQL_STMT_CACHE_DEFAULT_CAPACITY
+
+/* *********************************** **
+ * Result Cache
+ * 	client-side cache of PGresults keyed by (SQL, params), bounded by TTL and bytes.
+ * 	entries are tagged (e.g. by table name), each tag has a version number: 
+ * 	invalidating a tag only bumps its version, stale entries are dropped lazily.
+ * 	tags are also NOTIFY channels, so server-side triggers drive the invalidation.
+** *********************************** */
+#define PSQL_RESULT_CACHE_DEFAULT_TTL_MS (60 * 1000)
+#define PSQL_RESULT_CACHE_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+#define PSQL_RESULT_CACHE_DEFAULT_POLL_INTERVAL_MS (100)
+
+typedef struct psql_cache_tag
+{
+	char * name;
+	uint64_t version;
+}psql_cache_tag_t;
+
+typedef struct psql_cache_entry_tag
+{
+	psql_cache_tag_t * tag;
+	uint64_t version;		// tag->version when the entry was stored
+}psql_cache_entry_tag_t;
+
+typedef struct psql_result_cache_entry
+{
+	uint64_t hash;
+	size_t cb_key;
+	unsigned char * key;	// serialized (SQL, params)
+	
+	PGresult * res;
+	size_t num_bytes;
+	double expire_time;
+	
+	int num_tags;
+	psql_cache_entry_tag_t * tags;
+	
+	struct psql_result_cache_entry * prev;
+	struct psql_result_cache_entry * next;
+}psql_result_cache_entry_t;
+
+struct psql_result_cache
+{
+	pthread_mutex_t mutex;
+	psql_result_cache_params_t params;
+	
+	avl_tree_t entries[1];
+	avl_tree_t tags[1];
+	psql_result_cache_entry_t * lru_head;
+	psql_result_cache_entry_t * lru_tail;
+	size_t num_bytes;
+	
+	psql_context_t * listener;	// nullable, the connection which LISTENs on the tags
+	int listener_failed;		// no invalidation source: the cache is bypassed until psql_result_cache_listen() restores it
+	double last_poll_time;
+	
+	psql_result_cache_stats_t stats;
+};
+
+static int result_cache_entry_compare(const void * _a, const void * _b)
+{
+	const psql_result_cache_entry_t * a = _a;
+	const psql_result_cache_entry_t * b = _b;
+	if(a->hash != b->hash) return (a->hash < b->hash)?-1:1;
+	if(a->cb_key != b->cb_key) return (a->cb_key < b->cb_key)?-1:1;
+	return memcmp(a->key, b->key, a->cb_key);
+}
+
+static int result_cache_tag_compare(const void * _a, const void * _b)
+{
+	const psql_cache_tag_t * a = _a;
+	const psql_cache_tag_t * b = _b;
+	return strcmp(a->name, b->name);
+}
+
+static void result_cache_entry_free(void * _entry)
+{
+	psql_result_cache_entry_t * entry = _entry;
+	if(NULL == entry) return;
+	if(entry->res) PQclear(entry->res);
+	free(entry->key);
+	free(entry->tags);
+	free(entry);
+}
+
+static void result_cache_tag_free(void * _tag)
+{
+	psql_cache_tag_t * tag = _tag;
+	if(NULL == tag) return;
+	free(tag->name);
+	free(tag);
+}
+
+static void result_cache_lru_unlink(psql_result_cache_t * cache, psql_result_cache_entry_t * entry)
+{
+	if(entry->prev) entry->prev->next = entry->next;
+	else cache->lru_head = entry->next;
+	if(entry->next) entry->next->prev = entry->prev;
+	else cache->lru_tail = entry->prev;
+	entry->prev = entry->next = NULL;
+}
+
+static void result_cache_lru_push_front(psql_result_cache_t * cache, psql_result_cache_entry_t * entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->lru_head;
+	if(cache->lru_head) cache->lru_head->prev = entry;
+	cache->lru_head = entry;
+	if(NULL == cache->lru_tail) cache->lru_tail = entry;
+}
+
+static void result_cache_remove(psql_result_cache_t * cache, psql_result_cache_entry_t * entry)
+{
+	result_cache_lru_unlink(cache, entry);
+	avl_tree_del(cache->entries, entry, result_cache_entry_compare);
+	cache->num_bytes -= entry->num_bytes;
+	result_cache_entry_free(entry);
+}
+
+static psql_cache_tag_t * result_cache_get_tag(psql_result_cache_t * cache, const char * name, int create)
+{
+	psql_cache_tag_t key = { .name = (char *)name };
+	struct avl_node * node = avl_tree_find(cache->tags, &key, result_cache_tag_compare);
+	if(node) return avl_node_get_data(node);
+	if(!create) return NULL;
+	
+	psql_cache_tag_t * tag = calloc(1, sizeof(*tag));
+	assert(tag);
+	tag->name = strdup(name);
+	tag->version = 1;
+	assert(tag->name);
+	node = avl_tree_add(cache->tags, tag, result_cache_tag_compare);
+	assert(node);
+	return tag;
+}
+
+static int result_cache_entry_is_valid(const psql_result_cache_entry_t * entry, double now)
+{
+	if(now >= entry->expire_time) return 0;
+	for(int i = 0; i < entry->num_tags; ++i) {
+		if(entry->tags[i].version != entry->tags[i].tag->version) return 0;
+	}
+	return 1;
+}
+
+/* (SQL, result_format, [type, format, length, value] x num_params) */
+static void result_cache_serialize_key(auto_buffer_t * buf, const char * command, const psql_params_t * params)
+{
+	auto_buffer_push(buf, command, strlen(command) + 1);
+	int32_t header[2] = { params->num_params, params->result_format };
+	auto_buffer_push(buf, header, sizeof(header));
+	for(int i = 0; i < params->num_params; ++i) {
+		const char * value = params->values?params->values[i]:NULL;
+		int32_t format = params->value_formats?params->value_formats[i]:0;
+		int32_t length = -1;
+		if(value) length = (format && params->cb_values)?params->cb_values[i]:(int32_t)strlen(value);
+		
+		int32_t desc[3] = { params->types?(int32_t)params->types[i]:0, format, length };
+		auto_buffer_push(buf, desc, sizeof(desc));
+		if(length > 0) auto_buffer_push(buf, value, length);
+	}
+}
+
+static size_t result_estimate_bytes(const PGresult * res)
+{
+	int num_rows = PQntuples(res);
+	int num_fields = PQnfields(res);
+	size_t num_bytes = sizeof(PGresult *) + (size_t)num_fields * 64;	// field descriptors
+	for(int row = 0; row < num_rows; ++row) {
+		num_bytes += (size_t)num_fields * (sizeof(void *) + sizeof(int));	// per-value overhead inside libpq
+		for(int col = 0; col < num_fields; ++col) num_bytes += PQgetlength(res, row, col) + 1;
+	}
+	return num_bytes;
+}
+
+static inline PGresult * result_copy(const PGresult * res)
+{
+	return PQcopyResult(res, PG_COPYRES_ATTRS | PG_COPYRES_TUPLES);
+}
+
+psql_result_cache_t * psql_result_cache_init(psql_result_cache_t * cache, const psql_result_cache_params_t * params)
+{
+	if(NULL == cache) cache = calloc(1, sizeof(*cache));
+	else memset(cache, 0, sizeof(*cache));
+	assert(cache);
+	
+	if(params) cache->params = *params;
+	if(cache->params.ttl_ms <= 0) cache->params.ttl_ms = PSQL_RESULT_CACHE_DEFAULT_TTL_MS;
+	if(cache->params.max_bytes == 0) cache->params.max_bytes = PSQL_RESULT_CACHE_DEFAULT_MAX_BYTES;
+	if(cache->params.poll_interval_ms <= 0) cache->params.poll_interval_ms = PSQL_RESULT_CACHE_DEFAULT_POLL_INTERVAL_MS;
+	
+	pthread_mutex_init(&cache->mutex, NULL);
+	avl_tree_init(cache->entries, cache);
+	cache->entries->on_free_data = result_cache_entry_free;
+	avl_tree_init(cache->tags, cache);
+	cache->tags->on_free_data = result_cache_tag_free;
+	return cache;
+}
+
+void psql_result_cache_cleanup(psql_result_cache_t * cache)
+{
+	if(NULL == cache) return;
+	avl_tree_cleanup(cache->entries);
+	avl_tree_cleanup(cache->tags);
+	cache->lru_head = cache->lru_tail = NULL;
+	cache->num_bytes = 0;
+	cache->listener = NULL;
+	pthread_mutex_destroy(&cache->mutex);
+}
+
+static int result_cache_listen_locked(psql_result_cache_t * cache, psql_context_t * listener, const char * tag)
+{
+	char * channel = PQescapeIdentifier(listener->conn, tag, strlen(tag));
+	if(NULL == channel) return -1;
+	char command[PATH_MAX] = "";
+	snprintf(command, sizeof(command), "LISTEN %s", channel);
+	PQfreemem(channel);
+	return psql_execute(listener, command, NULL);
+}
+
+/*
+ * psql_result_cache_listen(): 
+ *   LISTEN on the channel 'tag' with the (dedicated) listener connection.
+ *   all tags must use the same listener connection, 
+ *   unless the listener has failed: then the (reconnected or new) listener LISTENs on all known tags again.
+ */
+int psql_result_cache_listen(psql_result_cache_t * cache, psql_context_t * listener, const char * tag)
+{
+	assert(cache && listener && listener->conn && tag);
+	
+	pthread_mutex_lock(&cache->mutex);
+	if(cache->listener && cache->listener != listener && !cache->listener_failed) {
+		pthread_mutex_unlock(&cache->mutex);
+		return -1;
+	}
+	
+	int rc = 0;
+	if(cache->listener_failed) {
+		// results cached before the failure have already been dropped, nothing was stored since
+		for(struct avl_node * node = avl_tree_iter_begin(cache->tags); node && 0 == rc; node = avl_tree_iter_next(cache->tags)) {
+			psql_cache_tag_t * known_tag = avl_node_get_data(node);
+			rc = result_cache_listen_locked(cache, listener, known_tag->name);
+		}
+	}
+	if(0 == rc) rc = result_cache_listen_locked(cache, listener, tag);
+	if(0 == rc) {
+		cache->listener = listener;
+		cache->listener_failed = 0;
+		result_cache_get_tag(cache, tag, 1);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+	return rc;
+}
+
+static void result_cache_invalidate_locked(psql_result_cache_t * cache, const char * name)
+{
+	if(NULL == name) {
+		while(cache->lru_tail) result_cache_remove(cache, cache->lru_tail);
+		++cache->stats.num_invalidations;
+		return;
+	}
+	psql_cache_tag_t * tag = result_cache_get_tag(cache, name, 0);
+	if(NULL == tag) return;
+	++tag->version;
+	++cache->stats.num_invalidations;
+}
+
+void psql_result_cache_invalidate(psql_result_cache_t * cache, const char * tag)
+{
+	assert(cache);
+	pthread_mutex_lock(&cache->mutex);
+	result_cache_invalidate_locked(cache, tag);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/* drains pending notifications without blocking: the channel (and a non-empty payload) name the tags */
+static int result_cache_poll_locked(psql_result_cache_t * cache, double now)
+{
+	cache->last_poll_time = now;
+	psql_context_t * listener = cache->listener;
+	if(cache->listener_failed) return -1;
+	if(NULL == listener || NULL == listener->conn) return 0;
+	
+	if(!PQconsumeInput(listener->conn)) {
+		// the listener is gone: nothing guarantees the cached results anymore, 
+		// and nothing would invalidate new ones.
+		psql_set_conn_error(listener);
+		fprintf(stderr, "[ERROR]: result cache listener: %s\n", listener->err_msg);
+		result_cache_invalidate_locked(cache, NULL);
+		cache->listener_failed = 1;
+		return -1;
+	}
+	
+	int num_notifies = 0;
+	PGnotify * notify = NULL;
+	while((notify = PQnotifies(listener->conn))) {
+		result_cache_invalidate_locked(cache, notify->relname);
+		if(notify->extra && notify->extra[0]) result_cache_invalidate_locked(cache, notify->extra);
+		PQfreemem(notify);
+		++num_notifies;
+	}
+	return num_notifies;
+}
+
+int psql_result_cache_poll(psql_result_cache_t * cache)
+{
+	assert(cache);
+	pthread_mutex_lock(&cache->mutex);
+	int rc = result_cache_poll_locked(cache, psql_get_time());
+	pthread_mutex_unlock(&cache->mutex);
+	return rc;
+}
+
+/*
+ * on a miss, *p_snapshot receives the versions of the tags before the query runs: 
+ * an invalidation that arrives while it runs must make the stored result stale.
+ * *p_snapshot stays NULL when the result must not be stored (no invalidation source).
+ */
+static PGresult * result_cache_lookup(psql_result_cache_t * cache, psql_result_cache_entry_t * key, double now, 
+	const char ** tags, int num_tags, psql_cache_entry_tag_t ** p_snapshot)
+{
+	PGresult * res = NULL;
+	*p_snapshot = NULL;
+	pthread_mutex_lock(&cache->mutex);
+	if(cache->listener && (now - cache->last_poll_time) * 1000.0 >= cache->params.poll_interval_ms) {
+		result_cache_poll_locked(cache, now);
+	}
+	if(cache->listener_failed) {	// bypass the cache
+		++cache->stats.num_misses;
+		pthread_mutex_unlock(&cache->mutex);
+		return NULL;
+	}
+	
+	struct avl_node * node = avl_tree_find(cache->entries, key, result_cache_entry_compare);
+	if(node) {
+		psql_result_cache_entry_t * entry = avl_node_get_data(node);
+		if(result_cache_entry_is_valid(entry, now)) {
+			res = result_copy(entry->res);
+			if(entry != cache->lru_head) {
+				result_cache_lru_unlink(cache, entry);
+				result_cache_lru_push_front(cache, entry);
+			}
+			++cache->stats.num_hits;
+		}else {
+			result_cache_remove(cache, entry);
+			++cache->stats.num_stale;
+		}
+	}
+	if(NULL == res) {
+		++cache->stats.num_misses;
+		psql_cache_entry_tag_t * snapshot = calloc(num_tags + 1, sizeof(*snapshot));
+		assert(snapshot);
+		for(int i = 0; i < num_tags; ++i) {
+			snapshot[i].tag = result_cache_get_tag(cache, tags[i], 1);
+			snapshot[i].version = snapshot[i].tag->version;
+		}
+		*p_snapshot = snapshot;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+	return res;
+}
+
+/* takes the ownership of res and of the tag versions snapshot taken by the lookup */
+static void result_cache_store(psql_result_cache_t * cache, psql_result_cache_entry_t * key, 
+	PGresult * res, psql_cache_entry_tag_t * snapshot, int num_tags, double now)
+{
+	size_t num_bytes = result_estimate_bytes(res) + key->cb_key + sizeof(*key) + num_tags * sizeof(psql_cache_entry_tag_t);
+	if(num_bytes > cache->params.max_bytes / 4) {	// never let a single result flush most of the cache
+		PQclear(res);
+		free(snapshot);
+		return;
+	}
+	
+	psql_result_cache_entry_t * entry = calloc(1, sizeof(*entry));
+	assert(entry);
+	entry->hash = key->hash;
+	entry->cb_key = key->cb_key;
+	entry->key = malloc(key->cb_key);
+	assert(entry->key);
+	memcpy(entry->key, key->key, key->cb_key);
+	entry->res = res;
+	entry->num_bytes = num_bytes;
+	entry->expire_time = now + (double)cache->params.ttl_ms / 1000.0;
+	entry->tags = snapshot;
+	entry->num_tags = num_tags;
+	
+	pthread_mutex_lock(&cache->mutex);
+	if(cache->listener_failed) {	// the listener failed while the query was running
+		pthread_mutex_unlock(&cache->mutex);
+		result_cache_entry_free(entry);
+		return;
+	}
+	
+	// replace an existing (stale) entry
+	struct avl_node * node = avl_tree_find(cache->entries, entry, result_cache_entry_compare);
+	if(node) result_cache_remove(cache, avl_node_get_data(node));
+	
+	while(cache->lru_tail && (cache->num_bytes + num_bytes) > cache->params.max_bytes) {
+		result_cache_remove(cache, cache->lru_tail);
+		++cache->stats.num_evictions;
+	}
+	
+	node = avl_tree_add(cache->entries, entry, result_cache_entry_compare);
+	assert(node);
+	result_cache_lru_push_front(cache, entry);
+	cache->num_bytes += num_bytes;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/*
+ * psql_result_cache_exec(): 
+ *   same as psql_exec_params(), but successful row-returning results are served from the cache.
+ *   @tags: the tables (NOTIFY channels) the result depends on, nullable.
+ *   the caller owns *p_result in both cases.
+ */
+int psql_result_cache_exec(psql_result_cache_t * cache, psql_context_t * psql, 
+	const char * command, const psql_params_t * params, 
+	const char ** tags, int num_tags, 
+	psql_result_t * p_result)
+{
+	assert(cache && psql && psql->conn && command);
+	static const psql_params_t empty_params[1];
+	if(NULL == params) params = empty_params;
+	
+	auto_buffer_t buf[1];
+	auto_buffer_init(buf, 0);
+	result_cache_serialize_key(buf, command, params);
+	psql_result_cache_entry_t key = {
+		.hash = hash_fnv1a_bytes(buf->data, buf->length),
+		.cb_key = buf->length,
+		.key = buf->data,
+	};
+	
+	if(NULL == tags) num_tags = 0;
+	double now = psql_get_time();
+	psql_cache_entry_tag_t * snapshot = NULL;
+	PGresult * res = result_cache_lookup(cache, &key, now, tags, num_tags, &snapshot);
+	if(res) {
+		auto_buffer_cleanup(buf);
+		if(p_result) *p_result = res;
+		else PQclear(res);
+		return 0;
+	}
+	
+	psql_result_t result = NULL;
+	int rc = psql_exec_params(psql, command, params, &result);
+	if(snapshot && 0 == rc && PQresultStatus(result) == PGRES_TUPLES_OK) {
+		PGresult * copy = result_copy(result);
+		if(copy) result_cache_store(cache, &key, copy, snapshot, num_tags, now);
+		else free(snapshot);
+	}else {
+		free(snapshot);
+	}
+	auto_buffer_cleanup(buf);
+	
+	if(p_result) *p_result = result;
+	else psql_result_clear(&result);
+	return rc;
+}
+
+int psql_result_cache_get_stats(psql_result_cache_t * cache, psql_result_cache_stats_t * stats)
+{
+	assert(cache && stats);
+	pthread_mutex_lock(&cache->mutex);
+	*stats = cache->stats;
+	stats->num_entries = cache->entries->count;
+	stats->num_bytes = cache->num_bytes;
+	pthread_mutex_unlock(&cache->mutex);
+	return 0;
+}
+
+#undef PSQL_RESULT_CACHE_DEFAULT_TTL_MS
+#undef PSQL_RESULT_CACHE_DEFAULT_MAX_BYTES
+#undef PSQL_RESULT_CACHE_DEFAULT_POLL_INTERVAL_MS
+
+/* *********************************** **
+ * Notification Dispatcher
+ * 	a background thread owns a dedicated connection, LISTENs on the subscribed channels
+ * 	and sleeps in poll() on its socket (plus an eventfd for control requests).
+ * 	notifications are drained in batches and handed to the channel's callbacks, 
+ * 	or to a bounded queue (psql_notify_dispatcher_pop()) for subscribers without a callback.
+** *********************************** */
+#define PSQL_NOTIFY_DEFAULT_MAX_BATCH (256)
+#define PSQL_NOTIFY_DEFAULT_QUEUE_SIZE (4096)
+#define PSQL_NOTIFY_DEFAULT_RECONNECT_INTERVAL_MS (1000)
+
+typedef struct psql_notify_subscriber
+{
+	psql_notify_callback_fn callback;	// NULL: push to the queue
+	void * user_data;
+}psql_notify_subscriber_t;
+
+typedef struct psql_notify_channel
+{
+	char * name;
+	int listening;			// LISTEN has succeeded on the current connection
+	int syncing;			// (UN)LISTEN in flight: kept in the tree until notify_sync_channels() is done
+	int num_subscribers;
+	int max_subscribers;
+	psql_notify_subscriber_t * subscribers;
+}psql_notify_channel_t;
+
+struct psql_notify_dispatcher
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	psql_notify_dispatcher_params_t params;
+	char * sz_conn;
+	psql_context_t psql[1];		// owned by the dispatcher thread once started
+	
+	avl_tree_t channels[1];
+	
+	int wakeup_fd;
+	pthread_t th;
+	int running;
+	int quit;
+	
+	// subscription changes are applied by the dispatcher thread
+	uint64_t sync_requested;
+	uint64_t sync_completed;
+	int sync_rc;
+	
+	// pull queue (ring buffer)
+	psql_notification_t ** queue;
+	int queue_start;
+	int queue_length;
+	
+	psql_notify_dispatcher_stats_t stats;
+};
+
+static int notify_channel_compare(const void * _a, const void * _b)
+{
+	const psql_notify_channel_t * a = _a;
+	const psql_notify_channel_t * b = _b;
+	return strcmp(a->name, b->name);
+}
+
+static void notify_channel_free(void * _channel)
+{
+	psql_notify_channel_t * channel = _channel;
+	if(NULL == channel) return;
+	free(channel->subscribers);
+	free(channel->name);
+	free(channel);
+}
+
+static psql_notify_channel_t * notify_find_channel(psql_notify_dispatcher_t * dispatcher, const char * name)
+{
+	psql_notify_channel_t key = { .name = (char *)name };
+	struct avl_node * node = avl_tree_find(dispatcher->channels, &key, notify_channel_compare);
+	return node?avl_node_get_data(node):NULL;
+}
+
+static void notify_wakeup(psql_notify_dispatcher_t * dispatcher)
+{
+	uint64_t one = 1;
+	ssize_t cb = write(dispatcher->wakeup_fd, &one, sizeof(one));
+	(void)cb;	// EAGAIN: the counter is already non-zero, the thread will wake up anyway
+}
+
+static psql_notification_t * notification_dup(const PGnotify * notify, double recv_time)
+{
+	size_t cb_channel = strlen(notify->relname) + 1;
+	size_t cb_payload = (notify->extra?strlen(notify->extra):0) + 1;
+	
+	// a single allocation, released with free()
+	psql_notification_t * notification = malloc(sizeof(*notification) + cb_channel + cb_payload);
+	assert(notification);
+	char * channel = (char *)(notification + 1);
+	char * payload = channel + cb_channel;
+	memcpy(channel, notify->relname, cb_channel);
+	memcpy(payload, notify->extra?notify->extra:"", cb_payload);
+	
+	notification->channel = channel;
+	notification->payload = payload;
+	notification->be_pid = notify->be_pid;
+	notification->recv_time = recv_time;
+	return notification;
+}
+
+/* must be called with the mutex locked */
+static void notify_queue_push(psql_notify_dispatcher_t * dispatcher, psql_notification_t * notification)
+{
+	int queue_size = dispatcher->params.queue_size;
+	if(dispatcher->queue_length == queue_size) {	// drop the oldest one
+		free(dispatcher->queue[dispatcher->queue_start]);
+		dispatcher->queue_start = (dispatcher->queue_start + 1) % queue_size;
+		--dispatcher->queue_length;
+		++dispatcher->stats.num_dropped;
+	}
+	dispatcher->queue[(dispatcher->queue_start + dispatcher->queue_length) % queue_size] = notification;
+	++dispatcher->queue_length;
+	++dispatcher->stats.num_queued;
+	pthread_cond_broadcast(&dispatcher->cond);
+}
+
+/* LISTEN / UNLISTEN to match the subscriptions, runs on the dispatcher thread only. */
+static int notify_sync_channels(psql_notify_dispatcher_t * dispatcher)
+{
+	psql_context_t * psql = dispatcher->psql;
+	if(NULL == psql->conn || PQstatus(psql->conn) != CONNECTION_OK) return -1;
+	int rc = 0;
+	
+	pthread_mutex_lock(&dispatcher->mutex);
+	ssize_t count = dispatcher->channels->count;
+	psql_notify_channel_t ** channels = calloc(count + 1, sizeof(*channels));
+	assert(channels);
+	int num_channels = 0;
+	for(struct avl_node * node = avl_tree_iter_begin(dispatcher->channels); node; node = avl_tree_iter_next(dispatcher->channels)) {
+		psql_notify_channel_t * channel = avl_node_get_data(node);
+		if(channel->listening != (channel->num_subscribers > 0)) channels[num_channels++] = channel;
+	}
+	
+	auto_buffer_t command[1];
+	auto_buffer_init(command, 0);
+	for(int i = 0; i < num_channels; ++i) {
+		psql_notify_channel_t * channel = channels[i];
+		char * name = PQescapeIdentifier(psql->conn, channel->name, strlen(channel->name));
+		if(NULL == name) { 
+			rc = -1; 
+			channels[i--] = channels[--num_channels];
+			continue; 
+		}
+		append_string(command, channel->listening?"UNLISTEN ":"LISTEN ");
+		append_string(command, name);
+		append_string(command, ";");
+		PQfreemem(name);
+		channel->syncing = 1;
+	}
+	pthread_mutex_unlock(&dispatcher->mutex);
+	
+	// all (UN)LISTEN commands in a single round trip (one implicit transaction: all or nothing), 
+	// notifications arriving meanwhile stay in libpq until the next drain
+	int ok = 1;
+	if(command->length > 0) {
+		auto_buffer_push(command, "", 1);
+		if(psql_execute(psql, (const char *)command->data, NULL)) {
+			fprintf(stderr, "[ERROR]: %s(): %s\n", __FUNCTION__, psql->err_msg);
+			ok = 0;
+			rc = -1;
+		}
+	}
+	auto_buffer_cleanup(command);
+	
+	// only a successful command changes the state, a failed LISTEN is retried by the next sync
+	pthread_mutex_lock(&dispatcher->mutex);
+	for(int i = 0; i < num_channels; ++i) {
+		psql_notify_channel_t * channel = channels[i];
+		channel->syncing = 0;
+		if(ok) channel->listening = !channel->listening;
+		if(!channel->listening && channel->num_subscribers == 0) {
+			avl_tree_del(dispatcher->channels, channel, notify_channel_compare);
+			notify_channel_free(channel);
+		}
+	}
+	pthread_mutex_unlock(&dispatcher->mutex);
+	free(channels);
+	return rc;
+}
+
+static int notify_reconnect(psql_notify_dispatcher_t * dispatcher)
+{
+	psql_context_t * psql = dispatcher->psql;
+	if(psql->conn) {
+		PQfinish(psql->conn);
+		psql->conn = NULL;
+	}
+	
+	// the new session listens on nothing yet
+	pthread_mutex_lock(&dispatcher->mutex);
+	for(struct avl_node * node = avl_tree_iter_begin(dispatcher->channels); node; node = avl_tree_iter_next(dispatcher->channels)) {
+		psql_notify_channel_t * channel = avl_node_get_data(node);
+		channel->listening = 0;
+	}
+	pthread_mutex_unlock(&dispatcher->mutex);
+	
+	if(psql_connect_db(psql, dispatcher->sz_conn, 0)) return -1;
+	return notify_sync_channels(dispatcher);
+}
+
+static void notify_dispatch(psql_notify_dispatcher_t * dispatcher, psql_notification_t ** batch, int num_notifications)
+{
+	psql_notify_subscriber_t * subscribers = NULL;
+	int max_subscribers = 0;
+	
+	for(int i = 0; i < num_notifications; ++i) {
+		psql_notification_t * notification = batch[i];
+		
+		// snapshot the subscribers, so that callbacks run unlocked and may (un)subscribe
+		pthread_mutex_lock(&dispatcher->mutex);
+		int num_subscribers = 0;
+		psql_notify_channel_t * channel = notify_find_channel(dispatcher, notification->channel);
+		if(channel && channel->num_subscribers > 0) {
+			num_subscribers = channel->num_subscribers;
+			if(num_subscribers > max_subscribers) {
+				max_subscribers = num_subscribers;
+				subscribers = realloc(subscribers, max_subscribers * sizeof(*subscribers));
+				assert(subscribers);
+			}
+			memcpy(subscribers, channel->subscribers, num_subscribers * sizeof(*subscribers));
+		}else {
+			++dispatcher->stats.num_unhandled;
+		}
+		pthread_mutex_unlock(&dispatcher->mutex);
+		
+		int to_queue = 0;
+		for(int j = 0; j < num_subscribers; ++j) {
+			if(NULL == subscribers[j].callback) {
+				to_queue = 1;
+				continue;
+			}
+			subscribers[j].callback(dispatcher, notification, subscribers[j].user_data);
+			__atomic_add_fetch(&dispatcher->stats.num_callbacks, 1, __ATOMIC_RELAXED);
+		}
+		
+		// queued last: from then on the notification belongs to the consumer
+		if(to_queue) {
+			pthread_mutex_lock(&dispatcher->mutex);
+			notify_queue_push(dispatcher, notification);
+			pthread_mutex_unlock(&dispatcher->mutex);
+		}else {
+			free(notification);
+		}
+	}
+	free(subscribers);
+}
+
+static int notify_drain(psql_notify_dispatcher_t * dispatcher, psql_notification_t ** batch)
+{
+	PGconn * conn = dispatcher->psql->conn;
+	if(!PQconsumeInput(conn)) {
+		psql_set_conn_error(dispatcher->psql);
+		fprintf(stderr, "[ERROR]: notify dispatcher: %s\n", dispatcher->psql->err_msg);
+		return -1;
+	}
+	
+	int max_batch = dispatcher->params.max_batch;
+	int num_notifications = 0;
+	do {
+		double now = psql_get_time();
+		PGnotify * notify = NULL;
+		num_notifications = 0;
+		while(num_notifications < max_batch && (notify = PQnotifies(conn))) {
+			batch[num_notifications++] = notification_dup(notify, now);
+			PQfreemem(notify);
+		}
+		if(num_notifications == 0) break;
+		
+		pthread_mutex_lock(&dispatcher->mutex);
+		dispatcher->stats.num_received += num_notifications;
+		++dispatcher->stats.num_batches;
+		pthread_mutex_unlock(&dispatcher->mutex);
+		
+		notify_dispatch(dispatcher, batch, num_notifications);
+	}while(num_notifications == max_batch);
+	return 0;
+}
+
+static void notify_complete_sync(psql_notify_dispatcher_t * dispatcher, uint64_t sync_id, int rc)
+{
+	pthread_mutex_lock(&dispatcher->mutex);
+	dispatcher->sync_completed = sync_id;
+	dispatcher->sync_rc = rc;
+	pthread_cond_broadcast(&dispatcher->cond);
+	pthread_mutex_unlock(&dispatcher->mutex);
+}
+
+static void * psql_notify_dispatcher_thread(void * user_data)
+{
+	psql_notify_dispatcher_t * dispatcher = user_data;
+	psql_context_t * psql = dispatcher->psql;
+	psql_notification_t ** batch = calloc(dispatcher->params.max_batch, sizeof(*batch));
+	assert(batch);
+	
+	int retry_sync = 0;
+	int need_drain = 1;	// psql_notify_dispatcher_start() has just connected and LISTENed
+	while(1) {
+		pthread_mutex_lock(&dispatcher->mutex);
+		int quit = dispatcher->quit;
+		uint64_t sync_id = dispatcher->sync_requested;
+		int need_sync = retry_sync || (sync_id != dispatcher->sync_completed);
+		pthread_mutex_unlock(&dispatcher->mutex);
+		if(quit) break;
+		
+		int connected = (psql->conn && PQstatus(psql->conn) == CONNECTION_OK);
+		if(!connected) {
+			if(0 == notify_reconnect(dispatcher)) {
+				connected = 1;
+				pthread_mutex_lock(&dispatcher->mutex);
+				++dispatcher->stats.num_reconnects;
+				pthread_mutex_unlock(&dispatcher->mutex);
+				
+				// notifications sent while disconnected are lost
+				if(dispatcher->params.on_reconnect) dispatcher->params.on_reconnect(dispatcher, dispatcher->params.user_data);
+			}
+			need_sync = 1;
+		}
+		if(need_sync) {
+			int rc = connected?notify_sync_channels(dispatcher):0;
+			retry_sync = connected && (rc != 0);
+			notify_complete_sync(dispatcher, sync_id, rc);
+			need_drain = 1;
+		}
+		
+		// (UN)LISTEN round trips may have read notifications into libpq, 
+		// the socket would not report them again.
+		if(connected && need_drain) {
+			need_drain = 0;
+			if(notify_drain(dispatcher, batch)) {
+				PQfinish(psql->conn);
+				psql->conn = NULL;
+				continue;
+			}
+		}
+		
+		struct pollfd pfds[2] = {
+			[0] = { .fd = dispatcher->wakeup_fd, .events = POLLIN },
+			[1] = { .fd = connected?PQsocket(psql->conn):-1, .events = POLLIN },
+		};
+		int timeout = (connected && !retry_sync)?-1:(int)dispatcher->params.reconnect_interval_ms;
+		int n = poll(pfds, 2, timeout);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("psql_notify_dispatcher_thread()::poll()");
+			break;
+		}
+		if(pfds[0].revents & POLLIN) {
+			uint64_t counter = 0;
+			ssize_t cb = read(dispatcher->wakeup_fd, &counter, sizeof(counter));
+			(void)cb;
+		}
+		if(connected && (pfds[1].revents & (POLLIN | POLLERR | POLLHUP))) {
+			if(notify_drain(dispatcher, batch)) {
+				// reconnect on the next iteration
+				PQfinish(psql->conn);
+				psql->conn = NULL;
+			}
+		}
+	}
+	free(batch);
+	return NULL;
+}
+
+psql_notify_dispatcher_t * psql_notify_dispatcher_init(psql_notify_dispatcher_t * dispatcher, const char * sz_conn, const psql_notify_dispatcher_params_t * params)
+{
+	if(NULL == dispatcher) dispatcher = calloc(1, sizeof(*dispatcher));
+	else memset(dispatcher, 0, sizeof(*dispatcher));
+	assert(dispatcher);
+	
+	if(params) dispatcher->params = *params;
+	if(dispatcher->params.max_batch <= 0) dispatcher->params.max_batch = PSQL_NOTIFY_DEFAULT_MAX_BATCH;
+	if(dispatcher->params.queue_size <= 0) dispatcher->params.queue_size = PSQL_NOTIFY_DEFAULT_QUEUE_SIZE;
+	if(dispatcher->params.reconnect_interval_ms <= 0) dispatcher->params.reconnect_interval_ms = PSQL_NOTIFY_DEFAULT_RECONNECT_INTERVAL_MS;
+	
+	dispatcher->sz_conn = strdup(sz_conn?sz_conn:"dbname=postgres");
+	assert(dispatcher->sz_conn);
+	psql_context_init(dispatcher->psql, dispatcher);
+	avl_tree_init(dispatcher->channels, dispatcher);
+	dispatcher->channels->on_free_data = notify_channel_free;
+	
+	dispatcher->queue = calloc(dispatcher->params.queue_size, sizeof(*dispatcher->queue));
+	assert(dispatcher->queue);
+	
+	dispatcher->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	assert(dispatcher->wakeup_fd >= 0);
+	pthread_mutex_init(&dispatcher->mutex, NULL);
+	pthread_cond_init(&dispatcher->cond, NULL);
+	return dispatcher;
+}
+
+/*
+ * psql_notify_dispatcher_start(): 
+ *   connects (synchronously, so that configuration errors are reported to the caller), 
+ *   LISTENs on the channels subscribed so far and starts the dispatcher thread.
+ */
+int psql_notify_dispatcher_start(psql_notify_dispatcher_t * dispatcher)
+{
+	assert(dispatcher);
+	if(dispatcher->running) return 0;
+	
+	int rc = notify_reconnect(dispatcher);
+	if(rc) return -1;
+	
+	dispatcher->quit = 0;
+	rc = pthread_create(&dispatcher->th, NULL, psql_notify_dispatcher_thread, dispatcher);
+	if(rc) {
+		fprintf(stderr, "[ERROR]: %s()::pthread_create(): %s\n", __FUNCTION__, strerror(rc));
+		return -1;
+	}
+	dispatcher->running = 1;
+	return 0;
+}
+
+void psql_notify_dispatcher_stop(psql_notify_dispatcher_t * dispatcher)
+{
+	assert(dispatcher);
+	if(!dispatcher->running) return;
+	
+	pthread_mutex_lock(&dispatcher->mutex);
+	dispatcher->quit = 1;
+	pthread_cond_broadcast(&dispatcher->cond);	// wake up psql_notify_dispatcher_pop()
+	pthread_mutex_unlock(&dispatcher->mutex);
+	notify_wakeup(dispatcher);
+	
+	pthread_join(dispatcher->th, NULL);
+	dispatcher->running = 0;
+	
+	if(dispatcher->psql->conn) {
+		PQfinish(dispatcher->psql->conn);
+		dispatcher->psql->conn = NULL;
+	}
+}
+
+void psql_notify_dispatcher_cleanup(psql_notify_dispatcher_t * dispatcher)
+{
+	if(NULL == dispatcher) return;
+	psql_notify_dispatcher_stop(dispatcher);
+	
+	for(int i = 0; i < dispatcher->queue_length; ++i) {
+		free(dispatcher->queue[(dispatcher->queue_start + i) % dispatcher->params.queue_size]);
+	}
+	free(dispatcher->queue);
+	dispatcher->queue = NULL;
+	dispatcher->queue_length = 0;
+	
+	avl_tree_cleanup(dispatcher->channels);
+	psql_context_cleanup(dispatcher->psql);
+	free(dispatcher->sz_conn);
+	dispatcher->sz_conn = NULL;
+	
+	if(dispatcher->wakeup_fd >= 0) close(dispatcher->wakeup_fd);
+	dispatcher->wakeup_fd = -1;
+	pthread_cond_destroy(&dispatcher->cond);
+	pthread_mutex_destroy(&dispatcher->mutex);
+}
+
+/* 
+ * ask the dispatcher thread to apply the subscription changes and wait for the result.
+ * (called with the mutex locked)
+ */
+static int notify_request_sync(psql_notify_dispatcher_t * dispatcher)
+{
+	if(!dispatcher->running) return 0;	// applied by psql_notify_dispatcher_start()
+	if(pthread_equal(pthread_self(), dispatcher->th)) {
+		// called from a callback: the thread applies it before the next poll()
+		++dispatcher->sync_requested;
+		return 0;
+	}
+	
+	uint64_t sync_id = ++dispatcher->sync_requested;
+	notify_wakeup(dispatcher);
+	while(dispatcher->sync_completed < sync_id && !dispatcher->quit) {
+		pthread_cond_wait(&dispatcher->cond, &dispatcher->mutex);
+	}
+	return dispatcher->sync_rc;
+}
+
+/*
+ * psql_notify_dispatcher_listen(): 
+ *   subscribe to a channel, @callback == NULL: the notifications go to the queue.
+ *   once this returns, the LISTEN is active on the server.
+ */
+int psql_notify_dispatcher_listen(psql_notify_dispatcher_t * dispatcher, const char * channel_name, psql_notify_callback_fn callback, void * user_data)
+{
+	assert(dispatcher && channel_name && channel_name[0]);
+	pthread_mutex_lock(&dispatcher->mutex);
+	psql_notify_channel_t * channel = notify_find_channel(dispatcher, channel_name);
+	if(NULL == channel) {
+		channel = calloc(1, sizeof(*channel));
+		assert(channel);
+		channel->name = strdup(channel_name);
+		assert(channel->name);
+		struct avl_node * node = avl_tree_add(dispatcher->channels, channel, notify_channel_compare);
+		assert(node);
+	}
+	if(channel->num_subscribers == channel->max_subscribers) {
+		int new_size = channel->max_subscribers?(channel->max_subscribers * 2):4;
+		psql_notify_subscriber_t * subscribers = realloc(channel->subscribers, new_size * sizeof(*subscribers));
+		assert(subscribers);
+		channel->subscribers = subscribers;
+		channel->max_subscribers = new_size;
+	}
+	channel->subscribers[channel->num_subscribers++] = (psql_notify_subscriber_t){ callback, user_data };
+	
+	int rc = 0;
+	if(!channel->listening) rc = notify_request_sync(dispatcher);
+	pthread_mutex_unlock(&dispatcher->mutex);
+	return rc;
+}
+
+int psql_notify_dispatcher_unlisten(psql_notify_dispatcher_t * dispatcher, const char * channel_name, psql_notify_callback_fn callback, void * user_data)
+{
+	assert(dispatcher && channel_name);
+	pthread_mutex_lock(&dispatcher->mutex);
+	psql_notify_channel_t * channel = notify_find_channel(dispatcher, channel_name);
+	int found = 0;
+	for(int i = 0; channel && i < channel->num_subscribers; ++i) {
+		if(channel->subscribers[i].callback == callback && channel->subscribers[i].user_data == user_data) {
+			memmove(&channel->subscribers[i], &channel->subscribers[i + 1], (channel->num_subscribers - i - 1) * sizeof(*channel->subscribers));
+			--channel->num_subscribers;
+			found = 1;
+			break;
+		}
+	}
+	
+	int rc = found?0:-1;
+	if(found && channel->num_subscribers == 0) {
+		if(channel->listening || channel->syncing) rc = notify_request_sync(dispatcher);
+		else {
+			avl_tree_del(dispatcher->channels, channel, notify_channel_compare);
+			notify_channel_free(channel);
+		}
+	}
+	pthread_mutex_unlock(&dispatcher->mutex);
+	return rc;
+}
+
+/*
+ * psql_notify_dispatcher_pop(): 
+ *   take the next queued notification, the caller must free() it.
+ *   @timeout_ms: < 0: wait forever; 0: don't wait.
+ *   @return 1: got one; 0: timeout; -1: the dispatcher is stopped.
+ */
+int psql_notify_dispatcher_pop(psql_notify_dispatcher_t * dispatcher, psql_notification_t ** p_notification, int64_t timeout_ms)
+{
+	assert(dispatcher && p_notification);
+	*p_notification = NULL;
+	
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	if(timeout_ms > 0) {
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000) {
+			++deadline.tv_sec;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+	
+	int rc = 0;
+	pthread_mutex_lock(&dispatcher->mutex);
+	while(0 == dispatcher->queue_length) {
+		if(dispatcher->quit || !dispatcher->running) { rc = -1; break; }
+		if(0 == timeout_ms) break;
+		if(timeout_ms < 0) pthread_cond_wait(&dispatcher->cond, &dispatcher->mutex);
+		else if(pthread_cond_timedwait(&dispatcher->cond, &dispatcher->mutex, &deadline) == ETIMEDOUT) break;
+	}
+	if(dispatcher->queue_length > 0) {
+		*p_notification = dispatcher->queue[dispatcher->queue_start];
+		dispatcher->queue_start = (dispatcher->queue_start + 1) % dispatcher->params.queue_size;
+		--dispatcher->queue_length;
+		rc = 1;
+	}
+	pthread_mutex_unlock(&dispatcher->mutex);
+	return rc;
+}
+
+int psql_notify_dispatcher_get_stats(psql_notify_dispatcher_t * dispatcher, psql_notify_dispatcher_stats_t * stats)
+{
+	assert(dispatcher && stats);
+	pthread_mutex_lock(&dispatcher->mutex);
+	*stats = dispatcher->stats;
+	stats->num_callbacks = __atomic_load_n(&dispatcher->stats.num_callbacks, __ATOMIC_RELAXED);
+	stats->num_channels = dispatcher->channels->count;
+	stats->queue_length = dispatcher->queue_length;
+	pthread_mutex_unlock(&dispatcher->mutex);
+	return 0;
+}
+
+#undef PSQL_NOTIFY_DEFAULT_MAX_BATCH
+#undef PSQL_NOTIFY_DEFAULT_QUEUE_SIZE
+#undef PSQL_NOTIFY_DEFAULT_RECONNECT_INTERVAL_MS
+
+/* *********************************** **
+ * Streaming Query
+ * 	rows are delivered as they arrive instead of being buffered in a single PGresult.
+ * 	chunk_size <= 1: single-row mode;
+ * 	chunk_size >  1: chunked-rows mode (libpq >= 17), falls back to single-row mode.
+** *********************************** */
+static void psql_cancel_query(psql_context_t * psql)
+{
+	PGcancel * cancel = PQgetCancel(psql->conn);
+	if(NULL == cancel) return;
+	
+	char err_msg[256] = "";
+	if(!PQcancel(cancel, err_msg, sizeof(err_msg))) {
+		fprintf(stderr, "[ERROR]: PQcancel() failed: %s\n", err_msg);
+	}
+	PQfreeCancel(cancel);
+	return;
+}
+
+int psql_query_stream(psql_context_t * psql, const char * command, const psql_params_t * params, 
+	int chunk_size, psql_on_rows_fn on_rows, void * user_data, psql_stream_stats_t * stats)
+{
+	assert(psql && psql->conn && command && on_rows);
+	PGconn * conn = psql->conn;
+	psql_stream_stats_t _stats[1];
+	if(NULL == stats) stats = _stats;
+	memset(stats, 0, sizeof(*stats));
+	
+	double begin_time = psql_get_time();
+	int rc = params?psql_send_query_params(psql, command, params):psql_send_query(psql, command);
+	if(rc) {
+		fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+		return -1;
+	}
+	
+	int ok = 0;
+#if defined(LIBPQ_HAS_CHUNK_MODE)
+	if(chunk_size > 1) ok = PQsetChunkedRowsMode(conn, chunk_size);
+#endif
+	if(!ok) ok = PQsetSingleRowMode(conn);
 	if(!ok) {
-		const char * err_msg = PQerrorMessage(conn);
-		if(err_msg) {
-			strncpy(psql->err_msg, err_msg, sizeof(psql->err_msg));
+		fprintf(stderr, "[WARNING]: %s(): streaming mode is not available, the result will be buffered.\n", __FUNCTION__);
+	}
+	
+	int cancelled = 0;
+	int cancel_acknowledged = 0;
+	PGresult * res = NULL;
+	while((res = psql_do_get_result(psql))) {
+		if(cancelled) {	// discard the remaining rows, but not an error which is not the cancel itself
+			if(PQresultStatus(res) == PGRES_FATAL_ERROR) {
+				const char * sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+				if(sqlstate && 0 == strcmp(sqlstate, "57014")) {	// query_canceled
+					cancel_acknowledged = 1;
+				}else {
+					psql_check_result(psql, res);
+					fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+					rc = -1;
+				}
+			}
+			PQclear(res);
+			continue;
+		}
+		
+		if(psql_check_result(psql, res) < 0) {
+			// the server may fail in the middle of the stream, after some rows have been delivered
+			fprintf(stderr, "[ERROR]: %s\n", psql->err_msg);
+			rc = -1;
+			PQclear(res);
+			continue;
+		}
+		
+		int num_rows = PQntuples(res);
+		if(num_rows > 0) {
+			if(0 == stats->num_rows) stats->time_to_first_row = psql_get_time() - begin_time;
+			stats->num_rows += num_rows;
+			++stats->num_chunks;
+			
+			if(on_rows(psql, res, num_rows, user_data)) {
+				psql_cancel_query(psql);
+				stats->cancelled = cancelled = 1;
+			}
+		}
+		PQclear(res);
+	}
+	
+	if(cancelled && !cancel_acknowledged && PQstatus(conn) == CONNECTION_OK 
+		&& PQtransactionStatus(conn) == PQTRANS_IDLE) {
+		// the query completed before the cancel request was processed, 
+		// which could then interrupt the caller's next statement: let a throw-away statement absorb it.
+		// not inside a transaction block, where a cancel landing on it would abort the caller's transaction.
+		res = psql_do_exec(psql, "SELECT 1");
+		PQclear(res);
+	}
+	stats->total_time = psql_get_time() - begin_time;
+	if(psql->metrics) {	// the whole stream counts as one call
+		psql_metrics_record(psql, psql_metrics_register(psql, command), NULL, stats->total_time, 
+			rc < 0, stats->num_rows, 0, 0);
+	}
+	return rc;
+}
+
+/* *********************************** **
+ * Server-side Cursor
+ * 	DECLARE ... CURSOR / FETCH n, with an optional background thread 
+ * 	that fetches the next batch while the caller processes the current one.
+** *********************************** */
+#define PSQL_CURSOR_MIN_FETCH_SIZE (64)
+#define PSQL_CURSOR_MAX_FETCH_SIZE (64 * 1024)
+
+struct psql_cursor
+{
+	psql_context_t * psql;
+	char name[64];
+	int own_transaction;
+	int is_open;
+	int eof;
+	int failed;
+	
+	int fetch_size;
+	int min_fetch_size;
+	int max_fetch_size;
+	
+	PGresult * current;	// owned by the cursor until the next call
+	
+	// prefetch
+	int prefetch;
+	pthread_t th;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int quit;
+	PGresult * next;	// single-slot buffer
+	double next_ready_time;
+	double last_fetch_time;	// duration of the last FETCH
+	double last_return_time;	// no prefetch: when the previous batch was handed to the caller
+	
+	psql_cursor_stats_t stats;
+};
+
+static PGresult * psql_cursor_fetch(psql_cursor_t * cursor, int fetch_size, double * p_duration)
+{
+	char command[200] = "";
+	snprintf(command, sizeof(command), "FETCH FORWARD %d FROM \"%s\";", fetch_size, cursor->name);
+	
+	double begin_time = psql_get_time();
+	PGresult * res = psql_do_exec(cursor->psql, command);
+	if(p_duration) *p_duration = psql_get_time() - begin_time;
+	
+	if(psql_check_result(cursor->psql, res) < 0) {
+		fprintf(stderr, "[ERROR]: %s\n", cursor->psql->err_msg);
+		PQclear(res);
+		return NULL;
+	}
+	return res;
+}
+
+/*
+ * grow the batch when the consumer had to wait for the network, 
+ * shrink it when batches sit idle longer than they take to fetch.
+ */
+static void psql_cursor_adapt_fetch_size(psql_cursor_t * cursor, double wait_time, double idle_time, double fetch_time)
+{
+	int fetch_size = cursor->fetch_size;
+	if(wait_time > 0.0005 && wait_time > fetch_time * 0.1) fetch_size *= 2;
+	else if(idle_time > fetch_time) fetch_size = fetch_size * 3 / 4;
+	
+	if(fetch_size < cursor->min_fetch_size) fetch_size = cursor->min_fetch_size;
+	if(fetch_size > cursor->max_fetch_size) fetch_size = cursor->max_fetch_size;
+	cursor->fetch_size = fetch_size;
+}
+
+static void * psql_cursor_prefetch_thread(void * user_data)
+{
+	psql_cursor_t * cursor = user_data;
+	
+	pthread_mutex_lock(&cursor->mutex);
+	while(!cursor->quit && !cursor->eof && !cursor->failed) {
+		if(cursor->next) {	// wait until the consumer takes the batch
+			pthread_cond_wait(&cursor->cond, &cursor->mutex);
+			continue;
+		}
+		int fetch_size = cursor->fetch_size;
+		pthread_mutex_unlock(&cursor->mutex);
+		
+		double duration = 0;
+		PGresult * res = psql_cursor_fetch(cursor, fetch_size, &duration);
+		
+		pthread_mutex_lock(&cursor->mutex);
+		cursor->last_fetch_time = duration;
+		cursor->stats.total_fetch_time += duration;
+		if(NULL == res) cursor->failed = 1;
+		else if(PQntuples(res) < fetch_size) cursor->eof = 1;
+		cursor->next = res;
+		cursor->next_ready_time = psql_get_time();
+		pthread_cond_broadcast(&cursor->cond);
+	}
+	pthread_mutex_unlock(&cursor->mutex);
+	return NULL;
+}
+
+psql_cursor_t * psql_cursor_init(psql_cursor_t * cursor, psql_context_t * psql, int min_fetch_size, int max_fetch_size)
+{
+	assert(psql);
+	if(NULL == cursor) cursor = calloc(1, sizeof(*cursor));
+	else memset(cursor, 0, sizeof(*cursor));
+	assert(cursor);
+	
+	if(min_fetch_size <= 0) min_fetch_size = PSQL_CURSOR_MIN_FETCH_SIZE;
+	if(max_fetch_size <= 0) max_fetch_size = PSQL_CURSOR_MAX_FETCH_SIZE;
+	if(max_fetch_size < min_fetch_size) max_fetch_size = min_fetch_size;
+	
+	cursor->psql = psql;
+	cursor->min_fetch_size = min_fetch_size;
+	cursor->max_fetch_size = max_fetch_size;
+	pthread_mutex_init(&cursor->mutex, NULL);
+	pthread_cond_init(&cursor->cond, NULL);
+	return cursor;
+}
+
+void psql_cursor_cleanup(psql_cursor_t * cursor)
+{
+	if(NULL == cursor) return;
+	psql_cursor_close(cursor);
+	pthread_cond_destroy(&cursor->cond);
+	pthread_mutex_destroy(&cursor->mutex);
+	return;
+}
+
+int psql_cursor_open(psql_cursor_t * cursor, const char * query, const psql_params_t * params, int fetch_size, int prefetch)
+{
+	assert(cursor && cursor->psql && cursor->psql->conn && query);
+	psql_context_t * psql = cursor->psql;
+	if(cursor->is_open) return -1;
+	
+	static unsigned int s_cursor_id;
+	snprintf(cursor->name, sizeof(cursor->name), "_psql_cursor_%u", __atomic_add_fetch(&s_cursor_id, 1, __ATOMIC_RELAXED));
+	
+	// cursors without HOLD only live inside a transaction block
+	cursor->own_transaction = 0;
+	if(PQtransactionStatus(psql->conn) == PQTRANS_IDLE) {
+		if(psql_execute(psql, "BEGIN;", NULL)) return -1;
+		cursor->own_transaction = 1;
+	}
+	
+	size_t cb_query = strlen(query);
+	while(cb_query > 0 && (query[cb_query - 1] == ';' || isspace((unsigned char)query[cb_query - 1]))) --cb_query;
+	
+	auto_buffer_t command[1];
+	auto_buffer_init(command, cb_query + 100);
+	char prefix[128] = "";
+	int cb = snprintf(prefix, sizeof(prefix), "DECLARE \"%s\" NO SCROLL CURSOR FOR ", cursor->name);
+	auto_buffer_push(command, prefix, cb);
+	auto_buffer_push(command, query, cb_query);
+	auto_buffer_push(command, "", 1);
+	
+	static const psql_params_t empty_params[1];
+	int rc = psql_exec_params(psql, (const char *)command->data, params?params:empty_params, NULL);
+	auto_buffer_cleanup(command);
+	if(rc) {
+		if(cursor->own_transaction) psql_execute(psql, "ROLLBACK;", NULL);
+		cursor->own_transaction = 0;
+		return -1;
+	}
+	
+	if(fetch_size < cursor->min_fetch_size) fetch_size = cursor->min_fetch_size;
+	if(fetch_size > cursor->max_fetch_size) fetch_size = cursor->max_fetch_size;
+	cursor->fetch_size = fetch_size;
+	cursor->is_open = 1;
+	cursor->eof = 0;
+	cursor->failed = 0;
+	cursor->quit = 0;
+	cursor->prefetch = prefetch;
+	cursor->last_return_time = 0;
+	memset(&cursor->stats, 0, sizeof(cursor->stats));
+	
+	if(prefetch) {
+		rc = pthread_create(&cursor->th, NULL, psql_cursor_prefetch_thread, cursor);
+		if(rc) {
+			perror("psql_cursor_open()::pthread_create()");
+			cursor->prefetch = 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * psql_cursor_next_batch()
+ * 	@return the next batch of rows (owned by the cursor, valid until the next call), 
+ * 		NULL if no more rows or on error (see psql_cursor_get_stats()).
+ */
+psql_result_t psql_cursor_next_batch(psql_cursor_t * cursor, int * p_num_rows)
+{
+	assert(cursor);
+	if(p_num_rows) *p_num_rows = 0;
+	if(cursor->current) {
+		PQclear(cursor->current);
+		cursor->current = NULL;
+	}
+	if(!cursor->is_open) return NULL;
+	
+	double begin_time = psql_get_time();
+	PGresult * res = NULL;
+	
+	if(cursor->prefetch) {
+		pthread_mutex_lock(&cursor->mutex);
+		while(NULL == cursor->next && !cursor->eof && !cursor->failed) {
+			pthread_cond_wait(&cursor->cond, &cursor->mutex);
+		}
+		res = cursor->next;
+		cursor->next = NULL;
+		
+		if(res) {
+			double now = psql_get_time();
+			double wait_time = now - begin_time;
+			double idle_time = now - cursor->next_ready_time;	// time the batch was ready before it was needed
+			if(idle_time > wait_time) idle_time -= wait_time;
+			else idle_time = 0;
+			
+			cursor->stats.total_wait_time += wait_time;
+			psql_cursor_adapt_fetch_size(cursor, wait_time, idle_time, cursor->last_fetch_time);
+		}
+		pthread_cond_broadcast(&cursor->cond);
+		pthread_mutex_unlock(&cursor->mutex);
+	}else if(!cursor->eof) {
+		int fetch_size = cursor->fetch_size;
+		double duration = 0;
+		res = psql_cursor_fetch(cursor, fetch_size, &duration);
+		cursor->stats.total_fetch_time += duration;
+		cursor->stats.total_wait_time += duration;
+		if(NULL == res) cursor->failed = 1;
+		else if(PQntuples(res) < fetch_size) cursor->eof = 1;
+		
+		if(res && cursor->last_return_time > 0) {
+			// nothing overlaps with the FETCH, so a larger batch only amortizes the round trip: 
+			// grow while the round trip costs more than processing the previous batch did, 
+			// never shrink because of the consumer (that would just add round trips).
+			double process_time = begin_time - cursor->last_return_time;
+			if(process_time < duration) psql_cursor_adapt_fetch_size(cursor, duration, 0, duration);
+		}
+		cursor->last_return_time = psql_get_time();
+	}
+	
+	if(NULL == res) return NULL;
+	int num_rows = PQntuples(res);
+	if(num_rows == 0) {
+		PQclear(res);
+		return NULL;
+	}
+	
+	cursor->current = res;
+	++cursor->stats.num_batches;
+	cursor->stats.num_rows += num_rows;
+	if(p_num_rows) *p_num_rows = num_rows;
+	return res;
+}
+
+int psql_cursor_close(psql_cursor_t * cursor)
+{
+	assert(cursor);
+	if(!cursor->is_open) return 0;
+	psql_context_t * psql = cursor->psql;
+	
+	if(cursor->prefetch) {
+		pthread_mutex_lock(&cursor->mutex);
+		cursor->quit = 1;
+		pthread_cond_broadcast(&cursor->cond);
+		pthread_mutex_unlock(&cursor->mutex);
+		pthread_join(cursor->th, NULL);
+		cursor->prefetch = 0;
+	}
+	if(cursor->next) {
+		PQclear(cursor->next);
+		cursor->next = NULL;
+	}
+	if(cursor->current) {
+		PQclear(cursor->current);
+		cursor->current = NULL;
+	}
+	
+	int rc = 0;
+	char command[200] = "";
+	snprintf(command, sizeof(command), "CLOSE \"%s\";", cursor->name);
+	if(PQtransactionStatus(psql->conn) == PQTRANS_INTRANS) rc = psql_execute(psql, command, NULL);
+	
+	if(cursor->own_transaction) {
+		if(rc == 0 && !cursor->failed) rc = psql_execute(psql, "COMMIT;", NULL);
+		else psql_execute(psql, "ROLLBACK;", NULL);
+		cursor->own_transaction = 0;
+	}
+	cursor->is_open = 0;
+	return (rc || cursor->failed)?-1:0;
+}
+
+int psql_cursor_get_stats(psql_cursor_t * cursor, psql_cursor_stats_t * stats)
+{
+	assert(cursor && stats);
+	pthread_mutex_lock(&cursor->mutex);
+	*stats = cursor->stats;
+	stats->fetch_size = cursor->fetch_size;
+	stats->failed = cursor->failed;
+	pthread_mutex_unlock(&cursor->mutex);
+	return 0;
+}
+#undef PSQL_CURSOR_MIN_FETCH_SIZE
+#undef PSQL_CURSOR_MAX_FETCH_SIZE
+
+/* *********************************** **
+ * Typed Result Accessors
+ * 	binary-format columns (result_format == 1) are decoded from network order, 
+ * 	text-format integers, floats and bools are parsed as a fallback.
+ * 	@return 0: ok; 1: NULL (value unchanged); -1: type mismatch or invalid data.
+** *********************************** */
+
+int psql_oid_to_data_type(unsigned int oid, int * p_is_array)
+{
+	for(int type = 0; type < psql_data_types_count; ++type) {
+		if(s_psql_data_types[type].oid == oid) {
+			if(p_is_array) *p_is_array = 0;
+			return type;
+		}
+		if(s_psql_data_types[type].array_oid == oid) {
+			if(p_is_array) *p_is_array = 1;
+			return type;
+		}
+	}
+	return -1;
+}
+
+static inline uint16_t read_be16(const char * p) { uint16_t v; memcpy(&v, p, 2); return be16toh(v); }
+static inline uint32_t read_be32(const char * p) { uint32_t v; memcpy(&v, p, 4); return be32toh(v); }
+static inline uint64_t read_be64(const char * p) { uint64_t v; memcpy(&v, p, 8); return be64toh(v); }
+
+#define result_cell_prepare(res, row, col, data, length, type) 	\
+	if(PQgetisnull(res, row, col)) return 1;					\
+	const char * data = PQgetvalue(res, row, col);				\
+	int length = PQgetlength(res, row, col);					\
+	int type = psql_oid_to_data_type(PQftype(res, col), NULL);	\
+	int is_binary = (PQfformat(res, col) == 1);
+
+int psql_result_is_null(const psql_result_t res, int row, int col)
+{
+	return PQgetisnull(res, row, col);
+}
+
+/*
+ * cell decoders: the type and format are resolved by the caller, 
+ * so that psql_column_load() can resolve them once per column.
+ */
+static inline int decode_cell_int64(int type, int is_binary, const char * data, int length, int64_t * p_value)
+{
+	int64_t value = 0;
+	if(is_binary) {
+		if(type == psql_data_type_int2 && length == 2) value = (int16_t)read_be16(data);
+		else if(type == psql_data_type_int4 && length == 4) value = (int32_t)read_be32(data);
+		else if(type == psql_data_type_int8 && length == 8) value = (int64_t)read_be64(data);
+		else return -1;
+	}else {
+		if(type != psql_data_type_int2 && type != psql_data_type_int4 && type != psql_data_type_int8) return -1;
+		char * p_end = NULL;
+		value = strtoll(data, &p_end, 10);
+		if(p_end == data) return -1;
+	}
+	if(p_value) *p_value = value;
+	return 0;
+}
+
+static double decode_numeric(const char * data, int length)
+{
+	if(length < 8) return NAN;
+	int ndigits = (int16_t)read_be16(data);
+	int weight = (int16_t)read_be16(data + 2);
+	uint16_t sign = read_be16(data + 4);
+	if(sign == 0xD000) return INFINITY;	// PG14+
+	if(sign == 0xF000) return -INFINITY;
+	if(sign == 0xC000 || length < 8 + ndigits * 2) return NAN;
+	
+	double value = 0;
+	for(int i = 0; i < ndigits; ++i) value = value * 10000.0 + (double)read_be16(data + 8 + i * 2);
+	value *= pow(10000.0, weight - ndigits + 1);
+	return (sign == 0x4000)?-value:value;
+}
+
+static inline int decode_cell_double(int type, int is_binary, const char * data, int length, double * p_value)
+{
+	double value = 0;
+	if(is_binary) {
+		if(type == psql_data_type_float4 && length == 4) {
+			uint32_t bits = read_be32(data);
+			float f_value = 0;
+			memcpy(&f_value, &bits, sizeof(f_value));
+			value = f_value;
+		}else if(type == psql_data_type_float8 && length == 8) {
+			uint64_t bits = read_be64(data);
+			memcpy(&value, &bits, sizeof(value));
+		}else if(type == psql_data_type_numeric) {
+			value = decode_numeric(data, length);
+		}else {
+			int64_t i_value = 0;
+			if(decode_cell_int64(type, is_binary, data, length, &i_value)) return -1;
+			value = (double)i_value;
+		}
+	}else {
+		switch(type) {
+		case psql_data_type_float4: case psql_data_type_float8: case psql_data_type_numeric:
+		case psql_data_type_int2: case psql_data_type_int4: case psql_data_type_int8:
+			break;
+		default:
+			return -1;
+		}
+		char * p_end = NULL;
+		value = strtod(data, &p_end);
+		if(p_end == data) return -1;
+	}
+	if(p_value) *p_value = value;
+	return 0;
+}
+
+static inline int decode_cell_bool(int type, int is_binary, const char * data, int length, int * p_value)
+{
+	if(type != psql_data_type_bool) return -1;
+	
+	int value = 0;
+	if(is_binary) {
+		if(length != 1) return -1;
+		value = (data[0] != 0);
+	}else {
+		value = (data[0] == 't');
+	}
+	if(p_value) *p_value = value;
+	return 0;
+}
+
+static inline int decode_cell_uuid(int type, int is_binary, const char * data, int length, unsigned char uuid[16])
+{
+	if(type != psql_data_type_uuid) return -1;
+	
+	if(is_binary) {
+		if(length != 16) return -1;
+		if(uuid) memcpy(uuid, data, 16);
+		return 0;
+	}
+	
+	// text: xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx
+	unsigned char value[16];
+	int n = 0;
+	for(const char * p = data; *p && n < 32; ++p) {
+		if(*p == '-') continue;
+		int v = hex_value(*p);
+		if(v < 0) return -1;
+		if(n & 1) value[n / 2] |= v;
+		else value[n / 2] = v << 4;
+		++n;
+	}
+	if(n != 32) return -1;
+	if(uuid) memcpy(uuid, value, 16);
+	return 0;
+}
+
+static inline int decode_cell_timestamp(int type, int is_binary, const char * data, int length, int64_t * p_unix_usec)
+{
+	if(type != psql_data_type_timestamp && type != psql_data_type_timestamptz) return -1;
+	if(!is_binary || length != 8) return -1;	// text timestamps depend on DateStyle / TimeZone
+	
+	int64_t value = (int64_t)read_be64(data);
+	if(value == INT64_MAX || value == INT64_MIN) {	// 'infinity' / '-infinity'
+		if(p_unix_usec) *p_unix_usec = value;
+		return 0;
+	}
+	if(p_unix_usec) *p_unix_usec = value + PSQL_EPOCH_OFFSET_USEC;
+	return 0;
+}
+
+int psql_result_get_int64(const psql_result_t res, int row, int col, int64_t * p_value)
+{
+	result_cell_prepare(res, row, col, data, length, type);
+	return decode_cell_int64(type, is_binary, data, length, p_value);
+}
+
+int psql_result_get_double(const psql_result_t res, int row, int col, double * p_value)
+{
+	result_cell_prepare(res, row, col, data, length, type);
+	return decode_cell_double(type, is_binary, data, length, p_value);
+}
+
+int psql_result_get_bool(const psql_result_t res, int row, int col, int * p_value)
+{
+	result_cell_prepare(res, row, col, data, length, type);
+	return decode_cell_bool(type, is_binary, data, length, p_value);
+}
+
+int psql_result_get_uuid(const psql_result_t res, int row, int col, unsigned char uuid[16])
+{
+	result_cell_prepare(res, row, col, data, length, type);
+	return decode_cell_uuid(type, is_binary, data, length, uuid);
+}
+
+int psql_result_get_timestamp(const psql_result_t res, int row, int col, int64_t * p_unix_usec)
+{
+	result_cell_prepare(res, row, col, data, length, type);
+	return decode_cell_timestamp(type, is_binary, data, length, p_unix_usec);
+}
+
+/*
+ * raw cell data of any type (eg. bytea / text), valid until the result is cleared
+ */
+int psql_result_get_bytes(const psql_result_t res, int row, int col, const void ** p_data, int * p_length)
+{
+	result_cell_prepare(res, row, col, data, length, type);
+	(void)type;
+	(void)is_binary;
+	if(p_data) *p_data = data;
+	if(p_length) *p_length = length;
+	return 0;
+}
+#undef result_cell_prepare
+
+/* *********************************** **
+ * Columnar Result
+ * 	converts a PGresult into contiguous typed arrays (one per column), 
+ * 	so that post-processing loops run over plain C arrays.
+** *********************************** */
+static int psql_column_get_storage(int type, int is_array, int is_binary)
+{
+	if(is_array) return psql_column_storage_string;
+	switch(type) {
+	case psql_data_type_bool: return psql_column_storage_bool;
+	case psql_data_type_int2: return psql_column_storage_int16;
+	case psql_data_type_int4: return psql_column_storage_int32;
+	case psql_data_type_int8: return psql_column_storage_int64;
+	case psql_data_type_float4: return psql_column_storage_float32;
+	case psql_data_type_float8: 
+	case psql_data_type_numeric: 
+		return psql_column_storage_float64;
+	case psql_data_type_uuid: return psql_column_storage_uuid;
+	case psql_data_type_timestamp: 
+	case psql_data_type_timestamptz:
+		return is_binary?psql_column_storage_timestamp:psql_column_storage_string;
+	default:
+		break;
+	}
+	return psql_column_storage_string;
+}
+
+static const size_t s_column_storage_widths[psql_column_storage_types_count] = {
+	[psql_column_storage_string] = 0,
+	[psql_column_storage_bool] = 1,
+	[psql_column_storage_int16] = 2,
+	[psql_column_storage_int32] = 4,
+	[psql_column_storage_int64] = 8,
+	[psql_column_storage_float32] = 4,
+	[psql_column_storage_float64] = 8,
+	[psql_column_storage_uuid] = 16,
+	[psql_column_storage_timestamp] = 8,
+};
+
+static int psql_column_load(psql_column_t * column, const PGresult * res, int col, int num_rows)
+{
+	int is_array = 0;
+	int is_binary = (PQfformat(res, col) == 1);
+	column->name = strdup(PQfname(res, col));
+	column->type = psql_oid_to_data_type(PQftype(res, col), &is_array);
+	column->is_array = is_array;
+	column->storage = psql_column_get_storage(column->type, is_array, is_binary);
+	
+	column->null_bitmap = calloc((num_rows + 7) / 8 + 1, 1);
+	assert(column->null_bitmap);
+	
+	if(column->storage == psql_column_storage_string) {
+		column->offsets = calloc(num_rows + 1, sizeof(*column->offsets));
+		assert(column->offsets);
+		
+		int64_t cb_total = 0;
+		for(int row = 0; row < num_rows; ++row) {
+			column->offsets[row] = cb_total;
+			if(PQgetisnull(res, row, col)) continue;
+			cb_total += PQgetlength(res, row, col);
+		}
+		column->offsets[num_rows] = cb_total;
+		
+		column->str_data = malloc(cb_total + 1);
+		assert(column->str_data);
+		column->str_data[cb_total] = '\0';
+		
+		for(int row = 0; row < num_rows; ++row) {
+			if(PQgetisnull(res, row, col)) {
+				column->null_bitmap[row >> 3] |= (1 << (row & 7));
+				++column->num_nulls;
+				continue;
+			}
+			memcpy(column->str_data + column->offsets[row], PQgetvalue(res, row, col), 
+				column->offsets[row + 1] - column->offsets[row]);
+		}
+		return 0;
+	}
+	
+	int type = column->type;
+	size_t width = s_column_storage_widths[column->storage];
+	column->values.data = calloc(num_rows + 1, width);
+	assert(column->values.data);
+	
+	int rc = 0;
+	for(int row = 0; row < num_rows; ++row) {
+		if(PQgetisnull(res, row, col)) {
+			column->null_bitmap[row >> 3] |= (1 << (row & 7));
+			++column->num_nulls;
+			continue;
+		}
+		
+		// type and format have been resolved once for the whole column
+		const char * data = PQgetvalue(res, row, col);
+		int length = PQgetlength(res, row, col);
+		int64_t i_value = 0;
+		double d_value = 0;
+		int b_value = 0;
+		switch(column->storage) {
+		case psql_column_storage_bool: 
+			rc = decode_cell_bool(type, is_binary, data, length, &b_value);
+			column->values.b[row] = b_value;
+			break;
+		case psql_column_storage_int16:
+			rc = decode_cell_int64(type, is_binary, data, length, &i_value);
+			column->values.i16[row] = (int16_t)i_value;
+			break;
+		case psql_column_storage_int32:
+			rc = decode_cell_int64(type, is_binary, data, length, &i_value);
+			column->values.i32[row] = (int32_t)i_value;
+			break;
+		case psql_column_storage_int64:
+			rc = decode_cell_int64(type, is_binary, data, length, &column->values.i64[row]);
+			break;
+		case psql_column_storage_float32:
+			rc = decode_cell_double(type, is_binary, data, length, &d_value);
+			column->values.f32[row] = (float)d_value;
+			break;
+		case psql_column_storage_float64:
+			rc = decode_cell_double(type, is_binary, data, length, &column->values.f64[row]);
+			break;
+		case psql_column_storage_uuid:
+			rc = decode_cell_uuid(type, is_binary, data, length, column->values.uuid[row]);
+			break;
+		case psql_column_storage_timestamp:
+			rc = decode_cell_timestamp(type, is_binary, data, length, &column->values.i64[row]);
+			break;
+		default:
+			rc = -1;
+			break;
+		}
+		if(rc) {
+			fprintf(stderr, "[ERROR]: %s(): invalid value at row %d, column '%s'\n", __FUNCTION__, row, column->name);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void psql_column_cleanup(psql_column_t * column)
+{
+	free(column->name);
+	free(column->null_bitmap);
+	free(column->values.data);
+	free(column->offsets);
+	free(column->str_data);
+	memset(column, 0, sizeof(*column));
+}
+
+psql_columns_t * psql_columns_init(psql_columns_t * columns, const psql_result_t res)
+{
+	assert(res);
+	int is_allocated = (NULL == columns);
+	if(NULL == columns) columns = calloc(1, sizeof(*columns));
+	else memset(columns, 0, sizeof(*columns));
+	assert(columns);
+	
+	int num_rows = PQntuples(res);
+	int num_columns = PQnfields(res);
+	if(num_columns <= 0) return columns;
+	
+	columns->columns = calloc(num_columns, sizeof(*columns->columns));
+	assert(columns->columns);
+	columns->num_rows = num_rows;
+	columns->num_columns = num_columns;
+	
+	for(int col = 0; col < num_columns; ++col) {
+		int rc = psql_column_load(&columns->columns[col], res, col, num_rows);
+		if(rc) {
+			psql_columns_cleanup(columns);
+			if(is_allocated) free(columns);
+			return NULL;
 		}
+	}
+	return columns;
+}
+
+void psql_columns_cleanup(psql_columns_t * columns)
+{
+	if(NULL == columns) return;
+	if(columns->columns) {
+		for(int col = 0; col < columns->num_columns; ++col) psql_column_cleanup(&columns->columns[col]);
+		free(columns->columns);
+		columns->columns = NULL;
+	}
+	columns->num_columns = 0;
+	columns->num_rows = 0;
+	return;
+}
+
+const char * psql_column_get_string(const psql_column_t * column, int row, int * p_length)
+{
+	assert(column && column->storage == psql_column_storage_string);
+	if(psql_column_is_null(column, row)) {
+		if(p_length) *p_length = -1;
+		return NULL;
+	}
+	if(p_length) *p_length = (int)(column->offsets[row + 1] - column->offsets[row]);
+	return column->str_data + column->offsets[row];
+}
+
+/* *********************************** **
+ * Async Engine (epoll)
+ * 	drives many non-blocking connections from a single thread: 
+ * 	results are read as soon as the socket becomes readable, 
+ * 	and pending output is flushed when it becomes writable.
+** *********************************** */
+typedef struct psql_async_task
+{
+	psql_async_engine_t * engine;	// NULL: the engine has been cleaned up
+	psql_context_t * psql;
+	int fd;	// registered with epoll while busy, -1: not registered
+	uint32_t events;	// registered epoll events
+	
+	struct psql_async_task * prev;
+	struct psql_async_task * next;
+	
+	int busy;
+	int status;
+	psql_async_on_result_fn on_result;
+	psql_async_on_complete_fn on_complete;
+	void * user_data;
+}psql_async_task_t;
+
+struct psql_async_engine
+{
+	int epfd;
+	int max_events;
+	struct epoll_event * events;
+	int num_events;	// events returned by the last epoll_wait(), being dispatched
+	int num_tasks;
+	int num_busy;
+	struct psql_async_task * tasks;
+};
+
+psql_async_engine_t * psql_async_engine_init(psql_async_engine_t * engine, int max_events)
+{
+	if(NULL == engine) engine = calloc(1, sizeof(*engine));
+	else memset(engine, 0, sizeof(*engine));
+	assert(engine);
+	
+	if(max_events <= 0) max_events = 64;
+	engine->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(engine->epfd < 0) {
+		perror("psql_async_engine_init()::epoll_create1()");
+		assert(engine->epfd >= 0);
+	}
+	engine->max_events = max_events;
+	engine->events = calloc(max_events, sizeof(*engine->events));
+	assert(engine->events);
+	return engine;
+}
+
+void psql_async_engine_cleanup(psql_async_engine_t * engine)
+{
+	if(NULL == engine) return;
+	
+	// detach the tasks, they are freed with their contexts
+	psql_async_task_t * task = engine->tasks;
+	while(task) {
+		psql_async_task_t * next = task->next;
+		task->engine = NULL;
+		task->busy = 0;
+		task->fd = -1;
+		task->prev = task->next = NULL;
+		task = next;
+	}
+	engine->tasks = NULL;
+	engine->num_tasks = 0;
+	engine->num_busy = 0;
+	
+	if(engine->epfd >= 0) close(engine->epfd);
+	engine->epfd = -1;
+	free(engine->events);
+	engine->events = NULL;
+	return;
+}
+
+/*
+ * a task is only registered with epoll while it is busy: 
+ * an idle socket closed by the server would report EPOLLHUP on every epoll_wait().
+ */
+static int psql_async_task_update_events(psql_async_task_t * task, uint32_t events)
+{
+	psql_async_engine_t * engine = task->engine;
+	int fd = PQsocket(task->psql->conn);
+	if(fd < 0) return -1;
+	
+	struct epoll_event ev = { .events = events, .data.ptr = task };
+	int rc = 0;
+	if(fd != task->fd) {	// not registered, or the connection has been reset
+		if(task->fd >= 0) epoll_ctl(engine->epfd, EPOLL_CTL_DEL, task->fd, NULL);
+		task->fd = -1;
+		rc = epoll_ctl(engine->epfd, EPOLL_CTL_ADD, fd, &ev);
+		if(0 == rc) task->fd = fd;
+	}else if(events != task->events) {
+		rc = epoll_ctl(engine->epfd, EPOLL_CTL_MOD, fd, &ev);
+	}
+	if(rc) {
+		perror("psql_async_task_update_events()::epoll_ctl()");
+		return -1;
+	}
+	task->events = events;
+	return 0;
+}
+
+static void psql_async_task_unregister(psql_async_task_t * task)
+{
+	if(task->fd >= 0) epoll_ctl(task->engine->epfd, EPOLL_CTL_DEL, task->fd, NULL);
+	task->fd = -1;
+	task->events = 0;
+}
+
+int psql_async_engine_add(psql_async_engine_t * engine, psql_context_t * psql)
+{
+	assert(engine && psql && psql->conn);
+	if(psql->async_task) return 0;
+	
+	if(PQsetnonblocking(psql->conn, 1) != 0) {
+		psql_set_conn_error(psql);
 		return -1;
 	}
-	return 0;
+	
+	psql_async_task_t * task = calloc(1, sizeof(*task));
+	assert(task);
+	task->engine = engine;
+	task->psql = psql;
+	task->fd = -1;
+	psql->async_task = task;
+	
+	task->next = engine->tasks;
+	if(engine->tasks) engine->tasks->prev = task;
+	engine->tasks = task;
+	++engine->num_tasks;
+	return 0;
+}
+
+static void psql_async_task_free(psql_context_t * psql)
+{
+	psql_async_task_t * task = psql->async_task;
+	if(NULL == task) return;
+	
+	psql->async_task = NULL;
+	psql_async_engine_t * engine = task->engine;
+	if(NULL == engine) {	// detached by psql_async_engine_cleanup()
+		free(task);
+		return;
+	}
+	
+	if(task->busy) --engine->num_busy;
+	psql_async_task_unregister(task);
+	
+	// freed by a callback: the events not dispatched yet must not reach it
+	for(int i = 0; i < engine->num_events; ++i) {
+		if(engine->events[i].data.ptr == task) engine->events[i].data.ptr = NULL;
+	}
+	
+	if(task->prev) task->prev->next = task->next;
+	else engine->tasks = task->next;
+	if(task->next) task->next->prev = task->prev;
+	--engine->num_tasks;
+	free(task);
 }
 
-int psql_send_prepare(psql_context_t * psql, const char * query, const char * stmt_name, int num_params, const unsigned int * param_types)
+int psql_async_engine_remove(psql_async_engine_t * engine, psql_context_t * psql)
 {
-	assert(psql && psql->conn);
-	PGconn * conn = psql->conn;
-	psql->err_msg[0] = '\0';
+	assert(engine && psql);
+	psql_async_task_t * task = psql->async_task;
+	if(NULL == task) return 0;
+	if(task->busy) return -1;
 	
-	int ok = PQsendPrepare(conn, stmt_name, query, num_params, param_types);
-	if(!ok) {
-		const char * err_msg = PQerrorMessage(conn);
-		if(err_msg) {
-			strncpy(psql->err_msg, err_msg, sizeof(psql->err_msg));
-		}
-		return -1;
-	}
+	if(psql->conn) PQsetnonblocking(psql->conn, 0);
+	psql_async_task_free(psql);
 	return 0;
 }
 
-int psql_send_query_prepared(psql_context_t * psql, const char * stmt_name, const psql_params_t * params)
+/*
+ * to be called right after one of psql_send_query*() succeeded on a connection added to the engine.
+ */
+int psql_async_engine_submit(psql_async_engine_t * engine, psql_context_t * psql, 
+	psql_async_on_result_fn on_result, psql_async_on_complete_fn on_complete, void * user_data)
 {
-	assert(psql && psql->conn);
-	PGconn * conn = psql->conn;
-	psql->err_msg[0] = '\0';
+	assert(engine && psql && psql->conn);
+	psql_async_task_t * task = psql->async_task;
+	if(NULL == task || task->busy) return -1;
 	
-	int ok = PQsendQueryPrepared(conn, stmt_name, 
-		params->num_params, 
-		params->values, params->cb_values, params->value_formats,
-		params->result_format);
-	if(!ok) {
-		const char * err_msg = PQerrorMessage(conn);
-		if(err_msg) {
-			strncpy(psql->err_msg, err_msg, sizeof(psql->err_msg));
-		}
+	task->on_result = on_result;
+	task->on_complete = on_complete;
+	task->user_data = user_data;
+	task->status = 0;
+	
+	int flush_rc = PQflush(psql->conn);
+	if(flush_rc < 0) {
+		psql_set_conn_error(psql);
 		return -1;
 	}
+	if(psql_async_task_update_events(task, EPOLLIN | ((flush_rc == 1)?EPOLLOUT:0))) return -1;
+	
+	task->busy = 1;
+	++engine->num_busy;
 	return 0;
 }
 
-enum {
-	FAILED = -1,
-	NO_MORE_RESULTS = 0,
-	MORE_RESULTS = 1
-};
-int psql_get_result(psql_context_t * psql, psql_result_t * p_result)
+static void psql_async_task_complete(psql_async_task_t * task)
 {
-	assert(psql && psql->conn);
+	task->busy = 0;
+	--task->engine->num_busy;
+	psql_async_task_unregister(task);
+	if(task->on_complete) task->on_complete(task->psql, task->status, task->user_data);
+}
+
+static void psql_async_task_process(psql_async_task_t * task, uint32_t events)
+{
+	psql_context_t * psql = task->psql;
 	PGconn * conn = psql->conn;
-	psql->err_msg[0] = '\0';
 	
-	PGresult * res = PQgetResult(conn);
-	if(NULL == res) return NO_MORE_RESULTS;	// ok and and there will be no more results.
+	if(events & (EPOLLERR | EPOLLHUP)) {
+		PQconsumeInput(conn);	// let libpq detect the failure
+	}
 	
-	if(NULL == p_result) {
+	if(events & EPOLLOUT) {
+		int rc = PQflush(conn);
+		if(rc < 0) {
+			psql_set_conn_error(psql);
+			task->status = -1;
+			psql_async_task_complete(task);
+			return;
+		}
+		if(rc == 0) psql_async_task_update_events(task, EPOLLIN);
+	}
+	
+	if(events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+		if(!PQconsumeInput(conn)) {
+			psql_set_conn_error(psql);
+			fprintf(stderr, "[ERROR]: PQconsumeInput() failed: %s\n", psql->err_msg);
+			task->status = -1;
+			// drain whatever libpq has buffered, then report the failure
+			PGresult * res = NULL;
+			while(!PQisBusy(conn) && (res = psql_do_get_result(psql))) PQclear(res);
+			psql_async_task_complete(task);
+			return;
+		}
+	}
+	
+	while(!PQisBusy(conn)) {
+		PGresult * res = psql_do_get_result(psql);
+		if(NULL == res) {
+			psql_async_task_complete(task);
+			return;
+		}
+		if(psql_check_result(psql, res) < 0) task->status = -1;
+		if(task->on_result) task->on_result(psql, res, task->user_data);
 		PQclear(res);
-		return MORE_RESULTS;
 	}
-	*p_result = res;
-	return MORE_RESULTS; // ok and maybe more results available.
+	return;
+}
+
+/*
+ * psql_async_engine_run()
+ * 	@timeout_ms: <0: wait until all submitted queries have completed; >=0: max time to wait for events.
+ * 	@return number of queries still in progress, or -1 on error.
+ */
+int psql_async_engine_run(psql_async_engine_t * engine, int timeout_ms)
+{
+	assert(engine);
+	double deadline = (timeout_ms >= 0)?(psql_get_time() + (double)timeout_ms / 1000.0):0;
+	
+	while(engine->num_busy > 0) {
+		int wait_ms = -1;
+		if(timeout_ms >= 0) {
+			double remaining = deadline - psql_get_time();
+			if(remaining < 0) remaining = 0;
+			wait_ms = (int)(remaining * 1000.0 + 0.5);
+		}
+		
+		int n = epoll_wait(engine->epfd, engine->events, engine->max_events, wait_ms);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("psql_async_engine_run()::epoll_wait()");
+			return -1;
+		}
+		engine->num_events = n;
+		for(int i = 0; i < n; ++i) {
+			psql_async_task_t * task = engine->events[i].data.ptr;
+			if(NULL == task || !task->busy) continue;	// freed or completed by an earlier callback
+			psql_async_task_process(task, engine->events[i].events);
+		}
+		engine->num_events = 0;
+		if(timeout_ms >= 0 && psql_get_time() >= deadline) break;
+	}
+	return engine->num_busy;
 }
 
 #if defined(_TEST_RDB_POSTGRES) && defined(_STAND_ALONE)
@@ -566,6 +7201,17 @@ static psql_context_t g_psql[1];
 int test_psql_execute(psql_context_t * psql);
 int test_psql_prepare(psql_context_t * psql);
 int test_async_query(psql_context_t * psql);
+int test_psql_pool(const char * sz_conn);
+int test_psql_exec_cached(psql_context_t * psql);
+int test_psql_query_stream(psql_context_t * psql);
+int test_psql_typed_results(psql_context_t * psql);
+int test_psql_async_engine(const char * sz_conn);
+int test_psql_connect_parallel(const char * sz_conn);
+int test_psql_params_builder(psql_context_t * psql);
+int test_psql_result_cache(psql_context_t * psql, const char * sz_conn);
+int test_psql_notify_dispatcher(psql_context_t * psql, const char * sz_conn);
+int test_psql_metrics(psql_context_t * psql);
+int test_psql_hooks(psql_context_t * psql);
 
 int main(int argc, char **argv)
 {
@@ -605,6 +7251,17 @@ int main(int argc, char **argv)
 	
 	test_async_query(psql);
 	
+	test_psql_pool(sz_conn);
+	test_psql_exec_cached(psql);
+	test_psql_query_stream(psql);
+	test_psql_typed_results(psql);
+	test_psql_async_engine(sz_conn);
+	test_psql_connect_parallel(sz_conn);
+	test_psql_params_builder(psql);
+	test_psql_result_cache(psql, sz_conn);
+	test_psql_notify_dispatcher(psql, sz_conn);
+	test_psql_metrics(psql);
+	test_psql_hooks(psql);
 	
 	PQfinish(psql->conn);
 	
@@ -732,5 +7389,607 @@ int test_async_query(psql_context_t * psql)
 	psql_result_clear(&res);
 	return 0;
 }
+
+static void * pool_worker_thread(void * user_data)
+{
+	psql_pool_t * pool = user_data;
+	for(int i = 0; i < 100; ++i) {
+		psql_context_t * psql = psql_pool_acquire(pool, 5000);
+		assert(psql);
+		
+		int rc = psql_execute(psql, "select 1;", NULL);
+		assert(0 == rc);
+		psql_pool_release(pool, psql);
+	}
+	return NULL;
+}
+
+int test_psql_pool(const char * sz_conn)
+{
+	printf("==== %s() ====\n", __FUNCTION__);
+#define NUM_THREADS (8)
+	psql_pool_params_t params = {
+		.min_idle = 2,
+		.max_idle = 4,
+		.max_conns = 4,
+	};
+	psql_pool_t * pool = psql_pool_init(NULL, sz_conn, &params);
+	assert(pool);
+	
+	pthread_t threads[NUM_THREADS];
+	for(int i = 0; i < NUM_THREADS; ++i) {
+		int rc = pthread_create(&threads[i], NULL, pool_worker_thread, pool);
+		assert(0 == rc);
+	}
+	for(int i = 0; i < NUM_THREADS; ++i) pthread_join(threads[i], NULL);
+	
+	psql_pool_stats_t stats[1];
+	psql_pool_get_stats(pool, stats);
+	printf(" --> acquired: %ld, created: %ld, waits: %ld, avg wait: %.6f ms, max wait: %.6f ms\n",
+		(long)stats->num_acquired, (long)stats->num_created, (long)stats->num_waits,
+		stats->total_wait_time * 1000.0 / (double)stats->num_acquired,
+		stats->max_wait_time * 1000.0);
+	assert(stats->num_acquired == NUM_THREADS * 100);
+	assert(stats->num_created <= params.max_conns);
+	
+	psql_pool_cleanup(pool);
+	free(pool);
+#undef NUM_THREADS
+	return 0;
+}
+int test_psql_exec_cached(psql_context_t * psql)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	static const char * query = "select * from pg_tables where schemaname=$1; ";
+	int rc = psql_stmt_cache_configure(psql, 2, 1);
+	assert(0 == rc);
+	
+	psql_params_t params[1];
+	memset(params, 0, sizeof(params));
+	psql_params_setv(params, 1, 0, 0, "pg_catalog", -1, 0);
+	
+	for(int i = 0; i < 10; ++i) {
+		psql_result_t res = NULL;
+		rc = psql_exec_cached(psql, query, params, &res);
+		assert(0 == rc && res);
+		psql_result_clear(&res);
+	}
+	
+	// a second statement evicts the first one (capacity == 1)
+	for(int i = 0; i < 3; ++i) {
+		rc = psql_exec_cached(psql, "select 1;", NULL, NULL);
+		assert(0 == rc);
+	}
+	
+	psql_stmt_cache_stats_t stats[1];
+	psql_stmt_cache_get_stats(psql, stats);
+	printf(" --> hits: %ld, misses: %ld, prepares: %ld, evictions: %ld, entries: %d, prepared: %d\n",
+		(long)stats->num_hits, (long)stats->num_misses, (long)stats->num_prepares, (long)stats->num_evictions,
+		stats->num_entries, stats->num_prepared);
+	assert(stats->num_prepares == 2 && stats->num_evictions == 1 && stats->num_prepared == 1);
+	psql_stmt_cache_clear(psql);
+	
+	// clear inside a transaction which has already filled the pending DEALLOCATE list
+	rc = psql_stmt_cache_configure(psql, 1, 8);
+	assert(0 == rc);
+	rc = psql_execute(psql, "BEGIN;", NULL);
+	assert(0 == rc);
+	char command[100] = "";
+	for(int i = 0; i < 300; ++i) {
+		snprintf(command, sizeof(command), "select %d;", i);
+		rc = psql_exec_cached(psql, command, NULL, NULL);
+		assert(0 == rc);
+	}
+	psql_stmt_cache_get_stats(psql, stats);
+	assert(stats->num_prepared == 8 && stats->num_pending_deallocs > 0);
+	
+	psql_stmt_cache_clear(psql);
+	psql_stmt_cache_get_stats(psql, stats);
+	printf(" --> cleared in a transaction: pending deallocs: %d\n", stats->num_pending_deallocs);
+	assert(stats->num_entries == 0 && stats->num_prepared == 0);
+	rc = psql_execute(psql, "COMMIT;", NULL);
+	assert(0 == rc);
+	
+	rc = psql_exec_cached(psql, "select 1;", NULL, NULL);	// flushes the pending DEALLOCATEs
+	assert(0 == rc);
+	psql_stmt_cache_get_stats(psql, stats);
+	assert(stats->num_pending_deallocs == 0);
+	
+	psql_stmt_cache_clear(psql);
+	psql_stmt_cache_configure(psql, 0, 0);
+	psql_params_cleanup(params);
+	return 0;
+}
+static int on_stream_rows(psql_context_t * psql, const psql_result_t res, int num_rows, void * user_data)
+{
+	int64_t * p_total = user_data;
+	*p_total += num_rows;
+	return (*p_total >= 50000);	// cancel the rest of the query
+}
+
+int test_psql_query_stream(psql_context_t * psql)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	int64_t total = 0;
+	psql_stream_stats_t stats[1];
+	
+	int rc = psql_query_stream(psql, "select generate_series(1, 100000);", NULL, 1000, on_stream_rows, &total, stats);
+	assert(0 == rc);
+	printf(" --> rows: %ld, chunks: %ld, time to first row: %.6f ms, total: %.6f ms, cancelled: %d\n",
+		(long)stats->num_rows, (long)stats->num_chunks, 
+		stats->time_to_first_row * 1000.0, stats->total_time * 1000.0, 
+		stats->cancelled);
+	assert(stats->cancelled && total == stats->num_rows);
+	
+	// the connection is still usable after a cancelled stream
+	rc = psql_execute(psql, "select 1;", NULL);
+	assert(0 == rc);
+	return 0;
+}
+int test_psql_typed_results(psql_context_t * psql)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	static const char * query = "select 42::int2, -7::int4, 1234567890123::int8, 1.5::float8, "
+		" '-12345.678'::numeric, true, "
+		" 'a0eebc99-9c0b-4ef8-bb6d-6bb9bd380a11'::uuid, "
+		" '2000-01-01 00:00:01'::timestamp, 'abc'::bytea, NULL::int4;";
+	
+	for(int result_format = 0; result_format <= 1; ++result_format) {
+		psql_params_t params[1];
+		memset(params, 0, sizeof(params));
+		psql_params_init(params, 0, result_format);
+		params->result_format = result_format;
+		
+		psql_result_t res = NULL;
+		int rc = psql_exec_params(psql, query, params, &res);
+		assert(0 == rc && res);
+		
+		int64_t i_value = 0;
+		double d_value = 0;
+		int b_value = 0;
+		unsigned char uuid[16];
+		
+		rc = psql_result_get_int64(res, 0, 0, &i_value); assert(0 == rc && i_value == 42);
+		rc = psql_result_get_int64(res, 0, 1, &i_value); assert(0 == rc && i_value == -7);
+		rc = psql_result_get_int64(res, 0, 2, &i_value); assert(0 == rc && i_value == INT64_C(1234567890123));
+		rc = psql_result_get_double(res, 0, 3, &d_value); assert(0 == rc && d_value == 1.5);
+		rc = psql_result_get_double(res, 0, 4, &d_value); assert(0 == rc && fabs(d_value + 12345.678) < 1e-9);
+		rc = psql_result_get_bool(res, 0, 5, &b_value); assert(0 == rc && b_value);
+		rc = psql_result_get_uuid(res, 0, 6, uuid); assert(0 == rc && uuid[0] == 0xa0 && uuid[15] == 0x11);
+		if(result_format == 1) {
+			rc = psql_result_get_timestamp(res, 0, 7, &i_value); 
+			assert(0 == rc && i_value == INT64_C(946684801000000));
+		}
+		rc = psql_result_get_int64(res, 0, 5, &i_value); assert(rc == -1);	// type mismatch
+		rc = psql_result_get_int64(res, 0, 9, &i_value); assert(rc == 1);	// NULL
+		
+		
+		// columnar copy of the same result
+		psql_columns_t columns[1];
+		psql_columns_t * p_columns = psql_columns_init(columns, res);
+		assert(p_columns == columns && columns->num_rows == 1 && columns->num_columns == 10);
+		assert(columns->columns[2].storage == psql_column_storage_int64 && columns->columns[2].values.i64[0] == INT64_C(1234567890123));
+		assert(columns->columns[4].storage == psql_column_storage_float64);
+		assert(psql_column_is_null(&columns->columns[9], 0));
+		
+		int cb = 0;
+		const char * sz = psql_column_get_string(&columns->columns[8], 0, &cb);
+		assert(sz && cb > 0);
+		psql_columns_cleanup(columns);
+		
+		psql_result_clear(&res);
+		psql_params_cleanup(params);
+	}
+	
+	// numeric infinities (PG14+)
+	if(PQserverVersion(psql->conn) >= 140000) {
+		for(int result_format = 0; result_format <= 1; ++result_format) {
+			psql_params_t params[1];
+			memset(params, 0, sizeof(params));
+			psql_params_init(params, 0, result_format);
+			params->result_format = result_format;
+			
+			psql_result_t res = NULL;
+			int rc = psql_exec_params(psql, "select 'Infinity'::numeric, '-Infinity'::numeric, 'NaN'::numeric;", params, &res);
+			assert(0 == rc && res);
+			
+			double d_value = 0;
+			rc = psql_result_get_double(res, 0, 0, &d_value); assert(0 == rc && isinf(d_value) && d_value > 0);
+			rc = psql_result_get_double(res, 0, 1, &d_value); assert(0 == rc && isinf(d_value) && d_value < 0);
+			rc = psql_result_get_double(res, 0, 2, &d_value); assert(0 == rc && isnan(d_value));
+			
+			psql_result_clear(&res);
+			psql_params_cleanup(params);
+		}
+	}
+	return 0;
+}
+static void on_async_complete(psql_context_t * psql, int status, void * user_data)
+{
+	int * p_num_completed = user_data;
+	assert(0 == status);
+	++*p_num_completed;
+}
+
+int test_psql_async_engine(const char * sz_conn)
+{
+	printf("==== %s() ====\n", __FUNCTION__);
+#define NUM_CONNS (16)
+	psql_context_t conns[NUM_CONNS];
+	memset(conns, 0, sizeof(conns));
+	
+	psql_async_engine_t * engine = psql_async_engine_init(NULL, 0);
+	assert(engine);
+	
+	for(int i = 0; i < NUM_CONNS; ++i) {
+		psql_context_init(&conns[i], NULL);
+		int rc = psql_connect_db(&conns[i], sz_conn, 0);
+		assert(0 == rc);
+		rc = psql_async_engine_add(engine, &conns[i]);
+		assert(0 == rc);
+	}
+	
+	int num_completed = 0;
+	app_timer_t * timer = app_timer_start(NULL);
+	for(int i = 0; i < NUM_CONNS; ++i) {
+		int rc = psql_send_query(&conns[i], "select pg_sleep(0.2);");
+		assert(0 == rc);
+		rc = psql_async_engine_submit(engine, &conns[i], NULL, on_async_complete, &num_completed);
+		assert(0 == rc);
+	}
+	int rc = psql_async_engine_run(engine, -1);
+	double time_elapsed = app_timer_stop(timer);
+	printf(" --> %d queries completed in %.6f ms\n", num_completed, time_elapsed * 1000.0);
+	assert(0 == rc && num_completed == NUM_CONNS);
+	assert(time_elapsed < 0.2 * NUM_CONNS / 2);	// queries ran concurrently
+	
+	for(int i = 0; i < NUM_CONNS; ++i) {
+		psql_async_engine_remove(engine, &conns[i]);
+		psql_context_cleanup(&conns[i]);
+	}
+	psql_async_engine_cleanup(engine);
+	free(engine);
+#undef NUM_CONNS
+	return 0;
+}
+
+int test_psql_connect_parallel(const char * sz_conn)
+{
+	printf("==== %s() ====\n", __FUNCTION__);
+#define NUM_CONNS (8)
+	int rc = 0;
+	double time_elapsed = 0.0;
+	app_timer_t timer[1];
+	
+	// async connect + wait
+	psql_context_t * psql = psql_context_init(NULL, NULL);
+	app_timer_start(timer);
+	rc = psql_connect_db(psql, sz_conn, 1);
+	assert(0 == rc);
+	rc = psql_connect_async_wait(psql, 5000);
+	time_elapsed = app_timer_stop(timer);
+	assert(0 == rc && psql->conn_status == CONNECTION_OK);
+	printf("psql_connect_async_wait(): time_elapsed=%.6f ms\n", time_elapsed * 1000);
+	psql_context_cleanup(psql);
+	free(psql);
+	
+	// open NUM_CONNS connections concurrently
+	psql_context_t * contexts[NUM_CONNS] = { NULL };
+	for(int i = 0; i < NUM_CONNS; ++i) contexts[i] = psql_context_init(NULL, NULL);
+	
+	app_timer_start(timer);
+	int num_connected = psql_connect_db_parallel(contexts, NUM_CONNS, sz_conn, 5000);
+	time_elapsed = app_timer_stop(timer);
+	printf("psql_connect_db_parallel(%d): num_connected=%d, time_elapsed=%.6f ms\n", 
+		NUM_CONNS, num_connected, time_elapsed * 1000);
+	assert(num_connected == NUM_CONNS);
+	
+	for(int i = 0; i < NUM_CONNS; ++i) {
+		assert(contexts[i]->conn && PQstatus(contexts[i]->conn) == CONNECTION_OK);
+		psql_context_cleanup(contexts[i]);
+		free(contexts[i]);
+	}
+	
+	// invalid host, all connections should fail before the deadline
+	for(int i = 0; i < NUM_CONNS; ++i) contexts[i] = psql_context_init(NULL, NULL);
+	num_connected = psql_connect_db_parallel(contexts, NUM_CONNS, "host=/nonexistent-dir dbname=postgres", 1000);
+	assert(0 == num_connected);
+	for(int i = 0; i < NUM_CONNS; ++i) {
+		assert(NULL == contexts[i]->conn);
+		psql_context_cleanup(contexts[i]);
+		free(contexts[i]);
+	}
+#undef NUM_CONNS
+	return 0;
+}
+
+int test_psql_params_builder(psql_context_t * psql)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	static const char * command = "select $1::text || '-' || $2::text, $3::int8 + 1, $4::float8 * 2, $5::bool, $6::int4 is null";
+	
+	psql_params_builder_t builder[1];
+	psql_params_builder_init(builder, 0, 0, 1);
+	
+	for(int i = 0; i < 100; ++i) {
+		psql_params_builder_reset(builder);
+		psql_params_builder_add_text(builder, "row", -1);
+		psql_params_builder_add_printf(builder, 0, "%d", i);
+		psql_params_builder_add_int64(builder, i);
+		psql_params_builder_add_double(builder, i + 0.5);
+		psql_params_builder_add_bool(builder, i & 1);
+		psql_params_builder_add_null(builder, 23);
+		
+		psql_result_t res = NULL;
+		int rc = psql_exec_params(psql, command, builder->params, &res);
+		assert(0 == rc && res);
+		
+		char expected[100] = "";
+		snprintf(expected, sizeof(expected), "row-%d", i);
+		
+		const char * text = psql_result_get_value(res, 0, 0);
+		int64_t value = 0;
+		double f = 0;
+		int b = 0, is_null = 0;
+		assert(0 == strcmp(text, expected));
+		assert(0 == psql_result_get_int64(res, 0, 1, &value) && value == (i + 1));
+		assert(0 == psql_result_get_double(res, 0, 2, &f) && f == (i + 0.5) * 2);
+		assert(0 == psql_result_get_bool(res, 0, 3, &b) && b == (i & 1));
+		assert(0 == psql_result_get_bool(res, 0, 4, &is_null) && is_null);
+		psql_result_clear(&res);
+	}
+	psql_params_builder_cleanup(builder);
+	return 0;
+}
+
+int test_psql_result_cache(psql_context_t * psql, const char * sz_conn)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	static const char * query = "select $1::int8 + 1, now()";
+	static const char * tags[] = { "test_result_cache" };
+	
+	psql_context_t * listener = psql_context_init(NULL, NULL);
+	int rc = psql_connect_db(listener, sz_conn, 0);
+	assert(0 == rc);
+	
+	psql_result_cache_params_t cache_params = { .ttl_ms = 200, .poll_interval_ms = 1 };
+	psql_result_cache_t * cache = psql_result_cache_init(NULL, &cache_params);
+	rc = psql_result_cache_listen(cache, listener, tags[0]);
+	assert(0 == rc);
+	
+	psql_params_builder_t builder[1];
+	psql_params_builder_init(builder, 1, 0, 0);
+	psql_params_builder_add_int64(builder, 41);
+	
+	psql_result_cache_stats_t stats[1];
+	for(int i = 0; i < 10; ++i) {
+		psql_result_t res = NULL;
+		rc = psql_result_cache_exec(cache, psql, query, builder->params, tags, 1, &res);
+		assert(0 == rc && res);
+		assert(0 == strcmp(psql_result_get_value(res, 0, 0), "42"));
+		psql_result_clear(&res);
+	}
+	psql_result_cache_get_stats(cache, stats);
+	assert(stats->num_misses == 1 && stats->num_hits == 9 && stats->num_entries == 1);
+	
+	// a NOTIFY on the tag (e.g. sent by a trigger) invalidates the entry
+	rc = psql_execute(psql, "NOTIFY test_result_cache;", NULL);
+	assert(0 == rc);
+	usleep(20 * 1000);
+	rc = psql_result_cache_exec(cache, psql, query, builder->params, tags, 1, NULL);
+	assert(0 == rc);
+	psql_result_cache_get_stats(cache, stats);
+	assert(stats->num_misses == 2 && stats->num_invalidations == 1);
+	
+	// expired by TTL
+	usleep(250 * 1000);
+	rc = psql_result_cache_exec(cache, psql, query, builder->params, tags, 1, NULL);
+	assert(0 == rc);
+	psql_result_cache_get_stats(cache, stats);
+	printf(" --> hits: %ld, misses: %ld, stale: %ld, evictions: %ld, invalidations: %ld, entries: %ld, bytes: %ld\n",
+		(long)stats->num_hits, (long)stats->num_misses, (long)stats->num_stale, (long)stats->num_evictions,
+		(long)stats->num_invalidations, (long)stats->num_entries, (long)stats->num_bytes);
+	assert(stats->num_misses == 3 && stats->num_stale == 2);
+	
+	psql_params_builder_cleanup(builder);
+	psql_result_cache_cleanup(cache);
+	free(cache);
+	psql_context_cleanup(listener);
+	free(listener);
+	return 0;
+}
+
+static void on_test_notification(psql_notify_dispatcher_t * dispatcher, const psql_notification_t * notification, void * user_data)
+{
+	int * p_count = user_data;
+	assert(0 == strcmp(notification->channel, "test_notify_a"));
+	__atomic_add_fetch(p_count, 1, __ATOMIC_RELAXED);
+}
+
+int test_psql_notify_dispatcher(psql_context_t * psql, const char * sz_conn)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	static const int num_notifications = 1000;
+	int count = 0;
+	
+	psql_notify_dispatcher_params_t params = { .max_batch = 64 };
+	psql_notify_dispatcher_t * dispatcher = psql_notify_dispatcher_init(NULL, sz_conn, &params);
+	int rc = psql_notify_dispatcher_listen(dispatcher, "test_notify_a", on_test_notification, &count);
+	assert(0 == rc);
+	rc = psql_notify_dispatcher_start(dispatcher);
+	assert(0 == rc);
+	
+	// subscribed while running: pulled from the queue
+	rc = psql_notify_dispatcher_listen(dispatcher, "test_notify_b", NULL, NULL);
+	assert(0 == rc);
+	
+	// one transaction: delivered all at once on COMMIT
+	rc = psql_execute(psql, "BEGIN;", NULL);
+	assert(0 == rc);
+	char command[200] = "";
+	for(int i = 0; i < num_notifications; ++i) {
+		snprintf(command, sizeof(command), "select pg_notify('%s', '%d');", (i & 1)?"test_notify_b":"test_notify_a", i);
+		rc = psql_execute(psql, command, NULL);
+		assert(0 == rc);
+	}
+	rc = psql_execute(psql, "COMMIT;", NULL);
+	assert(0 == rc);
+	
+	int num_popped = 0;
+	psql_notification_t * notification = NULL;
+	while(num_popped < num_notifications / 2 && psql_notify_dispatcher_pop(dispatcher, &notification, 3000) == 1) {
+		assert(0 == strcmp(notification->channel, "test_notify_b"));
+		assert(atoi(notification->payload) == num_popped * 2 + 1);	// in order
+		free(notification);
+		++num_popped;
+	}
+	assert(num_popped == num_notifications / 2);
+	for(int i = 0; i < 100 && __atomic_load_n(&count, __ATOMIC_RELAXED) < num_notifications / 2; ++i) usleep(10 * 1000);
+	assert(count == num_notifications / 2);
+	
+	rc = psql_notify_dispatcher_unlisten(dispatcher, "test_notify_a", on_test_notification, &count);
+	assert(0 == rc);
+	rc = psql_execute(psql, "NOTIFY test_notify_a;", NULL);
+	assert(0 == rc);
+	
+	psql_notify_dispatcher_stats_t stats[1];
+	psql_notify_dispatcher_get_stats(dispatcher, stats);
+	printf(" --> received: %ld, batches: %ld, callbacks: %ld, queued: %ld, dropped: %ld, channels: %ld\n",
+		(long)stats->num_received, (long)stats->num_batches, (long)stats->num_callbacks,
+		(long)stats->num_queued, (long)stats->num_dropped, (long)stats->num_channels);
+	assert(stats->num_channels == 1 && stats->num_dropped == 0);
+	
+	psql_notify_dispatcher_cleanup(dispatcher);
+	free(dispatcher);
+	return 0;
+}
+
+int test_psql_metrics(psql_context_t * psql)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	char label[PSQL_METRICS_LABEL_SIZE] = "";
+	uint64_t fingerprint = psql_metrics_fingerprint("DO $$ BEGIN RAISE NOTICE 'a'; END $$;", label, sizeof(label));
+	assert(0 == strcmp(label, "DO ?"));
+	assert(fingerprint == psql_metrics_fingerprint("DO $body$ select '$$' || 2 $body$;", label, sizeof(label)));
+	psql_metrics_fingerprint("select \"it's 1\", $1 from \"t\"\"2\" where a = 'x';", label, sizeof(label));
+	assert(0 == strcmp(label, "select \"it's 1\", $1 from \"t\"\"2\" where a = ?"));
+	
+	int rc = psql_metrics_enable(psql, 1);
+	assert(0 == rc);
+	psql_metrics_measure_bytes(psql, 1);
+	
+	char command[200] = "";
+	for(int i = 0; i < 100; ++i) {
+		// same fingerprint: "select generate_series(?, ?)"
+		snprintf(command, sizeof(command), "select generate_series(1, %d)", i + 1);
+		rc = psql_execute(psql, command, NULL);
+		assert(0 == rc);
+	}
+	rc = psql_execute(psql, "select * from no_such_table_xyz", NULL);
+	assert(rc);
+	
+	psql_stmt_metrics_t * metrics = NULL;
+	int count = psql_metrics_snapshot(psql, &metrics, 1);
+	assert(count == 2 && metrics);
+	for(int i = 0; i < count; ++i) {
+		psql_stmt_metrics_t * m = &metrics[i];
+		printf(" --> [%s]: calls: %ld, errors: %ld, rows: %ld, sent: %ld, received: %ld, "
+			"avg: %.3f ms, p50: %.3f ms, p99: %.3f ms, max: %.3f ms\n",
+			m->label, (long)m->num_calls, (long)m->num_errors, (long)m->num_rows, 
+			(long)m->bytes_sent, (long)m->bytes_received,
+			m->total_time / m->num_calls * 1000.0, 
+			psql_stmt_metrics_percentile(m, 0.5) * 1000.0, 
+			psql_stmt_metrics_percentile(m, 0.99) * 1000.0,
+			m->max_time * 1000.0);
+		if(0 == strcmp(m->label, "select generate_series(?, ?)")) {
+			assert(m->num_calls == 100 && m->num_rows == 5050 && m->num_errors == 0);
+			assert(m->bytes_received > 0);
+		}else {
+			assert(m->num_calls == 1 && m->num_errors == 1);
+		}
+	}
+	free(metrics);
+	
+	// the snapshot has reset the metrics
+	count = psql_metrics_snapshot(psql, &metrics, 0);
+	assert(count == 0 && NULL == metrics);
+	psql_metrics_measure_bytes(psql, 0);
+	psql_metrics_enable(psql, 0);
+	return 0;
+}
+
+struct test_hook_context
+{
+	int num_before[4];
+	int num_after[4];
+	int num_failed;
+	int64_t num_rows;
+};
+static void test_hook_before(psql_context_t * psql, const psql_hook_event_t * event, void ** p_span, void * user_data)
+{
+	struct test_hook_context * ctx = user_data;
+	++ctx->num_before[event->op];
+	*p_span = (void *)event->command;
+}
+static void test_hook_after(psql_context_t * psql, const psql_hook_event_t * event, void ** p_span, void * user_data)
+{
+	struct test_hook_context * ctx = user_data;
+	assert(*p_span == (void *)event->command);	// carried over from the before hook
+	++ctx->num_after[event->op];
+	if(event->rc) ++ctx->num_failed;
+	ctx->num_rows += event->num_rows;
+	if(event->duration > 0.1) {	// slow query log
+		fprintf(stderr, "[WARN]: slow query (%.3f s): %s\n", event->duration, event->command?event->command:event->stmt_name);
+	}
+}
+
+int test_psql_hooks(psql_context_t * psql)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	struct test_hook_context ctx[1];
+	memset(ctx, 0, sizeof(ctx));
+	
+	int hook_id = psql_add_hook(psql, test_hook_before, test_hook_after, ctx);
+	assert(hook_id > 0);
+	
+	int rc = psql_execute(psql, "select generate_series(1, 10);", NULL);
+	assert(0 == rc);
+	
+	psql_params_t params[1];
+	memset(params, 0, sizeof(params));
+	psql_params_setv(params, 1, 0, 0, "5", -1, 0);
+	rc = psql_exec_params(psql, "select generate_series(1, $1::int);", params, NULL);
+	assert(0 == rc);
+	
+	rc = psql_send_query(psql, "select 1;");
+	assert(0 == rc);
+	while(psql_get_result(psql, NULL) > 0);
+	
+	rc = psql_execute(psql, "select * from no_such_table_xyz;", NULL);
+	assert(rc);
+	
+	psql_prepare_params_t prepare_params[1] = {{ .stmt_name = "test-hooks-no-such-table" }};
+	rc = psql_prepare(psql, "select * from no_such_table_xyz;", prepare_params);
+	assert(rc);
+	assert(ctx->num_after[psql_hook_op_prepare] == 1);
+	
+	printf(" --> exec: %d/%d, send: %d/%d, get_result: %d/%d, failed: %d, rows: %ld\n",
+		ctx->num_before[psql_hook_op_exec], ctx->num_after[psql_hook_op_exec],
+		ctx->num_before[psql_hook_op_send], ctx->num_after[psql_hook_op_send],
+		ctx->num_before[psql_hook_op_get_result], ctx->num_after[psql_hook_op_get_result],
+		ctx->num_failed, (long)ctx->num_rows);
+	assert(ctx->num_after[psql_hook_op_exec] == 3 && ctx->num_after[psql_hook_op_send] == 1);
+	assert(ctx->num_after[psql_hook_op_get_result] == 2);	// the result, then NULL
+	assert(ctx->num_failed == 2 && ctx->num_rows == 16);
+	
+	rc = psql_remove_hook(psql, hook_id);
+	assert(0 == rc);
+	psql_execute(psql, "select 1;", NULL);
+	assert(ctx->num_after[psql_hook_op_exec] == 3);
+	
+	psql_params_cleanup(params);
+	return 0;
+}
 #endif
 
+
@@ -30,41 +30,858 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
-enum rdb_type
+#include <libpq-fe.h>
+#include <sqlite3.h>
+
+#include "rdb-utils.h"
+#include "rdb-postgres.h"
+
+#define RDB_BATCH_ROWS (1000)
+
+/* *********************************** **
+ * Transaction
+ * 	backend independent, built on rdb->execute()
+** *********************************** */
+static int rdb_trans_exec(rdb_transaction_t * trans, const char * fmt, const char * saved_name)
+{
+	rdb_context_t * rdb = trans->priv;
+	assert(rdb && rdb->execute);
+	char sql[256] = "";
+	int cb = snprintf(sql, sizeof(sql), fmt, saved_name);
+	if(cb <= 0 || cb >= sizeof(sql)) return -1;
+	return rdb->execute(rdb, sql, NULL);
+}
+
+static int rdb_trans_begin(rdb_transaction_t * trans)
+{
+	return rdb_trans_exec(trans, "BEGIN%s", "");
+}
+static int rdb_trans_save_point(rdb_transaction_t * trans, const char * saved_name)
+{
+	assert(saved_name && saved_name[0]);
+	return rdb_trans_exec(trans, "SAVEPOINT \"%s\"", saved_name);
+}
+static int rdb_trans_commit(rdb_transaction_t * trans)
+{
+	return rdb_trans_exec(trans, "COMMIT%s", "");
+}
+static int rdb_trans_rollback(rdb_transaction_t * trans, const char * saved_name)
+{
+	if(NULL == saved_name) return rdb_trans_exec(trans, "ROLLBACK%s", "");
+	return rdb_trans_exec(trans, "ROLLBACK TO SAVEPOINT \"%s\"", saved_name);
+}
+
+rdb_transaction_t * rdb_transaction_init(rdb_transaction_t * trans, rdb_context_t * rdb)
 {
-	rdb_type_postgres,
-	rdb_type_mariadb,
-	rdb_type_sqllite,
-	rdb_type_oracle,
-	rdb_type_sqlserver,
+	assert(rdb);
+	if(NULL == trans) {
+		trans = calloc(1, sizeof(*trans));
+		assert(trans);
+	}
+	trans->priv = rdb;
+	trans->begin = rdb_trans_begin;
+	trans->save_point = rdb_trans_save_point;
+	trans->commit = rdb_trans_commit;
+	trans->rollback = rdb_trans_rollback;
+	return trans;
+}
+
+/* *********************************** **
+ * PostgreSQL backend
+ * 	priv: psql_context_t *
+** *********************************** */
+static int pg_connect(rdb_context_t * rdb, const char * conn_string, int async_mode)
+{
+	psql_context_t * psql = rdb->priv;
+	assert(psql);
+	return psql_connect_db(psql, conn_string, async_mode);
+}
+
+static int pg_execute(rdb_context_t * rdb, const char * sql_statements, void ** p_result)
+{
+	return psql_execute(rdb->priv, sql_statements, p_result);
+}
+
+static void pg_clear_result(void * result)
+{
+	psql_result_clear(&result);
+}
+
+static int pg_disconnect(rdb_context_t * rdb)
+{
+	return psql_disconnect(rdb->priv);
+}
+
+static void pg_set_text_params(psql_params_t * params, int num_params, const char ** values)
+{
+	psql_params_init(params, num_params, 0);
+	for(int i = 0; i < num_params; ++i) {
+		params->values[i] = values[i];
+		params->cb_values[i] = values[i]?(int)strlen(values[i]):0;
+	}
+}
+
+struct pg_batch_state
+{
+	int64_t num_affected;
+	int num_failed;
 };
+static void pg_on_batch_result(psql_context_t * psql, int index, int status, const psql_result_t res, void * user_data)
+{
+	struct pg_batch_state * state = user_data;
+	if(status != psql_pipeline_status_ok) {
+		++state->num_failed;
+		return;
+	}
+	const char * affected = PQcmdTuples((PGresult *)res);
+	if(affected && affected[0]) state->num_affected += atoll(affected);
+}
 
-typedef struct rdb_transaction
+static int64_t pg_execute_batch(rdb_context_t * rdb, const char * command, int num_params, int num_rows, const char ** values)
 {
-	void * priv;
-	int (* begin)(struct rdb_transaction * trans);
-	int (* save_point)(struct rdb_transaction * trans, const char * saved_name);
-	int (* commit)(struct rdb_transaction * trans);
-	int (* rollback)(struct rdb_transaction * trans, const char * saved_name);
-}rdb_transaction_t;
+	psql_context_t * psql = rdb->priv;
+	assert(psql && command && num_params >= 0 && num_rows >= 0);
+	assert(num_rows == 0 || num_params == 0 || values);
+	if(num_rows == 0) return 0;
+
+	// an explicit transaction (a savepoint inside the caller's one) instead of the implicit one of the sync: 
+	// COMMIT is only queued once every statement has been sent, a failed send is rolled back.
+	int in_trans = psql_in_transaction(psql);
+	if(in_trans < 0) return -1;
+	const char * begin_sql = in_trans?"SAVEPOINT rdb_batch":"BEGIN";
+	const char * commit_sql = in_trans?"RELEASE rdb_batch":"COMMIT";
+	const char * rollback_sql = in_trans?"ROLLBACK TO rdb_batch; RELEASE rdb_batch":"ROLLBACK";
+
+	if(psql_pipeline_enter(psql)) return -1;
+
+	psql_params_t params[1];
+	memset(params, 0, sizeof(params));
+	int rc = psql_pipeline_send_params(psql, begin_sql, params);
+	for(int row = 0; row < num_rows && 0 == rc; ++row) {
+		pg_set_text_params(params, num_params, values + (size_t)row * num_params);
+		rc = psql_pipeline_send_params(psql, command, params);
+	}
+	psql_params_cleanup(params);
+	memset(params, 0, sizeof(params));
+	if(0 == rc) rc = psql_pipeline_send_params(psql, commit_sql, params);
+
+	// one sync for the whole batch: one round trip
+	struct pg_batch_state state[1] = {{ 0 }};
+	if(psql_pipeline_sync(psql) || psql_pipeline_get_results(psql, NULL, 0, pg_on_batch_result, state) < 0) rc = -1;
+	psql_pipeline_exit(psql);
 
-typedef struct rdb_context
+	if(rc || state->num_failed) {
+		psql_execute(psql, rollback_sql, NULL);
+		return -1;
+	}
+	return state->num_affected;
+}
+
+struct pg_stream_state
 {
+	rdb_context_t * rdb;
+	rdb_on_row_fn on_row;
 	void * user_data;
-	void * priv;
-	
-	int (* connect)(struct rdb_context * rdb, const char * conn_string, int async_mmode);
-	int (* execute)(struct rdb_context * rdb, const char * sql_statements, void ** p_result);
-	void (* clear_result)(void * result);
-	int (* disconnect)(struct rdb_context * rdb);
-}rdb_context_t;
+	int num_fields;
+	const char ** field_names;
+	const char ** values;
+	int64_t num_rows;
+};
+static int pg_on_rows(psql_context_t * psql, const psql_result_t res, int num_rows, void * user_data)
+{
+	struct pg_stream_state * state = user_data;
+	if(NULL == state->values) {	// the field count is fixed for the whole query
+		state->num_fields = psql_result_get_fields(res, NULL);
+		if(state->num_fields <= 0) return 0;
+		state->field_names = calloc(state->num_fields, sizeof(*state->field_names));
+		state->values = calloc(state->num_fields, sizeof(*state->values));
+		assert(state->field_names && state->values);
+	}
+	// the names belong to the current chunk
+	for(int col = 0; col < state->num_fields; ++col) state->field_names[col] = PQfname(res, col);
+
+	for(int row = 0; row < num_rows; ++row) {
+		for(int col = 0; col < state->num_fields; ++col) {
+			state->values[col] = psql_result_is_null(res, row, col)?NULL:psql_result_get_value(res, row, col);
+		}
+		++state->num_rows;
+		if(state->on_row(state->rdb, state->num_fields, state->field_names, state->values, state->user_data)) return 1;
+	}
+	return 0;
+}
+
+static int64_t pg_query(rdb_context_t * rdb, const char * sql, int num_params, const char ** params,
+	rdb_on_row_fn on_row, void * user_data)
+{
+	assert(rdb->priv && sql && on_row);
+	psql_params_t pg_params[1];
+	memset(pg_params, 0, sizeof(pg_params));
+	if(num_params > 0) pg_set_text_params(pg_params, num_params, params);
+
+	struct pg_stream_state state[1] = {{
+		.rdb = rdb,
+		.on_row = on_row,
+		.user_data = user_data,
+	}};
+	int rc = psql_query_stream(rdb->priv, sql, (num_params > 0)?pg_params:NULL, 256, pg_on_rows, state, NULL);
+	free(state->field_names);
+	free(state->values);
+	psql_params_cleanup(pg_params);
+	return rc?-1:state->num_rows;
+}
+
+static int pg_get_num_rows(const void * result)
+{
+	return psql_result_get_count((psql_result_t)result);
+}
+static int pg_get_num_fields(const void * result)
+{
+	return psql_result_get_fields((psql_result_t)result, NULL);
+}
+static const char * pg_get_field_name(const void * result, int col)
+{
+	return PQfname(result, col);
+}
+static const char * pg_get_value(const void * result, int row, int col)
+{
+	if(psql_result_is_null((psql_result_t)result, row, col)) return NULL;
+	return psql_result_get_value((psql_result_t)result, row, col);
+}
+
+static void rdb_postgres_init(rdb_context_t * rdb)
+{
+	rdb->priv = psql_context_init(NULL, rdb);
+	rdb->connect = pg_connect;
+	rdb->execute = pg_execute;
+	rdb->clear_result = pg_clear_result;
+	rdb->disconnect = pg_disconnect;
+	rdb->execute_batch = pg_execute_batch;
+	rdb->query = pg_query;
+	rdb->get_num_rows = pg_get_num_rows;
+	rdb->get_num_fields = pg_get_num_fields;
+	rdb->get_field_name = pg_get_field_name;
+	rdb->get_value = pg_get_value;
+}
+
+static void rdb_postgres_cleanup(rdb_context_t * rdb)
+{
+	psql_context_cleanup(rdb->priv);
+	free(rdb->priv);
+	rdb->priv = NULL;
+}
+
+/* *********************************** **
+ * SQLite backend (local read-cache tier)
+ * 	priv: sqlite3 *
+** *********************************** */
+typedef struct rdb_sqlite_result
+{
+	int num_fields;
+	int num_rows;
+	int max_rows;
+	char ** field_names;
+	char ** values;	// values[row * num_fields + col]
+}rdb_sqlite_result_t;
+
+static void sqlite_result_reset(rdb_sqlite_result_t * result)
+{
+	for(int i = 0; i < result->num_fields; ++i) free(result->field_names[i]);
+	for(int i = 0; i < result->num_rows * result->num_fields; ++i) free(result->values[i]);
+	free(result->field_names);
+	free(result->values);
+	memset(result, 0, sizeof(*result));
+}
+
+static void sqlite_clear_result(void * result)
+{
+	if(NULL == result) return;
+	sqlite_result_reset(result);
+	free(result);
+}
+
+static int sqlite_connect(rdb_context_t * rdb, const char * conn_string, int async_mode)
+{
+	(void)async_mode;	// sqlite is in-process
+	if(rdb->priv) return 0;
+	if(NULL == conn_string || !conn_string[0]) conn_string = ":memory:";
+
+	sqlite3 * db = NULL;
+	int rc = sqlite3_open_v2(conn_string, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL);
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "[ERROR]: %s(%s): %s\n", __FUNCTION__, conn_string, db?sqlite3_errmsg(db):sqlite3_errstr(rc));
+		sqlite3_close(db);
+		return -1;
+	}
+	// cache tier: rebuildable data, trade durability for write speed
+	rc = sqlite3_exec(db, "PRAGMA journal_mode = MEMORY; PRAGMA synchronous = OFF; PRAGMA temp_store = MEMORY;", NULL, NULL, NULL);
+	if(rc != SQLITE_OK) fprintf(stderr, "[WARNING]: %s(): %s\n", __FUNCTION__, sqlite3_errmsg(db));
+	sqlite3_busy_timeout(db, 5000);
+	rdb->priv = db;
+	return 0;
+}
+
+static int sqlite_disconnect(rdb_context_t * rdb)
+{
+	if(NULL == rdb->priv) return 0;
+	sqlite3_close_v2(rdb->priv);
+	rdb->priv = NULL;
+	return 0;
+}
+
+/* binds text values to $1 .. $n (or ?1 .. ?n, or anonymous '?' in order) */
+static int sqlite_bind_text(sqlite3_stmt * stmt, int num_params, const char ** values)
+{
+	int num_bindings = sqlite3_bind_parameter_count(stmt);
+	for(int i = 1; i <= num_bindings; ++i) {
+		const char * name = sqlite3_bind_parameter_name(stmt, i);
+		int index = i;
+		if(name && (name[0] == '$' || name[0] == '?')) index = atoi(name + 1);
+		if(index < 1 || index > num_params) return -1;
+
+		const char * value = values[index - 1];
+		int rc = value?sqlite3_bind_text(stmt, i, value, -1, SQLITE_STATIC):sqlite3_bind_null(stmt, i);
+		if(rc != SQLITE_OK) return -1;
+	}
+	return 0;
+}
+
+static void sqlite_result_append_row(rdb_sqlite_result_t * result, sqlite3_stmt * stmt)
+{
+	if(result->num_rows == result->max_rows) {
+		result->max_rows = result->max_rows?(result->max_rows * 2):64;
+		result->values = realloc(result->values, sizeof(*result->values) * result->max_rows * result->num_fields);
+		assert(result->values);
+	}
+	char ** values = result->values + (size_t)result->num_rows * result->num_fields;
+	for(int col = 0; col < result->num_fields; ++col) {
+		const char * value = (const char *)sqlite3_column_text(stmt, col);
+		values[col] = value?strdup(value):NULL;
+	}
+	++result->num_rows;
+}
+
+/*
+ * sqlite_run(): executes all statements of sql
+ * 	rows are delivered to on_row (if not NULL),
+ * 	and the rows of the last statement returning columns are collected into result (if not NULL).
+ * 	@return number of rows, or -1
+ */
+static int64_t sqlite_run(rdb_context_t * rdb, const char * sql, int num_params, const char ** params,
+	rdb_on_row_fn on_row, void * user_data, rdb_sqlite_result_t * result)
+{
+	sqlite3 * db = rdb->priv;
+	assert(db && sql);
+
+	int64_t num_rows = 0;
+	const char * tail = sql;
+	const char ** field_names = NULL;
+	const char ** values = NULL;
+	int rc = SQLITE_OK;
+	int stopped = 0;
+
+	while(tail && *tail && !stopped) {
+		sqlite3_stmt * stmt = NULL;
+		rc = sqlite3_prepare_v2(db, tail, -1, &stmt, &tail);
+		if(rc != SQLITE_OK) break;
+		if(NULL == stmt) continue;	// whitespaces or comments
+
+		if(num_params > 0 && sqlite_bind_text(stmt, num_params, params)) {
+			fprintf(stderr, "[ERROR]: %s(): parameters do not match the statement\n", __FUNCTION__);
+			sqlite3_finalize(stmt);
+			return -1;
+		}
+
+		int num_fields = sqlite3_column_count(stmt);
+		if(num_fields > 0) {
+			if(result) {
+				sqlite_result_reset(result);
+				result->num_fields = num_fields;
+				result->field_names = calloc(num_fields, sizeof(*result->field_names));
+				assert(result->field_names);
+				for(int i = 0; i < num_fields; ++i) result->field_names[i] = strdup(sqlite3_column_name(stmt, i));
+			}
+			if(on_row) {
+				field_names = realloc(field_names, sizeof(*field_names) * num_fields);
+				values = realloc(values, sizeof(*values) * num_fields);
+				assert(field_names && values);
+				for(int i = 0; i < num_fields; ++i) field_names[i] = sqlite3_column_name(stmt, i);
+			}
+		}
+
+		while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+			++num_rows;
+			if(result) sqlite_result_append_row(result, stmt);
+			if(on_row) {
+				for(int i = 0; i < num_fields; ++i) values[i] = (const char *)sqlite3_column_text(stmt, i);
+				if(on_row(rdb, num_fields, field_names, values, user_data)) {
+					stopped = 1;
+					break;
+				}
+			}
+		}
+		sqlite3_finalize(stmt);
+		if(rc == SQLITE_DONE || stopped) rc = SQLITE_OK;
+		if(rc != SQLITE_OK) break;
+	}
+	free(field_names);
+	free(values);
+
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "[ERROR]: %s(): %s\n", __FUNCTION__, sqlite3_errmsg(db));
+		return -1;
+	}
+	return num_rows;
+}
+
+static int sqlite_execute(rdb_context_t * rdb, const char * sql_statements, void ** p_result)
+{
+	rdb_sqlite_result_t * result = NULL;
+	if(p_result) {
+		result = calloc(1, sizeof(*result));
+		assert(result);
+	}
+	if(sqlite_run(rdb, sql_statements, 0, NULL, NULL, NULL, result) < 0) {
+		sqlite_clear_result(result);
+		return -1;
+	}
+	if(p_result) *p_result = result;
+	return 0;
+}
+
+static int64_t sqlite_query(rdb_context_t * rdb, const char * sql, int num_params, const char ** params,
+	rdb_on_row_fn on_row, void * user_data)
+{
+	assert(on_row);
+	return sqlite_run(rdb, sql, num_params, params, on_row, user_data, NULL);
+}
+
+static int64_t sqlite_execute_batch(rdb_context_t * rdb, const char * command, int num_params, int num_rows, const char ** values)
+{
+	sqlite3 * db = rdb->priv;
+	assert(db && command && num_params >= 0 && num_rows >= 0);
+	assert(num_rows == 0 || num_params == 0 || values);
+	if(num_rows == 0) return 0;
+
+	// a savepoint instead of BEGIN, so that it can be nested in a caller's transaction
+	int rc = sqlite3_exec(db, "SAVEPOINT rdb_batch", NULL, NULL, NULL);
+	if(rc != SQLITE_OK) {
+		fprintf(stderr, "[ERROR]: %s(): %s\n", __FUNCTION__, sqlite3_errmsg(db));
+		return -1;
+	}
+
+	sqlite3_stmt * stmt = NULL;
+	int64_t num_affected = 0;
+	rc = sqlite3_prepare_v2(db, command, -1, &stmt, NULL);
+	for(int row = 0; row < num_rows && rc == SQLITE_OK; ++row) {
+		if(sqlite_bind_text(stmt, num_params, values + (size_t)row * num_params)) {
+			rc = SQLITE_RANGE;
+			break;
+		}
+		while((rc = sqlite3_step(stmt)) == SQLITE_ROW);
+		if(rc != SQLITE_DONE) break;
+		num_affected += sqlite3_changes(db);
+		sqlite3_reset(stmt);
+		rc = SQLITE_OK;
+	}
+	if(rc != SQLITE_OK) fprintf(stderr, "[ERROR]: %s(): %s\n", __FUNCTION__, sqlite3_errmsg(db));
+	sqlite3_finalize(stmt);
+
+	if(rc != SQLITE_OK) {
+		sqlite3_exec(db, "ROLLBACK TO rdb_batch; RELEASE rdb_batch", NULL, NULL, NULL);
+		return -1;
+	}
+	if(sqlite3_exec(db, "RELEASE rdb_batch", NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "[ERROR]: %s(): %s\n", __FUNCTION__, sqlite3_errmsg(db));
+		return -1;
+	}
+	return num_affected;
+}
+
+static int sqlite_get_num_rows(const void * result)
+{
+	return ((const rdb_sqlite_result_t *)result)->num_rows;
+}
+static int sqlite_get_num_fields(const void * result)
+{
+	return ((const rdb_sqlite_result_t *)result)->num_fields;
+}
+static const char * sqlite_get_field_name(const void * result, int col)
+{
+	const rdb_sqlite_result_t * res = result;
+	if(col < 0 || col >= res->num_fields) return NULL;
+	return res->field_names[col];
+}
+static const char * sqlite_get_value(const void * result, int row, int col)
+{
+	const rdb_sqlite_result_t * res = result;
+	if(row < 0 || row >= res->num_rows || col < 0 || col >= res->num_fields) return NULL;
+	return res->values[(size_t)row * res->num_fields + col];
+}
+
+static void rdb_sqlite_init(rdb_context_t * rdb)
+{
+	rdb->priv = NULL;	// opened by connect()
+	rdb->connect = sqlite_connect;
+	rdb->execute = sqlite_execute;
+	rdb->clear_result = sqlite_clear_result;
+	rdb->disconnect = sqlite_disconnect;
+	rdb->execute_batch = sqlite_execute_batch;
+	rdb->query = sqlite_query;
+	rdb->get_num_rows = sqlite_get_num_rows;
+	rdb->get_num_fields = sqlite_get_num_fields;
+	rdb->get_field_name = sqlite_get_field_name;
+	rdb->get_value = sqlite_get_value;
+}
+
+/* *********************************** **
+ * rdb_context
+** *********************************** */
+rdb_context_t * rdb_context_init(rdb_context_t * rdb, enum rdb_type type, void * user_data)
+{
+	switch(type) {
+	case rdb_type_postgres:
+	case rdb_type_sqllite:
+		break;
+	default:
+		fprintf(stderr, "[ERROR]: %s(): rdb_type %d is not supported\n", __FUNCTION__, (int)type);
+		return NULL;
+	}
+
+	if(NULL == rdb) {
+		rdb = calloc(1, sizeof(*rdb));
+		assert(rdb);
+	}else {
+		memset(rdb, 0, sizeof(*rdb));
+	}
+	rdb->user_data = user_data;
+	rdb->type = type;
+
+	if(type == rdb_type_postgres) rdb_postgres_init(rdb);
+	else rdb_sqlite_init(rdb);
+	return rdb;
+}
+
+void rdb_context_cleanup(rdb_context_t * rdb)
+{
+	if(NULL == rdb) return;
+	if(rdb->type == rdb_type_postgres) rdb_postgres_cleanup(rdb);
+	else if(rdb->disconnect) rdb->disconnect(rdb);
+	rdb->priv = NULL;
+}
+
+/* *********************************** **
+ * Read-cache loader
+** *********************************** */
+struct rdb_load_state
+{
+	rdb_context_t * cache;
+	const char * table_name;
+	int num_fields;
+	char * insert_sql;
+	char ** values;		// RDB_BATCH_ROWS * num_fields, owned copies
+	int num_queued;
+	int64_t num_loaded;
+	int failed;
+};
+
+static void append_identifier(char ** p, char * p_end, const char * name)
+{
+	// "name", with embedded quotes doubled
+	if(*p < p_end) *(*p)++ = '"';
+	for(; *name && *p < p_end - 1; ++name) {
+		if(*name == '"') *(*p)++ = '"';
+		if(*p < p_end - 1) *(*p)++ = *name;
+	}
+	if(*p < p_end) *(*p)++ = '"';
+}
+
+static int load_state_prepare(struct rdb_load_state * state, int num_fields, const char ** field_names)
+{
+	// DROP + CREATE in the cache's transaction, INSERT statement for the batches
+	size_t size = 256 + strlen(state->table_name) * 2;
+	for(int i = 0; i < num_fields; ++i) size += strlen(field_names[i]) * 2 + 32;
+	char * sql = malloc(size);
+	assert(sql);
+
+	char * p = sql;
+	char * p_end = sql + size;
+	p += snprintf(p, p_end - p, "DROP TABLE IF EXISTS %s; CREATE TABLE %s (", state->table_name, state->table_name);
+	for(int i = 0; i < num_fields; ++i) {
+		if(i > 0) *p++ = ',';
+		append_identifier(&p, p_end, field_names[i]);
+		p += snprintf(p, p_end - p, " TEXT");
+	}
+	snprintf(p, p_end - p, ")");
+	int rc = state->cache->execute(state->cache, sql, NULL);
+
+	p = sql;
+	p += snprintf(p, p_end - p, "INSERT INTO %s VALUES (", state->table_name);
+	for(int i = 0; i < num_fields; ++i) p += snprintf(p, p_end - p, "%s$%d", (i > 0)?",":"", i + 1);
+	snprintf(p, p_end - p, ")");
+	state->insert_sql = sql;
+
+	state->num_fields = num_fields;
+	state->values = calloc((size_t)RDB_BATCH_ROWS * num_fields, sizeof(*state->values));
+	assert(state->values);
+	return rc;
+}
+
+static int load_state_flush(struct rdb_load_state * state)
+{
+	if(state->num_queued == 0) return 0;
+	int64_t num_inserted = state->cache->execute_batch(state->cache, state->insert_sql,
+		state->num_fields, state->num_queued, (const char **)state->values);
+	for(int i = 0; i < state->num_queued * state->num_fields; ++i) {
+		free(state->values[i]);
+		state->values[i] = NULL;
+	}
+	state->num_queued = 0;
+	if(num_inserted < 0) return -1;
+	state->num_loaded += num_inserted;
+	return 0;
+}
+
+static int on_load_row(rdb_context_t * source, int num_fields, const char ** field_names, const char ** values, void * user_data)
+{
+	struct rdb_load_state * state = user_data;
+	if(NULL == state->insert_sql && load_state_prepare(state, num_fields, field_names)) {
+		state->failed = 1;
+		return 1;
+	}
+
+	char ** row = state->values + (size_t)state->num_queued * num_fields;
+	for(int i = 0; i < num_fields; ++i) row[i] = values[i]?strdup(values[i]):NULL;
+	if(++state->num_queued == RDB_BATCH_ROWS && load_state_flush(state)) {
+		state->failed = 1;
+		return 1;
+	}
+	return 0;
+}
+
+static int on_any_row(rdb_context_t * rdb, int num_fields, const char ** field_names, const char ** values, void * user_data)
+{
+	return 1;	// one row is enough
+}
+
+// 1: table_name exists in the cache, 0: not, -1: error
+static int cache_table_exists(rdb_context_t * cache, const char * table_name)
+{
+	const char * sql = (cache->type == rdb_type_postgres)
+		?"SELECT 1 WHERE to_regclass($1) IS NOT NULL"
+		:"SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = $1";
+	int64_t num_rows = cache->query(cache, sql, 1, &table_name, on_any_row, NULL);
+	if(num_rows < 0) return -1;
+	return (num_rows > 0);
+}
+
+int64_t rdb_load_table(rdb_context_t * cache, const char * table_name, rdb_context_t * source, const char * select_sql)
+{
+	assert(cache && cache->priv && table_name && source && select_sql);
+	assert(cache != source);
+
+	if(cache->execute(cache, "BEGIN", NULL)) return -1;
+
+	struct rdb_load_state state[1] = {{
+		.cache = cache,
+		.table_name = table_name,
+	}};
+	int64_t num_rows = source->query(source, select_sql, 0, NULL, on_load_row, state);
+	if(num_rows >= 0 && !state->failed && load_state_flush(state)) state->failed = 1;
+
+	if(num_rows == 0 && !state->failed) {
+		// no rows, no column names: empty the existing table (if any)
+		int exists = cache_table_exists(cache, table_name);
+		if(exists < 0) state->failed = 1;
+		else if(exists) {
+			char sql[PATH_MAX] = "";
+			snprintf(sql, sizeof(sql), "DELETE FROM %s", table_name);
+			if(cache->execute(cache, sql, NULL)) state->failed = 1;
+		}
+	}
+
+	for(int i = 0; i < state->num_queued * state->num_fields; ++i) free(state->values[i]);
+	free(state->values);
+	free(state->insert_sql);
+
+	if(num_rows < 0 || state->failed) {
+		cache->execute(cache, "ROLLBACK", NULL);
+		return -1;
+	}
+	if(cache->execute(cache, "COMMIT", NULL)) return -1;
+	return state->num_loaded;
+}
+
+#undef RDB_BATCH_ROWS
 
 
 #if defined(_TEST_RDS_UTILS) && defined(_STAND_ALONE)
+static int on_count_row(rdb_context_t * rdb, int num_fields, const char ** field_names, const char ** values, void * user_data)
+{
+	int64_t * p_sum = user_data;
+	assert(num_fields == 2 && 0 == strcmp(field_names[0], "id"));
+	*p_sum += atoll(values[0]);
+	return 0;
+}
+
+static int on_stop_row(rdb_context_t * rdb, int num_fields, const char ** field_names, const char ** values, void * user_data)
+{
+	return 1;
+}
+
+static void test_sqlite(rdb_context_t * cache)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, cache);
+	int rc = cache->execute(cache, "CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT)", NULL);
+	assert(0 == rc);
+
+	static const char * values[] = { "1", "alice", "2", NULL, "3", "carol" };
+	int64_t num_rows = cache->execute_batch(cache, "INSERT INTO t VALUES ($1, $2)", 2, 3, values);
+	assert(num_rows == 3);
+
+	// all-or-nothing: the duplicated key fails the whole batch
+	static const char * dup_values[] = { "4", "dave", "1", "again" };
+	num_rows = cache->execute_batch(cache, "INSERT INTO t VALUES ($1, $2)", 2, 2, dup_values);
+	assert(num_rows == -1);
+
+	void * result = NULL;
+	rc = cache->execute(cache, "SELECT count(*) FROM t; SELECT id, name FROM t ORDER BY id", &result);
+	assert(0 == rc);
+	assert(cache->get_num_rows(result) == 3 && cache->get_num_fields(result) == 2);
+	assert(0 == strcmp(cache->get_field_name(result, 1), "name"));
+	assert(0 == strcmp(cache->get_value(result, 2, 1), "carol"));
+	assert(NULL == cache->get_value(result, 1, 1));
+	cache->clear_result(result);
+
+	int64_t sum = 0;
+	const char * params[1] = { "1" };
+	num_rows = cache->query(cache, "SELECT id, name FROM t WHERE id > $1", 1, params, on_count_row, &sum);
+	assert(num_rows == 2 && sum == 5);
+	num_rows = cache->query(cache, "SELECT id, name FROM t", 0, NULL, on_stop_row, NULL);
+	assert(num_rows == 1);
+
+	rdb_transaction_t trans[1];
+	rdb_transaction_init(trans, cache);
+	rc = trans->begin(trans);
+	assert(0 == rc);
+	cache->execute(cache, "DELETE FROM t WHERE id = 1", NULL);
+	trans->save_point(trans, "sp1");
+	cache->execute(cache, "DELETE FROM t", NULL);
+	trans->rollback(trans, "sp1");
+	rc = trans->commit(trans);
+	assert(0 == rc);
+
+	rc = cache->execute(cache, "SELECT id FROM t", &result);
+	assert(0 == rc && cache->get_num_rows(result) == 2);
+	cache->clear_result(result);
+}
+
+static void test_load_empty(rdb_context_t * cache)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, cache);
+	rdb_context_t * source = rdb_context_init(NULL, rdb_type_sqllite, NULL);
+	assert(source);
+	int rc = source->connect(source, ":memory:", 0);
+	assert(0 == rc);
+	rc = source->execute(source, "CREATE TABLE src (id INTEGER, name TEXT)", NULL);
+	assert(0 == rc);
+
+	// no rows: a missing table stays missing, an existing one is emptied
+	int64_t num_loaded = rdb_load_table(cache, "empty_cache", source, "SELECT id, name FROM src");
+	assert(num_loaded == 0);
+	rc = source->execute(source, "INSERT INTO src VALUES (1, 'a'), (2, 'b')", NULL);
+	assert(0 == rc);
+	num_loaded = rdb_load_table(cache, "empty_cache", source, "SELECT id, name FROM src");
+	assert(num_loaded == 2);
+	rc = source->execute(source, "DELETE FROM src", NULL);
+	assert(0 == rc);
+	num_loaded = rdb_load_table(cache, "empty_cache", source, "SELECT id, name FROM src");
+	assert(num_loaded == 0);
+
+	void * result = NULL;
+	rc = cache->execute(cache, "SELECT count(*) FROM empty_cache", &result);
+	assert(0 == rc && 0 == strcmp(cache->get_value(result, 0, 0), "0"));
+	cache->clear_result(result);
+
+	rdb_context_cleanup(source);
+	free(source);
+}
+
+static void test_postgres_to_cache(rdb_context_t * pg, rdb_context_t * cache)
+{
+	printf("==== %s(%p, %p) ====\n", __FUNCTION__, pg, cache);
+	int rc = pg->execute(pg, "CREATE TEMP TABLE rdb_ref (id int8 primary key, name text)", NULL);
+	assert(0 == rc);
+
+	static const int num_rows = 2500;
+	const char ** values = calloc(num_rows * 2, sizeof(*values));
+	char (*texts)[32] = calloc(num_rows, sizeof(*texts));
+	assert(values && texts);
+	for(int i = 0; i < num_rows; ++i) {
+		snprintf(texts[i], sizeof(texts[i]), "%d", i + 1);
+		values[i * 2] = texts[i];
+		values[i * 2 + 1] = (i % 10)?texts[i]:NULL;
+	}
+	int64_t num_inserted = pg->execute_batch(pg, "INSERT INTO rdb_ref VALUES ($1, $2)", 2, num_rows, values);
+	assert(num_inserted == num_rows);
+	free(values);
+	free(texts);
+
+	// a batch which cannot be sent (too many parameters) is rolled back, not committed
+	static const int max_params = 65536;
+	values = calloc(max_params, sizeof(*values));
+	assert(values);
+	num_inserted = pg->execute_batch(pg, "SELECT 1", max_params, 1, values);
+	assert(num_inserted == -1);
+	free(values);
+	assert(0 == psql_in_transaction(pg->priv));
+
+	int64_t num_loaded = rdb_load_table(cache, "ref_cache", pg, "SELECT id, name FROM rdb_ref");
+	assert(num_loaded == num_rows);
+
+	int64_t sum = 0;
+	int64_t count = cache->query(cache, "SELECT id, name FROM ref_cache", 0, NULL, on_count_row, &sum);
+	assert(count == num_rows && sum == (int64_t)num_rows * (num_rows + 1) / 2);
+}
+
 int main(int argc, char **argv)
 {
-	
+	rdb_context_t * cache = rdb_context_init(NULL, rdb_type_sqllite, NULL);
+	assert(cache);
+	int rc = cache->connect(cache, ":memory:", 0);
+	assert(0 == rc);
+	test_sqlite(cache);
+	test_load_empty(cache);
+
+	// load login info from environment variables:
+	const char * user = 	getenv("BAMS_PSQL_DB_USER");
+	const char * password = getenv("BAMS_PSQL_DB_PASSWORD");
+	const char * host = 	getenv("BAMS_TEST_DB_SERVER");
+	const char * port = 	getenv("BAMS_TEST_DB_SERVER_PORT");
+	const char * dbname = 	getenv("BAMS_TEST_DBNAME");
+	if(host && user && password) {
+		if(NULL == port) port = "5432";
+		if(NULL == dbname) dbname = "test_db1";
+
+		char sz_conn[PATH_MAX] = "";
+		snprintf(sz_conn, sizeof(sz_conn),
+			" host=%s port=%s "
+			" dbname=%s user=%s password=%s ",
+			host, port,
+			dbname, user, password);
+
+		rdb_context_t * pg = rdb_context_init(NULL, rdb_type_postgres, NULL);
+		assert(pg);
+		rc = pg->connect(pg, sz_conn, 0);
+		assert(0 == rc);
+		test_postgres_to_cache(pg, cache);
+		rdb_context_cleanup(pg);
+		free(pg);
+	}
+
+	rdb_context_cleanup(cache);
+	free(cache);
 	return 0;
 }
 #endif
@@ -0,0 +1,624 @@
+/*
+ * bench-psql-ingest.c
+ *
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to
+ * do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+/*
+ * ingestion benchmark: strategy x batch size x row width x threads
+ *
+ * strategies (the unit of a latency sample in brackets):
+ * 	row:         prepared INSERT per row, one transaction per batch	[transaction]
+ * 	multirow:    multi-row INSERT ... VALUES (psql_insert_batcher)	[statement]
+ * 	pipeline:    prepared INSERT per row in pipeline mode, one sync per batch	[sync]
+ * 	copy_text:   COPY FROM STDIN, one COPY per batch	[COPY]
+ * 	copy_binary: COPY FROM STDIN BINARY, one COPY per batch	[COPY]
+ *
+ * $ tests/make.sh bench-psql-ingest
+ * $ tests/bench-psql-ingest -n 100000 -s copy_text,copy_binary -b 1000,10000 -w 32,1024 -t 1,4 -f json -o ingest.json
+ *
+ * the connection info is loaded from the same environment variables as the tests.
+ * with -S <socket_dir> an in-process fake server (tests/psql-fake-server.c) is used instead,
+ * which measures the client side only: encoding, libpq and the socket, no server work.
+ * results: one record per combination, throughput and per-batch latency percentiles.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <limits.h>
+#include <stdint.h>
+#include <endian.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "rdb-postgres.h"
+#include <libpq-fe.h>
+#include "psql-fake-server.h"
+
+#include "utils.h"
+
+#define SCHEMA_NAME 	"bench_schema"
+#define TABLE_NAME 		SCHEMA_NAME".ingest"
+#define MAX_MATRIX_VALUES (16)
+
+static const char * sql_ddl =
+"BEGIN; "
+"DROP TABLE IF EXISTS " TABLE_NAME ";"
+"CREATE SCHEMA IF NOT EXISTS " SCHEMA_NAME ";"
+"CREATE TABLE " TABLE_NAME "("
+"	id			INT8	NOT NULL, "
+"	worker		INT4	NOT NULL, "
+"	payload		TEXT	NOT NULL "
+");"
+"END;";
+
+static const char * insert_command = "INSERT INTO " TABLE_NAME "(id, worker, payload) VALUES($1, $2, $3);";
+static const char * insert_stmt_name = "bench-ingest-insert";
+
+enum ingest_strategy
+{
+	ingest_strategy_row,
+	ingest_strategy_multirow,
+	ingest_strategy_pipeline,
+	ingest_strategy_copy_text,
+	ingest_strategy_copy_binary,
+	ingest_strategies_count
+};
+static const char * s_strategy_names[ingest_strategies_count] = {
+	[ingest_strategy_row] = "row",
+	[ingest_strategy_multirow] = "multirow",
+	[ingest_strategy_pipeline] = "pipeline",
+	[ingest_strategy_copy_text] = "copy_text",
+	[ingest_strategy_copy_binary] = "copy_binary",
+};
+
+struct bench_config
+{
+	int64_t num_rows;
+	int strategies[ingest_strategies_count];
+	int num_strategies;
+	int batch_sizes[MAX_MATRIX_VALUES];
+	int num_batch_sizes;
+	int row_widths[MAX_MATRIX_VALUES];
+	int num_row_widths;
+	int threads[MAX_MATRIX_VALUES];
+	int num_threads;
+	int json_output;
+	FILE * fp;
+	const char * fake_socket_dir;	// run against the in-process fake server
+};
+
+struct bench_worker
+{
+	pthread_t th;
+	int index;
+	psql_context_t * psql;
+
+	int strategy;
+	int batch_size;
+	int row_width;
+	int64_t first_row;
+	int64_t num_rows;
+
+	char * payload;
+	double * latencies;		// one sample per batch
+	int num_latencies;
+	int max_latencies;
+	int64_t num_inserted;
+	int num_errors;
+};
+
+struct bench_result
+{
+	int strategy;
+	int batch_size;
+	int row_width;
+	int num_threads;
+	int64_t num_rows;
+	int num_errors;
+	double time_elapsed;
+	double rows_per_sec;
+	double mb_per_sec;
+	double p50;
+	double p99;
+	double max;
+};
+
+static inline double get_time(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void worker_add_latency(struct bench_worker * worker, double latency)
+{
+	if(worker->num_latencies == worker->max_latencies) {
+		int new_size = worker->max_latencies?(worker->max_latencies * 2):1024;
+		worker->latencies = realloc(worker->latencies, new_size * sizeof(*worker->latencies));
+		assert(worker->latencies);
+		worker->max_latencies = new_size;
+	}
+	worker->latencies[worker->num_latencies++] = latency;
+}
+
+/* ************************************************
+ * strategies
+************************************************ */
+struct row_values
+{
+	char sz_id[32];
+	char sz_worker[16];
+	int64_t be_id;
+	int32_t be_worker;
+	const char * values[3];
+	int cb_values[3];
+};
+
+static void make_row(struct bench_worker * worker, int64_t id, int binary, struct row_values * row)
+{
+	if(binary) {
+		row->be_id = htobe64(id);
+		row->be_worker = htobe32(worker->index);
+		row->values[0] = (const char *)&row->be_id;
+		row->values[1] = (const char *)&row->be_worker;
+		row->cb_values[0] = sizeof(row->be_id);
+		row->cb_values[1] = sizeof(row->be_worker);
+	}else {
+		row->cb_values[0] = snprintf(row->sz_id, sizeof(row->sz_id), "%ld", (long)id);
+		row->cb_values[1] = snprintf(row->sz_worker, sizeof(row->sz_worker), "%d", worker->index);
+		row->values[0] = row->sz_id;
+		row->values[1] = row->sz_worker;
+	}
+	row->values[2] = worker->payload;
+	row->cb_values[2] = worker->row_width;
+}
+
+static int run_row_by_row(struct bench_worker * worker)
+{
+	psql_context_t * psql = worker->psql;
+	struct row_values row;
+	psql_params_t params[1] = {{ .num_params = 3, .values = row.values, .cb_values = row.cb_values }};
+
+	int64_t end_row = worker->first_row + worker->num_rows;
+	for(int64_t id = worker->first_row; id < end_row; ) {
+		double begin_time = get_time();
+		if(psql_execute(psql, "BEGIN;", NULL)) return -1;
+		int64_t batch_end = id + worker->batch_size;
+		if(batch_end > end_row) batch_end = end_row;
+		for(; id < batch_end; ++id) {
+			make_row(worker, id, 0, &row);
+			if(psql_exec_prepared(psql, insert_stmt_name, params, NULL)) ++worker->num_errors;
+			else ++worker->num_inserted;
+		}
+		if(psql_execute(psql, "COMMIT;", NULL)) return -1;
+		worker_add_latency(worker, get_time() - begin_time);
+	}
+	return 0;
+}
+
+static int run_multirow(struct bench_worker * worker)
+{
+	psql_insert_batcher_params_t params = {
+		.mode = psql_insert_batch_mode_values,
+		.max_rows = worker->batch_size + 1,	// flushed explicitly
+		.max_bytes = (size_t)256 * 1024 * 1024,
+	};
+	psql_insert_batcher_t batcher[1];
+	psql_insert_batcher_init(batcher, worker->psql, TABLE_NAME, "id, worker, payload", 3, &params);
+
+	struct row_values row;
+	int64_t end_row = worker->first_row + worker->num_rows;
+	for(int64_t id = worker->first_row; id < end_row; ) {
+		double begin_time = get_time();	// row building included, as in the other strategies
+		int64_t batch_end = id + worker->batch_size;
+		if(batch_end > end_row) batch_end = end_row;
+		for(; id < batch_end; ++id) {
+			make_row(worker, id, 0, &row);
+			if(psql_insert_batcher_add_values(batcher, row.values) < 0) ++worker->num_errors;
+		}
+		int num_queued = batcher->num_queued;
+		int64_t num_inserted = psql_insert_batcher_flush(batcher);
+		worker_add_latency(worker, get_time() - begin_time);
+		if(num_inserted < 0) worker->num_errors += num_queued;	// per row, like the other strategies
+	}
+	worker->num_inserted = batcher->num_inserted;	// including the batches flushed by add() (parameter limit)
+	psql_insert_batcher_cleanup(batcher);
+	return 0;
+}
+
+static int run_pipeline(struct bench_worker * worker)
+{
+	psql_context_t * psql = worker->psql;
+	struct row_values row;
+	psql_params_t params[1] = {{ .num_params = 3, .values = row.values, .cb_values = row.cb_values }};
+	int * statuses = calloc(worker->batch_size, sizeof(*statuses));
+	assert(statuses);
+
+	int rc = psql_pipeline_enter(psql);
+	if(rc) { free(statuses); return -1; }
+
+	int64_t end_row = worker->first_row + worker->num_rows;
+	for(int64_t id = worker->first_row; id < end_row && 0 == rc; ) {
+		double begin_time = get_time();
+		int64_t batch_end = id + worker->batch_size;
+		if(batch_end > end_row) batch_end = end_row;
+		for(; id < batch_end; ++id) {
+			make_row(worker, id, 0, &row);
+			rc = psql_pipeline_send_prepared(psql, insert_stmt_name, params);
+			if(rc) break;
+		}
+		// sync even after a failed send, so that the statements already queued are drained
+		if(psql_pipeline_sync(psql)) {
+			rc = -1;
+			break;
+		}
+
+		ssize_t num_results = psql_pipeline_get_results(psql, statuses, worker->batch_size, NULL, NULL);
+		worker_add_latency(worker, get_time() - begin_time);
+		for(ssize_t i = 0; i < num_results; ++i) {
+			if(statuses[i] == psql_pipeline_status_ok) ++worker->num_inserted;
+			else ++worker->num_errors;
+		}
+		if(num_results < 0) rc = -1;
+	}
+	psql_pipeline_exit(psql);
+	free(statuses);
+	return rc;
+}
+
+static int run_copy(struct bench_worker * worker, int format)
+{
+	int binary = (format == psql_copy_format_binary);
+	psql_copy_writer_t writer[1];
+	psql_copy_writer_init(writer, worker->psql, format, 0);
+
+	struct row_values row;
+	int rc = 0;
+	int64_t end_row = worker->first_row + worker->num_rows;
+	for(int64_t id = worker->first_row; id < end_row; ) {
+		double begin_time = get_time();
+		rc = psql_copy_writer_begin(writer, TABLE_NAME, "id, worker, payload");
+		if(rc) break;
+
+		int64_t batch_end = id + worker->batch_size;
+		if(batch_end > end_row) batch_end = end_row;
+		for(; id < batch_end && 0 == rc; ++id) {
+			make_row(worker, id, binary, &row);
+			rc = psql_copy_writer_append_row(writer, 3, row.values, row.cb_values);
+		}
+		int64_t num_rows = psql_copy_writer_end(writer, rc?"bench aborted":NULL);
+		worker_add_latency(worker, get_time() - begin_time);
+		if(num_rows < 0) {
+			++worker->num_errors;
+			rc = -1;
+			break;
+		}
+		worker->num_inserted += num_rows;
+	}
+	psql_copy_writer_cleanup(writer);
+	return rc;
+}
+
+static void * bench_worker_thread(void * user_data)
+{
+	struct bench_worker * worker = user_data;
+	int rc = 0;
+	switch(worker->strategy) {
+	case ingest_strategy_row: rc = run_row_by_row(worker); break;
+	case ingest_strategy_multirow: rc = run_multirow(worker); break;
+	case ingest_strategy_pipeline: rc = run_pipeline(worker); break;
+	case ingest_strategy_copy_text: rc = run_copy(worker, psql_copy_format_text); break;
+	case ingest_strategy_copy_binary: rc = run_copy(worker, psql_copy_format_binary); break;
+	default: rc = -1; break;
+	}
+	if(rc) ++worker->num_errors;
+	return NULL;
+}
+
+/* ************************************************
+ * matrix
+************************************************ */
+static int compare_double(const void * a, const void * b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x < y)?-1:(x > y);
+}
+
+static double percentile(const double * sorted, int count, double q)
+{
+	if(count <= 0) return 0.0;
+	int index = (int)(q * (double)count + 0.5) - 1;
+	if(index < 0) index = 0;
+	if(index >= count) index = count - 1;
+	return sorted[index];
+}
+
+static int run_one(psql_context_t ** contexts, int strategy, int batch_size, int row_width, int num_threads,
+	int64_t num_rows, struct bench_result * result)
+{
+	int rc = psql_execute(contexts[0], "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	if(rc) return -1;
+
+	char * payload = malloc(row_width + 1);
+	assert(payload);
+	for(int i = 0; i < row_width; ++i) payload[i] = 'a' + (i % 26);
+	payload[row_width] = '\0';
+
+	struct bench_worker * workers = calloc(num_threads, sizeof(*workers));
+	assert(workers);
+	int64_t rows_per_worker = (num_rows + num_threads - 1) / num_threads;
+	for(int i = 0; i < num_threads; ++i) {
+		struct bench_worker * worker = &workers[i];
+		worker->index = i;
+		worker->psql = contexts[i];
+		worker->strategy = strategy;
+		worker->batch_size = batch_size;
+		worker->row_width = row_width;
+		worker->payload = payload;
+		worker->first_row = i * rows_per_worker;
+		worker->num_rows = rows_per_worker;
+		if(worker->first_row + worker->num_rows > num_rows) worker->num_rows = num_rows - worker->first_row;
+		if(worker->num_rows < 0) worker->num_rows = 0;
+	}
+
+	double begin_time = get_time();
+	for(int i = 0; i < num_threads; ++i) {
+		rc = pthread_create(&workers[i].th, NULL, bench_worker_thread, &workers[i]);
+		assert(0 == rc);
+	}
+	for(int i = 0; i < num_threads; ++i) pthread_join(workers[i].th, NULL);
+	double time_elapsed = get_time() - begin_time;
+
+	// merge the latency samples
+	int num_latencies = 0;
+	for(int i = 0; i < num_threads; ++i) num_latencies += workers[i].num_latencies;
+	double * latencies = calloc(num_latencies + 1, sizeof(*latencies));
+	assert(latencies);
+	num_latencies = 0;
+
+	memset(result, 0, sizeof(*result));
+	for(int i = 0; i < num_threads; ++i) {
+		memcpy(latencies + num_latencies, workers[i].latencies, workers[i].num_latencies * sizeof(*latencies));
+		num_latencies += workers[i].num_latencies;
+		result->num_rows += workers[i].num_inserted;
+		result->num_errors += workers[i].num_errors;
+		free(workers[i].latencies);
+	}
+	qsort(latencies, num_latencies, sizeof(*latencies), compare_double);
+
+	result->strategy = strategy;
+	result->batch_size = batch_size;
+	result->row_width = row_width;
+	result->num_threads = num_threads;
+	result->time_elapsed = time_elapsed;
+	result->rows_per_sec = (time_elapsed > 0)?(double)result->num_rows / time_elapsed:0;
+	result->mb_per_sec = result->rows_per_sec * (row_width + 12) / (1024.0 * 1024.0);	// payload + id + worker
+	result->p50 = percentile(latencies, num_latencies, 0.50);
+	result->p99 = percentile(latencies, num_latencies, 0.99);
+	result->max = num_latencies?latencies[num_latencies - 1]:0;
+
+	free(latencies);
+	free(workers);
+	free(payload);
+	return 0;
+}
+
+static void output_result(struct bench_config * config, const struct bench_result * result, int index)
+{
+	FILE * fp = config->fp;
+	if(config->json_output) {
+		fprintf(fp, "%s\n  {\"strategy\": \"%s\", \"batch_size\": %d, \"row_width\": %d, \"threads\": %d, "
+			"\"rows\": %ld, \"errors\": %d, \"seconds\": %.6f, \"rows_per_sec\": %.1f, \"mb_per_sec\": %.3f, "
+			"\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}",
+			(index > 0)?",":"",
+			s_strategy_names[result->strategy], result->batch_size, result->row_width, result->num_threads,
+			(long)result->num_rows, result->num_errors, result->time_elapsed, result->rows_per_sec, result->mb_per_sec,
+			result->p50 * 1000.0, result->p99 * 1000.0, result->max * 1000.0);
+	}else {
+		if(index == 0) fprintf(fp, "strategy,batch_size,row_width,threads,rows,errors,seconds,rows_per_sec,mb_per_sec,p50_ms,p99_ms,max_ms\n");
+		fprintf(fp, "%s,%d,%d,%d,%ld,%d,%.6f,%.1f,%.3f,%.3f,%.3f,%.3f\n",
+			s_strategy_names[result->strategy], result->batch_size, result->row_width, result->num_threads,
+			(long)result->num_rows, result->num_errors, result->time_elapsed, result->rows_per_sec, result->mb_per_sec,
+			result->p50 * 1000.0, result->p99 * 1000.0, result->max * 1000.0);
+	}
+	fflush(fp);
+}
+
+/* ************************************************
+ * command line
+************************************************ */
+static int parse_int_list(const char * text, int * values, int max_values)
+{
+	int count = 0;
+	const char * p = text;
+	while(*p && count < max_values) {
+		char * p_end = NULL;
+		long value = strtol(p, &p_end, 10);
+		if(p_end == p || value <= 0) return -1;
+		values[count++] = (int)value;
+		p = p_end;
+		if(*p == ',') ++p;
+		else if(*p) return -1;
+	}
+	return count;
+}
+
+static int parse_strategies(const char * text, int * strategies)
+{
+	int count = 0;
+	char * dup = strdup(text);
+	assert(dup);
+	char * saveptr = NULL;
+	for(char * token = strtok_r(dup, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+		int strategy = -1;
+		for(int i = 0; i < ingest_strategies_count; ++i) {
+			if(0 == strcmp(token, s_strategy_names[i])) { strategy = i; break; }
+		}
+		if(strategy < 0 || count >= ingest_strategies_count) { count = -1; break; }
+		strategies[count++] = strategy;
+	}
+	free(dup);
+	return count;
+}
+
+static void print_usage(const char * exe_name)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"  -n rows         rows per run (default: 100000)\n"
+		"  -s strategies   row,multirow,pipeline,copy_text,copy_binary (default: all but row)\n"
+		"  -b batch_sizes  e.g. 100,1000,10000 (default: 1000)\n"
+		"  -w row_widths   payload bytes per row, e.g. 32,1024 (default: 64)\n"
+		"  -t threads      e.g. 1,4 (default: 1)\n"
+		"  -f csv|json     output format (default: csv)\n"
+		"  -o file         output file (default: stdout)\n"
+		"  -S socket_dir   run against an in-process fake server (client overhead only)\n",
+		exe_name);
+}
+
+static int parse_args(struct bench_config * config, int argc, char ** argv)
+{
+	memset(config, 0, sizeof(*config));
+	config->num_rows = 100 * 1000;
+	for(int i = ingest_strategy_multirow; i < ingest_strategies_count; ++i) config->strategies[config->num_strategies++] = i;
+	config->batch_sizes[config->num_batch_sizes++] = 1000;
+	config->row_widths[config->num_row_widths++] = 64;
+	config->threads[config->num_threads++] = 1;
+	config->fp = stdout;
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:s:b:w:t:f:o:S:h")) != -1) {
+		switch(opt) {
+		case 'n': config->num_rows = atoll(optarg); if(config->num_rows <= 0) return -1; break;
+		case 's': config->num_strategies = parse_strategies(optarg, config->strategies); if(config->num_strategies <= 0) return -1; break;
+		case 'b': config->num_batch_sizes = parse_int_list(optarg, config->batch_sizes, MAX_MATRIX_VALUES); if(config->num_batch_sizes <= 0) return -1; break;
+		case 'w': config->num_row_widths = parse_int_list(optarg, config->row_widths, MAX_MATRIX_VALUES); if(config->num_row_widths <= 0) return -1; break;
+		case 't': config->num_threads = parse_int_list(optarg, config->threads, MAX_MATRIX_VALUES); if(config->num_threads <= 0) return -1; break;
+		case 'f':
+			if(0 == strcmp(optarg, "json")) config->json_output = 1;
+			else if(0 == strcmp(optarg, "csv")) config->json_output = 0;
+			else return -1;
+			break;
+		case 'o':
+			config->fp = fopen(optarg, "w");
+			if(NULL == config->fp) { perror(optarg); return -1; }
+			break;
+		case 'S': config->fake_socket_dir = optarg; break;
+		default: return -1;
+		}
+	}
+	return 0;
+}
+
+static int build_conn_string(char * sz_conn, size_t size)
+{
+	// load login info from environment variables:
+	const char * user = 	getenv("BAMS_PSQL_DB_USER");
+	const char * password = getenv("BAMS_PSQL_DB_PASSWORD");
+	const char * host = 	getenv("BAMS_TEST_DB_SERVER");
+	const char * port = 	getenv("BAMS_TEST_DB_SERVER_PORT");
+	const char * dbname = 	getenv("BAMS_TEST_DBNAME");
+
+	assert(host && user && password);
+	if(NULL == port) port = "5432";
+	if(NULL == dbname) dbname = "test_db1";
+
+	int cb = snprintf(sz_conn, size,
+		" host=%s port=%s "
+		" dbname=%s user=%s password=%s ",
+		host, port,
+		dbname, user, password);
+	return (cb > 0 && cb < size)?0:-1;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_config config[1];
+	if(parse_args(config, argc, argv)) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	char sz_conn[PATH_MAX] = "";
+	psql_fake_server_t * fake_server = NULL;
+	int rc = 0;
+	if(config->fake_socket_dir) {
+		fake_server = psql_fake_server_start(config->fake_socket_dir, 5432);
+		assert(fake_server);
+		snprintf(sz_conn, sizeof(sz_conn), "host=%s port=5432 dbname=fake user=fake", config->fake_socket_dir);
+	}else {
+		rc = build_conn_string(sz_conn, sizeof(sz_conn));
+		assert(0 == rc);
+	}
+
+	// one connection per thread, shared by all runs
+	int max_threads = 1;
+	for(int i = 0; i < config->num_threads; ++i) if(config->threads[i] > max_threads) max_threads = config->threads[i];
+	psql_context_t ** contexts = calloc(max_threads, sizeof(*contexts));
+	assert(contexts);
+	for(int i = 0; i < max_threads; ++i) contexts[i] = psql_context_init(NULL, NULL);
+	int num_connected = psql_connect_db_parallel(contexts, max_threads, sz_conn, 10 * 1000);
+	assert(num_connected == max_threads);
+
+	rc = psql_execute(contexts[0], sql_ddl, NULL);
+	assert(0 == rc);
+
+	psql_prepare_params_t prepare_params[1] = {{ .stmt_name = insert_stmt_name, .num_params = 3 }};
+	for(int i = 0; i < max_threads; ++i) {
+		rc = psql_prepare(contexts[i], insert_command, prepare_params);
+		assert(0 == rc);
+	}
+
+	if(config->json_output) fprintf(config->fp, "[");
+	int index = 0;
+	for(int s = 0; s < config->num_strategies; ++s)
+	for(int b = 0; b < config->num_batch_sizes; ++b)
+	for(int w = 0; w < config->num_row_widths; ++w)
+	for(int t = 0; t < config->num_threads; ++t) {
+		struct bench_result result[1];
+		fprintf(stderr, "==== %s: batch_size=%d, row_width=%d, threads=%d ====\n",	// progress, kept out of the results
+			s_strategy_names[config->strategies[s]], config->batch_sizes[b], config->row_widths[w], config->threads[t]);
+		rc = run_one(contexts, config->strategies[s], config->batch_sizes[b], config->row_widths[w], config->threads[t],
+			config->num_rows, result);
+		if(rc) continue;
+		output_result(config, result, index++);
+	}
+	if(config->json_output) fprintf(config->fp, "\n]\n");
+
+	psql_execute(contexts[0], "DROP TABLE IF EXISTS " TABLE_NAME ";", NULL);
+	for(int i = 0; i < max_threads; ++i) {
+		psql_context_cleanup(contexts[i]);
+		free(contexts[i]);
+	}
+	free(contexts);
+	if(fake_server) psql_fake_server_stop(fake_server);
+	if(config->fp != stdout) fclose(config->fp);
+	return 0;
+}
+
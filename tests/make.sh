@@ -16,6 +16,15 @@ case "${TARGET}" in
 			$(pkg-config --cflags --libs libpq) \
 			-lm -lpthread -ljson-c -lpcre
 		;;
+	rdb-utils)
+		${CC} -D_TEST_RDS_UTILS	\
+			-o tests/${TARGET} 		\
+			src/rdb-utils.c 		\
+			src/rdb-postgres.c 		\
+			utils/*.c 				\
+			$(pkg-config --cflags --libs libpq) \
+			-lm -lpthread -ljson-c -lpcre -lsqlite3
+		;;
 	test-psql-cursor|test-psql-bulk-insert)
 		${CC} -o tests/${TARGET} tests/${TARGET}.c 	\
 			src/rdb-postgres.c 						\
@@ -23,6 +32,22 @@ case "${TARGET}" in
 			$(pkg-config --cflags --libs libpq) 	\
 			-lm -lpthread -ljson-c -lpcre
 		;;
+	bench-psql-ingest)
+		${CC} -Itests -o tests/${TARGET} tests/${TARGET}.c 	\
+			tests/psql-fake-server.c 				\
+			src/rdb-postgres.c 						\
+			utils/*.c 								\
+			$(pkg-config --cflags --libs libpq) 	\
+			-lm -lpthread -ljson-c -lpcre
+		;;
+	psql-fake-server)
+		${CC} -D_TEST_PSQL_FAKE_SERVER \
+			-o tests/${TARGET} tests/${TARGET}.c 	\
+			src/rdb-postgres.c 						\
+			utils/*.c 								\
+			$(pkg-config --cflags --libs libpq) 	\
+			-lm -lpthread -ljson-c -lpcre
+		;;
 	*)
 		echo "build nothing ..."
 		;;
@@ -0,0 +1,1431 @@
+/*
+ * psql-fake-server.c
+ *
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ *
+ * The MIT License
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to
+ * do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <limits.h>
+#include <stdint.h>
+#include <endian.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "auto_buffer.h"
+#include "psql-fake-server.h"
+
+#define FAKE_PROTOCOL_VERSION_3 (196608)	// 3.0
+#define FAKE_SSL_REQUEST_CODE (80877103)
+#define FAKE_GSSENC_REQUEST_CODE (80877104)
+#define FAKE_CANCEL_REQUEST_CODE (80877102)
+#define FAKE_OUTPUT_FLUSH_SIZE (64 * 1024)
+#define FAKE_TEXT_OID (25)
+
+typedef struct fake_canned
+{
+	char * prefix;
+	size_t cb_prefix;
+
+	// result set
+	int num_fields;
+	char ** field_names;
+	int num_rows;
+	char ** values;
+
+	// error (if sqlstate != NULL)
+	char * sqlstate;
+	char * message;
+
+	struct fake_canned * next;
+}fake_canned_t;
+
+typedef struct fake_stmt
+{
+	char * name;
+	char * query;
+	int num_params;
+	struct fake_stmt * next;
+}fake_stmt_t;
+
+typedef struct fake_portal
+{
+	char * name;
+	char * query;
+	int result_format;
+	char * first_param;		// text value of $1, to count the rows of unnest() inserts
+	struct fake_portal * next;
+}fake_portal_t;
+
+typedef struct fake_conn
+{
+	psql_fake_server_t * server;
+	int fd;
+	pthread_t th;
+
+	unsigned char * in;
+	size_t in_size;
+	size_t in_begin;
+	size_t in_end;
+	auto_buffer_t out[1];
+
+	char txn_status;		// 'I', 'T' or 'E'
+	int skip_until_sync;	// extended protocol error recovery
+	fake_stmt_t * stmts;
+	fake_portal_t * portals;
+
+	struct fake_conn * next;
+}fake_conn_t;
+
+struct psql_fake_server
+{
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int listen_fd;
+	int wakeup_fd;
+	pthread_t th;
+	int quit;
+
+	pthread_mutex_t mutex;
+	fake_canned_t * canned;
+	fake_conn_t * conns;
+	int32_t next_pid;
+
+	psql_fake_server_stats_t stats;
+};
+
+/* ************************************************
+ * i/o
+************************************************ */
+static int conn_flush(fake_conn_t * conn)
+{
+	auto_buffer_t * out = conn->out;
+	const unsigned char * p = out->data;
+	size_t length = out->length;
+	while(length > 0) {
+		ssize_t cb = write(conn->fd, p, length);
+		if(cb < 0) {
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		p += cb;
+		length -= cb;
+	}
+	__atomic_add_fetch(&conn->server->stats.num_bytes_sent, (int64_t)out->length, __ATOMIC_RELAXED);
+	out->length = 0;
+	return 0;
+}
+
+/* makes sure that 'need' bytes are buffered, pending output is flushed before blocking */
+static int conn_fill(fake_conn_t * conn, size_t need)
+{
+	while(conn->in_end - conn->in_begin < need) {
+		if(conn->out->length > 0 && conn_flush(conn)) return -1;
+
+		if(conn->in_begin > 0) {
+			memmove(conn->in, conn->in + conn->in_begin, conn->in_end - conn->in_begin);
+			conn->in_end -= conn->in_begin;
+			conn->in_begin = 0;
+		}
+		if(conn->in_size < need || conn->in_size - conn->in_end < 4096) {
+			size_t new_size = conn->in_size?(conn->in_size * 2):FAKE_OUTPUT_FLUSH_SIZE;
+			while(new_size < need) new_size *= 2;
+			unsigned char * in = realloc(conn->in, new_size);
+			assert(in);
+			conn->in = in;
+			conn->in_size = new_size;
+		}
+
+		ssize_t cb = read(conn->fd, conn->in + conn->in_end, conn->in_size - conn->in_end);
+		if(cb < 0 && errno == EINTR) continue;
+		if(cb <= 0) return -1;
+		conn->in_end += cb;
+		__atomic_add_fetch(&conn->server->stats.num_bytes_received, (int64_t)cb, __ATOMIC_RELAXED);
+	}
+	return 0;
+}
+
+/* the body stays valid until the next read */
+static int conn_read_message(fake_conn_t * conn, char * p_type, const unsigned char ** p_body, size_t * p_length)
+{
+	if(conn_fill(conn, 5)) return -1;
+	const unsigned char * p = conn->in + conn->in_begin;
+	uint32_t length = be32toh(*(uint32_t *)(p + 1));
+	if(length < 4) return -1;
+	if(conn_fill(conn, 1 + length)) return -1;
+
+	p = conn->in + conn->in_begin;
+	*p_type = (char)p[0];
+	*p_body = p + 5;
+	*p_length = length - 4;
+	conn->in_begin += 1 + length;
+	return 0;
+}
+
+static size_t msg_begin(fake_conn_t * conn, char type)
+{
+	static const uint32_t placeholder = 0;
+	auto_buffer_push(conn->out, &type, 1);
+	size_t pos = conn->out->length;
+	auto_buffer_push(conn->out, &placeholder, 4);
+	return pos;
+}
+
+static void msg_end(fake_conn_t * conn, size_t pos)
+{
+	uint32_t length = htobe32((uint32_t)(conn->out->length - pos));
+	memcpy(conn->out->data + pos, &length, 4);
+	if(conn->out->length >= FAKE_OUTPUT_FLUSH_SIZE) conn_flush(conn);
+}
+
+static inline void put_int16(fake_conn_t * conn, int16_t value)
+{
+	uint16_t be_value = htobe16((uint16_t)value);
+	auto_buffer_push(conn->out, &be_value, 2);
+}
+static inline void put_int32(fake_conn_t * conn, int32_t value)
+{
+	uint32_t be_value = htobe32((uint32_t)value);
+	auto_buffer_push(conn->out, &be_value, 4);
+}
+static inline void put_cstr(fake_conn_t * conn, const char * str)
+{
+	auto_buffer_push(conn->out, str, strlen(str) + 1);
+}
+
+/* reads a cstring from a message body, NULL if malformed */
+static const char * get_cstr(const unsigned char ** p, const unsigned char * p_end)
+{
+	const unsigned char * str = *p;
+	const unsigned char * nul = memchr(str, '\0', p_end - str);
+	if(NULL == nul) return NULL;
+	*p = nul + 1;
+	return (const char *)str;
+}
+static int get_int16(const unsigned char ** p, const unsigned char * p_end, int16_t * value)
+{
+	if(p_end - *p < 2) return -1;
+	*value = (int16_t)be16toh(*(uint16_t *)*p);
+	*p += 2;
+	return 0;
+}
+static int get_int32(const unsigned char ** p, const unsigned char * p_end, int32_t * value)
+{
+	if(p_end - *p < 4) return -1;
+	*value = (int32_t)be32toh(*(uint32_t *)*p);
+	*p += 4;
+	return 0;
+}
+
+/* ************************************************
+ * responses
+************************************************ */
+static void send_parameter_status(fake_conn_t * conn, const char * name, const char * value)
+{
+	size_t pos = msg_begin(conn, 'S');
+	put_cstr(conn, name);
+	put_cstr(conn, value);
+	msg_end(conn, pos);
+}
+
+static void send_ready_for_query(fake_conn_t * conn)
+{
+	size_t pos = msg_begin(conn, 'Z');
+	auto_buffer_push(conn->out, &conn->txn_status, 1);
+	msg_end(conn, pos);
+}
+
+static void send_error(fake_conn_t * conn, const char * sqlstate, const char * message)
+{
+	size_t pos = msg_begin(conn, 'E');
+	auto_buffer_push(conn->out, "S", 1); put_cstr(conn, "ERROR");
+	auto_buffer_push(conn->out, "V", 1); put_cstr(conn, "ERROR");
+	auto_buffer_push(conn->out, "C", 1); put_cstr(conn, sqlstate);
+	auto_buffer_push(conn->out, "M", 1); put_cstr(conn, message);
+	auto_buffer_push(conn->out, "", 1);
+	msg_end(conn, pos);
+	if(conn->txn_status == 'T') conn->txn_status = 'E';
+}
+
+static void send_command_complete(fake_conn_t * conn, const char * tag)
+{
+	size_t pos = msg_begin(conn, 'C');
+	put_cstr(conn, tag);
+	msg_end(conn, pos);
+}
+
+static const char * s_generic_field_names[1] = { "?column?" };
+static const char * s_generic_values[1] = { "1" };
+
+static void send_row_description(fake_conn_t * conn, const fake_canned_t * canned, int result_format)
+{
+	int num_fields = canned?canned->num_fields:1;
+	const char ** field_names = canned?(const char **)canned->field_names:s_generic_field_names;
+
+	size_t pos = msg_begin(conn, 'T');
+	put_int16(conn, num_fields);
+	for(int i = 0; i < num_fields; ++i) {
+		put_cstr(conn, field_names[i]);
+		put_int32(conn, 0);		// table oid
+		put_int16(conn, 0);		// column number
+		put_int32(conn, FAKE_TEXT_OID);
+		put_int16(conn, -1);	// type size
+		put_int32(conn, -1);	// type modifier
+		put_int16(conn, result_format);	// text values are the same in both formats
+	}
+	msg_end(conn, pos);
+}
+
+static int send_data_rows(fake_conn_t * conn, const fake_canned_t * canned)
+{
+	int num_fields = canned?canned->num_fields:1;
+	int num_rows = canned?canned->num_rows:1;
+	const char ** values = canned?(const char **)canned->values:s_generic_values;
+
+	for(int row = 0; row < num_rows; ++row) {
+		size_t pos = msg_begin(conn, 'D');
+		put_int16(conn, num_fields);
+		for(int col = 0; col < num_fields; ++col) {
+			const char * value = values[row * num_fields + col];
+			if(NULL == value) {
+				put_int32(conn, -1);
+				continue;
+			}
+			size_t length = strlen(value);
+			put_int32(conn, (int32_t)length);
+			auto_buffer_push(conn->out, value, length);
+		}
+		msg_end(conn, pos);
+	}
+	return num_rows;
+}
+
+/* ************************************************
+ * statements
+************************************************ */
+static const char * skip_spaces(const char * p)
+{
+	while(*p && (isspace((unsigned char)*p) || *p == '(')) ++p;
+	return p;
+}
+
+static int keyword_is(const char * p, const char * keyword)
+{
+	size_t length = strlen(keyword);
+	return (0 == strncasecmp(p, keyword, length) && !isalnum((unsigned char)p[length]) && p[length] != '_');
+}
+
+static const char * strcasestr_n(const char * haystack, const char * needle)
+{
+	size_t length = strlen(needle);
+	for(const char * p = haystack; *p; ++p) {
+		if(0 == strncasecmp(p, needle, length)) return p;
+	}
+	return NULL;
+}
+
+static const fake_canned_t * find_canned(psql_fake_server_t * server, const char * query)
+{
+	query = skip_spaces(query);
+	pthread_mutex_lock(&server->mutex);
+	const fake_canned_t * canned = server->canned;
+	for(; canned; canned = canned->next) {
+		if(0 == strncasecmp(query, canned->prefix, canned->cb_prefix)) break;
+	}
+	pthread_mutex_unlock(&server->mutex);
+	return canned;
+}
+
+static int statement_returns_rows(const char * query, const fake_canned_t * canned)
+{
+	if(canned) return (NULL == canned->sqlstate);
+	const char * p = skip_spaces(query);
+	return keyword_is(p, "SELECT") || keyword_is(p, "WITH") || keyword_is(p, "VALUES")
+		|| keyword_is(p, "SHOW") || keyword_is(p, "TABLE") || keyword_is(p, "FETCH");
+}
+
+/* INSERT ... VALUES (...), (...): the number of tuples; INSERT ... unnest($1, ...): elements of $1 */
+static int64_t count_insert_rows(const char * query, const char * first_param)
+{
+	const char * p = strcasestr_n(query, "VALUES");
+	if(p) {
+		int64_t num_rows = 0;
+		int depth = 0;
+		int in_quote = 0;
+		for(p += 6; *p; ++p) {
+			if(in_quote) {
+				if(*p == '\'') in_quote = 0;
+				continue;
+			}
+			if(*p == '\'') in_quote = 1;
+			else if(*p == '(') { if(depth++ == 0) ++num_rows; }
+			else if(*p == ')') --depth;
+		}
+		return num_rows;
+	}
+	if(strcasestr_n(query, "unnest") && first_param && first_param[0] == '{') {
+		if(first_param[1] == '}') return 0;
+		int64_t num_rows = 1;
+		int in_quote = 0;
+		for(const char * q = first_param + 1; *q; ++q) {
+			if(*q == '\\' && q[1]) { ++q; continue; }
+			if(*q == '"') in_quote = !in_quote;
+			else if(*q == ',' && !in_quote) ++num_rows;
+		}
+		return num_rows;
+	}
+	return 1;
+}
+
+/* COPY ... FROM STDIN: counts the rows in the CopyData stream */
+typedef struct copy_in_state
+{
+	int binary;
+	int64_t num_rows;
+
+	// binary format parser
+	int phase;			// enum below
+	unsigned char tmp[19];
+	size_t tmp_length;
+	size_t want;
+	size_t skip;
+	int fields_left;
+}copy_in_state_t;
+enum { copy_phase_header, copy_phase_tuple, copy_phase_field_length, copy_phase_done };
+
+static void copy_in_consume(copy_in_state_t * state, const unsigned char * data, size_t length)
+{
+	if(!state->binary) {
+		for(const unsigned char * p = data; (p = memchr(p, '\n', data + length - p)); ++p) ++state->num_rows;
+		return;
+	}
+
+	const unsigned char * p = data;
+	const unsigned char * p_end = data + length;
+	while(p < p_end && state->phase != copy_phase_done) {
+		if(state->skip > 0) {
+			size_t cb = ((size_t)(p_end - p) < state->skip)?(size_t)(p_end - p):state->skip;
+			p += cb;
+			state->skip -= cb;
+			continue;
+		}
+		size_t cb = state->want - state->tmp_length;
+		if((size_t)(p_end - p) < cb) cb = p_end - p;
+		memcpy(state->tmp + state->tmp_length, p, cb);
+		state->tmp_length += cb;
+		p += cb;
+		if(state->tmp_length < state->want) break;
+		state->tmp_length = 0;
+
+		switch(state->phase) {
+		case copy_phase_header:
+			state->skip = be32toh(*(uint32_t *)(state->tmp + 15));	// header extension
+			state->phase = copy_phase_tuple;
+			state->want = 2;
+			break;
+		case copy_phase_tuple:
+			state->fields_left = (int16_t)be16toh(*(uint16_t *)state->tmp);
+			if(state->fields_left < 0) {
+				state->phase = copy_phase_done;
+				break;
+			}
+			++state->num_rows;
+			if(state->fields_left > 0) {
+				state->phase = copy_phase_field_length;
+				state->want = 4;
+			}
+			break;
+		case copy_phase_field_length:
+		{
+			int32_t field_length = (int32_t)be32toh(*(uint32_t *)state->tmp);
+			if(field_length > 0) state->skip = field_length;
+			if(--state->fields_left == 0) {
+				state->phase = copy_phase_tuple;
+				state->want = 2;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+static int run_copy_in(fake_conn_t * conn, int binary, int num_columns)
+{
+	size_t pos = msg_begin(conn, 'G');
+	unsigned char format = binary;
+	auto_buffer_push(conn->out, &format, 1);
+	put_int16(conn, num_columns);
+	for(int i = 0; i < num_columns; ++i) put_int16(conn, binary);
+	msg_end(conn, pos);
+
+	copy_in_state_t state = { .binary = binary, .phase = copy_phase_header, .want = 19 };
+	while(1) {
+		char type = 0;
+		const unsigned char * body = NULL;
+		size_t length = 0;
+		if(conn_read_message(conn, &type, &body, &length)) return -1;
+
+		switch(type) {
+		case 'd':
+			copy_in_consume(&state, body, length);
+			break;
+		case 'c':
+		{
+			char tag[64] = "";
+			snprintf(tag, sizeof(tag), "COPY %ld", (long)state.num_rows);
+			send_command_complete(conn, tag);
+			__atomic_add_fetch(&conn->server->stats.num_copy_rows, state.num_rows, __ATOMIC_RELAXED);
+			return 0;
+		}
+		case 'f':
+		{
+			char message[PATH_MAX] = "";
+			snprintf(message, sizeof(message), "COPY from stdin failed: %.*s", (int)length, (const char *)body);
+			send_error(conn, "57014", message);
+			return 1;
+		}
+		case 'H': case 'S':
+			break;
+		default:
+			send_error(conn, "08P01", "unexpected message type during COPY from stdin");
+			return 1;
+		}
+	}
+}
+
+static void copy_out_push_text(auto_buffer_t * buf, const char * value)
+{
+	if(NULL == value) {
+		auto_buffer_push(buf, "\\N", 2);
+		return;
+	}
+	for(const char * p = value; *p; ++p) {
+		char escaped = 0;
+		switch(*p) {
+		case '\\': escaped = '\\'; break;
+		case '\t': escaped = 't'; break;
+		case '\n': escaped = 'n'; break;
+		case '\r': escaped = 'r'; break;
+		default: auto_buffer_push(buf, p, 1); continue;
+		}
+		char seq[2] = { '\\', escaped };
+		auto_buffer_push(buf, seq, 2);
+	}
+}
+
+/* COPY (query) TO STDOUT: rows of the canned query; COPY table TO STDOUT: rows of "SELECT * FROM table" */
+static int run_copy_out(fake_conn_t * conn, const char * query, int binary)
+{
+	const fake_canned_t * canned = NULL;
+	const char * p = skip_spaces(query + 4);
+	if(*p && p[-1] == '(') {
+		canned = find_canned(conn->server, p);
+	}else {
+		char table_query[PATH_MAX] = "";
+		size_t cb = strcspn(p, " \t\r\n(;");
+		snprintf(table_query, sizeof(table_query), "SELECT * FROM %.*s", (int)cb, p);
+		canned = find_canned(conn->server, table_query);
+	}
+	if(canned && canned->sqlstate) {
+		send_error(conn, canned->sqlstate, canned->message);
+		return 1;
+	}
+	int num_fields = canned?canned->num_fields:0;
+	int num_rows = canned?canned->num_rows:0;
+
+	size_t pos = msg_begin(conn, 'H');
+	unsigned char format = binary;
+	auto_buffer_push(conn->out, &format, 1);
+	put_int16(conn, num_fields);
+	for(int i = 0; i < num_fields; ++i) put_int16(conn, binary);
+	msg_end(conn, pos);
+
+	if(binary) {
+		static const unsigned char header[19] = "PGCOPY\n\377\r\n\0" "\0\0\0\0" "\0\0\0\0";
+		pos = msg_begin(conn, 'd');
+		auto_buffer_push(conn->out, header, sizeof(header));
+		msg_end(conn, pos);
+	}
+	for(int row = 0; row < num_rows; ++row) {
+		const char ** values = (const char **)canned->values + row * num_fields;
+		pos = msg_begin(conn, 'd');
+		if(binary) {
+			put_int16(conn, num_fields);
+			for(int col = 0; col < num_fields; ++col) {
+				if(NULL == values[col]) {
+					put_int32(conn, -1);
+					continue;
+				}
+				size_t length = strlen(values[col]);
+				put_int32(conn, (int32_t)length);
+				auto_buffer_push(conn->out, values[col], length);
+			}
+		}else {
+			for(int col = 0; col < num_fields; ++col) {
+				if(col > 0) auto_buffer_push(conn->out, "\t", 1);
+				copy_out_push_text(conn->out, values[col]);
+			}
+			auto_buffer_push(conn->out, "\n", 1);
+		}
+		msg_end(conn, pos);
+	}
+	if(binary) {
+		pos = msg_begin(conn, 'd');
+		put_int16(conn, -1);
+		msg_end(conn, pos);
+	}
+	pos = msg_begin(conn, 'c');
+	msg_end(conn, pos);
+
+	char tag[64] = "";
+	snprintf(tag, sizeof(tag), "COPY %d", num_rows);
+	send_command_complete(conn, tag);
+	return 0;
+}
+
+static int count_copy_columns(const char * query)
+{
+	// COPY table(col1, col2, ...) FROM STDIN
+	const char * p = skip_spaces(query + 4);
+	const char * p_end = p + strcspn(p, " \t\r\n(;");
+	p = p_end;
+	while(isspace((unsigned char)*p)) ++p;
+	if(*p != '(') return 1;
+	int num_columns = 1;
+	for(++p; *p && *p != ')'; ++p) if(*p == ',') ++num_columns;
+	return num_columns;
+}
+
+/*
+ * run_statement()
+ * 	@describe: send RowDescription before the rows (simple query protocol)
+ * 	@return 0: ok; 1: error sent to the client; -1: connection error
+ */
+static int run_statement(fake_conn_t * conn, const char * query, int result_format, int describe, const char * first_param)
+{
+	__atomic_add_fetch(&conn->server->stats.num_queries, 1, __ATOMIC_RELAXED);
+	const char * p = skip_spaces(query);
+	char tag[64] = "";
+
+	if(keyword_is(p, "COMMIT") || keyword_is(p, "END")) {
+		send_command_complete(conn, (conn->txn_status == 'E')?"ROLLBACK":"COMMIT");
+		conn->txn_status = 'I';
+		return 0;
+	}
+	if(keyword_is(p, "ROLLBACK") || keyword_is(p, "ABORT")) {
+		send_command_complete(conn, "ROLLBACK");
+		conn->txn_status = 'I';
+		return 0;
+	}
+	if(conn->txn_status == 'E') {
+		send_error(conn, "25P02", "current transaction is aborted, commands ignored until end of transaction block");
+		return 1;
+	}
+
+	const fake_canned_t * canned = find_canned(conn->server, query);
+	if(canned && canned->sqlstate) {
+		send_error(conn, canned->sqlstate, canned->message);
+		return 1;
+	}
+
+	if(keyword_is(p, "BEGIN") || keyword_is(p, "START")) {
+		send_command_complete(conn, "BEGIN");
+		conn->txn_status = 'T';
+		return 0;
+	}
+	if(keyword_is(p, "COPY")) {
+		int binary = (NULL != strcasestr_n(p, "BINARY"));
+		if(strcasestr_n(p, "FROM STDIN")) return run_copy_in(conn, binary, count_copy_columns(p));
+		if(strcasestr_n(p, "TO STDOUT")) return run_copy_out(conn, p, binary);
+		send_error(conn, "0A000", "only COPY FROM STDIN and COPY TO STDOUT are supported");
+		return 1;
+	}
+
+	if(statement_returns_rows(query, canned)) {
+		if(describe) send_row_description(conn, canned, result_format);
+		int num_rows = send_data_rows(conn, canned);
+		snprintf(tag, sizeof(tag), "SELECT %d", num_rows);
+	}else if(keyword_is(p, "INSERT")) {
+		snprintf(tag, sizeof(tag), "INSERT 0 %ld", (long)count_insert_rows(p, first_param));
+	}else if(keyword_is(p, "UPDATE") || keyword_is(p, "DELETE") || keyword_is(p, "MERGE")) {
+		snprintf(tag, sizeof(tag), "%.*s 0", 6, p);
+		for(char * c = tag; *c; ++c) *c = toupper((unsigned char)*c);
+		if(keyword_is(p, "MERGE")) snprintf(tag, sizeof(tag), "MERGE 0");
+	}else {
+		size_t cb = 0;
+		while(isalpha((unsigned char)p[cb]) && cb < sizeof(tag) - 1) {
+			tag[cb] = toupper((unsigned char)p[cb]);
+			++cb;
+		}
+		tag[cb] = '\0';
+	}
+	send_command_complete(conn, tag);
+	return 0;
+}
+
+/* ************************************************
+ * protocol
+************************************************ */
+static int process_simple_query(fake_conn_t * conn, const char * sql, size_t length)
+{
+	char * query = strndup(sql, length);
+	assert(query);
+
+	int num_statements = 0;
+	int rc = 0;
+	char * p = query;
+	while(*p && rc == 0) {
+		// split on ';' outside of quotes
+		char * statement = p;
+		int in_quote = 0;
+		for(; *p; ++p) {
+			if(*p == '\'' || *p == '"') {
+				if(!in_quote) in_quote = *p;
+				else if(in_quote == *p) in_quote = 0;
+			}else if(*p == ';' && !in_quote) break;
+		}
+		if(*p) *p++ = '\0';
+
+		const char * text = statement;
+		while(isspace((unsigned char)*text)) ++text;
+		if(*text == '\0') continue;
+		++num_statements;
+		rc = run_statement(conn, text, 0, 1, NULL);
+	}
+	free(query);
+
+	if(rc < 0) return -1;
+	if(num_statements == 0) {
+		size_t pos = msg_begin(conn, 'I');	// EmptyQueryResponse
+		msg_end(conn, pos);
+	}
+	send_ready_for_query(conn);
+	return 0;
+}
+
+static fake_stmt_t * find_stmt(fake_conn_t * conn, const char * name)
+{
+	for(fake_stmt_t * stmt = conn->stmts; stmt; stmt = stmt->next) if(0 == strcmp(stmt->name, name)) return stmt;
+	return NULL;
+}
+
+static fake_portal_t * find_portal(fake_conn_t * conn, const char * name)
+{
+	for(fake_portal_t * portal = conn->portals; portal; portal = portal->next) if(0 == strcmp(portal->name, name)) return portal;
+	return NULL;
+}
+
+static void free_stmt(fake_stmt_t * stmt)
+{
+	free(stmt->name);
+	free(stmt->query);
+	free(stmt);
+}
+
+static void free_portal(fake_portal_t * portal)
+{
+	free(portal->name);
+	free(portal->query);
+	free(portal->first_param);
+	free(portal);
+}
+
+static void close_stmt(fake_conn_t * conn, const char * name)
+{
+	for(fake_stmt_t ** p_stmt = &conn->stmts; *p_stmt; p_stmt = &(*p_stmt)->next) {
+		if(strcmp((*p_stmt)->name, name)) continue;
+		fake_stmt_t * stmt = *p_stmt;
+		*p_stmt = stmt->next;
+		free_stmt(stmt);
+		return;
+	}
+}
+
+static void close_portal(fake_conn_t * conn, const char * name)
+{
+	for(fake_portal_t ** p_portal = &conn->portals; *p_portal; p_portal = &(*p_portal)->next) {
+		if(strcmp((*p_portal)->name, name)) continue;
+		fake_portal_t * portal = *p_portal;
+		*p_portal = portal->next;
+		free_portal(portal);
+		return;
+	}
+}
+
+static int process_parse(fake_conn_t * conn, const unsigned char * p, const unsigned char * p_end)
+{
+	const char * name = get_cstr(&p, p_end);
+	const char * query = name?get_cstr(&p, p_end):NULL;
+	int16_t num_params = 0;
+	if(NULL == query || get_int16(&p, p_end, &num_params)) return -1;
+
+	if(name[0] && find_stmt(conn, name)) {
+		char message[200] = "";
+		snprintf(message, sizeof(message), "prepared statement \"%s\" already exists", name);
+		send_error(conn, "42P05", message);
+		return 1;
+	}
+	close_stmt(conn, name);	// the unnamed statement is replaced
+
+	fake_stmt_t * stmt = calloc(1, sizeof(*stmt));
+	assert(stmt);
+	stmt->name = strdup(name);
+	stmt->query = strdup(query);
+	stmt->num_params = num_params;
+	stmt->next = conn->stmts;
+	conn->stmts = stmt;
+
+	size_t pos = msg_begin(conn, '1');	// ParseComplete
+	msg_end(conn, pos);
+	return 0;
+}
+
+static int process_bind(fake_conn_t * conn, const unsigned char * p, const unsigned char * p_end)
+{
+	const char * portal_name = get_cstr(&p, p_end);
+	const char * stmt_name = portal_name?get_cstr(&p, p_end):NULL;
+	if(NULL == stmt_name) return -1;
+
+	int16_t num_formats = 0;
+	if(get_int16(&p, p_end, &num_formats) || p_end - p < num_formats * 2) return -1;
+	int first_format = 0;
+	if(num_formats > 0) first_format = (int16_t)be16toh(*(uint16_t *)p);
+	p += num_formats * 2;
+
+	int16_t num_params = 0;
+	if(get_int16(&p, p_end, &num_params)) return -1;
+	char * first_param = NULL;
+	for(int i = 0; i < num_params; ++i) {
+		int32_t length = 0;
+		if(get_int32(&p, p_end, &length)) { free(first_param); return -1; }
+		if(length < 0) continue;
+		if(p_end - p < length) { free(first_param); return -1; }
+		if(i == 0 && first_format == 0) first_param = strndup((const char *)p, length);
+		p += length;
+	}
+
+	int16_t num_result_formats = 0;
+	if(get_int16(&p, p_end, &num_result_formats) || p_end - p < num_result_formats * 2) { free(first_param); return -1; }
+	int result_format = (num_result_formats > 0)?(int16_t)be16toh(*(uint16_t *)p):0;
+
+	fake_stmt_t * stmt = find_stmt(conn, stmt_name);
+	if(NULL == stmt) {
+		free(first_param);
+		char message[200] = "";
+		snprintf(message, sizeof(message), "prepared statement \"%s\" does not exist", stmt_name);
+		send_error(conn, "26000", message);
+		return 1;
+	}
+
+	close_portal(conn, portal_name);
+	fake_portal_t * portal = calloc(1, sizeof(*portal));
+	assert(portal);
+	portal->name = strdup(portal_name);
+	portal->query = strdup(stmt->query);
+	portal->result_format = result_format;
+	portal->first_param = first_param;
+	portal->next = conn->portals;
+	conn->portals = portal;
+
+	size_t pos = msg_begin(conn, '2');	// BindComplete
+	msg_end(conn, pos);
+	return 0;
+}
+
+static int process_describe(fake_conn_t * conn, const unsigned char * p, const unsigned char * p_end)
+{
+	if(p >= p_end) return -1;
+	char kind = *p++;
+	const char * name = get_cstr(&p, p_end);
+	if(NULL == name) return -1;
+
+	const char * query = NULL;
+	int result_format = 0;
+	if(kind == 'S') {
+		fake_stmt_t * stmt = find_stmt(conn, name);
+		if(NULL == stmt) {
+			send_error(conn, "26000", "prepared statement does not exist");
+			return 1;
+		}
+		size_t pos = msg_begin(conn, 't');	// ParameterDescription
+		put_int16(conn, stmt->num_params);
+		for(int i = 0; i < stmt->num_params; ++i) put_int32(conn, FAKE_TEXT_OID);
+		msg_end(conn, pos);
+		query = stmt->query;
+	}else {
+		fake_portal_t * portal = find_portal(conn, name);
+		if(NULL == portal) {
+			send_error(conn, "34000", "portal does not exist");
+			return 1;
+		}
+		query = portal->query;
+		result_format = portal->result_format;
+	}
+
+	const fake_canned_t * canned = find_canned(conn->server, query);
+	if(statement_returns_rows(query, canned)) {
+		send_row_description(conn, canned, result_format);
+	}else {
+		size_t pos = msg_begin(conn, 'n');	// NoData
+		msg_end(conn, pos);
+	}
+	return 0;
+}
+
+static int process_execute(fake_conn_t * conn, const unsigned char * p, const unsigned char * p_end)
+{
+	const char * name = get_cstr(&p, p_end);
+	if(NULL == name) return -1;
+	fake_portal_t * portal = find_portal(conn, name);
+	if(NULL == portal) {
+		send_error(conn, "34000", "portal does not exist");
+		return 1;
+	}
+	return run_statement(conn, portal->query, portal->result_format, 0, portal->first_param);
+}
+
+static int process_close(fake_conn_t * conn, const unsigned char * p, const unsigned char * p_end)
+{
+	if(p >= p_end) return -1;
+	char kind = *p++;
+	const char * name = get_cstr(&p, p_end);
+	if(NULL == name) return -1;
+	if(kind == 'S') close_stmt(conn, name);
+	else close_portal(conn, name);
+
+	size_t pos = msg_begin(conn, '3');	// CloseComplete
+	msg_end(conn, pos);
+	return 0;
+}
+
+static int process_startup(fake_conn_t * conn)
+{
+	while(1) {
+		if(conn_fill(conn, 8)) return -1;
+		uint32_t length = be32toh(*(uint32_t *)(conn->in + conn->in_begin));
+		if(length < 8 || length > 10000) return -1;
+		if(conn_fill(conn, length)) return -1;
+		int32_t code = (int32_t)be32toh(*(uint32_t *)(conn->in + conn->in_begin + 4));
+		conn->in_begin += length;
+
+		if(code == FAKE_SSL_REQUEST_CODE || code == FAKE_GSSENC_REQUEST_CODE) {
+			if(write(conn->fd, "N", 1) != 1) return -1;	// not supported, continue in plain text
+			continue;
+		}
+		if(code == FAKE_CANCEL_REQUEST_CODE) return -1;
+		if(code != FAKE_PROTOCOL_VERSION_3) {
+			send_error(conn, "0A000", "unsupported frontend protocol");
+			conn_flush(conn);
+			return -1;
+		}
+		break;
+	}
+
+	size_t pos = msg_begin(conn, 'R');	// AuthenticationOk
+	put_int32(conn, 0);
+	msg_end(conn, pos);
+
+	send_parameter_status(conn, "server_version", "16.0");
+	send_parameter_status(conn, "server_encoding", "UTF8");
+	send_parameter_status(conn, "client_encoding", "UTF8");
+	send_parameter_status(conn, "DateStyle", "ISO, MDY");
+	send_parameter_status(conn, "integer_datetimes", "on");
+	send_parameter_status(conn, "standard_conforming_strings", "on");
+	send_parameter_status(conn, "TimeZone", "UTC");
+
+	pos = msg_begin(conn, 'K');	// BackendKeyData
+	put_int32(conn, __atomic_add_fetch(&conn->server->next_pid, 1, __ATOMIC_RELAXED));
+	put_int32(conn, 0x5eed);
+	msg_end(conn, pos);
+
+	conn->txn_status = 'I';
+	send_ready_for_query(conn);
+	return conn_flush(conn);
+}
+
+static void * fake_conn_thread(void * user_data)
+{
+	fake_conn_t * conn = user_data;
+	if(process_startup(conn)) goto label_exit;
+
+	while(1) {
+		char type = 0;
+		const unsigned char * body = NULL;
+		size_t length = 0;
+		if(conn_read_message(conn, &type, &body, &length)) break;
+		const unsigned char * body_end = body + length;
+
+		if(type == 'X') break;	// Terminate
+		if(conn->skip_until_sync && type != 'S') continue;
+
+		int rc = 0;
+		switch(type) {
+		case 'Q': rc = process_simple_query(conn, (const char *)body, length); break;
+		case 'P': rc = process_parse(conn, body, body_end); break;
+		case 'B': rc = process_bind(conn, body, body_end); break;
+		case 'D': rc = process_describe(conn, body, body_end); break;
+		case 'E': rc = process_execute(conn, body, body_end); break;
+		case 'C': rc = process_close(conn, body, body_end); break;
+		case 'H': rc = conn_flush(conn); break;
+		case 'S':
+			conn->skip_until_sync = 0;
+			send_ready_for_query(conn);
+			break;
+		case 'd': case 'c': case 'f':
+			break;	// stray COPY messages after an error
+		default:
+			send_error(conn, "08P01", "unsupported message type");
+			rc = 1;
+			break;
+		}
+		if(rc < 0) break;
+		if(rc > 0 && type != 'Q') conn->skip_until_sync = 1;
+	}
+
+label_exit:
+	conn_flush(conn);
+	shutdown(conn->fd, SHUT_RDWR);
+	return NULL;
+}
+
+/* ************************************************
+ * server
+************************************************ */
+static void * fake_server_thread(void * user_data)
+{
+	psql_fake_server_t * server = user_data;
+	struct pollfd pfds[2] = {
+		[0] = { .fd = server->listen_fd, .events = POLLIN },
+		[1] = { .fd = server->wakeup_fd, .events = POLLIN },
+	};
+	while(!server->quit) {
+		int n = poll(pfds, 2, -1);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			perror("fake_server_thread()::poll()");
+			break;
+		}
+		if(pfds[1].revents) break;
+		if(!(pfds[0].revents & POLLIN)) continue;
+
+		int fd = accept(server->listen_fd, NULL, NULL);
+		if(fd < 0) continue;
+
+		fake_conn_t * conn = calloc(1, sizeof(*conn));
+		assert(conn);
+		conn->server = server;
+		conn->fd = fd;
+		auto_buffer_init(conn->out, FAKE_OUTPUT_FLUSH_SIZE * 2);
+
+		pthread_mutex_lock(&server->mutex);
+		conn->next = server->conns;
+		server->conns = conn;
+		++server->stats.num_connections;
+		pthread_mutex_unlock(&server->mutex);
+
+		int rc = pthread_create(&conn->th, NULL, fake_conn_thread, conn);
+		assert(0 == rc);
+	}
+	return NULL;
+}
+
+psql_fake_server_t * psql_fake_server_start(const char * socket_dir, int port)
+{
+	assert(socket_dir);
+	if(port <= 0) port = 5432;
+
+	psql_fake_server_t * server = calloc(1, sizeof(*server));
+	assert(server);
+	server->listen_fd = -1;
+	server->wakeup_fd = -1;
+	server->next_pid = 10000;
+	pthread_mutex_init(&server->mutex, NULL);
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int cb = snprintf(server->path, sizeof(server->path), "%s/.s.PGSQL.%d", socket_dir, port);
+	if(cb <= 0 || cb >= sizeof(server->path) || cb >= sizeof(addr.sun_path)) {	// never bind a truncated path
+		fprintf(stderr, "[ERROR]: %s(): socket path too long\n", __FUNCTION__);
+		goto label_error;
+	}
+
+	server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(server->listen_fd < 0) {
+		perror("psql_fake_server_start()::socket()");
+		goto label_error;
+	}
+	memcpy(addr.sun_path, server->path, cb + 1);
+	unlink(server->path);
+	if(bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(server->listen_fd, 128)) {
+		perror("psql_fake_server_start()::bind()");
+		goto label_error;
+	}
+
+	server->wakeup_fd = eventfd(0, EFD_CLOEXEC);
+	assert(server->wakeup_fd >= 0);
+
+	// a few canned results which the client library asks for
+	static const char * version_num[1] = { "160000" };
+	static const char * version[1] = { "16.0" };
+	psql_fake_server_add_result(server, "SHOW server_version_num", 1, (const char *[]){ "server_version_num" }, 1, version_num);
+	psql_fake_server_add_result(server, "SHOW server_version", 1, (const char *[]){ "server_version" }, 1, version);
+
+	int rc = pthread_create(&server->th, NULL, fake_server_thread, server);
+	assert(0 == rc);
+	return server;
+
+label_error:
+	if(server->listen_fd >= 0) close(server->listen_fd);
+	pthread_mutex_destroy(&server->mutex);
+	free(server);
+	return NULL;
+}
+
+static void free_canned(fake_canned_t * canned)
+{
+	for(int i = 0; i < canned->num_fields; ++i) free(canned->field_names[i]);
+	for(int i = 0; i < canned->num_fields * canned->num_rows; ++i) free(canned->values[i]);
+	free(canned->field_names);
+	free(canned->values);
+	free(canned->prefix);
+	free(canned->sqlstate);
+	free(canned->message);
+	free(canned);
+}
+
+void psql_fake_server_stop(psql_fake_server_t * server)
+{
+	if(NULL == server) return;
+	server->quit = 1;
+	uint64_t one = 1;
+	if(write(server->wakeup_fd, &one, sizeof(one)) != sizeof(one)) perror("psql_fake_server_stop()::write()");
+	pthread_join(server->th, NULL);
+
+	close(server->listen_fd);
+	unlink(server->path);
+
+	fake_conn_t * conn = server->conns;
+	while(conn) {
+		fake_conn_t * next = conn->next;
+		shutdown(conn->fd, SHUT_RDWR);	// unblocks the connection thread
+		pthread_join(conn->th, NULL);
+		close(conn->fd);
+
+		while(conn->stmts) {
+			fake_stmt_t * stmt = conn->stmts;
+			conn->stmts = stmt->next;
+			free_stmt(stmt);
+		}
+		while(conn->portals) {
+			fake_portal_t * portal = conn->portals;
+			conn->portals = portal->next;
+			free_portal(portal);
+		}
+		free(conn->in);
+		auto_buffer_cleanup(conn->out);
+		free(conn);
+		conn = next;
+	}
+
+	while(server->canned) {
+		fake_canned_t * canned = server->canned;
+		server->canned = canned->next;
+		free_canned(canned);
+	}
+	close(server->wakeup_fd);
+	pthread_mutex_destroy(&server->mutex);
+	free(server);
+}
+
+static void add_canned(psql_fake_server_t * server, fake_canned_t * canned)
+{
+	// the latest one wins
+	pthread_mutex_lock(&server->mutex);
+	canned->next = server->canned;
+	server->canned = canned;
+	pthread_mutex_unlock(&server->mutex);
+}
+
+int psql_fake_server_add_result(psql_fake_server_t * server, const char * query_prefix,
+	int num_fields, const char ** field_names,
+	int num_rows, const char ** values)
+{
+	assert(server && query_prefix && num_fields > 0 && field_names);
+	assert(num_rows == 0 || values);
+
+	fake_canned_t * canned = calloc(1, sizeof(*canned));
+	assert(canned);
+	canned->prefix = strdup(query_prefix);
+	canned->cb_prefix = strlen(query_prefix);
+	canned->num_fields = num_fields;
+	canned->num_rows = num_rows;
+	canned->field_names = calloc(num_fields, sizeof(*canned->field_names));
+	canned->values = calloc((size_t)num_fields * num_rows + 1, sizeof(*canned->values));
+	assert(canned->field_names && canned->values);
+	for(int i = 0; i < num_fields; ++i) canned->field_names[i] = strdup(field_names[i]);
+	for(int i = 0; i < num_fields * num_rows; ++i) canned->values[i] = values[i]?strdup(values[i]):NULL;
+
+	add_canned(server, canned);
+	return 0;
+}
+
+int psql_fake_server_add_error(psql_fake_server_t * server, const char * query_prefix,
+	const char * sqlstate, const char * message)
+{
+	assert(server && query_prefix && sqlstate && message);
+	fake_canned_t * canned = calloc(1, sizeof(*canned));
+	assert(canned);
+	canned->prefix = strdup(query_prefix);
+	canned->cb_prefix = strlen(query_prefix);
+	canned->sqlstate = strdup(sqlstate);
+	canned->message = strdup(message);
+
+	add_canned(server, canned);
+	return 0;
+}
+
+int psql_fake_server_get_stats(psql_fake_server_t * server, psql_fake_server_stats_t * stats)
+{
+	assert(server && stats);
+	pthread_mutex_lock(&server->mutex);
+	stats->num_connections = server->stats.num_connections;
+	pthread_mutex_unlock(&server->mutex);
+	stats->num_queries = __atomic_load_n(&server->stats.num_queries, __ATOMIC_RELAXED);
+	stats->num_copy_rows = __atomic_load_n(&server->stats.num_copy_rows, __ATOMIC_RELAXED);
+	stats->num_bytes_received = __atomic_load_n(&server->stats.num_bytes_received, __ATOMIC_RELAXED);
+	stats->num_bytes_sent = __atomic_load_n(&server->stats.num_bytes_sent, __ATOMIC_RELAXED);
+	return 0;
+}
+
+#undef FAKE_PROTOCOL_VERSION_3
+#undef FAKE_SSL_REQUEST_CODE
+#undef FAKE_GSSENC_REQUEST_CODE
+#undef FAKE_CANCEL_REQUEST_CODE
+#undef FAKE_OUTPUT_FLUSH_SIZE
+#undef FAKE_TEXT_OID
+
+
+/******************************************************
+ * TEST Module
+ * 	$ tests/make.sh psql-fake-server
+ * 	$ tests/psql-fake-server             # self test + client overhead microbenchmarks
+ * 	$ tests/psql-fake-server --serve     # serve until killed
+ *****************************************************/
+#if defined(_TEST_PSQL_FAKE_SERVER) && defined(_STAND_ALONE)
+#include <signal.h>
+#include <time.h>
+#include <libpq-fe.h>
+#include "rdb-postgres.h"
+
+static volatile sig_atomic_t s_quit;
+static void on_signal(int sig) { s_quit = 1; }
+
+static double get_time(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void test_fake_queries(psql_context_t * psql)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	psql_result_t res = NULL;
+	int rc = psql_execute(psql, "select * from users where id < 10", &res);
+	assert(0 == rc && psql_result_get_count(res) == 3);
+	assert(0 == strcmp(psql_result_get_value(res, 1, 1), "bob"));
+	assert(psql_result_is_null(res, 2, 1));
+	psql_result_clear(&res);
+
+	psql_params_t params[1];
+	memset(params, 0, sizeof(params));
+	psql_params_setv(params, 1, 0, 0, "42", -1, 0);
+	rc = psql_exec_params(psql, "select * from users where id = $1", params, &res);
+	assert(0 == rc && psql_result_get_count(res) == 3);
+	psql_result_clear(&res);
+
+	rc = psql_execute(psql, "select * from no_such_table", NULL);
+	assert(rc);
+	rc = psql_execute(psql, "BEGIN; INSERT INTO t VALUES (1), (2), ('a,(b)'); COMMIT;", NULL);
+	assert(0 == rc);
+
+	psql_prepare_params_t prepare_params[1] = {{ .stmt_name = "fake-insert", .num_params = 1 }};
+	rc = psql_prepare(psql, "INSERT INTO t(id) VALUES($1)", prepare_params);
+	assert(0 == rc);
+	rc = psql_exec_prepared(psql, "fake-insert", params, &res);
+	assert(0 == rc && 0 == strcmp(PQcmdTuples(res), "1"));
+	psql_result_clear(&res);
+
+	// pipeline mode
+	rc = psql_pipeline_enter(psql);
+	assert(0 == rc);
+	for(int i = 0; i < 100; ++i) {
+		rc = psql_pipeline_send_prepared(psql, "fake-insert", params);
+		assert(0 == rc);
+	}
+	rc = psql_pipeline_sync(psql);
+	assert(0 == rc);
+	int statuses[100];
+	ssize_t num_results = psql_pipeline_get_results(psql, statuses, 100, NULL, NULL);
+	assert(num_results == 100);
+	for(int i = 0; i < 100; ++i) assert(statuses[i] == psql_pipeline_status_ok);
+	psql_pipeline_exit(psql);
+
+	// COPY in both formats
+	for(int format = psql_copy_format_text; format <= psql_copy_format_binary; ++format) {
+		psql_copy_writer_t writer[1];
+		psql_copy_writer_init(writer, psql, format, 0);
+		rc = psql_copy_writer_begin(writer, "t", "id, name");
+		assert(0 == rc);
+		for(int i = 0; i < 10000; ++i) {
+			const char * values[2] = { "1234", (i % 3)?"name\twith tab":NULL };
+			int cb_values[2] = { 4, 13 };
+			rc = psql_copy_writer_append_row(writer, 2, values, cb_values);
+			assert(0 == rc);
+		}
+		int64_t num_rows = psql_copy_writer_end(writer, NULL);
+		assert(num_rows == 10000);
+		psql_copy_writer_cleanup(writer);
+	}
+
+	// COPY TO STDOUT
+	psql_copy_reader_t reader[1];
+	psql_copy_reader_init(reader, psql, psql_copy_format_text);
+	rc = psql_copy_reader_begin(reader, "users", NULL);
+	assert(0 == rc);
+	const psql_copy_field_t * fields = NULL;
+	int num_rows = 0;
+	while((rc = psql_copy_reader_next_row(reader, &fields)) > 0) ++num_rows;
+	assert(num_rows == 3);
+	assert(psql_copy_reader_end(reader) == 3);
+	psql_copy_reader_cleanup(reader);
+	psql_params_cleanup(params);
+}
+
+static void bench_client_overhead(psql_context_t * psql)
+{
+	printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	static const int num_round_trips = 20000;
+	psql_params_t params[1];
+	memset(params, 0, sizeof(params));
+	psql_params_setv(params, 1, 0, 0, "42", -1, 0);
+
+	double begin_time = get_time();
+	for(int i = 0; i < num_round_trips; ++i) psql_exec_prepared(psql, "fake-insert", params, NULL);
+	double time_elapsed = get_time() - begin_time;
+	printf(" --> exec_prepared round trip: %.3f us\n", time_elapsed / num_round_trips * 1000000.0);
+
+	int statuses[1000];
+	begin_time = get_time();
+	psql_pipeline_enter(psql);
+	for(int i = 0; i < num_round_trips; ++i) {
+		psql_pipeline_send_prepared(psql, "fake-insert", params);
+		if((i + 1) % 1000 == 0) {
+			psql_pipeline_sync(psql);
+			psql_pipeline_get_results(psql, statuses, 1000, NULL, NULL);
+		}
+	}
+	psql_pipeline_exit(psql);
+	time_elapsed = get_time() - begin_time;
+	printf(" --> pipelined statement: %.3f us\n", time_elapsed / num_round_trips * 1000000.0);
+
+	static const int num_copy_rows = 1000 * 1000;
+	for(int format = psql_copy_format_text; format <= psql_copy_format_binary; ++format) {
+		psql_copy_writer_t writer[1];
+		psql_copy_writer_init(writer, psql, format, 0);
+		begin_time = get_time();
+		psql_copy_writer_begin(writer, "t", "id, name, email");
+		for(int i = 0; i < num_copy_rows; ++i) {
+			const char * values[3] = { "12345678", "user-000000001", "user-000000001@test.com" };
+			int cb_values[3] = { 8, 14, 23 };
+			psql_copy_writer_append_row(writer, 3, values, cb_values);
+		}
+		int64_t num_rows = psql_copy_writer_end(writer, NULL);
+		time_elapsed = get_time() - begin_time;
+		assert(num_rows == num_copy_rows);
+		printf(" --> COPY %s: %.0f rows/s, %.1f MB/s\n", (format == psql_copy_format_binary)?"binary":"text",
+			num_rows / time_elapsed, writer->num_bytes / time_elapsed / (1024.0 * 1024.0));
+		psql_copy_writer_cleanup(writer);
+	}
+	psql_params_cleanup(params);
+}
+
+int main(int argc, char ** argv)
+{
+	int serve = (argc > 1 && 0 == strcmp(argv[1], "--serve"));
+	char socket_dir[] = "/tmp/psql-fake-server-XXXXXX";
+	if(NULL == mkdtemp(socket_dir)) {
+		perror("mkdtemp()");
+		return 1;
+	}
+
+	psql_fake_server_t * server = psql_fake_server_start(socket_dir, 5432);
+	assert(server);
+
+	static const char * field_names[2] = { "id", "name" };
+	static const char * values[3 * 2] = { "1", "alice", "2", "bob", "3", NULL };
+	psql_fake_server_add_result(server, "select * from users", 2, field_names, 3, values);
+	psql_fake_server_add_result(server, "SELECT * FROM users", 2, field_names, 3, values);
+	psql_fake_server_add_error(server, "select * from no_such_table", "42P01", "relation \"no_such_table\" does not exist");
+
+	char sz_conn[PATH_MAX] = "";
+	snprintf(sz_conn, sizeof(sz_conn), "host=%s port=5432 dbname=fake user=fake", socket_dir);
+
+	if(serve) {
+		printf("listening on %s/.s.PGSQL.5432, connect with: \"%s\"\n", socket_dir, sz_conn);
+		signal(SIGINT, on_signal);
+		signal(SIGTERM, on_signal);
+		while(!s_quit) pause();
+	}else {
+		psql_context_t * psql = psql_context_init(NULL, NULL);
+		int rc = psql_connect_db(psql, sz_conn, 0);
+		assert(0 == rc);
+
+		test_fake_queries(psql);
+		bench_client_overhead(psql);
+
+		psql_context_cleanup(psql);
+		free(psql);
+	}
+
+	psql_fake_server_stats_t stats[1];
+	psql_fake_server_get_stats(server, stats);
+	printf("server: connections: %ld, queries: %ld, copy rows: %ld, received: %ld bytes, sent: %ld bytes\n",
+		(long)stats->num_connections, (long)stats->num_queries, (long)stats->num_copy_rows,
+		(long)stats->num_bytes_received, (long)stats->num_bytes_sent);
+
+	psql_fake_server_stop(server);
+	rmdir(socket_dir);
+	return 0;
+}
+#endif
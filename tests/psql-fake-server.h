@@ -0,0 +1,50 @@
+#ifndef PSQL_FAKE_SERVER_H_
+#define PSQL_FAKE_SERVER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * psql_fake_server: an in-process stand-in for a PostgreSQL server, for offline benchmarks
+ * 	speaks enough of the v3 protocol over a Unix socket (<socket_dir>/.s.PGSQL.<port>):
+ * 	  - startup (trust auth), ParameterStatus, BackendKeyData, ReadyForQuery with the transaction status
+ * 	  - simple query (multiple statements), extended query (Parse / Bind / Describe / Execute / Sync / Close),
+ * 	    so pipeline mode works as well
+ * 	  - COPY FROM STDIN (text or binary, the rows are counted and discarded)
+ * 	  - COPY TO STDOUT (the canned rows of the query, or of "SELECT * FROM <table>")
+ * 	  - canned result sets and errors, matched by query prefix (case-insensitive)
+ * 	everything else completes with a plausible command tag (e.g. "INSERT 0 <rows>") and no rows,
+ * 	a SELECT without a canned result returns a single row with a single column: "1".
+ *
+ * 	connect with: "host=<socket_dir> port=<port> dbname=fake user=fake"
+*/
+typedef struct psql_fake_server psql_fake_server_t;
+
+psql_fake_server_t * psql_fake_server_start(const char * socket_dir, int port);
+void psql_fake_server_stop(psql_fake_server_t * server);	// closes all connections and frees the server
+
+// all columns are text (oid 25), values[row * num_fields + col], NULL: SQL NULL
+int psql_fake_server_add_result(psql_fake_server_t * server, const char * query_prefix,
+	int num_fields, const char ** field_names,
+	int num_rows, const char ** values);
+int psql_fake_server_add_error(psql_fake_server_t * server, const char * query_prefix,
+	const char * sqlstate, const char * message);
+
+typedef struct psql_fake_server_stats
+{
+	int64_t num_connections;
+	int64_t num_queries;		// simple query statements + executes
+	int64_t num_copy_rows;		// received by COPY FROM STDIN
+	int64_t num_bytes_received;
+	int64_t num_bytes_sent;
+}psql_fake_server_stats_t;
+int psql_fake_server_get_stats(psql_fake_server_t * server, psql_fake_server_stats_t * stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -32,6 +32,10 @@
 #include <assert.h>
 
 #include <limits.h>
+#include <stdint.h>
+#include <endian.h>
+#include <time.h>
+#include <unistd.h>
 #include "rdb-postgres.h"
 #include <stdarg.h>
 #include <libpq-fe.h>
@@ -85,6 +89,7 @@ struct user_record
 }__attribute__((packed));
 typedef struct user_record user_record_t;
 
+static char sz_conn[PATH_MAX] = "";	// shared with the tests which open their own connections
 static psql_context_t * init_connection(int argc, char ** argv, void * user_data)
 {
 	// load login info from environment variables: 
@@ -106,7 +111,6 @@ static psql_context_t * init_connection(int argc, char ** argv, void * user_data
 	printf("libpq version: %d.%d\n", major, minor);
 	
 	
-	char sz_conn[PATH_MAX] = "";
 	int cb = snprintf(sz_conn, sizeof(sz_conn), 
 		" host=%s port=%s "
 		" dbname=%s user=%s password=%s ",
@@ -121,9 +125,6 @@ static psql_context_t * init_connection(int argc, char ** argv, void * user_data
 	return psql;
 }
 
-#include <libpq-fe.h>
-#include "auto_buffer.h"
-
 #define _TEST_INSERT 
 static const int num_records = 100 * 1000;
 static user_record_t user[1];
@@ -131,8 +132,16 @@ static double time_elapsed = 0.0;
 static app_timer_t * timer;
 
 void test_normal_inserting_with_prepared_stmt(psql_context_t * psql);
+void test_pipeline_inserting_with_prepared_stmt(psql_context_t * psql);
+void test_batched_inserting(psql_context_t * psql, int mode);
+void test_bulk_upsert(psql_context_t * psql, int use_merge);
+void test_parallel_copy_loader(psql_context_t * psql, int num_workers);
+void test_copy_pipeline(psql_context_t * psql, int num_encoders);
+void test_import_csv(psql_context_t * psql, int num_workers);
 void test_copy_from_text_format(psql_context_t * psql);
 void test_copy_from_binary_format(psql_context_t * psql);
+void test_copy_from_binary_typed(psql_context_t * psql);
+void test_copy_to_stdout(psql_context_t * psql, int format);
 int main(int argc, char **argv)
 {
 	psql_context_t * psql = init_connection(argc, argv, NULL);
@@ -154,10 +163,32 @@ int main(int argc, char **argv)
 		test_normal_inserting_with_prepared_stmt(psql);
 	}
 	
+	test_pipeline_inserting_with_prepared_stmt(psql);
+	
+	test_batched_inserting(psql, psql_insert_batch_mode_values);
+	test_batched_inserting(psql, psql_insert_batch_mode_unnest);
+	
+	test_bulk_upsert(psql, 0);
+	test_bulk_upsert(psql, 1);
+	
+	test_parallel_copy_loader(psql, 1);
+	test_parallel_copy_loader(psql, 4);
+	
+	test_copy_pipeline(psql, 1);
+	test_copy_pipeline(psql, 2);
+	
+	test_import_csv(psql, 1);
+	test_import_csv(psql, 4);
+	
 	test_copy_from_text_format(psql);
 	
 	test_copy_from_binary_format(psql);
 	
+	test_copy_from_binary_typed(psql);
+	
+	test_copy_to_stdout(psql, psql_copy_format_text);
+	test_copy_to_stdout(psql, psql_copy_format_binary);
+	
 	psql_context_cleanup(psql);
 	free(psql);
 	return 0;
@@ -230,17 +261,11 @@ void test_normal_inserting_with_prepared_stmt(psql_context_t * psql)
 	return;
 }
 
-void test_copy_from_text_format(psql_context_t * psql)
+void test_pipeline_inserting_with_prepared_stmt(psql_context_t * psql)
 {
 	debug_printf("==== %s(%p) ====\n", __FUNCTION__, psql);
-	static const char * copy_command = "COPY " TABLE_NAME "(user_name, email, password) "
-		" FROM STDIN "
-		//~ " WITH FORMAT text "	// delim == '\t'
-		";";
-
+	user_record_t record[1];
 	int rc = 0;
-	psql_result_t res = NULL;
-	ExecStatusType status = PGRES_BAD_RESPONSE;
 	
 	// truncate table before insert
 	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
@@ -249,221 +274,581 @@ void test_copy_from_text_format(psql_context_t * psql)
 	rc = psql_execute(psql, "BEGIN;", NULL);
 	assert(0 == rc);
 	
-	rc = psql_execute(psql, copy_command, res);
+#define NUM_PARAMS (3)
+#define PIPELINE_BATCH_SIZE (1000)
+	static const char * insert_command = "insert into " 
+		TABLE_NAME 
+		"(user_name, email, password) "
+		"values($1,$2,$3);";
+	
+	static const char * insert_stmt_name = "insert-users-pipeline";
+	psql_prepare_params_t prepare_params[1] = {{
+		.stmt_name = insert_stmt_name,
+		.num_params = 3, 
+		.types = NULL,
+	}};
+	rc = psql_prepare(psql, insert_command, prepare_params);
 	assert(0 == rc);
-	psql_result_clear(&res);
 	
-	auto_buffer_t _buf[1];
-	auto_buffer_t * buf = auto_buffer_init(_buf, 0);
-	app_timer_start(timer);
+	// libpq copies the parameters on send, so the buffers can be reused for the next statement.
+	psql_params_t query_params[1] = {{ .num_params = NUM_PARAMS }};
+	const char * param_values[NUM_PARAMS] = {NULL};
+	query_params->values = param_values;
 	
-	PGconn * conn = *(PGconn **)psql;
-	int batch_size = num_records;
-	int records_left = num_records;
-	int ok = 0;
-	// prepare data, can be processed by other threads
+	int statuses[PIPELINE_BATCH_SIZE];
 	
-	while(records_left > 0) {
-		printf("records_left: %d\n", records_left);
-		if(records_left < batch_size) batch_size = records_left;
-		for(int i = 0; i < batch_size; ++i) {
-			memset(user, 0, sizeof(user));
-			
-			snprintf(user->user_name, sizeof(user->user_name), "user-%.9d", i + num_records);
-			snprintf(user->email, sizeof(user->email), "%s@test.com", user->user_name);
-			snprintf(user->password, sizeof(user->password), "%.9d", i + num_records);
-			
-			char line[1024] = "";
-			int cb = snprintf(line, sizeof(line), "%s\t%s\t%s\n", user->user_name, user->email, user->password);
-			assert(cb > 0);
+	app_timer_start(timer);
+	rc = psql_pipeline_enter(psql);
+	assert(0 == rc);
+	
+	for(int i = 0; i < num_records; ++i) {
+		memset(record, 0, sizeof(record));
+		
+		snprintf(record->user_name, sizeof(record->user_name), "user-%.9d", i);
+		snprintf(record->email, sizeof(record->email), "%s@test.com", record->user_name);
+		snprintf(record->password, sizeof(record->password), "%.9d", i);
+		
+		param_values[0] = record->user_name;
+		param_values[1] = record->email;
+		param_values[2] = record->password;
+		
+		rc = psql_pipeline_send_prepared(psql, insert_stmt_name, query_params);
+		assert(0 == rc);
+		
+		if(((i + 1) % PIPELINE_BATCH_SIZE) == 0 || (i + 1) == num_records) {
+			rc = psql_pipeline_sync(psql);
+			assert(0 == rc);
 			
-			auto_buffer_push(buf, line, cb);
+			ssize_t num_results = psql_pipeline_get_results(psql, statuses, PIPELINE_BATCH_SIZE, NULL, NULL);
+			assert(num_results > 0);
+			for(ssize_t ii = 0; ii < num_results; ++ii) assert(statuses[ii] == psql_pipeline_status_ok);
 		}
-		ok = PQputCopyData(conn, (char *)buf->data, buf->length);
-		assert(ok);
-		res = PQgetResult(conn);
-		status = PQresultStatus(res);
-		assert(status == PGRES_COPY_IN);
-		psql_result_clear(&res);
-	
-		records_left -= batch_size;
-		buf->length = 0;
-		buf->start_pos = 0;
 	}
-
-	auto_buffer_cleanup(buf);
-
-	ok = PQputCopyEnd(conn, NULL);
-	assert(ok);
-	res = PQgetResult(conn);
-	status = PQresultStatus(res);
-	//~ assert(status == PGRES_COPY_IN);
-	printf("--> status: %s\n", PQresStatus(status));
-	psql_result_clear(&res);
 	
+	rc = psql_pipeline_exit(psql);
+	assert(0 == rc);
 	time_elapsed = app_timer_stop(timer);
 	printf("time_elapsed: %.6f ms\n", time_elapsed * 1000.0);
 	
 	rc = psql_execute(psql, "COMMIT;", NULL);
 	assert(0 == rc);
+	
+	// clear records
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+#undef PIPELINE_BATCH_SIZE
+#undef NUM_PARAMS
 	return;
 }
 
+void test_batched_inserting(psql_context_t * psql, int mode)
+{
+	debug_printf("==== %s(%p, mode=%d) ====\n", __FUNCTION__, psql, mode);
+	user_record_t record[1];
+	int rc = 0;
+	
+	// truncate table before insert
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+	
+	rc = psql_execute(psql, "BEGIN;", NULL);
+	assert(0 == rc);
+	
+#define NUM_PARAMS (3)
+	psql_insert_batcher_params_t params = {
+		.mode = mode,
+		.max_rows = 1000,
+	};
+	psql_insert_batcher_t batcher[1];
+	psql_insert_batcher_init(batcher, psql, TABLE_NAME, "user_name, email, password", NUM_PARAMS, &params);
+	
+	// same row-at-a-time loop as test_normal_inserting_with_prepared_stmt()
+	psql_params_t query_params[1] = {{ .num_params = NUM_PARAMS }};
+	const char * param_values[NUM_PARAMS] = {NULL};
+	query_params->values = param_values;
+	
+	app_timer_start(timer);
+	for(int i = 0; i < num_records; ++i) {
+		memset(record, 0, sizeof(record));
+		
+		snprintf(record->user_name, sizeof(record->user_name), "user-%.9d", i);
+		snprintf(record->email, sizeof(record->email), "%s@test.com", record->user_name);
+		snprintf(record->password, sizeof(record->password), "%.9d", i);
+		
+		param_values[0] = record->user_name;
+		param_values[1] = record->email;
+		param_values[2] = record->password;
+		
+		rc = psql_insert_batcher_add(batcher, query_params);
+		assert(0 == rc);
+	}
+	int64_t num_inserted = psql_insert_batcher_flush(batcher);
+	assert(num_inserted >= 0);
+	time_elapsed = app_timer_stop(timer);
+	printf("time_elapsed: %.6f ms, batches: %ld\n", time_elapsed * 1000.0, (long)batcher->num_batches);
+	
+	assert(batcher->num_inserted == num_records);
+	assert(batcher->num_failed == 0);
+	psql_insert_batcher_cleanup(batcher);
+	
+	rc = psql_execute(psql, "COMMIT;", NULL);
+	assert(0 == rc);
+	
+	psql_result_t res = NULL;
+	rc = psql_execute(psql, "SELECT count(*) FROM " TABLE_NAME ";", &res);
+	assert(0 == rc && res);
+	assert(atoi(psql_result_get_value(res, 0, 0)) == num_records);
+	psql_result_clear(&res);
+	
+	// clear records
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+#undef NUM_PARAMS
+	return;
+}
 
-#include <stdint.h>
-#include <endian.h>
+void test_bulk_upsert(psql_context_t * psql, int use_merge)
+{
+	debug_printf("==== %s(%p, use_merge=%d) ====\n", __FUNCTION__, psql, use_merge);
+	user_record_t record[1];
+	int rc = 0;
+	
+	psql_result_t res = NULL;
+	rc = psql_execute(psql, "SHOW server_version_num;", &res);
+	assert(0 == rc && res);
+	int server_version = atoi(psql_result_get_value(res, 0, 0));
+	psql_result_clear(&res);
+	if(use_merge && server_version < 150000) {
+		printf("MERGE is not supported by the server (%d), skipped.\n", server_version);
+		return;
+	}
+	
+	// truncate table before insert
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+	
+#define NUM_FIELDS (3)
+	psql_upsert_params_t params = {
+		.columns = "user_name, email, password",
+		.key_columns = "user_name",
+		.format = psql_copy_format_text,
+		.use_merge = use_merge,
+	};
+	psql_upsert_t upsert[1];
+	psql_upsert_t * p_upsert = psql_upsert_init(upsert, psql, TABLE_NAME, &params);
+	assert(p_upsert);
+	
+	const char * values[NUM_FIELDS] = { record->user_name, record->email, record->password };
+	
+	// pass 0: all rows are new; pass 1: the first half is updated, the second half is new
+	for(int pass = 0; pass < 2; ++pass) {
+		int first = pass * (num_records / 2);
+		int64_t num_inserted = 0, num_updated = 0;
+		
+		rc = psql_execute(psql, "BEGIN;", NULL);
+		assert(0 == rc);
+		
+		app_timer_start(timer);
+		rc = psql_upsert_begin(upsert);
+		assert(0 == rc);
+		for(int i = first; i < (first + num_records); ++i) {
+			memset(record, 0, sizeof(record));
+			snprintf(record->user_name, sizeof(record->user_name), "user-%.9d", i);
+			snprintf(record->email, sizeof(record->email), "%s@test%d.com", record->user_name, pass);
+			snprintf(record->password, sizeof(record->password), "%.9d", i);
+			
+			rc = psql_upsert_append_row(upsert, NUM_FIELDS, values, NULL);
+			assert(0 == rc);
+		}
+		rc = psql_upsert_end(upsert, &num_inserted, &num_updated);
+		assert(0 == rc);
+		time_elapsed = app_timer_stop(timer);
+		
+		rc = psql_execute(psql, "COMMIT;", NULL);
+		assert(0 == rc);
+		
+		printf("pass %d: inserted=%ld, updated=%ld, time_elapsed: %.6f ms\n", 
+			pass, (long)num_inserted, (long)num_updated, time_elapsed * 1000.0);
+		assert(num_inserted == ((pass == 0)?num_records:(num_records / 2)));
+		assert(num_updated == ((pass == 0)?0:(num_records / 2)));
+	}
+	psql_upsert_cleanup(upsert);
+	
+	rc = psql_execute(psql, "SELECT count(*) FROM " TABLE_NAME " WHERE email LIKE '%@test1.com';", &res);
+	assert(0 == rc && res);
+	assert(atoi(psql_result_get_value(res, 0, 0)) == num_records);
+	psql_result_clear(&res);
+	
+	// clear records
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+#undef NUM_FIELDS
+	return;
+}
 
-struct psql_binary_header
+static int fill_users_partition(psql_loader_partition_t * partition)
 {
-	uint8_t signature[11];
-	uint32_t flags;	// big-endian, always zero
-	uint32_t extensions[1];
-}__attribute__((packed));
+#define NUM_FIELDS (3)
+	// runs on the worker thread: use a local record instead of the shared 'user'
+	user_record_t record[1];
+	const char * values[NUM_FIELDS] = { record->user_name, record->email, record->password };
+	
+	int64_t end = partition->first_row + partition->num_rows;
+	for(int64_t i = partition->first_row; i < end; ++i) {
+		memset(record, 0, sizeof(record));
+		snprintf(record->user_name, sizeof(record->user_name), "user-%.9ld", (long)i);
+		snprintf(record->email, sizeof(record->email), "%s@test.com", record->user_name);
+		snprintf(record->password, sizeof(record->password), "%.9ld", (long)i);
+		
+		int rc = psql_copy_writer_append_row(partition->writer, NUM_FIELDS, values, NULL);
+		if(rc) return -1;
+	}
+#undef NUM_FIELDS
+	return 0;
+}
 
-struct psql_field_binary
+void test_parallel_copy_loader(psql_context_t * psql, int num_workers)
 {
-	uint32_t length; // big-endian
-	unsigned char data[0];
-}__attribute__((packed));
+	debug_printf("==== %s(%p, num_workers=%d) ====\n", __FUNCTION__, psql, num_workers);
+	int rc = 0;
+	
+	// truncate table before insert
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+	
+	psql_loader_params_t params = {
+		.num_workers = num_workers,
+		.format = psql_copy_format_text,
+		.columns = "user_name, email, password",
+		.total_rows = num_records,
+	};
+	psql_loader_summary_t summary[1];
+	rc = psql_loader_run(sz_conn, TABLE_NAME, &params, fill_users_partition, NULL, summary);
+	assert(0 == rc);
+	
+	printf("workers: %d, rows: %ld, bytes: %ld, committed: %d, time_elapsed: %.6f ms (slowest worker: %.6f ms)\n", 
+		summary->num_workers, (long)summary->num_rows, (long)summary->num_bytes, summary->committed,
+		summary->time_elapsed * 1000.0, summary->max_worker_time * 1000.0);
+	assert(summary->committed && summary->num_failed == 0);
+	assert(summary->num_committed == summary->num_workers);
+	assert(summary->num_rows == num_records);
+	
+	psql_result_t res = NULL;
+	rc = psql_execute(psql, "SELECT count(*) FROM " TABLE_NAME ";", &res);
+	assert(0 == rc && res);
+	assert(atoi(psql_result_get_value(res, 0, 0)) == num_records);
+	psql_result_clear(&res);
+	
+	// clear records
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+	return;
+}
 
-struct psql_tuple_binary
+#define MAX_ENCODERS (16)
+struct encoder_state
 {
-	uint16_t num_fields; // big-endian
-	struct psql_field_binary fields[0];	
-}__attribute__((packed));
+	int num_encoders;
+	int64_t next_row[MAX_ENCODERS];	// encoder i handles rows i, i + num_encoders, ...
+};
 
+static int64_t encode_users_chunk(int encoder_index, auto_buffer_t * chunk, size_t chunk_size, void * user_data)
+{
+#define NUM_FIELDS (3)
+	struct encoder_state * state = user_data;
+	user_record_t record[1];
+	const char * values[NUM_FIELDS] = { record->user_name, record->email, record->password };
+	
+	int64_t num_rows = 0;
+	int64_t i = state->next_row[encoder_index];
+	for(; i < num_records && chunk->length < chunk_size; i += state->num_encoders) {
+		memset(record, 0, sizeof(record));
+		snprintf(record->user_name, sizeof(record->user_name), "user-%.9ld", (long)i);
+		snprintf(record->email, sizeof(record->email), "%s@test.com", record->user_name);
+		snprintf(record->password, sizeof(record->password), "%.9ld", (long)i);
+		
+		psql_copy_buffer_append_row(chunk, psql_copy_format_text, NUM_FIELDS, values, NULL);
+		++num_rows;
+	}
+	state->next_row[encoder_index] = i;
+#undef NUM_FIELDS
+	return num_rows;
+}
 
-void test_copy_from_binary_format(psql_context_t * psql)
+void test_copy_pipeline(psql_context_t * psql, int num_encoders)
 {
-	debug_printf("==== %s(%p) ====\n", __FUNCTION__, psql);
-	static const char * copy_command = "COPY " TABLE_NAME "(user_name, email, password) "
-		//~ " FROM '/1.dump' "
-		" FROM STDIN "
-		" BINARY "
-		";";
-	
+	debug_printf("==== %s(%p, num_encoders=%d) ====\n", __FUNCTION__, psql, num_encoders);
 	int rc = 0;
+	assert(num_encoders > 0 && num_encoders <= MAX_ENCODERS);
+	
 	// truncate table before insert
 	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
 	assert(0 == rc);
 	
-	rc = psql_execute(psql, "BEGIN;", NULL);
+	struct encoder_state state = { .num_encoders = num_encoders };
+	for(int i = 0; i < num_encoders; ++i) state.next_row[i] = i;
+	
+	psql_copy_pipeline_params_t params = {
+		.num_encoders = num_encoders,
+		.format = psql_copy_format_text,
+		.columns = "user_name, email, password",
+	};
+	psql_copy_pipeline_stats_t stats[1];
+	int64_t num_rows = psql_copy_pipeline_run(psql, TABLE_NAME, &params, encode_users_chunk, &state, stats);
+	assert(num_rows == num_records);
+	
+	printf("rows: %ld, chunks: %ld, encode_wait: %.3f ms, send_wait: %.3f ms, time_elapsed: %.6f ms\n", 
+		(long)stats->num_rows, (long)stats->num_chunks, 
+		stats->encode_wait_time * 1000.0, stats->send_wait_time * 1000.0, stats->time_elapsed * 1000.0);
+	
+	// clear records
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
 	assert(0 == rc);
+	return;
+}
+#undef MAX_ENCODERS
+
+void test_import_csv(psql_context_t * psql, int num_workers)
+{
+	debug_printf("==== %s(%p, num_workers=%d) ====\n", __FUNCTION__, psql, num_workers);
+	int rc = 0;
 	
-	psql_result_t res = NULL;
-	rc = psql_execute(psql, copy_command, res);
+	// prepare a csv file, with quoted fields and embedded newlines
+	char path[] = "/tmp/test-psql-import-XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	FILE * fp = fdopen(fd, "w");
+	assert(fp);
+	fprintf(fp, "user_name,email,password\n");
+	for(int i = 0; i < num_records; ++i) {
+		if(i % 10) fprintf(fp, "user-%.9d,user-%.9d@test.com,%.9d\n", i, i, i);
+		else fprintf(fp, "\"user-%.9d\",\"user-%.9d\n\"\"@test.com\",\"%.9d\"\r\n", i, i, i);
+	}
+	fclose(fp);
+	
+	// truncate table before insert
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
 	assert(0 == rc);
-	psql_result_clear(&res);
 	
-	auto_buffer_t _buf[1];
-	auto_buffer_t * buf = auto_buffer_init(_buf, 0);
-	PGconn * conn = *(PGconn **)psql;
-	ExecStatusType status = PGRES_BAD_RESPONSE;
-	int ok = FALSE;
-	static struct psql_binary_header hdr= {
-		.signature = "PGCOPY\n\377\r\n",
+	psql_csv_import_params_t params = {
+		.format = psql_csv_format_csv,
+		.has_header = 1,
+		.num_workers = num_workers,
+		.columns = "user_name, email, password",
 	};
-	assert(19 == sizeof(hdr));
+	psql_csv_import_stats_t stats[1];
+	int64_t num_rows = psql_import_csv(psql, TABLE_NAME, path, &params, stats);
+	unlink(path);
 	
-	for(int i = 0; i < sizeof(hdr); ++i) {
-		printf("%.2x ", hdr.signature[i]);	// since it does not exceed the size of hdr, this kind of out-of-bounds is safe
-	}
-	printf("\n");
-	
-	// dump data to a tmp file
-	FILE * fp = fopen("/tmp/1.dump", "w+");
-	fwrite(&hdr, 1, sizeof(hdr), fp);
-	
-	// write psql_binary_header
-	ok = PQputCopyData(conn, (char *)&hdr, sizeof(hdr));
-	assert(ok);
-	res = PQgetResult(conn);
-	status = PQresultStatus(res);
-	printf("status: %s\n", PQresStatus(status));
+	printf("workers: %d, rows: %ld, input: %ld bytes, time_elapsed: %.6f ms (%.1f MB/s)\n", 
+		stats->num_workers, (long)stats->num_rows, (long)stats->input_bytes, 
+		stats->time_elapsed * 1000.0, stats->input_bytes / stats->time_elapsed / 1000000.0);
+	assert(num_rows == num_records);
+	
+	psql_result_t res = NULL;
+	rc = psql_execute(psql, "SELECT count(*) FROM " TABLE_NAME " WHERE email LIKE '%\n\"@test.com';", &res);
+	assert(0 == rc && res);
+	assert(atoi(psql_result_get_value(res, 0, 0)) == num_records / 10);
 	psql_result_clear(&res);
 	
+	// clear records
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+	return;
+}
+
+void test_copy_from_text_format(psql_context_t * psql)
+{
+	debug_printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	user_record_t record[1];
+	int rc = 0;
+	
+	// truncate table before insert
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+	
+	rc = psql_execute(psql, "BEGIN;", NULL);
+	assert(0 == rc);
+	
+	psql_copy_writer_t writer[1];
+	psql_copy_writer_init(writer, psql, psql_copy_format_text, 0);
 	
 	app_timer_start(timer);
-	int batch_size = num_records;		
-	int records_left = num_records;
-
-	// write binary tuples
-	while(records_left > 0) {
-		if(records_left < batch_size) batch_size = records_left;
-		
-		uint32_t length  = 0;
-		uint16_t num_fields = htobe16(3);
-		for(int i = 0; i < batch_size; ++i) {
-			memset(user, 0, sizeof(user));
-			uint32_t cb_user = snprintf(user->user_name, sizeof(user->user_name), "user-%.9d", i + num_records);
-			uint32_t cb_email = snprintf(user->email, sizeof(user->email), "%s@test.com", user->user_name);
-			uint32_t cb_password = snprintf(user->password, sizeof(user->password), "%.9d", i + num_records);
-		
-			auto_buffer_push(buf, &num_fields, 2);	// push num fields
-			
-			length = htobe32(cb_user);
-			auto_buffer_push(buf, &length, sizeof(length));
-			auto_buffer_push(buf, user->user_name, cb_user);
-			
-			length = htobe32(cb_email);
-			auto_buffer_push(buf, &length, sizeof(length));
-			auto_buffer_push(buf, user->email, cb_email);
-			
-			length = htobe32(cb_password);
-			auto_buffer_push(buf, &length, sizeof(length));
-			auto_buffer_push(buf, user->password, cb_password);
-		}
+	rc = psql_copy_writer_begin(writer, TABLE_NAME, "user_name, email, password");
+	assert(0 == rc);
+	
+	// prepare data, can be processed by other threads
+	for(int i = 0; i < num_records; ++i) {
+		memset(record, 0, sizeof(record));
 		
-		fwrite(buf->data, 1, buf->length, fp);
+		int cb_values[3];
+		cb_values[0] = snprintf(record->user_name, sizeof(record->user_name), "user-%.9d", i + num_records);
+		cb_values[1] = snprintf(record->email, sizeof(record->email), "%s@test.com", record->user_name);
+		cb_values[2] = snprintf(record->password, sizeof(record->password), "%.9d", i + num_records);
 		
+		const char * values[3] = { record->user_name, record->email, record->password };
+		rc = psql_copy_writer_append_row(writer, 3, values, cb_values);
+		assert(0 == rc);
+	}
+	
+	int64_t num_rows = psql_copy_writer_end(writer, NULL);
+	printf("--> rows copied: %ld, bytes sent: %ld\n", (long)num_rows, (long)writer->num_bytes);
+	assert(num_rows == num_records);
+	
+	time_elapsed = app_timer_stop(timer);
+	printf("time_elapsed: %.6f ms\n", time_elapsed * 1000.0);
+	
+	rc = psql_execute(psql, "COMMIT;", NULL);
+	assert(0 == rc);
+	
+	psql_copy_writer_cleanup(writer);
+	return;
+}
+
+void test_copy_from_binary_format(psql_context_t * psql)
+{
+	debug_printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	user_record_t record[1];
+	int rc = 0;
+	
+	// truncate table before insert
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+	
+	rc = psql_execute(psql, "BEGIN;", NULL);
+	assert(0 == rc);
+	
+	psql_copy_writer_t writer[1];
+	psql_copy_writer_init(writer, psql, psql_copy_format_binary, 0);
+	
+	app_timer_start(timer);
+	rc = psql_copy_writer_begin(writer, TABLE_NAME, "user_name, email, password");
+	assert(0 == rc);
+	
+	// write binary tuples: varchar columns accept their text representation as binary input
+	for(int i = 0; i < num_records; ++i) {
+		memset(record, 0, sizeof(record));
 		
-		ok = PQputCopyData(conn, (char *)buf->data, buf->length);
-		assert(ok);
+		int cb_values[3];
+		cb_values[0] = snprintf(record->user_name, sizeof(record->user_name), "user-%.9d", i + num_records);
+		cb_values[1] = snprintf(record->email, sizeof(record->email), "%s@test.com", record->user_name);
+		cb_values[2] = snprintf(record->password, sizeof(record->password), "%.9d", i + num_records);
 		
-		res = PQgetResult(conn); 
-		status = PQresultStatus(res);
-		printf("bytes copied: %ld\n", (long)buf->length);
-		printf("put-data: status: %s\n", PQresStatus(status));
-		psql_result_clear(&res);
-	
-		// reset buffer
-		buf->length = 0;
-		buf->start_pos = 0;
-		records_left -= batch_size;
+		const char * values[3] = { record->user_name, record->email, record->password };
+		rc = psql_copy_writer_append_row(writer, 3, values, cb_values);
+		assert(0 == rc);
 	}
-	// write file trailer
-	static const uint16_t file_trailer = 0xFFFF;
-	ok = PQputCopyData(conn, (char *)&file_trailer, 2);
 	
-	fwrite(&file_trailer, 1, 2, fp);
-	fclose(fp);
+	int64_t num_rows = psql_copy_writer_end(writer, NULL);
+	printf("--> rows copied: %ld, bytes sent: %ld\n", (long)num_rows, (long)writer->num_bytes);
+	assert(num_rows == num_records);
 	
-	assert(ok);
-	res = PQgetResult(conn); 
-	status = PQresultStatus(res);
-	printf("put-trailer: status: %s\n", PQresStatus(status));
-	psql_result_clear(&res);
-		
+	time_elapsed = app_timer_stop(timer);
+	printf("time_elapsed: %.6f ms\n", time_elapsed * 1000.0);
 	
-	ok = PQputCopyEnd(conn, NULL);
-	res = PQgetResult(conn); 
-	status = PQresultStatus(res);
-	printf("status: %s\n", PQresStatus(status));
-	psql_result_clear(&res);
+	rc = psql_execute(psql, "COMMIT;", NULL);
+	assert(0 == rc);
+	
+	psql_copy_writer_cleanup(writer);
+	return;
+}
+
+void test_copy_from_binary_typed(psql_context_t * psql)
+{
+	debug_printf("==== %s(%p) ====\n", __FUNCTION__, psql);
+	user_record_t record[1];
+	int rc = 0;
+	
+	rc = psql_execute(psql, "TRUNCATE TABLE " TABLE_NAME ";", NULL);
+	assert(0 == rc);
+	
+	rc = psql_execute(psql, "BEGIN;", NULL);
+	assert(0 == rc);
+	
+	static const psql_column_desc_t columns[] = {
+		{ "user_id", 	psql_data_type_uuid },
+		{ "user_name", 	psql_data_type_varchar },
+		{ "email", 		psql_data_type_varchar },
+		{ "password", 	psql_data_type_varchar },
+		{ "ctime", 		psql_data_type_timestamp },
+	};
+	psql_copy_encoder_t encoder[1];
+	psql_copy_encoder_init(encoder, sizeof(columns) / sizeof(columns[0]), columns);
+	
+	psql_copy_writer_t writer[1];
+	psql_copy_writer_init(writer, psql, psql_copy_format_binary, 0);
+	
+	app_timer_start(timer);
+	rc = psql_copy_writer_begin(writer, TABLE_NAME, encoder->column_names);
+	assert(0 == rc);
+	
+	int64_t ctime = (int64_t)time(NULL) * 1000000;
+	for(int i = 0; i < num_records; ++i) {
+		memset(record, 0, sizeof(record));
+		int cb_user = snprintf(record->user_name, sizeof(record->user_name), "user-%.9d", i + num_records);
+		int cb_email = snprintf(record->email, sizeof(record->email), "%s@test.com", record->user_name);
+		int cb_password = snprintf(record->password, sizeof(record->password), "%.9d", i + num_records);
 		
+		unsigned char uuid[16] = { 0 };
+		uint32_t id = htobe32(i + 1);
+		memcpy(uuid + 12, &id, sizeof(id));
+		uuid[6] = 0x40;	// version 4
+		uuid[8] = 0x80;	// variant
+		
+		rc = psql_copy_encoder_begin_row(encoder, writer->buf);
+		rc |= psql_copy_encoder_add_uuid(encoder, uuid);
+		rc |= psql_copy_encoder_add_bytes(encoder, record->user_name, cb_user);
+		rc |= psql_copy_encoder_add_bytes(encoder, record->email, cb_email);
+		rc |= psql_copy_encoder_add_bytes(encoder, record->password, cb_password);
+		rc |= psql_copy_encoder_add_timestamp(encoder, ctime);
+		rc |= psql_copy_encoder_end_row(encoder);
+		assert(0 == rc);
 		
+		rc = psql_copy_writer_end_row(writer);
+		assert(0 == rc);
+	}
+	
+	int64_t num_rows = psql_copy_writer_end(writer, NULL);
+	printf("--> rows copied: %ld, bytes sent: %ld\n", (long)num_rows, (long)writer->num_bytes);
+	assert(num_rows == num_records);
+	
 	time_elapsed = app_timer_stop(timer);
 	printf("time_elapsed: %.6f ms\n", time_elapsed * 1000.0);
 	
-	
 	rc = psql_execute(psql, "COMMIT;", NULL);
 	assert(0 == rc);
 	
-	//~ res = PQgetResult(conn);
-	//~ ExecStatusType status = PQresultStatus(res);
-	//~ printf("status: %s\n", PQresStatus(status));
-	//~ psql_result_clear(&res);
+	psql_copy_writer_cleanup(writer);
+	psql_copy_encoder_cleanup(encoder);
+	return;
+}
+
+void test_copy_to_stdout(psql_context_t * psql, int format)
+{
+	debug_printf("==== %s(%p, format=%d) ====\n", __FUNCTION__, psql, format);
+	int rc = 0;
+	psql_copy_reader_t reader[1];
+	psql_copy_reader_init(reader, psql, format);
+	
+	app_timer_start(timer);
+	rc = psql_copy_reader_begin_query(reader, "select user_name, email, mtime from " TABLE_NAME);
+	assert(0 == rc);
+	
+	const psql_copy_field_t * fields = NULL;
+	int num_fields = 0;
+	while((num_fields = psql_copy_reader_next_row(reader, &fields)) > 0) {
+		assert(num_fields == 3);
+		assert(fields[0].data && fields[0].length == strlen("user-000000000"));
+		assert(fields[2].data == NULL && fields[2].length == -1);	// mtime is NULL
+	}
+	assert(num_fields == 0);
+	
+	int64_t num_rows = psql_copy_reader_end(reader);
+	time_elapsed = app_timer_stop(timer);
+	printf("--> rows read: %ld, bytes received: %ld\n", (long)num_rows, (long)reader->num_bytes);
+	printf("time_elapsed: %.6f ms\n", time_elapsed * 1000.0);
+	assert(num_rows == num_records);
 	
-	auto_buffer_cleanup(buf);
+	psql_copy_reader_cleanup(reader);
 	return;
 }
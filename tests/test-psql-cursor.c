@@ -0,0 +1,140 @@
+/*
+ * test-psql-cursor.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "rdb-postgres.h"
+#include <libpq-fe.h>
+
+#include "app_timer.h"
+#include "utils.h"
+
+static psql_context_t * init_connection(int argc, char ** argv, void * user_data)
+{
+	// load login info from environment variables: 
+	const char * user = 	getenv("BAMS_PSQL_DB_USER");
+	const char * password = getenv("BAMS_PSQL_DB_PASSWORD");
+	const char * host = 	getenv("BAMS_TEST_DB_SERVER");
+	const char * port = 	getenv("BAMS_TEST_DB_SERVER_PORT");
+	const char * dbname = 	getenv("BAMS_TEST_DBNAME");
+
+	assert(host && user && password);
+	if(NULL == port) port = "5432";
+	if(NULL == dbname) dbname = "test_db1";
+	
+	char sz_conn[PATH_MAX] = "";
+	int cb = snprintf(sz_conn, sizeof(sz_conn), 
+		" host=%s port=%s "
+		" dbname=%s user=%s password=%s ",
+		host, port,
+		dbname, user, password);
+	assert(cb > 0);
+	
+	psql_context_t * psql = psql_context_init(NULL, user_data);
+	int rc = psql_connect_db(psql, sz_conn, 0);
+	assert(0 == rc);
+	
+	return psql;
+}
+
+#define NUM_ROWS (1000 * 1000)
+static void test_cursor(psql_context_t * psql, int prefetch, int process_delay_us);
+int main(int argc, char **argv)
+{
+	psql_context_t * psql = init_connection(argc, argv, NULL);
+	
+	test_cursor(psql, 0, 0);
+	test_cursor(psql, 1, 0);
+	
+	// slow consumer (10 us per row): the fetch size shrinks with prefetch, and never without it
+	test_cursor(psql, 0, 10);
+	test_cursor(psql, 1, 10);
+	
+	psql_context_cleanup(psql);
+	free(psql);
+	return 0;
+}
+
+static void test_cursor(psql_context_t * psql, int prefetch, int process_delay_us)
+{
+	debug_printf("==== %s(%p, prefetch=%d, delay=%d us per row) ====\n", __FUNCTION__, psql, prefetch, process_delay_us);
+	app_timer_t * timer = app_timer_start(NULL);
+	
+	psql_cursor_t * cursor = psql_cursor_init(NULL, psql, 100, 10000);
+	assert(cursor);
+	
+	int rc = psql_cursor_open(cursor, "select generate_series(1, $1::int) as id;", NULL, 100, prefetch);
+	assert(rc != 0);	// missing parameter
+	
+	psql_params_t params[1];
+	memset(params, 0, sizeof(params));
+	char sz_num_rows[32] = "";
+	snprintf(sz_num_rows, sizeof(sz_num_rows), "%d", NUM_ROWS);
+	psql_params_setv(params, 1, 0, 0, sz_num_rows, -1, 0);
+	
+	// a slow consumer starts with a large batch, which only shrinks with prefetch
+	int initial_fetch_size = (process_delay_us > 0)?2000:100;
+	rc = psql_cursor_open(cursor, "select generate_series(1, $1::int) as id;", params, initial_fetch_size, prefetch);
+	assert(0 == rc);
+	
+	int64_t sum = 0;
+	int num_rows = 0;
+	psql_result_t res = NULL;
+	while((res = psql_cursor_next_batch(cursor, &num_rows))) {
+		for(int i = 0; i < num_rows; ++i) sum += atol(psql_result_get_value(res, i, 0));
+		if(process_delay_us > 0) usleep(process_delay_us * num_rows);
+	}
+	
+	psql_cursor_stats_t stats[1];
+	psql_cursor_get_stats(cursor, stats);
+	double time_elapsed = app_timer_stop(timer);
+	printf(" --> rows: %ld, batches: %ld, final fetch_size: %d, wait: %.3f ms, fetch: %.3f ms, total: %.3f ms\n",
+		(long)stats->num_rows, (long)stats->num_batches, stats->fetch_size,
+		stats->total_wait_time * 1000.0, stats->total_fetch_time * 1000.0, 
+		time_elapsed * 1000.0);
+	assert(stats->num_rows == NUM_ROWS && sum == (int64_t)NUM_ROWS * (NUM_ROWS + 1) / 2);
+	if(process_delay_us > 0) {
+		if(prefetch) assert(stats->fetch_size < initial_fetch_size);
+		else assert(stats->fetch_size >= initial_fetch_size);
+	}
+	
+	rc = psql_cursor_close(cursor);
+	assert(0 == rc);
+	
+	psql_params_cleanup(params);
+	psql_cursor_cleanup(cursor);
+	free(cursor);
+	return;
+}
@@ -0,0 +1,322 @@
+/*
+ * csv_scanner.c
+ * 
+ * Copyright 2021 chehw <hongwei.che@gmail.com>
+ * 
+ * The MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of 
+ * this software and associated documentation files (the "Software"), to deal in 
+ * the Software without restriction, including without limitation the rights to 
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+ * of the Software, and to permit persons to whom the Software is furnished to 
+ * do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all 
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE 
+ * SOFTWARE.
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "csv_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CSV_SCANNER_X86
+#endif
+
+/*************************************
+ * mmap file
+ ************************************/
+csv_file_t * csv_file_open(csv_file_t * file, const char * path)
+{
+	assert(path);
+	int is_allocated = (NULL == file);
+	if(NULL == file) file = calloc(1, sizeof(*file));
+	else memset(file, 0, sizeof(*file));
+	assert(file);
+	file->fd = -1;
+	
+	struct stat st[1];
+	int fd = open(path, O_RDONLY);
+	if(fd < 0 || fstat(fd, st) != 0) {
+		perror("csv_file_open()");
+		goto label_err;
+	}
+	file->fd = fd;
+	file->size = st->st_size;
+	if(file->size == 0) return file;
+	
+	void * data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(data == MAP_FAILED) {
+		perror("csv_file_open()::mmap()");
+		goto label_err;
+	}
+	madvise(data, file->size, MADV_SEQUENTIAL);
+	file->data = data;
+	return file;
+	
+label_err:
+	if(fd >= 0) close(fd);
+	if(is_allocated) free(file);
+	else memset(file, 0, sizeof(*file));
+	return NULL;
+}
+
+void csv_file_close(csv_file_t * file)
+{
+	if(NULL == file) return;
+	if(file->data) munmap((void *)file->data, file->size);
+	if(file->fd >= 0) close(file->fd);
+	memset(file, 0, sizeof(*file));
+	file->fd = -1;
+}
+
+/*************************************
+ * scan kernels
+ ************************************/
+typedef size_t (* scan_any_fn)(const unsigned char * p, size_t length, const csv_charset_t * set);
+typedef size_t (* count_char_fn)(const unsigned char * p, size_t length, unsigned char c);
+
+static size_t scan_any_scalar(const unsigned char * p, size_t length, const csv_charset_t * set)
+{
+	for(size_t i = 0; i < length; ++i) if(set->table[p[i]]) return i;
+	return length;
+}
+
+static size_t count_char_scalar(const unsigned char * p, size_t length, unsigned char c)
+{
+	size_t count = 0;
+	for(size_t i = 0; i < length; ++i) count += (p[i] == c);
+	return count;
+}
+
+#if defined(CSV_SCANNER_X86)
+__attribute__((target("sse2")))
+static size_t scan_any_sse2(const unsigned char * p, size_t length, const csv_charset_t * set)
+{
+	__m128i needles[CSV_CHARSET_MAX_CHARS];
+	int num_chars = set->num_chars;
+	for(int k = 0; k < num_chars; ++k) needles[k] = _mm_set1_epi8((char)set->chars[k]);
+	
+	size_t i = 0;
+	for(; i + 16 <= length; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i hits = _mm_cmpeq_epi8(block, needles[0]);
+		for(int k = 1; k < num_chars; ++k) hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[k]));
+		unsigned int mask = _mm_movemask_epi8(hits);
+		if(mask) return i + __builtin_ctz(mask);
+	}
+	return i + scan_any_scalar(p + i, length - i, set);
+}
+
+__attribute__((target("sse2,popcnt")))
+static size_t count_char_sse2(const unsigned char * p, size_t length, unsigned char c)
+{
+	__m128i needle = _mm_set1_epi8((char)c);
+	size_t count = 0;
+	size_t i = 0;
+	for(; i + 16 <= length; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+		count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+	}
+	return count + count_char_scalar(p + i, length - i, c);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_any_avx2(const unsigned char * p, size_t length, const csv_charset_t * set)
+{
+	__m256i needles[CSV_CHARSET_MAX_CHARS];
+	int num_chars = set->num_chars;
+	for(int k = 0; k < num_chars; ++k) needles[k] = _mm256_set1_epi8((char)set->chars[k]);
+	
+	size_t i = 0;
+	for(; i + 32 <= length; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i hits = _mm256_cmpeq_epi8(block, needles[0]);
+		for(int k = 1; k < num_chars; ++k) hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles[k]));
+		unsigned int mask = _mm256_movemask_epi8(hits);
+		if(mask) return i + __builtin_ctz(mask);
+	}
+	return i + scan_any_sse2(p + i, length - i, set);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t count_char_avx2(const unsigned char * p, size_t length, unsigned char c)
+{
+	__m256i needle = _mm256_set1_epi8((char)c);
+	size_t count = 0;
+	size_t i = 0;
+	for(; i + 32 <= length; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)(p + i));
+		count += __builtin_popcount((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+	}
+	return count + count_char_scalar(p + i, length - i, c);
+}
+#endif
+
+static scan_any_fn s_scan_any;
+static count_char_fn s_count_char;
+static const char * s_isa = "scalar";
+
+static void csv_scanner_select_isa(void)
+{
+	if(s_scan_any) return;
+	scan_any_fn scan_any = scan_any_scalar;
+	count_char_fn count_char = count_char_scalar;
+#if defined(CSV_SCANNER_X86)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		scan_any = scan_any_avx2;
+		count_char = count_char_avx2;
+		s_isa = "avx2";
+	}else if(__builtin_cpu_supports("sse2") && __builtin_cpu_supports("popcnt")) {
+		scan_any = scan_any_sse2;
+		count_char = count_char_sse2;
+		s_isa = "sse2";
+	}
+#endif
+	// benign race: every thread stores the same values
+	s_count_char = count_char;
+	__atomic_store_n(&s_scan_any, scan_any, __ATOMIC_RELEASE);
+}
+
+const char * csv_scanner_get_isa(void)
+{
+	csv_scanner_select_isa();
+	return s_isa;
+}
+
+csv_charset_t * csv_charset_init(csv_charset_t * set, const char * chars, int num_chars)
+{
+	assert(chars && num_chars > 0 && num_chars <= CSV_CHARSET_MAX_CHARS);
+	if(NULL == set) set = calloc(1, sizeof(*set));
+	else memset(set, 0, sizeof(*set));
+	assert(set);
+	
+	for(int i = 0; i < num_chars; ++i) {
+		unsigned char c = chars[i];
+		if(set->table[c]) continue;	// skip duplicates
+		set->table[c] = 1;
+		set->chars[set->num_chars++] = c;
+	}
+	csv_scanner_select_isa();
+	return set;
+}
+
+size_t csv_scan_any(const char * data, size_t length, const csv_charset_t * set)
+{
+	scan_any_fn scan_any = __atomic_load_n(&s_scan_any, __ATOMIC_ACQUIRE);
+	if(NULL == scan_any) {
+		csv_scanner_select_isa();
+		scan_any = s_scan_any;
+	}
+	return scan_any((const unsigned char *)data, length, set);
+}
+
+size_t csv_count_char(const char * data, size_t length, char c)
+{
+	csv_scanner_select_isa();
+	return s_count_char((const unsigned char *)data, length, (unsigned char)c);
+}
+
+/*************************************
+ * line-aligned split
+ ************************************/
+int csv_split_lines(const char * data, size_t size, char quote, int num_parts, size_t * offsets)
+{
+	assert(num_parts > 0 && offsets);
+	csv_charset_t set[1];
+	char chars[2] = { '\n', quote };
+	csv_charset_init(set, chars, quote?2:1);
+	
+	offsets[0] = 0;
+	size_t pos = 0;
+	int in_quotes = 0;
+	for(int i = 1; i < num_parts; ++i) {
+		size_t target = size / num_parts * i;
+		if(target < pos) target = pos;
+		
+		// the quote state at 'target' is the parity of all quotes before it ("" escapes count twice)
+		if(quote) in_quotes ^= (csv_count_char(data + pos, target - pos, quote) & 1);
+		pos = target;
+		
+		// move to the first newline outside quotes
+		while(pos < size) {
+			pos += csv_scan_any(data + pos, size - pos, set);
+			if(pos >= size) break;
+			if(data[pos++] == '\n' && !in_quotes) break;
+			if(data[pos - 1] == quote) in_quotes ^= 1;
+		}
+		offsets[i] = pos;
+	}
+	offsets[num_parts] = size;
+	return num_parts;
+}
+
+
+#if defined(_TEST_CSV_SCANNER) && defined(_STAND_ALONE)
+int main(int argc, char ** argv) 
+{
+	printf("isa: %s\n", csv_scanner_get_isa());
+	
+	// test 1. scan / count across the SIMD block boundaries
+	char text[256];
+	memset(text, 'a', sizeof(text));
+	csv_charset_t set[1];
+	csv_charset_init(set, ",\"\n\r", 4);
+	assert(csv_scan_any(text, sizeof(text), set) == sizeof(text));
+	for(size_t i = 0; i < sizeof(text); ++i) {
+		text[i] = ',';
+		assert(csv_scan_any(text, sizeof(text), set) == i);
+		assert(csv_count_char(text, sizeof(text), ',') == 1);
+		text[i] = 'a';
+	}
+	
+	// test 2. line-aligned split, newlines inside quotes are skipped
+	static const char * csv = 
+		"1,abc,\"x\ny\"\n"
+		"2,\"d\"\"e\",f\n"
+		"3,\"\n\n\n\",g\n"
+		"4,h,i\n";
+	size_t size = strlen(csv);
+	for(int num_parts = 1; num_parts <= 8; ++num_parts) {
+		size_t offsets[9];
+		csv_split_lines(csv, size, '"', num_parts, offsets);
+		for(int i = 0; i < num_parts; ++i) {
+			size_t start = offsets[i];
+			assert(start <= offsets[i + 1]);
+			// every non-empty part starts at the beginning of a row
+			if(start < size && start < offsets[i + 1]) assert(start == 0 || (csv[start] >= '1' && csv[start] <= '4' && csv[start + 1] == ','));
+		}
+	}
+	
+	// test 3. mmap
+	if(argc > 1) {
+		csv_file_t file[1];
+		if(csv_file_open(file, argv[1])) {
+			printf("%s: %zu bytes, %zu lines\n", argv[1], file->size, csv_count_char(file->data, file->size, '\n'));
+			csv_file_close(file);
+		}
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,51 @@
+#ifndef CHLIB_CSV_SCANNER_H_
+#define CHLIB_CSV_SCANNER_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * read-only mmap of a whole file, 
+ * pages are read on demand so the memory usage is bounded by the page cache.
+ */
+typedef struct csv_file
+{
+	int fd;
+	size_t size;
+	const char * data;
+}csv_file_t;
+csv_file_t * csv_file_open(csv_file_t * file, const char * path);
+void csv_file_close(csv_file_t * file);
+
+/*
+ * SIMD byte scanner (AVX2 / SSE2 / scalar, selected at runtime)
+ * 	csv_charset_init(set, ",\"\n\r", 4);
+ * 	size_t offset = csv_scan_any(data, length, set);	// index of the first byte in set, or length
+*/
+#define CSV_CHARSET_MAX_CHARS (8)
+typedef struct csv_charset
+{
+	int num_chars;
+	unsigned char chars[CSV_CHARSET_MAX_CHARS];
+	unsigned char table[256];	// scalar lookup
+}csv_charset_t;
+csv_charset_t * csv_charset_init(csv_charset_t * set, const char * chars, int num_chars);
+size_t csv_scan_any(const char * data, size_t length, const csv_charset_t * set);
+size_t csv_count_char(const char * data, size_t length, char c);
+
+/*
+ * splits data into num_parts line-aligned ranges: [offsets[i], offsets[i + 1]), 
+ * newlines inside quoted fields are not treated as row boundaries (quote = 0: no quoting).
+ * some ranges may be empty.
+ */
+int csv_split_lines(const char * data, size_t size, char quote, int num_parts, size_t * offsets);
+
+const char * csv_scanner_get_isa(void);	// "avx2", "sse2" or "scalar"
+
+#ifdef __cplusplus
+}
+#endif
+#endif